@@ -0,0 +1,8 @@
+
+#include "async_hash.hpp"
+
+ThreadPool& hash_executor() noexcept
+{
+   static ThreadPool pool;
+   return pool;
+}
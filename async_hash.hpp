@@ -0,0 +1,170 @@
+
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+// Awaitable hashing, for coroutine code that must not block its thread
+//
+// `co_await hash_async<Sha256>(data, size)` hashes on the calling thread if
+// the input is smaller than `inline_threshold` (where handing it to another
+// thread would cost more than hashing it), and otherwise suspends the
+// coroutine while a ThreadPool hashes it. The result is the finished hasher,
+// so `hexdigest()` and `get_digest()` are as usual.
+//
+// AsyncHasher does the same for a stream: each `co_await hash.append(...)`
+// completes inline or on the pool, in order, so the data need only stay
+// alive until the co_await returns.
+//
+// After hashing on the pool, the coroutine's continuation is handed to
+// `options.post`, which should queue it on the caller's event loop.
+// Without it, the coroutine carries on on the pool thread.
+//
+// Requires C++20 coroutines; with an earlier standard only the options and
+// executor below are declared.
+//
+// usage: Task<std::string> digest_of(const Blob& blob)
+//        {
+//           co_return (co_await hash_async<Sha256>(blob.data(), blob.size()))
+//               .hexdigest();
+//        }
+struct AsyncHashOptions
+{
+   size_t inline_threshold = 64 << 10; // bytes
+   ThreadPool* executor    = nullptr;  // hash_executor() if nullptr
+   std::function<void(std::function<void()>)> post; // see above
+};
+
+// A pool shared by every awaitable without an executor of its own, with one
+// thread per hardware thread, created on first use
+ThreadPool& hash_executor() noexcept;
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+// Appends to a hasher owned elsewhere
+template<typename Hasher> class HashAppendAwaitable
+{
+ public:
+   HashAppendAwaitable(Hasher& hasher,
+                       const void* data,
+                       size_t size,
+                       const AsyncHashOptions& options) noexcept
+       : hasher_(hasher)
+       , data_(data)
+       , size_(size)
+       , options_(options)
+   {}
+
+   bool await_ready() noexcept
+   {
+      if(size_ >= options_.inline_threshold) return false;
+      hasher_.append(data_, size_);
+      return true;
+   }
+
+   void await_suspend(std::coroutine_handle<> caller) noexcept
+   {
+      ThreadPool& executor
+          = options_.executor != nullptr ? *options_.executor : hash_executor();
+      // Once posted, the caller may resume, and destroy this awaitable,
+      // before `post` returns: so `post` is a copy, and `this` is done with
+      executor.submit([this, caller, post = options_.post] {
+         hasher_.append(data_, size_);
+         if(post)
+            post([caller] { caller.resume(); });
+         else
+            caller.resume();
+      });
+   }
+
+   void await_resume() const noexcept {}
+
+ private:
+   Hasher& hasher_;
+   const void* data_;
+   size_t size_;
+   AsyncHashOptions options_;
+};
+
+// A one-shot hash; `co_await` returns the finished hasher
+template<typename Hasher> class HashAwaitable
+{
+ public:
+   HashAwaitable(const void* data,
+                 size_t size,
+                 const AsyncHashOptions& options) noexcept
+       : append_(hasher_, data, size, options)
+   {}
+   HashAwaitable(const HashAwaitable&) = delete; // append_ refers to hasher_
+   HashAwaitable& operator=(const HashAwaitable&) = delete;
+
+   bool await_ready() noexcept { return append_.await_ready(); }
+   void await_suspend(std::coroutine_handle<> caller) noexcept
+   {
+      append_.await_suspend(caller);
+   }
+   Hasher await_resume() noexcept
+   {
+      hasher_.finish();
+      return hasher_;
+   }
+
+ private:
+   Hasher hasher_;
+   HashAppendAwaitable<Hasher> append_;
+};
+
+template<typename Hasher>
+HashAwaitable<Hasher> hash_async(const void* data,
+                                 size_t size,
+                                 const AsyncHashOptions& options = {}) noexcept
+{
+   return HashAwaitable<Hasher>(data, size, options);
+}
+
+template<typename Hasher>
+HashAwaitable<Hasher> hash_async(std::string_view text,
+                                 const AsyncHashOptions& options = {}) noexcept
+{
+   return HashAwaitable<Hasher>(text.data(), text.size(), options);
+}
+
+// A stream hasher whose appends are awaited. Only one append may be in
+// flight at a time.
+//
+// usage: AsyncHasher<Sha256> hash;
+//        while(auto chunk = co_await socket.read())
+//           co_await hash.append(chunk->data(), chunk->size());
+//        send(hash.hasher().hexdigest());
+template<typename Hasher> class AsyncHasher
+{
+ public:
+   explicit AsyncHasher(const AsyncHashOptions& options = {}) noexcept
+       : options_(options)
+   {}
+
+   HashAppendAwaitable<Hasher> append(const void* data, size_t size) noexcept
+   {
+      return HashAppendAwaitable<Hasher>(hasher_, data, size, options_);
+   }
+   HashAppendAwaitable<Hasher> append(std::string_view text) noexcept
+   {
+      return append(text.data(), text.size());
+   }
+
+   // Not while an append is in flight
+   Hasher& hasher() noexcept { return hasher_; }
+
+ private:
+   Hasher hasher_;
+   AsyncHashOptions options_;
+};
+
+#endif
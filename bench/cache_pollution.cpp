@@ -0,0 +1,133 @@
+
+// Measures how much hashing a large object slows down a co-running,
+// cache-sensitive thread, with and without the streaming mode.
+//
+// usage: cache_pollution [object-MiB [working-set-KiB [seconds]]]
+//
+// The co-runner chases pointers around a working set that should fit in
+// the LLC. Each mode reports the hasher's throughput, and the co-runner's
+// rate relative to running alone.
+
+#include "streaming_hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+struct alignas(64) Node
+{
+   Node* next;
+};
+
+// A random cycle through the whole working set, defeating the prefetcher
+static std::vector<Node> make_cycle(size_t n_nodes)
+{
+   std::vector<Node> nodes(n_nodes);
+   std::vector<size_t> order(n_nodes);
+   std::iota(order.begin(), order.end(), 0);
+   std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(42));
+   for(size_t i = 0; i < n_nodes; ++i)
+      nodes[order[i]].next = &nodes[order[(i + 1) % n_nodes]];
+   return nodes;
+}
+
+// Steps per second of the co-runner, while `hash` runs on another thread
+// for `seconds`. `hash` returns the number of bytes it hashed.
+template<typename F>
+static double run(std::vector<Node>& nodes,
+                  double seconds,
+                  F&& hash,
+                  double& hash_mb_s)
+{
+   std::atomic<bool> stop{false};
+   uint64_t steps = 0;
+   const Node* p  = &nodes[0];
+   std::thread hasher([&] {
+      const auto t0   = clock_type::now();
+      uint64_t bytes  = 0;
+      const auto stop_at = t0 + std::chrono::duration<double>(seconds);
+      while(clock_type::now() < stop_at) bytes += hash();
+      const std::chrono::duration<double> elapsed = clock_type::now() - t0;
+      hash_mb_s = double(bytes) / 1e6 / elapsed.count();
+      stop      = true;
+   });
+
+   const auto t0 = clock_type::now();
+   while(!stop.load(std::memory_order_relaxed)) {
+      for(int i = 0; i < 1024; ++i) p = p->next;
+      steps += 1024;
+   }
+   const std::chrono::duration<double> elapsed = clock_type::now() - t0;
+   hasher.join();
+   if(p == nullptr) std::puts(""); // keep the chase
+   return double(steps) / elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+   const size_t object_mib = argc > 1 ? size_t(atol(argv[1])) : 256;
+   const size_t working_kib = argc > 2 ? size_t(atol(argv[2])) : 4096;
+   const double seconds     = argc > 3 ? atof(argv[3]) : 2.0;
+
+   std::vector<char> object(object_mib << 20);
+   for(size_t i = 0; i < object.size(); ++i) object[i] = char(i * 31 >> 7);
+   auto nodes = make_cycle((working_kib << 10) / sizeof(Node));
+
+   const char* flush_name[] = {"none", "clflush", "clflushopt"};
+   std::printf("object %zu MiB, working set %zu KiB, line flush: %s\n\n",
+               object_mib,
+               working_kib,
+               flush_name[int(cache_flush_support())]);
+
+   double unused;
+   const double alone = run(nodes, seconds, [] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      return uint64_t(0);
+   }, unused);
+
+   struct Mode
+   {
+      const char* name;
+      bool streaming;
+      bool evict;
+   };
+   const Mode modes[] = {{"append()", false, false},
+                         {"streaming, prefetch only", true, false},
+                         {"streaming, prefetch + evict", true, true}};
+
+   std::printf("%-30s %12s %14s %10s\n",
+               "mode",
+               "hash MB/s",
+               "co-runner M/s",
+               "slowdown");
+   std::printf("%-30s %12s %14.1f %9.1f%%\n", "alone", "-", alone / 1e6, 0.0);
+   for(const auto& mode : modes) {
+      StreamingOptions options;
+      options.threshold = mode.streaming ? 0 : SIZE_MAX;
+      options.evict     = mode.evict;
+
+      double hash_mb_s = 0.0;
+      const double rate = run(nodes, seconds, [&] {
+         Sha256 sha;
+         append_streaming(sha, object.data(), object.size(), options);
+         sha.finish();
+         return uint64_t(object.size());
+      }, hash_mb_s);
+
+      std::printf("%-30s %12.0f %14.1f %9.1f%%\n",
+                  mode.name,
+                  hash_mb_s,
+                  rate / 1e6,
+                  100.0 * (1.0 - rate / alone));
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,476 @@
+
+#include "blob_store.hpp"
+
+#include "digest_sort.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char k_idx_magic[8] = {'H', 'F', 'P', 'K', 'I', 'D', 'X', '1'};
+
+struct PackLocation
+{
+   uint64_t offset;
+   uint64_t length;
+};
+
+// On-disk index record: 32 byte digest, then the location in the pack
+using PackIndexRecord = DigestRecord<Sha256Digest, PackLocation>;
+static_assert(sizeof(PackIndexRecord) == 48, "unexpected index padding");
+
+struct PackIndexHeader
+{
+   char magic[8];
+   uint64_t count;
+};
+
+// --------------------------------------------------------------------- helpers
+
+static bool from_hex(std::string_view s, uint8_t* bytes, size_t length)
+{
+   auto nibble = [](char c) -> int {
+      if(c >= '0' && c <= '9') return c - '0';
+      if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+      return -1;
+   };
+   if(s.size() != 2 * length) return false;
+   for(size_t i = 0; i < length; ++i) {
+      const int hi = nibble(s[2 * i]), lo = nibble(s[2 * i + 1]);
+      if(hi < 0 || lo < 0) return false;
+      bytes[i] = uint8_t((hi << 4) | lo);
+   }
+   return true;
+}
+
+// `created`, if not null, is set when the directory did not exist before
+static bool make_dir(const std::string& path, bool* created = nullptr) noexcept
+{
+   const bool made = mkdir(path.c_str(), 0755) == 0;
+   if(created != nullptr) *created = made;
+   return made || errno == EEXIST;
+}
+
+// Makes the entries created or renamed in `path` durable
+static bool sync_dir(const std::string& path) noexcept
+{
+   const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if(fd < 0) return false;
+   const bool ok = fsync(fd) == 0;
+   ::close(fd);
+   return ok;
+}
+
+static bool read_file(const std::string& path, std::string& out) noexcept
+{
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+
+   struct stat st;
+   bool ok = fstat(fd, &st) == 0;
+   if(ok) {
+      out.resize(size_t(st.st_size));
+      ok = pread_all(fd, &out[0], out.size(), 0);
+   }
+   ::close(fd);
+   return ok;
+}
+
+static std::vector<std::string> list_dir(const std::string& path)
+{
+   std::vector<std::string> names;
+   if(DIR* dir = opendir(path.c_str())) {
+      while(const dirent* e = readdir(dir))
+         if(e->d_name[0] != '.') names.emplace_back(e->d_name);
+      closedir(dir);
+   }
+   std::sort(begin(names), end(names));
+   return names;
+}
+
+// ------------------------------------------------------------------------ Pack
+
+// An immutable, memory-mapped packfile and its index
+struct BlobStore::Pack
+{
+   std::string name;
+   const uint8_t* data{nullptr};
+   size_t data_length{0};
+   const PackIndexRecord* records{nullptr};
+   size_t count{0};
+   void* idx_base{nullptr};
+   size_t idx_length{0};
+
+   ~Pack()
+   {
+      if(data != nullptr) munmap(const_cast<uint8_t*>(data), data_length);
+      if(idx_base != nullptr) munmap(idx_base, idx_length);
+   }
+
+   static void* map_file(const std::string& path, size_t& length) noexcept
+   {
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0) return nullptr;
+      struct stat st;
+      void* base = nullptr;
+      length     = 0;
+      if(fstat(fd, &st) == 0 && st.st_size > 0) {
+         length = size_t(st.st_size);
+         base   = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+         if(base == MAP_FAILED) base = nullptr;
+      }
+      ::close(fd);
+      return base;
+   }
+
+   bool load(const std::string& dir) noexcept
+   {
+      idx_base = map_file(dir + "/" + name + ".idx", idx_length);
+      if(idx_base == nullptr || idx_length < sizeof(PackIndexHeader))
+         return false;
+
+      PackIndexHeader header;
+      memcpy(&header, idx_base, sizeof(header));
+      const auto max_count = (idx_length - sizeof(header)) / sizeof(*records);
+      if(memcmp(header.magic, k_idx_magic, sizeof(k_idx_magic)) != 0
+         || header.count > max_count)
+         return false;
+
+      records = reinterpret_cast<const PackIndexRecord*>(
+          static_cast<const uint8_t*>(idx_base) + sizeof(header));
+      count = header.count;
+
+      // A pack of empty objects has no data to map
+      void* base = map_file(dir + "/" + name + ".pack", data_length);
+      data       = static_cast<const uint8_t*>(base);
+      return data != nullptr || data_length == 0;
+   }
+
+   const PackIndexRecord* find(const Sha256Digest& digest) const noexcept
+   {
+      const auto end = records + count;
+      auto less      = [](const PackIndexRecord& r, const Sha256Digest& d) {
+         return r.digest < d;
+      };
+      const auto pos = std::lower_bound(records, end, digest, less);
+      return (pos != end && pos->digest == digest) ? pos : nullptr;
+   }
+};
+
+struct BlobStore::PackSet
+{
+   std::vector<std::shared_ptr<const Pack>> packs;
+};
+
+// ------------------------------------------------------------------ BlobWriter
+
+BlobWriter::BlobWriter(const BlobStore* store,
+                       int fd,
+                       std::string tmp_path) noexcept
+    : store_(store)
+    , fd_(fd)
+    , tmp_path_(std::move(tmp_path))
+{}
+
+BlobWriter::BlobWriter(BlobWriter&& o) noexcept { *this = std::move(o); }
+
+BlobWriter& BlobWriter::operator=(BlobWriter&& o) noexcept
+{
+   if(this != &o) {
+      abort();
+      store_    = o.store_;
+      fd_       = o.fd_;
+      tmp_path_ = std::move(o.tmp_path_);
+      sha_      = o.sha_;
+      o.fd_     = -1;
+   }
+   return *this;
+}
+
+BlobWriter::~BlobWriter() noexcept { abort(); }
+
+bool BlobWriter::append(const void* buf, size_t length) noexcept
+{
+   if(fd_ < 0) return false;
+   if(!write_all(fd_, buf, length)) {
+      abort();
+      return false;
+   }
+   sha_.append(buf, length);
+   return true;
+}
+
+std::optional<Sha256Digest> BlobWriter::commit() noexcept
+{
+   if(fd_ < 0) return std::nullopt;
+
+   Sha256Digest digest;
+   sha_.finish().get_digest(digest.data());
+
+   const bool synced = fsync(fd_) == 0;
+   ::close(fd_);
+   fd_ = -1;
+
+   // The two fanout directories, then the atomic rename. The directories
+   // are synced too, so that an object reported as stored survives a crash.
+   const auto path = store_->loose_path(digest);
+   const auto dir2 = path.substr(0, path.rfind('/'));
+   const auto dir1 = dir2.substr(0, dir2.rfind('/'));
+   bool new1 = false, new2 = false;
+   const bool ok = synced && make_dir(dir1, &new1) && make_dir(dir2, &new2)
+                   && rename(tmp_path_.c_str(), path.c_str()) == 0
+                   && sync_dir(dir2) && (!new2 || sync_dir(dir1))
+                   && (!new1 || sync_dir(dir1.substr(0, dir1.rfind('/'))));
+
+   if(!ok) unlink(tmp_path_.c_str());
+   tmp_path_.clear();
+   return ok ? std::optional<Sha256Digest>(digest) : std::nullopt;
+}
+
+void BlobWriter::abort() noexcept
+{
+   if(fd_ >= 0) {
+      ::close(fd_);
+      unlink(tmp_path_.c_str());
+      fd_ = -1;
+   }
+}
+
+//  --------------------------------------------------------------- Construction
+
+BlobStore::BlobStore() noexcept
+    : packs_(std::make_shared<const PackSet>())
+{}
+
+BlobStore::~BlobStore() noexcept = default;
+
+bool BlobStore::open(const std::string& root) noexcept
+{
+   root_ = root;
+   if(!make_dir(root_) || !make_dir(root_ + "/objects")
+      || !make_dir(root_ + "/packs") || !make_dir(root_ + "/tmp"))
+      return false;
+   reload_packs_();
+   return true;
+}
+
+std::string BlobStore::loose_path(const Sha256Digest& digest) const
+{
+   const auto hex = to_hex(digest);
+   return root_ + "/objects/" + hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/"
+          + hex;
+}
+
+// ----------------------------------------------------------------------- write
+
+BlobWriter BlobStore::writer() const noexcept
+{
+   std::string path = root_ + "/tmp/blob-XXXXXX";
+   const int fd     = mkstemp(&path[0]);
+   return BlobWriter(this, fd, fd < 0 ? std::string{} : path);
+}
+
+std::optional<Sha256Digest> BlobStore::put(std::string_view data) const
+    noexcept
+{
+   auto w = writer();
+   if(!w.append(data)) return std::nullopt;
+   return w.commit();
+}
+
+// ------------------------------------------------------------------------ read
+
+bool BlobStore::find_in_packs_(const PackSet& packs,
+                               const Sha256Digest& digest,
+                               std::string* out) const noexcept
+{
+   for(const auto& pack : packs.packs) {
+      const auto record = pack->find(digest);
+      if(record == nullptr) continue;
+      const auto& loc = record->payload;
+      if(loc.offset + loc.length > pack->data_length) return false; // corrupt
+      if(out != nullptr && loc.length == 0) out->clear();
+      if(out != nullptr && loc.length > 0)
+         out->assign(reinterpret_cast<const char*>(pack->data) + loc.offset,
+                     loc.length);
+      return true;
+   }
+   return false;
+}
+
+bool BlobStore::contains(const Sha256Digest& digest) const noexcept
+{
+   struct stat st;
+   if(stat(loose_path(digest).c_str(), &st) == 0) return true;
+   if(find_in_packs_(*std::atomic_load(&packs_), digest, nullptr)) return true;
+   // pack() may have moved the object since we looked at the loose path
+   return packs_changed_() && reload_packs_()
+          && find_in_packs_(*std::atomic_load(&packs_), digest, nullptr);
+}
+
+bool BlobStore::get(const Sha256Digest& digest, std::string& out) const
+    noexcept
+{
+   if(read_file(loose_path(digest), out)) return true;
+   if(find_in_packs_(*std::atomic_load(&packs_), digest, &out)) return true;
+   // pack() may have moved the object since we looked at the loose path
+   return packs_changed_() && reload_packs_()
+          && find_in_packs_(*std::atomic_load(&packs_), digest, &out);
+}
+
+size_t BlobStore::n_packs() const noexcept
+{
+   return std::atomic_load(&packs_)->packs.size();
+}
+
+// Whether packs/ may have changed since the last rescan, judging by its
+// mtime, without taking reload_lock_. A pack added within the same tick of
+// the filesystem's clock as the rescan leaves the mtime as it was, so
+// while the mtime is that recent, packs/ counts as changed.
+bool BlobStore::packs_changed_() const noexcept
+{
+   struct stat st;
+   if(stat((root_ + "/packs").c_str(), &st) != 0) return true;
+   const int64_t mtime = to_ns(st.st_mtim);
+   if(mtime != packs_mtime_ns_.load(std::memory_order_acquire)) return true;
+   timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+   return to_ns(now) - mtime < 1000000000;
+}
+
+// Rescans packs/, reusing packs that are already mapped. Returns true if a
+// new pack was found.
+bool BlobStore::reload_packs_() const noexcept
+{
+   std::lock_guard<std::mutex> guard(reload_lock_);
+   const auto current = std::atomic_load(&packs_);
+
+   // Before listing, so that a pack added meanwhile changes it again
+   struct stat st;
+   const int64_t mtime
+       = stat((root_ + "/packs").c_str(), &st) == 0 ? to_ns(st.st_mtim) : -1;
+
+   auto next     = std::make_shared<PackSet>();
+   bool new_pack = false;
+   for(const auto& file : list_dir(root_ + "/packs")) {
+      const auto dot = file.rfind(".idx");
+      if(dot == std::string::npos || dot + 4 != file.size()) continue;
+      const auto name = file.substr(0, dot);
+
+      const auto existing = std::find_if(
+          begin(current->packs), end(current->packs), [&](const auto& p) {
+             return p->name == name;
+          });
+      if(existing != end(current->packs)) {
+         next->packs.push_back(*existing);
+      } else {
+         auto pack  = std::make_shared<Pack>();
+         pack->name = name;
+         if(pack->load(root_ + "/packs")) {
+            next->packs.push_back(std::move(pack));
+            new_pack = true;
+         }
+      }
+   }
+
+   std::atomic_store(&packs_, std::shared_ptr<const PackSet>(std::move(next)));
+   packs_mtime_ns_.store(mtime, std::memory_order_release);
+   return new_pack;
+}
+
+// ------------------------------------------------------------------------ pack
+
+long BlobStore::pack(size_t max_object_size) noexcept
+{
+   std::lock_guard<std::mutex> guard(pack_lock_);
+
+   // Collect small loose objects
+   std::vector<std::pair<std::string, Sha256Digest>> loose;
+   const auto objects = root_ + "/objects";
+   for(const auto& d1 : list_dir(objects))
+      for(const auto& d2 : list_dir(objects + "/" + d1))
+         for(const auto& name : list_dir(objects + "/" + d1 + "/" + d2)) {
+            const auto path = objects + "/" + d1 + "/" + d2 + "/" + name;
+            Sha256Digest digest;
+            struct stat st;
+            if(from_hex(name, digest.data(), digest.size())
+               && stat(path.c_str(), &st) == 0
+               && size_t(st.st_size) <= max_object_size)
+               loose.emplace_back(path, digest);
+         }
+   if(loose.empty()) return 0;
+
+   // Concatenate them into a temporary packfile. The pack is named after
+   // the digest of its content.
+   std::string pack_tmp = root_ + "/tmp/pack-XXXXXX";
+   const int pack_fd    = mkstemp(&pack_tmp[0]);
+   if(pack_fd < 0) return -1;
+
+   std::vector<PackIndexRecord> records;
+   std::vector<std::string> packed_paths;
+   Sha256 pack_sha;
+   std::string data;
+   uint64_t offset = 0;
+   bool ok         = true;
+   for(const auto& [path, digest] : loose) {
+      if(!read_file(path, data)) continue; // removed under us
+      ok = write_all(pack_fd, data.data(), data.size());
+      if(!ok) break;
+      pack_sha.append(data);
+      records.push_back({digest, {offset, data.size()}});
+      packed_paths.push_back(path);
+      offset += data.size();
+   }
+   ok = ok && fsync(pack_fd) == 0;
+   ::close(pack_fd);
+
+   Sha256Digest pack_digest;
+   pack_sha.finish().get_digest(pack_digest.data());
+   const auto hex  = to_hex(pack_digest);
+   const auto name = root_ + "/packs/" + hex.substr(0, 40);
+
+   // Write the index, then rename the pack and finally the index into place.
+   // Readers discover packs through their index, so they never see a pack
+   // without its data.
+   radix_sort(records.data(), records.size());
+   std::string idx_tmp = root_ + "/tmp/idx-XXXXXX";
+   const int idx_fd    = ok ? mkstemp(&idx_tmp[0]) : -1;
+   if(idx_fd >= 0) {
+      PackIndexHeader header;
+      memcpy(header.magic, k_idx_magic, sizeof(k_idx_magic));
+      header.count = records.size();
+      const auto n_bytes = records.size() * sizeof(PackIndexRecord);
+      ok                 = write_all(idx_fd, &header, sizeof(header))
+           && write_all(idx_fd, records.data(), n_bytes)
+           && fsync(idx_fd) == 0;
+      ::close(idx_fd);
+   } else {
+      ok = false;
+   }
+
+   // The loose objects are only removed once the pack is durable
+   ok = ok && rename(pack_tmp.c_str(), (name + ".pack").c_str()) == 0
+        && rename(idx_tmp.c_str(), (name + ".idx").c_str()) == 0
+        && sync_dir(root_ + "/packs");
+   if(!ok) {
+      unlink(pack_tmp.c_str());
+      if(idx_fd >= 0) unlink(idx_tmp.c_str());
+      return -1;
+   }
+
+   // Readers that miss the loose object will rescan packs/, and find it
+   reload_packs_();
+   for(const auto& path : packed_paths) unlink(path.c_str());
+   return long(packed_paths.size());
+}
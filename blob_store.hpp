@@ -0,0 +1,119 @@
+
+#pragma once
+
+#include "sha256.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class BlobStore;
+
+// Streams one object into a BlobStore. Every append() writes the bytes to a
+// temporary file and feeds the same bytes to Sha256, so the data is read
+// exactly once. commit() names the object by its digest.
+class BlobWriter
+{
+ public:
+   BlobWriter(BlobWriter&& o) noexcept;
+   BlobWriter(const BlobWriter&) = delete;
+   BlobWriter& operator=(BlobWriter&& o) noexcept;
+   BlobWriter& operator=(const BlobWriter&) = delete;
+   ~BlobWriter() noexcept; // aborts if not committed
+
+   bool good() const noexcept { return fd_ >= 0; }
+
+   bool append(const void* buf, size_t length) noexcept;
+   bool append(std::string_view data) noexcept
+   {
+      return append(data.data(), data.size());
+   }
+
+   // Flushes the object to disk, atomically renames it into place, and
+   // syncs its directory. Returns the object's digest, or nothing on I/O
+   // error.
+   std::optional<Sha256Digest> commit() noexcept;
+   void abort() noexcept;
+
+ private:
+   friend class BlobStore;
+   BlobWriter(const BlobStore* store, int fd, std::string tmp_path) noexcept;
+
+   const BlobStore* store_{nullptr};
+   int fd_{-1};
+   std::string tmp_path_;
+   Sha256 sha_;
+};
+
+// A local content-addressable store: blobs are stored under sha256(content).
+//
+// Layout under the root directory:
+//
+//    objects/ab/cd/abcd...     loose objects, two-level fanout on the digest
+//    packs/<name>.pack         many small objects, concatenated
+//    packs/<name>.idx          sorted (digest, offset, length) records
+//    tmp/                      objects being written
+//
+// Objects are written to tmp/ and renamed into place, so a reader sees an
+// object completely or not at all. pack() moves small loose objects into a
+// new packfile. Packs and their indexes are immutable and memory mapped;
+// readers share the set of packs through an atomically swapped shared_ptr,
+// so lookups never take a lock. A miss costs a stat() of packs/, to see
+// whether a pack has appeared since it was last scanned.
+//
+// usage: BlobStore store;
+//        if(!store.open("/var/lib/blobs")) { ...error... }
+//        auto writer = store.writer();
+//        writer.append(chunk); ...
+//        auto digest = writer.commit();
+//
+//        std::string data;
+//        if(store.get(*digest, data)) { ... }
+class BlobStore
+{
+ public:
+   BlobStore() noexcept;
+   BlobStore(const BlobStore&) = delete;
+   BlobStore& operator=(const BlobStore&) = delete;
+   ~BlobStore() noexcept;
+
+   // Creates the directory layout if necessary
+   bool open(const std::string& root) noexcept;
+   const std::string& root() const noexcept { return root_; }
+
+   BlobWriter writer() const noexcept;
+   std::optional<Sha256Digest> put(std::string_view data) const noexcept;
+
+   bool contains(const Sha256Digest& digest) const noexcept;
+   bool get(const Sha256Digest& digest, std::string& out) const noexcept;
+
+   // Moves loose objects of at most `max_object_size` bytes into a new pack.
+   // Safe to run while other threads read and write. Returns the number of
+   // objects packed, or -1 on I/O error.
+   long pack(size_t max_object_size = 64 * 1024) noexcept;
+
+   size_t n_packs() const noexcept;
+
+   std::string loose_path(const Sha256Digest& digest) const;
+
+ private:
+   struct Pack;
+   struct PackSet;
+
+   std::string root_;
+   mutable std::shared_ptr<const PackSet> packs_; // atomic_load/atomic_store
+   mutable std::mutex reload_lock_; // serializes reload_packs_()
+   std::mutex pack_lock_;           // one pack() at a time
+   mutable std::atomic<int64_t> packs_mtime_ns_{-1}; // at the last rescan
+
+   bool find_in_packs_(const PackSet& packs,
+                       const Sha256Digest& digest,
+                       std::string* out) const noexcept;
+   bool packs_changed_() const noexcept;
+   bool reload_packs_() const noexcept;
+};
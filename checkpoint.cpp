@@ -0,0 +1,230 @@
+
+#include "checkpoint.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char k_magic[8]  = {'H', 'F', 'C', 'K', 'P', 'T', '0', '2'};
+static constexpr size_t read_size = 1 << 20;
+
+struct SidecarHeader
+{
+   char magic[8];
+   uint32_t digest_size; // identifies the algorithm
+   uint32_t record_size;
+   uint64_t count;
+   uint64_t file_size; // bytes hashed by the last run
+   int64_t mtime_ns;   // of the file, at the end of the last run
+   uint32_t spot_check_bytes;
+   uint32_t reserved;
+   Sha256Digest head_spot; // see head_digest()
+};
+
+template<typename Midstate> struct CheckpointRecord
+{
+   uint64_t offset;
+   Sha256Digest spot; // of the `spot_check_bytes` before `offset`
+   Midstate midstate;
+};
+
+// --------------------------------------------------------------------- helpers
+
+// Sha256 of the `spot_bytes` (or fewer, at the start of the file) before
+// `offset`
+static bool spot_digest(int fd,
+                        uint64_t offset,
+                        uint32_t spot_bytes,
+                        Sha256Digest& out) noexcept
+{
+   const auto length = size_t(std::min<uint64_t>(offset, spot_bytes));
+   std::vector<char> buf(length);
+   if(!pread_all(fd, buf.data(), length, offset - length)) return false;
+   Sha256 sha;
+   sha.append(buf.data(), length);
+   sha.finish().get_digest(out.data());
+   return true;
+}
+
+template<typename Record>
+static bool spot_ok(int fd, const Record& r, uint32_t spot_bytes) noexcept
+{
+   if(spot_bytes == 0) return true;
+   Sha256Digest spot;
+   return spot_digest(fd, r.offset, spot_bytes, spot) && spot == r.spot;
+}
+
+// Sha256 of the first `spot_bytes` of the file, or fewer if the first
+// checkpoint, at `first_offset`, comes sooner
+static bool head_digest(int fd,
+                        uint64_t first_offset,
+                        uint32_t spot_bytes,
+                        Sha256Digest& out) noexcept
+{
+   const auto length = std::min<uint64_t>(first_offset, spot_bytes);
+   return spot_digest(fd, length, spot_bytes, out);
+}
+
+template<typename Record>
+static bool load_sidecar(const std::string& path,
+                         SidecarHeader& header,
+                         std::vector<Record>& records) noexcept
+{
+   std::FILE* fp = std::fopen(path.c_str(), "rb");
+   if(fp == nullptr) return false;
+   bool ok = std::fread(&header, sizeof(header), 1, fp) == 1
+             && memcmp(header.magic, k_magic, sizeof(k_magic)) == 0
+             && header.record_size == sizeof(Record)
+             && header.count < (1u << 30);
+   if(ok) {
+      records.resize(header.count);
+      ok = std::fread(records.data(), sizeof(Record), records.size(), fp)
+           == records.size();
+   }
+   std::fclose(fp);
+   if(!ok) records.clear();
+   return ok;
+}
+
+template<typename Record>
+static bool save_sidecar(const std::string& path,
+                         const SidecarHeader& header,
+                         const std::vector<Record>& records) noexcept
+{
+   const auto tmp_path = path + ".tmp";
+   std::FILE* fp       = std::fopen(tmp_path.c_str(), "wb");
+   if(fp == nullptr) return false;
+   bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1
+             && std::fwrite(records.data(), sizeof(Record), records.size(), fp)
+                    == records.size();
+   ok = (std::fclose(fp) == 0) && ok;
+   ok = ok && std::rename(tmp_path.c_str(), path.c_str()) == 0;
+   if(!ok) std::remove(tmp_path.c_str());
+   return ok;
+}
+
+// ------------------------------------------------------- hash_file_incremental
+
+template<typename Hasher>
+bool hash_file_incremental(const std::string& path,
+                           Hasher& hasher,
+                           const CheckpointOptions& options,
+                           uint64_t* bytes_hashed) noexcept
+{
+   using Record = CheckpointRecord<typename Hasher::Midstate>;
+
+   const auto sidecar = options.sidecar_path.empty() ? path + ".ckpt"
+                                                     : options.sidecar_path;
+   const auto interval = std::max<uint64_t>(options.interval, 1);
+
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+   struct stat st;
+   if(fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+   }
+   const auto size = uint64_t(st.st_size);
+
+   // Find the latest checkpoint that can be trusted
+   SidecarHeader header;
+   std::vector<Record> records;
+   if(load_sidecar(sidecar, header, records)
+      && (header.digest_size != hasher.digest_size()
+          || header.spot_check_bytes != options.spot_check_bytes))
+      records.clear(); // made with different settings
+
+   const bool unchanged = !records.empty() && header.file_size == size
+                          && header.mtime_ns == to_ns(st.st_mtim);
+   size_t n_trusted = 0;
+   for(size_t i = records.size(); i-- > 0 && n_trusted == 0;) {
+      if(records[i].offset > size) continue; // truncated since
+      if(unchanged
+         || (spot_ok(fd, records[i], options.spot_check_bytes)
+             && spot_ok(fd, records[0], options.spot_check_bytes)))
+         n_trusted = i + 1;
+   }
+   Sha256Digest head;
+   if(n_trusted > 0 && !unchanged && options.spot_check_bytes != 0
+      && !(head_digest(fd, records[0].offset, options.spot_check_bytes, head)
+           && head == header.head_spot))
+      n_trusted = 0; // the start of the file was rewritten
+   records.resize(n_trusted);
+
+   uint64_t pos = 0;
+   if(!records.empty()) {
+      hasher.restore(records.back().midstate);
+      pos = records.back().offset;
+   }
+   const uint64_t resumed_at = pos;
+
+   // Hash the rest, stopping at every checkpoint boundary
+   std::vector<char> buffer(read_size);
+   uint64_t next_checkpoint = (pos / interval + 1) * interval;
+   bool ok                  = true;
+   while(true) {
+      const auto want
+          = size_t(std::min<uint64_t>(buffer.size(), next_checkpoint - pos));
+      const ssize_t n = pread_retry(fd, buffer.data(), want, pos);
+      if(n <= 0) {
+         ok = n == 0;
+         break;
+      }
+      hasher.append(buffer.data(), size_t(n));
+      pos += uint64_t(n);
+
+      if(pos == next_checkpoint) {
+         Record r;
+         r.offset   = pos;
+         r.midstate = hasher.midstate();
+         ok         = options.spot_check_bytes == 0
+              || spot_digest(fd, pos, options.spot_check_bytes, r.spot);
+         if(!ok) break;
+         if(options.spot_check_bytes == 0) r.spot.fill(0);
+         records.push_back(r);
+         next_checkpoint += interval;
+      }
+   }
+
+   Sha256Digest head_spot = {};
+   if(ok && !records.empty() && options.spot_check_bytes != 0)
+      ok = head_digest(
+          fd, records[0].offset, options.spot_check_bytes, head_spot);
+
+   struct stat after;
+   ok = ok && fstat(fd, &after) == 0;
+   ::close(fd);
+   if(!ok) return false;
+
+   // If the file grew while we read it, don't claim that `pos` bytes match
+   // its mtime; the next run will spot check instead
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, k_magic, sizeof(k_magic));
+   header.digest_size      = uint32_t(hasher.digest_size());
+   header.record_size      = sizeof(Record);
+   header.count            = records.size();
+   header.file_size        = pos;
+   header.mtime_ns = uint64_t(after.st_size) == pos ? to_ns(after.st_mtim) : 0;
+   header.spot_check_bytes = options.spot_check_bytes;
+   header.head_spot        = head_spot;
+   save_sidecar(sidecar, header, records); // an optimization; failure is fine
+
+   hasher.finish();
+   if(bytes_hashed != nullptr) *bytes_hashed = pos - resumed_at;
+   return true;
+}
+
+template bool hash_file_incremental(const std::string&,
+                                    MD5&,
+                                    const CheckpointOptions&,
+                                    uint64_t*) noexcept;
+template bool hash_file_incremental(const std::string&,
+                                    Sha256&,
+                                    const CheckpointOptions&,
+                                    uint64_t*) noexcept;
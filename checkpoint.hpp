@@ -0,0 +1,56 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstdint>
+#include <string>
+
+// Incremental hashing of append-only files.
+//
+// While hashing a file, the hasher's midstate (chaining state, byte count,
+// and the buffered partial block) is saved every `interval` bytes to a
+// sidecar file. When the file has grown, the next hash resumes from the
+// latest checkpoint whose prefix is still intact, so the cost is proportional
+// to the appended bytes, not the file size.
+//
+// A checkpoint is trusted when:
+//
+//  * the file's size and mtime match the last run exactly, or
+//  * the file is at least as long as the checkpoint, and the Sha256 of the
+//    `spot_check_bytes` just before the checkpoint, just before the first
+//    checkpoint, and at the very start of the file still match. This catches
+//    a file that was truncated and rewritten, at the cost of a few small
+//    reads.
+//
+// If no checkpoint can be trusted, the file is hashed from the start, and
+// the sidecar is rewritten.
+//
+// usage: Sha256 sha;
+//        if(hash_file_incremental("/var/log/archive.log", sha))
+//           std::cout << sha.hexdigest();
+struct CheckpointOptions
+{
+   std::string sidecar_path;         // empty means `path + ".ckpt"`
+   uint64_t interval = 64ull << 20;  // bytes between checkpoints
+   uint32_t spot_check_bytes = 4096; // 0 trusts size and mtime alone
+};
+
+// `hasher` must be freshly constructed; it is finished on success.
+// `bytes_hashed`, if not null, receives the number of bytes actually read
+// and hashed (as opposed to skipped by resuming from a checkpoint).
+template<typename Hasher>
+bool hash_file_incremental(const std::string& path,
+                           Hasher& hasher,
+                           const CheckpointOptions& options = {},
+                           uint64_t* bytes_hashed           = nullptr) noexcept;
+
+extern template bool hash_file_incremental(const std::string&,
+                                           MD5&,
+                                           const CheckpointOptions&,
+                                           uint64_t*) noexcept;
+extern template bool hash_file_incremental(const std::string&,
+                                           Sha256&,
+                                           const CheckpointOptions&,
+                                           uint64_t*) noexcept;
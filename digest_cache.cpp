@@ -0,0 +1,297 @@
+
+#include "digest_cache.hpp"
+#include "io_util.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static constexpr char k_magic[8] = {'H', 'F', 'D', 'C', 'A', 'C', 'H', '1'};
+
+static constexpr size_t header_size  = 128;
+static constexpr size_t probe_window = 8;
+static constexpr size_t n_key_words  = 5;  // dev, ino, size, mtime, ctime
+static constexpr size_t n_data_words = 11; // key, md5, sha256
+static constexpr size_t n_words      = 12; // data, checksum
+
+// Files modified less than this long ago may be modified again within the
+// same mtime tick, which stat() would not notice. Don't cache them.
+static constexpr int64_t racy_window_ns = 1000000000;
+
+struct CacheHeader
+{
+   char magic[8];
+   uint64_t n_slots;
+   uint64_t slot_size;
+};
+
+// Every field is an atomic word, so that the seqlock's optimistic reads are
+// well defined. Relaxed loads and stores compile to plain moves.
+struct alignas(64) DigestCache::Slot
+{
+   std::atomic<uint64_t> seq; // odd while a write is in progress
+   std::atomic<uint64_t> words[n_words];
+};
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t)
+                  && std::atomic<uint64_t>::is_always_lock_free,
+              "slots are shared between processes, and must be lock-free");
+
+// --------------------------------------------------------------------- helpers
+
+struct SlotRecord
+{
+   uint64_t words[n_words];
+
+   uint64_t checksum() const noexcept // FNV-1a over the data words
+   {
+      uint64_t h = 0xcbf29ce484222325ull;
+      for(size_t i = 0; i < n_data_words; ++i) {
+         h ^= words[i];
+         h *= 0x100000001b3ull;
+      }
+      return h;
+   }
+
+   bool valid() const noexcept { return words[n_data_words] == checksum(); }
+};
+
+static void make_key(const struct stat& st, uint64_t key[n_key_words]) noexcept
+{
+   key[0] = uint64_t(st.st_dev);
+   key[1] = uint64_t(st.st_ino);
+   key[2] = uint64_t(st.st_size);
+   key[3] = uint64_t(to_ns(st.st_mtim));
+   key[4] = uint64_t(to_ns(st.st_ctim));
+}
+
+static size_t home_slot(const uint64_t key[n_key_words]) noexcept
+{
+   uint64_t x = key[0] * 0x9e3779b97f4a7c15ull ^ key[1]; // splitmix64 finish
+   x          = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+   x          = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+   return size_t(x ^ (x >> 31));
+}
+
+// Seqlock read. Returns false if the slot was being written.
+static bool read_slot(const std::atomic<uint64_t>& seq,
+                      const std::atomic<uint64_t>* words,
+                      SlotRecord& out) noexcept
+{
+   for(int attempt = 0; attempt < 16; ++attempt) {
+      const auto s0 = seq.load(std::memory_order_acquire);
+      if(s0 & 1) continue;
+      for(size_t i = 0; i < n_words; ++i)
+         out.words[i] = words[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(seq.load(std::memory_order_relaxed) == s0) return true;
+   }
+   return false;
+}
+
+//  --------------------------------------------------------------- Construction
+
+DigestCache::~DigestCache() noexcept { close(); }
+
+bool DigestCache::open(const std::string& path, size_t n_slots) noexcept
+{
+   close();
+
+   const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if(fd < 0) return false;
+
+   // Exclusive while creating or validating, so that two processes don't
+   // both initialize a new file
+   flock(fd, LOCK_EX);
+
+   bool ok = true;
+   CacheHeader header;
+   struct stat st;
+   ok = fstat(fd, &st) == 0;
+   if(ok && st.st_size == 0) {
+      size_t n = 1;
+      while(n < n_slots) n *= 2;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, k_magic, sizeof(k_magic));
+      header.n_slots   = n;
+      header.slot_size = sizeof(Slot);
+      ok = ftruncate(fd, off_t(header_size + n * sizeof(Slot))) == 0
+           && pwrite(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header));
+      st.st_size = off_t(header_size + n * sizeof(Slot));
+   } else if(ok) {
+      ok = pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header))
+           && memcmp(header.magic, k_magic, sizeof(k_magic)) == 0
+           && header.slot_size == sizeof(Slot) && header.n_slots > 0
+           && (header.n_slots & (header.n_slots - 1)) == 0
+           && size_t(st.st_size) >= header_size + header.n_slots * sizeof(Slot);
+   }
+
+   void* base = MAP_FAILED;
+   if(ok) {
+      length_        = size_t(st.st_size);
+      const int prot = PROT_READ | PROT_WRITE;
+      base           = mmap(nullptr, length_, prot, MAP_SHARED, fd, 0);
+      ok             = base != MAP_FAILED;
+   }
+   flock(fd, LOCK_UN);
+
+   if(!ok) {
+      ::close(fd);
+      length_ = 0;
+      return false;
+   }
+
+   fd_    = fd;
+   base_  = base;
+   slots_ = reinterpret_cast<Slot*>(static_cast<char*>(base) + header_size);
+   mask_  = header.n_slots - 1;
+   return true;
+}
+
+void DigestCache::close() noexcept
+{
+   if(base_ != nullptr) munmap(base_, length_);
+   if(fd_ >= 0) ::close(fd_);
+   fd_     = -1;
+   base_   = nullptr;
+   length_ = 0;
+   slots_  = nullptr;
+   mask_   = 0;
+}
+
+bool DigestCache::flush() noexcept
+{
+   return base_ == nullptr || msync(base_, length_, MS_SYNC) == 0;
+}
+
+// ---------------------------------------------------------------------- lookup
+
+std::optional<FileDigests> DigestCache::lookup(const struct stat& st) const
+    noexcept
+{
+   if(slots_ == nullptr) return std::nullopt;
+
+   uint64_t key[n_key_words];
+   make_key(st, key);
+   const size_t home = home_slot(key);
+
+   SlotRecord r;
+   for(size_t i = 0; i < probe_window; ++i) {
+      const auto& slot = slots_[(home + i) & mask_];
+      if(!read_slot(slot.seq, slot.words, r) || !r.valid()) continue;
+      if(r.words[0] != key[0] || r.words[1] != key[1]) continue;
+
+      // Same file. Hit if nothing else changed, else it's stale.
+      if(memcmp(r.words, key, sizeof(key)) != 0) break;
+      FileDigests digests;
+      memcpy(digests.md5.data(), &r.words[5], 16);
+      memcpy(digests.sha256.data(), &r.words[7], 32);
+      ++hits_;
+      return digests;
+   }
+
+   ++misses_;
+   return std::nullopt;
+}
+
+// ----------------------------------------------------------------------- store
+
+bool DigestCache::store(const struct stat& st,
+                        const FileDigests& digests) noexcept
+{
+   if(slots_ == nullptr) return false;
+
+   SlotRecord r;
+   make_key(st, r.words);
+   memcpy(&r.words[5], digests.md5.data(), 16);
+   memcpy(&r.words[7], digests.sha256.data(), 32);
+   r.words[n_data_words] = r.checksum();
+   const size_t home     = home_slot(r.words);
+
+   std::lock_guard<std::mutex> guard(write_lock_);
+   flock(fd_, LOCK_EX);
+
+   // Prefer the slot that already holds this file, then a free slot, and
+   // finally evict the home slot
+   Slot* target = nullptr;
+   Slot* empty  = nullptr;
+   SlotRecord old;
+   for(size_t i = 0; i < probe_window && target == nullptr; ++i) {
+      auto& slot = slots_[(home + i) & mask_];
+      if(!read_slot(slot.seq, slot.words, old) || !old.valid()) {
+         if(empty == nullptr) empty = &slot;
+      } else if(old.words[0] == r.words[0] && old.words[1] == r.words[1]) {
+         target = &slot;
+      }
+   }
+   if(target == nullptr) target = empty;
+   if(target == nullptr) target = &slots_[home & mask_];
+
+   // A crashed writer may have left the sequence number odd; recover
+   const auto s = target->seq.load(std::memory_order_relaxed) | 1;
+   target->seq.store(s, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   for(size_t i = 0; i < n_words; ++i)
+      target->words[i].store(r.words[i], std::memory_order_relaxed);
+   target->seq.store(s + 1, std::memory_order_release);
+
+   flock(fd_, LOCK_UN);
+   return true;
+}
+
+// ------------------------------------------------------------------- hash_file
+
+std::optional<FileDigests>
+DigestCache::hash_file(const std::string& path) noexcept
+{
+   struct stat before;
+   if(stat(path.c_str(), &before) != 0) return std::nullopt;
+   if(auto cached = lookup(before)) return cached;
+
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return std::nullopt;
+   if(fstat(fd, &before) != 0) {
+      ::close(fd);
+      return std::nullopt;
+   }
+
+   MD5 md5;
+   Sha256 sha;
+   std::vector<char> buffer(1 << 20);
+   bool ok = true;
+   while(true) {
+      const ssize_t n = read_retry(fd, buffer.data(), buffer.size());
+      if(n <= 0) {
+         ok = n == 0;
+         break;
+      }
+      md5.append(buffer.data(), size_t(n));
+      sha.append(buffer.data(), size_t(n));
+   }
+
+   struct stat after;
+   ok = ok && fstat(fd, &after) == 0;
+   ::close(fd);
+   if(!ok) return std::nullopt;
+
+   FileDigests digests;
+   md5.finish().get_digest(digests.md5.data());
+   sha.finish().get_digest(digests.sha256.data());
+
+   uint64_t k0[n_key_words], k1[n_key_words];
+   make_key(before, k0);
+   make_key(after, k1);
+
+   struct timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+   const bool unchanged = memcmp(k0, k1, sizeof(k0)) == 0;
+   const bool settled   = to_ns(now) - to_ns(after.st_mtim) >= racy_window_ns
+                        && to_ns(now) - to_ns(after.st_ctim) >= racy_window_ns;
+   if(unchanged && settled) store(after, digests);
+
+   return digests;
+}
@@ -0,0 +1,86 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <sys/stat.h>
+
+// Both digests of one file
+struct FileDigests
+{
+   Md5Digest md5;
+   Sha256Digest sha256;
+};
+
+// A persistent cache of file digests, keyed by stat() metadata: device,
+// inode, size, mtime and ctime (in nanoseconds). If none of those changed,
+// then neither did the file, and a repeat run costs one stat() per file
+// instead of reading and hashing it.
+//
+// The cache is a fixed-size open-addressing table in a memory-mapped file,
+// shared by all processes that open it. Each slot is guarded by a seqlock:
+//
+//  * Readers take no locks. They copy a slot, and retry if its sequence
+//    number was odd (write in progress) or changed during the copy.
+//  * Writers serialize with a mutex (threads) and flock() (processes).
+//  * Every slot carries a checksum over its contents, so a slot torn by a
+//    crash (power loss with a partially written-back page) reads as a miss,
+//    never as a wrong digest.
+//
+// When the probe window for a file is full, its home slot is overwritten:
+// this is a cache, not an index.
+//
+// usage: DigestCache cache;
+//        cache.open(std::string(getenv("HOME")) + "/.cache/digests");
+//        auto digests = cache.hash_file("big.iso"); // hashes once, then cached
+class DigestCache
+{
+ public:
+   DigestCache() noexcept = default;
+   DigestCache(const DigestCache&) = delete;
+   DigestCache& operator=(const DigestCache&) = delete;
+   ~DigestCache() noexcept;
+
+   // Opens (or creates, with `n_slots` rounded up to a power of two) a cache
+   // file. An existing cache keeps its own size.
+   bool open(const std::string& path, size_t n_slots = 1 << 16) noexcept;
+   void close() noexcept;
+   bool is_open() const noexcept { return slots_ != nullptr; }
+
+   size_t n_slots() const noexcept { return mask_ + 1; }
+
+   std::optional<FileDigests> lookup(const struct stat& st) const noexcept;
+   bool store(const struct stat& st, const FileDigests& digests) noexcept;
+
+   // stat()s `path`, and returns the cached digests if the file is unchanged.
+   // Otherwise hashes the file with MD5 and Sha256 in a single read pass, and
+   // caches the result, unless the file changed while it was being read, or
+   // was modified too recently for mtime to be trusted.
+   std::optional<FileDigests> hash_file(const std::string& path) noexcept;
+
+   // Writes dirty pages back to disk
+   bool flush() noexcept;
+
+   size_t hits() const noexcept { return hits_.load(); }
+   size_t misses() const noexcept { return misses_.load(); }
+
+ private:
+   struct Slot;
+
+   int fd_{-1};
+   void* base_{nullptr};
+   size_t length_{0};
+   Slot* slots_{nullptr};
+   size_t mask_{0};
+
+   std::mutex write_lock_;
+   mutable std::atomic<size_t> hits_{0};
+   mutable std::atomic<size_t> misses_{0};
+};
@@ -0,0 +1,368 @@
+
+#include "digest_db.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char k_magic[8] = {'H', 'F', 'D', 'I', 'G', 'D', 'B', '1'};
+
+static constexpr unsigned max_fanout_bits = 24;
+static constexpr size_t linear_threshold  = 8; // records
+static constexpr size_t prefetch_distance = 8; // lookups
+
+struct DigestDbHeader
+{
+   char magic[8];
+   uint32_t digest_size;
+   uint32_t fanout_bits;
+   uint64_t count;
+   uint64_t reserved;
+};
+static_assert(sizeof(DigestDbHeader) == 32, "unexpected header padding");
+
+// Leading 8 bytes of a digest as a big-endian integer, so that integer order
+// matches memcmp order.
+static inline uint64_t leading_bits(const uint8_t* digest) noexcept
+{
+   uint64_t x;
+   memcpy(&x, digest, sizeof(x));
+   return __builtin_bswap64(x);
+}
+
+static inline size_t fanout_size(unsigned fanout_bits) noexcept
+{
+   return fanout_bits == 0 ? 0 : (size_t(1) << fanout_bits) + 1;
+}
+
+//  --------------------------------------------------------------- Construction
+
+DigestDb::DigestDb(DigestDb&& o) noexcept { *this = std::move(o); }
+
+DigestDb::~DigestDb() noexcept { close(); }
+
+DigestDb& DigestDb::operator=(DigestDb&& o) noexcept
+{
+   if(this != &o) {
+      close();
+      base_        = o.base_;
+      length_      = o.length_;
+      fanout_      = o.fanout_;
+      records_     = o.records_;
+      count_       = o.count_;
+      digest_size_ = o.digest_size_;
+      fanout_bits_ = o.fanout_bits_;
+      o.base_      = nullptr;
+      o.close();
+   }
+   return *this;
+}
+
+// ------------------------------------------------------------------------ open
+
+bool DigestDb::open(const std::string& path) noexcept
+{
+   close();
+
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+
+   struct stat st;
+   if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(DigestDbHeader)) {
+      ::close(fd);
+      return false;
+   }
+
+   const size_t length = size_t(st.st_size);
+   void* base          = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(base == MAP_FAILED) return false;
+
+   DigestDbHeader header;
+   memcpy(&header, base, sizeof(header));
+
+   const size_t n_fanout   = fanout_size(header.fanout_bits);
+   const size_t records_at = sizeof(header) + n_fanout * sizeof(uint64_t);
+   const bool valid
+       = memcmp(header.magic, k_magic, sizeof(k_magic)) == 0
+         && header.digest_size >= sizeof(uint64_t) && header.digest_size <= 64
+         && header.fanout_bits <= max_fanout_bits && records_at <= length
+         && header.count <= (length - records_at) / header.digest_size;
+
+   // A fanout entry out of order, or past the records, would send lookups
+   // out of bounds
+   const auto fanout = reinterpret_cast<const uint64_t*>(
+       static_cast<const uint8_t*>(base) + sizeof(header));
+   bool fanout_valid
+       = valid && (n_fanout == 0 || fanout[n_fanout - 1] == header.count);
+   for(size_t i = 1; fanout_valid && i < n_fanout; ++i)
+      fanout_valid = fanout[i - 1] <= fanout[i];
+
+   if(!fanout_valid) {
+      munmap(base, length);
+      return false;
+   }
+
+   // Lookups jump around; don't let the kernel read ahead around each probe
+   madvise(base, length, MADV_RANDOM);
+
+   const auto bytes = static_cast<const uint8_t*>(base);
+   base_            = base;
+   length_          = length;
+   fanout_          = n_fanout == 0 ? nullptr : fanout;
+   records_         = bytes + records_at;
+   count_           = header.count;
+   digest_size_     = header.digest_size;
+   fanout_bits_     = header.fanout_bits;
+   return true;
+}
+
+void DigestDb::close() noexcept
+{
+   if(base_ != nullptr) munmap(base_, length_);
+   base_        = nullptr;
+   length_      = 0;
+   fanout_      = nullptr;
+   records_     = nullptr;
+   count_       = 0;
+   digest_size_ = 0;
+   fanout_bits_ = 0;
+}
+
+// --------------------------------------------------------------------- search
+
+void DigestDb::bucket_(const uint8_t* digest, size_t& lo, size_t& hi) const
+    noexcept
+{
+   if(fanout_ == nullptr) {
+      lo = 0;
+      hi = count_;
+   } else {
+      const auto prefix = leading_bits(digest) >> (64 - fanout_bits_);
+      lo                = fanout_[prefix];
+      hi                = fanout_[prefix + 1];
+   }
+}
+
+// Estimates the position of `digest` in its bucket [lo, hi) from the key
+// alone: digests are uniform over the bucket's range of leading bits. As it
+// reads no record, it costs no cache miss, and can be prefetched.
+size_t DigestDb::estimate_(const uint8_t* digest, size_t lo, size_t hi) const
+    noexcept
+{
+   assert(hi > lo);
+   const uint64_t within = leading_bits(digest) << fanout_bits_;
+   const double t        = std::ldexp(double(within), -64);
+   return std::min(hi - 1, lo + size_t(t * double(hi - lo)));
+}
+
+// Interpolates the position of `digest` in [lo, hi), assuming the leading
+// bits of the records in that range are uniformly distributed.
+size_t DigestDb::guess_(const uint8_t* digest, size_t lo, size_t hi) const
+    noexcept
+{
+   assert(hi > lo);
+   const uint64_t k  = leading_bits(digest);
+   const uint64_t k0 = leading_bits(record(lo));
+   const uint64_t k1 = leading_bits(record(hi - 1));
+   if(k <= k0 || k1 <= k0) return lo;
+   if(k >= k1) return hi - 1;
+   const double t = double(k - k0) / double(k1 - k0);
+   return std::min(hi - 1, lo + size_t(t * double(hi - 1 - lo)));
+}
+
+bool DigestDb::search_(const uint8_t* digest, size_t lo, size_t hi) const
+    noexcept
+{
+   // Interpolation search converges in ~log(log(n)) probes on uniform keys.
+   // Should the data be skewed, fall back to bisection after a few rounds.
+   // The first probe is estimated from the key alone, so that it's the
+   // address contains_batch() prefetched.
+   for(int round = 0; hi - lo > linear_threshold; ++round) {
+      const size_t mid = round == 0  ? estimate_(digest, lo, hi)
+                         : round < 4 ? guess_(digest, lo, hi)
+                                     : lo + (hi - lo) / 2;
+      const int c      = memcmp(record(mid), digest, digest_size_);
+      if(c == 0) return true;
+      if(c < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   for(size_t i = lo; i < hi; ++i)
+      if(memcmp(record(i), digest, digest_size_) == 0) return true;
+   return false;
+}
+
+// -------------------------------------------------------------------- contains
+
+bool DigestDb::contains(const uint8_t* digest) const noexcept
+{
+   if(count_ == 0) return false;
+   size_t lo, hi;
+   bucket_(digest, lo, hi);
+   return lo < hi && search_(digest, lo, hi);
+}
+
+bool DigestDb::contains(const Md5Digest& digest) const noexcept
+{
+   return digest.size() == digest_size_ && contains(digest.data());
+}
+
+bool DigestDb::contains(const Sha256Digest& digest) const noexcept
+{
+   return digest.size() == digest_size_ && contains(digest.data());
+}
+
+void DigestDb::contains_batch(const uint8_t* digests, size_t n, bool* out) const
+    noexcept
+{
+   if(count_ == 0) {
+      std::fill(out, out + n, false);
+      return;
+   }
+
+   auto prefetch = [&](size_t i) {
+      size_t lo, hi;
+      const auto digest = digests + i * digest_size_;
+      bucket_(digest, lo, hi);
+      if(lo < hi) __builtin_prefetch(record(estimate_(digest, lo, hi)));
+   };
+
+   for(size_t i = 0; i < std::min(n, prefetch_distance); ++i) prefetch(i);
+   for(size_t i = 0; i < n; ++i) {
+      if(i + prefetch_distance < n) prefetch(i + prefetch_distance);
+      out[i] = contains(digests + i * digest_size_);
+   }
+}
+
+// ----------------------------------------------------------------------- write
+
+bool write_digest_db(const std::string& path,
+                     const uint8_t* sorted_digests,
+                     size_t count,
+                     size_t digest_size,
+                     unsigned fanout_bits) noexcept
+{
+   DigestDbWriter writer;
+   bool ok = writer.open(path, digest_size, fanout_bits);
+   for(size_t i = 0; ok && i < count; ++i)
+      ok = writer.add(sorted_digests + i * digest_size);
+   return ok && writer.commit();
+}
+
+// Digests are written in batches of about this many bytes
+static constexpr size_t write_batch = 1 << 20;
+
+DigestDbWriter::~DigestDbWriter() noexcept { abandon_(); }
+
+void DigestDbWriter::abandon_() noexcept
+{
+   if(fd_ >= 0) {
+      ::close(fd_);
+      unlink(tmp_path_.c_str());
+      fd_ = -1;
+   }
+   ok_ = false;
+}
+
+bool DigestDbWriter::open(const std::string& path,
+                          size_t digest_size,
+                          unsigned fanout_bits) noexcept
+{
+   abandon_();
+   if(digest_size < sizeof(uint64_t) || digest_size > 64) return false;
+   if(fanout_bits > max_fanout_bits) return false;
+
+   path_        = path;
+   tmp_path_    = path + ".tmp";
+   digest_size_ = digest_size;
+   fanout_bits_ = fanout_bits;
+   count_       = 0;
+   next_prefix_ = 0;
+   fanout_.assign(fanout_size(fanout_bits), 0);
+   buffer_.clear();
+
+   const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+   fd_             = ::open(tmp_path_.c_str(), flags, 0644);
+   if(fd_ < 0) return false;
+
+   // The header and fanout table are written by commit(), once known
+   const auto records_at = sizeof(DigestDbHeader)
+                           + fanout_.size() * sizeof(uint64_t);
+   ok_ = lseek(fd_, off_t(records_at), SEEK_SET) == off_t(records_at);
+   return ok_;
+}
+
+// Writes all but the last buffered digest, which add() compares against
+bool DigestDbWriter::flush_() noexcept
+{
+   if(buffer_.size() <= digest_size_) return true;
+   const auto n = buffer_.size() - digest_size_;
+   if(!write_all(fd_, buffer_.data(), n)) return false;
+   buffer_.erase(buffer_.begin(), buffer_.begin() + ptrdiff_t(n));
+   return true;
+}
+
+bool DigestDbWriter::add(const uint8_t* digest) noexcept
+{
+   if(!ok_) return false;
+   if(!buffer_.empty()
+      && memcmp(&buffer_[buffer_.size() - digest_size_], digest, digest_size_)
+             >= 0) {
+      abandon_();
+      return false;
+   }
+
+   // Every bucket up to this digest's starts here
+   if(!fanout_.empty()) {
+      const auto prefix = leading_bits(digest) >> (64 - fanout_bits_);
+      while(next_prefix_ + 1 < fanout_.size() && next_prefix_ <= prefix)
+         fanout_[next_prefix_++] = count_;
+   }
+
+   buffer_.insert(buffer_.end(), digest, digest + digest_size_);
+   ++count_;
+   if(buffer_.size() >= write_batch && !flush_()) {
+      abandon_();
+      return false;
+   }
+   return true;
+}
+
+bool DigestDbWriter::commit() noexcept
+{
+   if(!ok_) return false;
+   while(next_prefix_ < fanout_.size()) fanout_[next_prefix_++] = count_;
+
+   DigestDbHeader header;
+   memcpy(header.magic, k_magic, sizeof(k_magic));
+   header.digest_size = uint32_t(digest_size_);
+   header.fanout_bits = fanout_bits_;
+   header.count       = count_;
+   header.reserved    = 0;
+
+   bool ok = write_all(fd_, buffer_.data(), buffer_.size())
+             && lseek(fd_, 0, SEEK_SET) == 0
+             && write_all(fd_, &header, sizeof(header))
+             && write_all(
+                 fd_, fanout_.data(), fanout_.size() * sizeof(uint64_t))
+             && fsync(fd_) == 0;
+   ok  = (::close(fd_) == 0) && ok;
+   fd_ = -1;
+   ok  = ok && rename(tmp_path_.c_str(), path_.c_str()) == 0;
+
+   if(!ok) unlink(tmp_path_.c_str());
+   ok_ = false;
+   return ok;
+}
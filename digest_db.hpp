@@ -0,0 +1,211 @@
+
+#pragma once
+
+#include "digest_sort.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A read-only, memory-mapped set of fixed-width digests (MD5 or SHA-256),
+// for "is this file in the known-hash set?" queries in the style of NSRL.
+//
+// On-disk format (host byte order):
+//
+//    Header       32 bytes: magic "HFDIGDB1", digest_size, fanout_bits, count
+//    Fanout       (1 << fanout_bits) + 1 uint64s, absent if fanout_bits == 0.
+//                 fanout[p] is the index of the first record whose leading
+//                 `fanout_bits` bits are >= p.
+//    Records      `count` digests, sorted (memcmp order) and unique.
+//
+// Opening the database is an mmap() and a check of the header and fanout
+// table, no matter how large it is. Because digests are uniformly
+// distributed, lookups use interpolation search inside the fanout bucket,
+// which takes a couple of probes on average.
+//
+// usage: DigestDb db;
+//        if(!db.open("nsrl-sha256.db")) { ...error... }
+//        if(db.contains(digest)) { ...known file... }
+class DigestDb
+{
+ public:
+   DigestDb() noexcept = default;
+   DigestDb(const DigestDb&) = delete;
+   DigestDb(DigestDb&& o) noexcept;
+   ~DigestDb() noexcept;
+
+   DigestDb& operator=(const DigestDb&) = delete;
+   DigestDb& operator=(DigestDb&& o) noexcept;
+
+   // Returns false if the file cannot be mapped, or is not a digest database
+   bool open(const std::string& path) noexcept;
+   void close() noexcept;
+   bool is_open() const noexcept { return base_ != nullptr; }
+
+   size_t size() const noexcept { return count_; }
+   size_t digest_size() const noexcept { return digest_size_; }
+   unsigned fanout_bits() const noexcept { return fanout_bits_; }
+
+   // `digest` must be `digest_size()` bytes
+   bool contains(const uint8_t* digest) const noexcept;
+   bool contains(const Md5Digest& digest) const noexcept;
+   bool contains(const Sha256Digest& digest) const noexcept;
+
+   // Looks up `n` packed digests, writing one result per digest to `out`.
+   // The first probe of each lookup, estimated from the key and the fanout
+   // table alone, is prefetched a few lookups ahead, which hides most of the
+   // page-cache/DRAM latency of a large database.
+   void contains_batch(const uint8_t* digests, size_t n, bool* out) const
+       noexcept;
+
+   const uint8_t* record(size_t index) const noexcept
+   {
+      return records_ + index * digest_size_;
+   }
+
+ private:
+   void* base_{nullptr};
+   size_t length_{0};
+
+   const uint64_t* fanout_{nullptr};
+   const uint8_t* records_{nullptr};
+   size_t count_{0};
+   size_t digest_size_{0};
+   unsigned fanout_bits_{0};
+
+   void bucket_(const uint8_t* digest, size_t& lo, size_t& hi) const noexcept;
+   size_t estimate_(const uint8_t* digest, size_t lo, size_t hi) const
+       noexcept;
+   size_t guess_(const uint8_t* digest, size_t lo, size_t hi) const noexcept;
+   bool search_(const uint8_t* digest, size_t lo, size_t hi) const noexcept;
+};
+
+// Writes a database file from `count` packed digests that are already sorted
+// and unique. The file is written under a temporary name and renamed into
+// place, so readers never see a partial database.
+bool write_digest_db(const std::string& path,
+                     const uint8_t* sorted_digests,
+                     size_t count,
+                     size_t digest_size,
+                     unsigned fanout_bits = 16) noexcept;
+
+// Writes a database file from digests given one at a time, in sorted order
+// and unique, so that they never need to be in memory all at once. As with
+// write_digest_db(), nothing appears at `path` until commit() succeeds.
+//
+// usage: DigestDbWriter writer;
+//        if(!writer.open("known.db", sizeof(Sha256Digest))) { ...error... }
+//        for(...) writer.add(digest.data()); // in order
+//        if(!writer.commit()) { ...error... }
+class DigestDbWriter
+{
+ public:
+   DigestDbWriter() noexcept = default;
+   DigestDbWriter(const DigestDbWriter&) = delete;
+   DigestDbWriter& operator=(const DigestDbWriter&) = delete;
+   ~DigestDbWriter() noexcept; // removes an uncommitted file
+
+   bool open(const std::string& path,
+             size_t digest_size,
+             unsigned fanout_bits = 16) noexcept;
+
+   // False on I/O error, or if `digest` does not sort after the previous
+   // one. commit() then fails too.
+   bool add(const uint8_t* digest) noexcept;
+
+   bool commit() noexcept;
+
+   uint64_t size() const noexcept { return count_; }
+
+ private:
+   std::string path_;
+   std::string tmp_path_;
+   int fd_  = -1;
+   bool ok_ = false;
+   size_t digest_size_   = 0;
+   unsigned fanout_bits_ = 0;
+   uint64_t count_       = 0;
+   size_t next_prefix_   = 0; // the first fanout entry not yet known
+   std::vector<uint64_t> fanout_;
+   std::vector<uint8_t> buffer_; // digests not yet written; the last is kept
+
+   bool flush_() noexcept;
+   void abandon_() noexcept;
+};
+
+// Collects digests, then sorts, dedups, and writes them as a DigestDb file.
+//
+// By default the digests are held in memory: sizeof(Digest) bytes each, and
+// as much again while they are sorted. Given a temporary directory and a
+// memory budget, they go through an ExternalDigestSorter instead, which
+// spills sorted runs there and merges them straight into the file, so the
+// database can be larger than memory.
+//
+// usage: DigestDbBuilder<Sha256Digest> builder; // or ("/var/tmp", 1 << 30)
+//        builder.add(digest); ...
+//        builder.write("known.db");
+template<typename Digest> class DigestDbBuilder
+{
+ public:
+   DigestDbBuilder() = default;
+   DigestDbBuilder(std::string tmp_dir, size_t memory_budget)
+       : sorter_(std::make_unique<ExternalDigestSorter<Digest>>(
+           std::move(tmp_dir), memory_budget))
+   {}
+
+   void reserve(size_t n)
+   {
+      if(!sorter_) digests_.reserve(n);
+   }
+
+   // With a sorter, a run that cannot be spilled makes write() fail
+   void add(const Digest& digest)
+   {
+      if(!sorter_)
+         digests_.push_back(digest);
+      else
+         spilled_ = sorter_->add(digest) && spilled_;
+      ++n_added_;
+   }
+
+   // Digests added, or once written, the unique digests written
+   size_t size() const noexcept { return n_added_; }
+
+   // Sorts and dedups the collected digests, then writes the database
+   bool write(const std::string& path, unsigned fanout_bits = 16)
+   {
+      if(!sorter_) {
+         digests_.resize(radix_sort_unique(digests_.data(), digests_.size()));
+         n_added_ = digests_.size();
+         return write_digest_db(path,
+                                digests_.empty() ? nullptr : digests_[0].data(),
+                                digests_.size(),
+                                sizeof(Digest),
+                                fanout_bits);
+      }
+
+      DigestDbWriter writer;
+      bool ok = spilled_ && writer.open(path, sizeof(Digest), fanout_bits);
+      ok = sorter_->finish([&](const Digest& digest, uint64_t) {
+         ok = ok && writer.add(digest.data());
+      }) && ok;
+      ok = ok && writer.commit();
+      n_added_ = size_t(writer.size());
+      spilled_ = true;
+      return ok;
+   }
+
+ private:
+   static_assert(sizeof(Digest) == sizeof(typename Digest::value_type)
+                                       * std::tuple_size<Digest>::value,
+                 "Digest must be a packed byte array");
+   std::vector<Digest> digests_;
+   std::unique_ptr<ExternalDigestSorter<Digest>> sorter_;
+   bool spilled_   = true; // every add() reached the sorter
+   size_t n_added_ = 0;
+};
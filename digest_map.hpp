@@ -0,0 +1,428 @@
+
+#pragma once
+
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+
+// A concurrent open-addressing hash map keyed by Sha256 digests
+//
+// SHA-256 output is already uniformly distributed, so there is no re-hashing:
+// digest bytes [0, 8) select the probe group, and digest byte 8 becomes a
+// 7-bit fingerprint ("tag"). A group is 16 slots whose tags are packed into
+// two 64-bit words (16 bytes, four groups per cache line), so a probe tests
+// all 16 fingerprints of a group with a handful of word operations.
+//
+// insert() and find() take no lock, and find() never waits. An insert may
+// spin (yielding) while another thread finishes a slot in the same group,
+// and, during a migration, until inserts still in flight in the old table
+// are done. An insert claims the first empty slot of a group with a CAS on
+// the tag word, writes key and value, and then publishes the fingerprint
+// with release semantics. Readers only ever look at published slots, and
+// published slots are never modified again.
+//
+// Growth: each table has a load limit of 7/8. When it is reached, a table
+// of twice the size is chained after it, and all new inserts go there. The
+// old table becomes read-only, and every insert then first copies a few of
+// its groups into the newest table. Once all are copied, the old table is
+// drained: finds and inserts start past it, so a miss normally probes a
+// single table, and at most two or three while a migration is under way.
+// Drained tables stay allocated until the map is destroyed, as readers may
+// still be inside them (at most doubling memory); entries are never
+// erased, so no memory reclamation scheme is required.
+//
+// usage:  DigestMap<uint64_t> index;
+//         index.insert(digest, location); // first insert wins
+//         if(auto loc = index.find(digest)) { ... }
+//
+// `Value` must be default constructible and copyable.
+template<typename Value> class DigestMap
+{
+ public:
+   explicit DigestMap(size_t initial_capacity = 1024);
+   DigestMap(const DigestMap&) = delete;
+   DigestMap& operator=(const DigestMap&) = delete;
+   ~DigestMap() = default;
+
+   // Returns the value stored under `key`, and `true` if this call inserted
+   // it. If `key` was already present, the existing value is returned.
+   std::pair<Value, bool> insert(const Sha256Digest& key, const Value& value);
+
+   std::optional<Value> find(const Sha256Digest& key) const;
+   bool contains(const Sha256Digest& key) const { return bool(find(key)); }
+
+   size_t size() const noexcept;     // Number of published entries
+   size_t capacity() const noexcept; // Total slots over all tables
+
+   // Tables a miss probes: 1, plus any not yet drained
+   size_t n_live_tables() const noexcept;
+
+ private:
+   static constexpr size_t group_size = 16;
+
+   static constexpr uint8_t k_empty = 0x00;
+   static constexpr uint8_t k_busy  = 0x01; // claimed, not yet published
+
+   static constexpr size_t migrate_groups = 4; // per insert, while sealed
+
+   static constexpr uint64_t k_lsb = 0x0101010101010101ull;
+   static constexpr uint64_t k_low = 0x7f7f7f7f7f7f7f7full;
+
+   struct alignas(16) Group
+   {
+      std::atomic<uint64_t> tags[2];
+   };
+
+   struct Slot
+   {
+      Sha256Digest key;
+      Value value;
+   };
+
+   enum class Result { inserted, found, full, sealed };
+
+   struct Table
+   {
+      explicit Table(size_t n_groups);
+
+      size_t mask;  // n_groups - 1
+      size_t limit; // maximum number of entries
+      std::unique_ptr<Group[]> groups;
+      std::unique_ptr<Slot[]> slots;
+
+      std::atomic<size_t> reserved{0};  // slots reserved by inserters
+      std::atomic<size_t> published{0}; // slots visible to readers
+      std::atomic<size_t> inflight{0};  // inserters currently in this table
+      std::atomic<Table*> next{nullptr};
+      std::unique_ptr<Table> next_owner; // written once, by the grower
+
+      // Migration, once sealed: groups claimed, groups copied, and whether
+      // every entry is now in a later table
+      std::atomic<size_t> migrate_cursor{0};
+      std::atomic<size_t> migrated{0};
+      std::atomic<bool> drained{false};
+      std::atomic<size_t> copies{0}; // entries copied in from older tables
+
+      Result try_insert(const Sha256Digest& key,
+                        const Value& value,
+                        Value& out) noexcept;
+      const Slot* find(const Sha256Digest& key) const noexcept;
+      void quiesce() const noexcept;
+      Table* grow() noexcept;
+   };
+
+   std::unique_ptr<Table> head_;
+   mutable std::atomic<Table*> first_live_; // the first table not drained
+
+   Table* live_() const noexcept;
+   std::pair<Value, bool>
+   insert_(Table* t, const Sha256Digest& key, const Value& value, bool copy);
+   void migrate_step_();
+
+   // ---------------------------------------------------------------- helpers
+
+   static uint64_t home_bits(const Sha256Digest& key) noexcept
+   {
+      uint64_t h;
+      std::memcpy(&h, key.data(), sizeof(h));
+      return h;
+   }
+
+   static uint8_t tag_of(const Sha256Digest& key) noexcept
+   {
+      return uint8_t(0x80 | (key[8] & 0x7f));
+   }
+
+   // Sets the high bit of every byte in `w` that is zero. Exact: unlike the
+   // classic `(w - lsb) & ~w & msb` there are no false positives.
+   static uint64_t zero_bytes(uint64_t w) noexcept
+   {
+      return ~(((w & k_low) + k_low) | w | k_low);
+   }
+
+   static uint64_t match_bytes(uint64_t w, uint8_t tag) noexcept
+   {
+      return zero_bytes(w ^ (k_lsb * tag));
+   }
+
+   static unsigned first_byte(uint64_t bits) noexcept
+   {
+      return unsigned(__builtin_ctzll(bits)) / 8;
+   }
+
+   static uint64_t with_byte(uint64_t w, unsigned i, uint8_t b) noexcept
+   {
+      return (w & ~(uint64_t(0xff) << (8 * i))) | (uint64_t(b) << (8 * i));
+   }
+};
+
+// ----------------------------------------------------------------------- Table
+
+template<typename Value>
+DigestMap<Value>::Table::Table(size_t n_groups)
+    : mask(n_groups - 1)
+    , limit(n_groups * group_size / 8 * 7)
+    , groups(new Group[n_groups])
+    , slots(new Slot[n_groups * group_size])
+{
+   for(size_t i = 0; i < n_groups; ++i) {
+      groups[i].tags[0].store(0, std::memory_order_relaxed);
+      groups[i].tags[1].store(0, std::memory_order_relaxed);
+   }
+}
+
+template<typename Value>
+typename DigestMap<Value>::Result
+DigestMap<Value>::Table::try_insert(const Sha256Digest& key,
+                                    const Value& value,
+                                    Value& out) noexcept
+{
+   // Announce ourselves before checking `next`. The grower publishes `next`
+   // and then waits for `inflight` to drain, so with seq_cst ordering either
+   // we see the new table, or the grower waits for us.
+   inflight.fetch_add(1);
+   if(next.load() != nullptr) {
+      inflight.fetch_sub(1);
+      return Result::sealed;
+   }
+
+   if(reserved.fetch_add(1, std::memory_order_relaxed) >= limit) {
+      reserved.fetch_sub(1, std::memory_order_relaxed);
+      inflight.fetch_sub(1);
+      return Result::full;
+   }
+
+   const uint8_t tag = tag_of(key);
+   size_t g          = home_bits(key) & mask;
+
+   for(size_t step = 1;; g = (g + step++) & mask) {
+      auto& group = groups[g];
+      while(true) {
+         uint64_t w[2] = {group.tags[0].load(std::memory_order_acquire),
+                          group.tags[1].load(std::memory_order_acquire)};
+
+         // The same key may be mid-insert by another thread: wait it out
+         if(match_bytes(w[0], k_busy) != 0 || match_bytes(w[1], k_busy) != 0) {
+            std::this_thread::yield();
+            continue;
+         }
+
+         for(unsigned k = 0; k < 2; ++k) {
+            for(auto m = match_bytes(w[k], tag); m != 0; m &= m - 1) {
+               const auto& slot = slots[g * group_size + k * 8 + first_byte(m)];
+               if(slot.key == key) {
+                  out = slot.value;
+                  reserved.fetch_sub(1, std::memory_order_relaxed);
+                  inflight.fetch_sub(1);
+                  return Result::found;
+               }
+            }
+         }
+
+         // Always claim the *first* empty slot of the group, so that every
+         // inserter of the same key contends on the same tag word.
+         const unsigned k = zero_bytes(w[0]) != 0 ? 0 : 1;
+         const auto empties = zero_bytes(w[k]);
+         if(empties == 0) break; // group is full, next group
+
+         const auto i = first_byte(empties);
+         if(!group.tags[k].compare_exchange_strong(
+                w[k], with_byte(w[k], i, k_busy), std::memory_order_acquire))
+            continue; // lost a race, re-examine the group
+
+         auto& slot = slots[g * group_size + k * 8 + i];
+         slot.key   = key;
+         slot.value = value;
+
+         // Publish: swap BUSY for the tag. Other bytes of the word may change
+         // under us (concurrent claims), so loop on the CAS.
+         auto cur = group.tags[k].load(std::memory_order_relaxed);
+         while(!group.tags[k].compare_exchange_weak(
+             cur, with_byte(cur, i, tag), std::memory_order_release))
+            ;
+
+         published.fetch_add(1, std::memory_order_relaxed);
+         inflight.fetch_sub(1);
+         out = value;
+         return Result::inserted;
+      }
+   }
+}
+
+template<typename Value>
+const typename DigestMap<Value>::Slot*
+DigestMap<Value>::Table::find(const Sha256Digest& key) const noexcept
+{
+   const uint8_t tag = tag_of(key);
+   size_t g          = home_bits(key) & mask;
+
+   for(size_t step = 1; step <= mask + 1; g = (g + step++) & mask) {
+      const auto& group = groups[g];
+      bool has_empty    = false;
+      for(unsigned k = 0; k < 2; ++k) {
+         const auto w = group.tags[k].load(std::memory_order_acquire);
+         for(auto m = match_bytes(w, tag); m != 0; m &= m - 1) {
+            const auto& slot = slots[g * group_size + k * 8 + first_byte(m)];
+            if(slot.key == key) return &slot;
+         }
+         has_empty = has_empty || zero_bytes(w) != 0;
+      }
+      if(has_empty) return nullptr;
+   }
+   return nullptr;
+}
+
+template<typename Value> void DigestMap<Value>::Table::quiesce() const noexcept
+{
+   while(inflight.load() != 0) std::this_thread::yield();
+}
+
+template<typename Value>
+typename DigestMap<Value>::Table* DigestMap<Value>::Table::grow() noexcept
+{
+   if(Table* existing = next.load()) return existing;
+
+   Table* expected = nullptr;
+   auto bigger     = std::make_unique<Table>((mask + 1) * 2);
+   if(next.compare_exchange_strong(expected, bigger.get())) {
+      next_owner = std::move(bigger);
+      return next_owner.get();
+   }
+   return expected; // somebody else grew it first
+}
+
+//  --------------------------------------------------------------- Construction
+
+template<typename Value>
+DigestMap<Value>::DigestMap(size_t initial_capacity)
+{
+   size_t n_groups = 1;
+   while(n_groups * group_size / 8 * 7 < initial_capacity) n_groups *= 2;
+   head_ = std::make_unique<Table>(n_groups);
+   first_live_.store(head_.get());
+}
+
+// ---------------------------------------------------------------------- insert
+
+template<typename Value>
+typename DigestMap<Value>::Table* DigestMap<Value>::live_() const noexcept
+{
+   // Only the oldest live table is ever migrated, so tables drain in order
+   for(Table* t = first_live_.load();;) {
+      if(!t->drained.load(std::memory_order_acquire)) return t;
+      Table* next = t->next.load();
+      if(first_live_.compare_exchange_weak(t, next)) t = next;
+   }
+}
+
+template<typename Value>
+std::pair<Value, bool> DigestMap<Value>::insert(const Sha256Digest& key,
+                                                const Value& value)
+{
+   migrate_step_();
+   return insert_(live_(), key, value, false);
+}
+
+// Copies the next few groups of the oldest sealed table into the newest.
+// Copies go through insert_(), so a table that fills up meanwhile grows as
+// usual, and a key is never in two live tables with different values: an
+// insert of a key that is still in a sealed table finds it there first.
+template<typename Value> void DigestMap<Value>::migrate_step_()
+{
+   Table* t = live_();
+   if(t->next.load() == nullptr) return; // nothing sealed
+
+   const size_t n_groups = t->mask + 1;
+   const size_t first    = t->migrate_cursor.fetch_add(migrate_groups);
+   if(first >= n_groups) return; // the rest are being copied
+   const size_t last = std::min(n_groups, first + migrate_groups);
+
+   t->quiesce(); // every entry is published
+   for(size_t g = first; g < last; ++g) {
+      for(unsigned k = 0; k < 2; ++k) {
+         const auto w = t->groups[g].tags[k].load(std::memory_order_acquire);
+         for(unsigned i = 0; i < 8; ++i) {
+            if(uint8_t(w >> (8 * i)) == k_empty) continue;
+            const auto& slot = t->slots[g * group_size + k * 8 + i];
+            insert_(t->next.load(), slot.key, slot.value, true);
+         }
+      }
+   }
+
+   const size_t n = last - first;
+   if(t->migrated.fetch_add(n, std::memory_order_acq_rel) + n == n_groups)
+      t->drained.store(true, std::memory_order_release);
+}
+
+template<typename Value>
+std::pair<Value, bool> DigestMap<Value>::insert_(Table* t,
+                                                 const Sha256Digest& key,
+                                                 const Value& value,
+                                                 bool copy)
+{
+   while(true) {
+      if(Table* next = t->next.load()) {
+         // Read-only table, but inserts that entered before it was sealed
+         // may still be running. Wait for them, then check for `key`.
+         t->quiesce();
+         if(const auto* slot = t->find(key)) return {slot->value, false};
+         t = next;
+         continue;
+      }
+
+      Value out;
+      switch(t->try_insert(key, value, out)) {
+      case Result::inserted:
+         if(copy) t->copies.fetch_add(1, std::memory_order_relaxed);
+         return {out, true};
+      case Result::found: return {out, false};
+      case Result::full: t->grow(); break;
+      case Result::sealed: break;
+      }
+   }
+}
+
+// ------------------------------------------------------------------------ find
+
+template<typename Value>
+std::optional<Value> DigestMap<Value>::find(const Sha256Digest& key) const
+{
+   for(const Table* t = live_(); t != nullptr; t = t->next.load())
+      if(const auto* slot = t->find(key)) return slot->value;
+   return std::nullopt;
+}
+
+// -----------------------------------------------------------------------------
+
+template<typename Value> size_t DigestMap<Value>::size() const noexcept
+{
+   // Copies are counted in the table they were copied from
+   size_t n = 0;
+   for(const Table* t = head_.get(); t != nullptr; t = t->next.load())
+      n += t->published.load(std::memory_order_relaxed)
+           - t->copies.load(std::memory_order_relaxed);
+   return n;
+}
+
+template<typename Value> size_t DigestMap<Value>::capacity() const noexcept
+{
+   size_t n = 0;
+   for(const Table* t = head_.get(); t != nullptr; t = t->next.load())
+      n += (t->mask + 1) * group_size;
+   return n;
+}
+
+template<typename Value>
+size_t DigestMap<Value>::n_live_tables() const noexcept
+{
+   size_t n = 0;
+   for(const Table* t = live_(); t != nullptr; t = t->next.load()) ++n;
+   return n;
+}
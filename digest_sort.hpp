@@ -0,0 +1,463 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// Radix sorting and dedup for large arrays of binary digests.
+//
+// The functions below sort arrays of `Md5Digest`/`Sha256Digest` (or any
+// std::array<uint8_t, N>), or arrays of `DigestRecord<Digest, Payload>` where
+// the payload travels with its digest. Order is memcmp order of the digest.
+//
+// The sort is a parallel MSD radix sort. A first pass over all threads
+// histograms and scatters on the leading byte. The 256 buckets are then
+// sorted independently, with a work queue that hands buckets to threads.
+// Each bucket is radix sorted on the following bytes until it is small
+// enough for a comparison sort. Digests are uniformly distributed, so
+// buckets are well balanced and only the first two or three bytes are ever
+// examined.
+//
+// usage: std::vector<Sha256Digest> digests = ...;
+//        radix_sort(digests.data(), digests.size());
+//
+//        std::vector<uint32_t> counts(digests.size());
+//        auto n = radix_sort_unique(digests.data(), counts.size(), &counts[0]);
+//        digests.resize(n); // digests[i] occurred counts[i] times
+
+template<typename Digest, typename Payload> struct DigestRecord
+{
+   Digest digest;
+   Payload payload;
+};
+
+template<size_t N>
+inline const std::array<uint8_t, N>&
+digest_of(const std::array<uint8_t, N>& digest) noexcept
+{
+   return digest;
+}
+
+template<typename Digest, typename Payload>
+inline const Digest& digest_of(const DigestRecord<Digest, Payload>& r) noexcept
+{
+   return r.digest;
+}
+
+// Sorts `n` records. `n_threads` of 0 means std::thread::hardware_concurrency
+template<typename T> void radix_sort(T* data, size_t n, unsigned n_threads = 0);
+
+// Sorts and dedups `n` records, keeping the first record of every run of
+// equal digests. Returns the number of unique records, which are compacted
+// to the front of `data`. If `counts` is not null, then `counts[i]` is set to
+// the number of times `data[i]` occurred. Dedup happens per bucket, in the
+// same parallel pass as the sort.
+template<typename T>
+size_t radix_sort_unique(T* data,
+                         size_t n,
+                         uint32_t* counts   = nullptr,
+                         unsigned n_threads = 0);
+
+// Sorts and dedups more digests than fit in memory.
+//
+// Records are accumulated into a buffer of `memory_budget` bytes. Each time
+// it fills, it is sorted and deduped with radix_sort_unique(), and spilled as
+// a sorted run to an (already unlinked) temporary file in `tmp_dir`. finish()
+// k-way merges the runs, merging duplicates across runs, and emits every
+// unique record in order, with its total count.
+//
+// usage: ExternalDigestSorter<Sha256Digest> sorter("/var/tmp", 1 << 30);
+//        for(...) sorter.add(digest);
+//        sorter.finish([&](const Sha256Digest& d, uint64_t count) { ... });
+template<typename T> class ExternalDigestSorter
+{
+ public:
+   using Emit = std::function<void(const T& record, uint64_t count)>;
+
+   ExternalDigestSorter(std::string tmp_dir,
+                        size_t memory_budget,
+                        unsigned n_threads = 0);
+   ExternalDigestSorter(const ExternalDigestSorter&) = delete;
+   ExternalDigestSorter& operator=(const ExternalDigestSorter&) = delete;
+   ~ExternalDigestSorter();
+
+   // Returns false if a run could not be spilled to disk
+   bool add(const T& record);
+
+   // Emits all unique records in sorted order. Returns false on I/O error.
+   // The sorter is empty afterwards, and can be reused.
+   bool finish(const Emit& emit);
+
+   size_t n_runs() const noexcept { return runs_.size(); }
+
+ private:
+   struct Entry
+   {
+      T record;
+      uint64_t count;
+   };
+
+   std::string tmp_dir_;
+   size_t capacity_;
+   unsigned n_threads_;
+   std::vector<T> buffer_;
+   std::vector<std::FILE*> runs_;
+
+   bool spill_();
+   void close_runs_();
+};
+
+// --------------------------------------------------------------------- detail
+
+namespace detail
+{
+static constexpr size_t radix_small_bucket = 64;
+
+template<typename T> inline const uint8_t* key_bytes(const T& x) noexcept
+{
+   return digest_of(x).data();
+}
+
+template<typename T> inline size_t key_size() noexcept
+{
+   return std::tuple_size<
+       std::decay_t<decltype(digest_of(std::declval<T>()))>>::value;
+}
+
+template<typename T> inline bool key_less(const T& a, const T& b) noexcept
+{
+   return memcmp(key_bytes(a), key_bytes(b), key_size<T>()) < 0;
+}
+
+template<typename T> inline bool key_equal(const T& a, const T& b) noexcept
+{
+   return memcmp(key_bytes(a), key_bytes(b), key_size<T>()) == 0;
+}
+
+inline unsigned thread_count(unsigned n_threads, size_t n) noexcept
+{
+   if(n_threads == 0)
+      n_threads = std::max(1u, std::thread::hardware_concurrency());
+   // Not worth a thread for less than ~64k records
+   const size_t useful = std::max<size_t>(1, n / 65536);
+   return unsigned(std::min<size_t>(n_threads, useful));
+}
+
+template<typename F> void run_threads(unsigned n_threads, F f)
+{
+   if(n_threads == 1) {
+      f(0u);
+      return;
+   }
+   std::vector<std::thread> threads;
+   threads.reserve(n_threads);
+   for(unsigned t = 0; t < n_threads; ++t) threads.emplace_back(f, t);
+   for(auto& thread : threads) thread.join();
+}
+
+// Sorts `data` in place on key bytes [byte, key_size), using `scratch` (of the
+// same length) as the scatter destination.
+template<typename T>
+void msd_sort(T* data, T* scratch, size_t n, size_t byte) noexcept
+{
+   if(n < radix_small_bucket || byte >= key_size<T>()) {
+      std::sort(data, data + n, key_less<T>);
+      return;
+   }
+
+   size_t offsets[257] = {0};
+   for(size_t i = 0; i < n; ++i) ++offsets[key_bytes(data[i])[byte] + 1];
+   for(size_t b = 1; b <= 256; ++b) offsets[b] += offsets[b - 1];
+
+   size_t pos[256];
+   std::copy(offsets, offsets + 256, pos);
+   for(size_t i = 0; i < n; ++i)
+      scratch[pos[key_bytes(data[i])[byte]]++] = data[i];
+   std::copy(scratch, scratch + n, data);
+
+   for(size_t b = 0; b < 256; ++b)
+      if(offsets[b + 1] - offsets[b] > 1)
+         msd_sort(data + offsets[b],
+                  scratch + offsets[b],
+                  offsets[b + 1] - offsets[b],
+                  byte + 1);
+}
+
+// Dedups a sorted range in place, returns the new length
+template<typename T>
+size_t unique_sorted(T* data, size_t n, uint32_t* counts) noexcept
+{
+   if(n == 0) return 0;
+   size_t out = 0;
+   if(counts) counts[0] = 1;
+   for(size_t i = 1; i < n; ++i) {
+      if(key_equal(data[out], data[i])) {
+         if(counts) ++counts[out];
+      } else {
+         data[++out] = data[i];
+         if(counts) counts[out] = 1;
+      }
+   }
+   return out + 1;
+}
+
+// The parallel top level: scatter on byte 0, then sort each bucket with
+// `sort_bucket(bucket, scratch, length, offset)`, which returns the number
+// of records it kept at the front of the bucket. Buckets are compacted at
+// the end, and the total is returned.
+template<typename T, typename SortBucket>
+size_t
+parallel_msd(T* data, size_t n, unsigned n_threads, SortBucket sort_bucket)
+{
+   static_assert(std::is_trivially_copyable<T>::value,
+                 "digest records must be trivially copyable");
+
+   n_threads = thread_count(n_threads, n);
+   if(n < radix_small_bucket) return sort_bucket(data, data, n, size_t(0));
+
+   std::vector<T> scratch(n);
+   std::vector<std::array<size_t, 256>> hist(n_threads);
+   auto part = [&](unsigned t) {
+      return std::make_pair(n * t / n_threads, n * (t + 1) / n_threads);
+   };
+
+   // Per-thread histograms of the leading byte
+   run_threads(n_threads, [&](unsigned t) {
+      auto& h = hist[t];
+      h.fill(0);
+      const auto [lo, hi] = part(t);
+      for(size_t i = lo; i < hi; ++i) ++h[key_bytes(data[i])[0]];
+   });
+
+   // Bucket b starts at `starts[b]`, and thread t writes its share of bucket b
+   // after the shares of threads 0..t-1
+   std::array<size_t, 257> starts;
+   starts[0] = 0;
+   for(size_t b = 0; b < 256; ++b) {
+      size_t total = 0;
+      for(unsigned t = 0; t < n_threads; ++t) {
+         const auto count = hist[t][b];
+         hist[t][b]       = starts[b] + total;
+         total += count;
+      }
+      starts[b + 1] = starts[b] + total;
+   }
+
+   run_threads(n_threads, [&](unsigned t) {
+      auto& pos           = hist[t];
+      const auto [lo, hi] = part(t);
+      for(size_t i = lo; i < hi; ++i)
+         scratch[pos[key_bytes(data[i])[0]]++] = data[i];
+   });
+
+   // Sort every bucket in `scratch`, using `data` as scratch, then copy back
+   std::array<size_t, 256> kept;
+   std::atomic<size_t> next_bucket{0};
+   run_threads(n_threads, [&](unsigned) {
+      for(size_t b; (b = next_bucket.fetch_add(1)) < 256;) {
+         const auto lo = starts[b], len = starts[b + 1] - starts[b];
+         kept[b] = sort_bucket(scratch.data() + lo, data + lo, len, lo);
+         const auto sorted = scratch.data() + lo;
+         std::copy(sorted, sorted + kept[b], data + lo);
+      }
+   });
+
+   size_t out = kept[0];
+   for(size_t b = 1; b < 256; ++b) {
+      if(out != starts[b])
+         std::copy(data + starts[b], data + starts[b] + kept[b], data + out);
+      out += kept[b];
+   }
+   return out;
+}
+} // namespace detail
+
+// ------------------------------------------------------------------ radix sort
+
+template<typename T> void radix_sort(T* data, size_t n, unsigned n_threads)
+{
+   auto sort_bucket = [](T* bucket, T* scratch, size_t len, size_t) {
+      detail::msd_sort(bucket, scratch, len, 1);
+      return len;
+   };
+   detail::parallel_msd(data, n, n_threads, sort_bucket);
+}
+
+template<typename T>
+size_t
+radix_sort_unique(T* data, size_t n, uint32_t* counts, unsigned n_threads)
+{
+   // Counts are written at each bucket's original offset, and compacted
+   // alongside the records at the end.
+   std::vector<size_t> bucket_at, bucket_kept;
+   std::mutex lock;
+   auto sort_bucket = [&](T* bucket, T* scratch, size_t len, size_t offset) {
+      detail::msd_sort(bucket, scratch, len, 1);
+      const auto kept = detail::unique_sorted(
+          bucket, len, counts == nullptr ? nullptr : counts + offset);
+      if(counts != nullptr) {
+         std::lock_guard<std::mutex> guard(lock);
+         bucket_at.push_back(offset);
+         bucket_kept.push_back(kept);
+      }
+      return kept;
+   };
+   const auto n_out = detail::parallel_msd(data, n, n_threads, sort_bucket);
+
+   if(counts != nullptr) {
+      // Buckets are compacted in order of their offsets
+      std::vector<size_t> order(bucket_at.size());
+      for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+      std::sort(begin(order), end(order), [&](size_t a, size_t b) {
+         return bucket_at[a] < bucket_at[b];
+      });
+      size_t out = 0;
+      for(auto i : order) {
+         const auto src = counts + bucket_at[i];
+         std::copy(src, src + bucket_kept[i], counts + out);
+         out += bucket_kept[i];
+      }
+   }
+   return n_out;
+}
+
+// ---------------------------------------------------------- external sorting
+
+template<typename T>
+ExternalDigestSorter<T>::ExternalDigestSorter(std::string tmp_dir,
+                                              size_t memory_budget,
+                                              unsigned n_threads)
+    : tmp_dir_(std::move(tmp_dir))
+    , capacity_(std::max<size_t>(1, memory_budget / sizeof(T)))
+    , n_threads_(n_threads)
+{}
+
+template<typename T> ExternalDigestSorter<T>::~ExternalDigestSorter()
+{
+   close_runs_();
+}
+
+template<typename T> void ExternalDigestSorter<T>::close_runs_()
+{
+   for(auto fp : runs_) std::fclose(fp);
+   runs_.clear();
+}
+
+template<typename T> bool ExternalDigestSorter<T>::add(const T& record)
+{
+   if(buffer_.empty()) buffer_.reserve(capacity_);
+   buffer_.push_back(record);
+   return buffer_.size() < capacity_ || spill_();
+}
+
+// Writes the buffer as a sorted run of `Entry` records
+template<typename T> bool ExternalDigestSorter<T>::spill_()
+{
+   std::vector<uint32_t> counts(buffer_.size());
+   const auto n = radix_sort_unique(
+       buffer_.data(), buffer_.size(), counts.data(), n_threads_);
+
+   std::string path = tmp_dir_ + "/digest-run-XXXXXX";
+   const int fd     = mkstemp(&path[0]);
+   if(fd < 0) return false;
+   unlink(path.c_str()); // the run disappears when closed
+   std::FILE* fp = fdopen(fd, "w+b");
+   if(fp == nullptr) {
+      close(fd);
+      return false;
+   }
+   runs_.push_back(fp);
+
+   bool ok = true;
+   for(size_t i = 0; i < n && ok; ++i) {
+      const Entry entry{buffer_[i], counts[i]};
+      ok = std::fwrite(&entry, sizeof(entry), 1, fp) == 1;
+   }
+   ok = ok && std::fflush(fp) == 0;
+   buffer_.clear();
+   return ok;
+}
+
+template<typename T> bool ExternalDigestSorter<T>::finish(const Emit& emit)
+{
+   // Everything fit in memory, no merge required
+   if(runs_.empty()) {
+      std::vector<uint32_t> counts(buffer_.size());
+      const auto n = radix_sort_unique(
+          buffer_.data(), buffer_.size(), counts.data(), n_threads_);
+      for(size_t i = 0; i < n; ++i) emit(buffer_[i], counts[i]);
+      buffer_.clear();
+      return true;
+   }
+
+   if(!buffer_.empty() && !spill_()) {
+      close_runs_();
+      return false;
+   }
+   buffer_.shrink_to_fit();
+
+   // k-way merge. The heap holds the head entry of every run.
+   struct Head
+   {
+      Entry entry;
+      size_t run;
+   };
+   auto greater = [](const Head& a, const Head& b) {
+      return detail::key_less(b.entry.record, a.entry.record);
+   };
+   std::priority_queue<Head, std::vector<Head>, decltype(greater)> heap(
+       greater);
+
+   bool ok = true;
+   auto pull = [&](size_t run) {
+      Head head;
+      head.run = run;
+      if(std::fread(&head.entry, sizeof(Entry), 1, runs_[run]) == 1)
+         heap.push(head);
+      else if(std::ferror(runs_[run]))
+         ok = false;
+   };
+
+   for(size_t run = 0; run < runs_.size(); ++run) {
+      std::rewind(runs_[run]);
+      pull(run);
+   }
+
+   while(!heap.empty() && ok) {
+      const auto first = heap.top();
+      heap.pop();
+      pull(first.run);
+
+      Entry current = first.entry;
+      while(!heap.empty()
+            && detail::key_equal(heap.top().entry.record, current.record)) {
+         const auto head = heap.top();
+         heap.pop();
+         current.count += head.entry.count;
+         pull(head.run);
+      }
+      emit(current.record, current.count);
+   }
+
+   close_runs_();
+   return ok;
+}
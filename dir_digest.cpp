@@ -0,0 +1,385 @@
+
+#include "dir_digest.hpp"
+#include "file_hash.hpp"
+#include "io_util.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char k_magic[8] = {'H', 'F', 'T', 'R', 'E', 'E', '0', '2'};
+
+struct ManifestHeader
+{
+   char magic[8];
+   uint32_t record_size;
+   uint32_t reserved;
+   uint64_t count;
+   uint64_t strings_size; // bytes of paths and link targets, after records
+   uint64_t n_errors;
+   Sha256Digest root;
+};
+
+struct ManifestRecord
+{
+   Sha256Digest digest;
+   uint64_t size;
+   int64_t mtime_ns;
+   int64_t ctime_ns;
+   uint64_t ino;
+   uint64_t strings_offset; // the path, then the link target
+   uint32_t path_length;
+   uint32_t target_length;
+   uint32_t mode;
+   int32_t error;
+};
+
+// -------------------------------------------------------------------- encoding
+
+static void put_u32(std::string& out, uint32_t x) noexcept
+{
+   for(int shift = 24; shift >= 0; shift -= 8) out += char(x >> shift);
+}
+
+static void put_u64(std::string& out, uint64_t x) noexcept
+{
+   put_u32(out, uint32_t(x >> 32));
+   put_u32(out, uint32_t(x));
+}
+
+void encode_dir_record(std::string& out,
+                       const std::string& name,
+                       const DirDigestEntry& entry,
+                       bool modes) noexcept
+{
+   out += char(entry.type);
+   put_u32(out, modes ? entry.mode & 07777 : 0);
+   put_u32(out, uint32_t(name.size()));
+   out += name;
+   switch(entry.type) {
+   case DirEntryType::file:
+      put_u64(out, entry.size);
+      out.append(reinterpret_cast<const char*>(entry.digest.data()), 32);
+      break;
+   case DirEntryType::directory:
+      out.append(reinterpret_cast<const char*>(entry.digest.data()), 32);
+      break;
+   case DirEntryType::symlink:
+      put_u32(out, uint32_t(entry.target.size()));
+      out += entry.target;
+      break;
+   case DirEntryType::other: put_u32(out, entry.mode & S_IFMT); break;
+   }
+}
+
+std::string DirDigest::root_hex() const noexcept { return to_hex(root); }
+
+// ------------------------------------------------------------------ dir_digest
+
+static DirEntryType type_of(mode_t mode) noexcept
+{
+   return S_ISREG(mode)   ? DirEntryType::file
+          : S_ISDIR(mode) ? DirEntryType::directory
+          : S_ISLNK(mode) ? DirEntryType::symlink
+                          : DirEntryType::other;
+}
+
+void set_dir_entry_stat(DirDigestEntry& entry, const struct stat& st) noexcept
+{
+   entry.type     = type_of(st.st_mode);
+   entry.mode     = uint32_t(st.st_mode);
+   entry.size     = S_ISREG(st.st_mode) ? uint64_t(st.st_size) : 0;
+   entry.mtime_ns = to_ns(st.st_mtim);
+   entry.ctime_ns = to_ns(st.st_ctim);
+   entry.ino      = uint64_t(st.st_ino);
+}
+
+namespace
+{
+struct Node
+{
+   std::string name;
+   DirDigestEntry entry;
+   std::vector<std::unique_ptr<Node>> children;
+};
+
+class Walk
+{
+ public:
+   Walk(ThreadPool& pool, const DirDigestOptions& options) noexcept
+       : pool_(pool)
+       , options_(options)
+   {
+      if(!options.mmap) file_options_.mmap_threshold = SIZE_MAX;
+      if(options.previous != nullptr)
+         for(const auto& e : options.previous->entries)
+            if(e.type == DirEntryType::file && e.error == 0)
+               previous_.emplace(e.path, &e);
+   }
+
+   // `node` has been stat'd; fills in what its type needs. `rel` is its
+   // path relative to the root.
+   void visit(Node* node, std::string path, std::string rel) noexcept
+   {
+      switch(node->entry.type) {
+      case DirEntryType::file:
+         if(reuse_(node, rel)) break;
+         pool_.submit([this, node, path = std::move(path)] {
+            hash_(node, path);
+         });
+         break;
+      case DirEntryType::directory:
+         pool_.submit([this, node, path = std::move(path), rel = rel] {
+            list_(node, path, rel);
+         });
+         break;
+      case DirEntryType::symlink: read_link_(node, path); break;
+      case DirEntryType::other: break;
+      }
+   }
+
+ private:
+   ThreadPool& pool_;
+   const DirDigestOptions& options_;
+   FileHashOptions file_options_;
+   std::unordered_map<std::string, const DirDigestEntry*> previous_;
+
+   bool reuse_(Node* node, const std::string& rel) const noexcept
+   {
+      const auto ii = previous_.find(rel);
+      if(ii == previous_.end()) return false;
+      const auto& old = *ii->second;
+      if(old.size != node->entry.size || old.mtime_ns != node->entry.mtime_ns
+         || old.ctime_ns != node->entry.ctime_ns
+         || old.ino != node->entry.ino)
+         return false;
+      node->entry.digest = ii->second->digest;
+      return true;
+   }
+
+   void hash_(Node* node, const std::string& path) const noexcept
+   {
+      Sha256 sha;
+      errno = 0;
+      if(!hash_file(path, sha, file_options_)) {
+         node->entry.error = errno != 0 ? errno : EIO;
+         return;
+      }
+      sha.finish().get_digest(node->entry.digest.data());
+   }
+
+   static void read_link_(Node* node, const std::string& path) noexcept
+   {
+      std::string target(256, '\0');
+      for(;;) {
+         const ssize_t n = readlink(path.c_str(), &target[0], target.size());
+         if(n < 0) {
+            node->entry.error = errno;
+            return;
+         }
+         if(size_t(n) < target.size()) {
+            target.resize(size_t(n));
+            break;
+         }
+         target.resize(target.size() * 2);
+      }
+      node->entry.target = std::move(target);
+   }
+
+   void list_(Node* node,
+              const std::string& path,
+              const std::string& rel) noexcept
+   {
+      if(options_.on_directory) options_.on_directory(path);
+      DIR* dir = opendir(path.c_str());
+      if(dir == nullptr) {
+         node->entry.error = errno;
+         return;
+      }
+
+      // Children are stat'd relative to the open directory
+      const int dir_fd = dirfd(dir);
+      while(const dirent* e = readdir(dir)) {
+         if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+         node->children.push_back(std::make_unique<Node>());
+         Node* child = node->children.back().get();
+         child->name = e->d_name;
+
+         struct stat st;
+         if(fstatat(dir_fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            child->entry.error = errno;
+            continue;
+         }
+         set_dir_entry_stat(child->entry, st);
+         visit(child,
+               path + '/' + child->name,
+               rel.empty() ? child->name : rel + '/' + child->name);
+      }
+      closedir(dir);
+   }
+};
+
+// Sorts children, computes directory digests bottom up, and flattens the
+// tree into `out`
+void finish(Node& node,
+            const std::string& path,
+            bool modes,
+            DirDigest& out) noexcept
+{
+   const size_t index = out.entries.size();
+   node.entry.path    = path;
+   out.entries.push_back(node.entry);
+   if(node.entry.error != 0) ++out.n_errors;
+   if(node.entry.type != DirEntryType::directory) return;
+
+   std::sort(node.children.begin(),
+             node.children.end(),
+             [](const auto& a, const auto& b) { return a->name < b->name; });
+
+   Sha256 sha;
+   std::string record;
+   for(auto& child : node.children) {
+      const auto child_path
+          = path.empty() ? child->name : path + '/' + child->name;
+      finish(*child, child_path, modes, out);
+      record.clear();
+      encode_dir_record(record, child->name, child->entry, modes);
+      sha.append(record.data(), record.size());
+   }
+   sha.finish().get_digest(node.entry.digest.data());
+   out.entries[index].digest = node.entry.digest;
+}
+} // namespace
+
+DirDigest dir_digest(const std::string& root,
+                     const DirDigestOptions& options) noexcept
+{
+   Node top;
+   struct stat st;
+   if(stat(root.c_str(), &st) != 0)
+      top.entry.error = errno;
+   else
+      set_dir_entry_stat(top.entry, st);
+
+   if(top.entry.error == 0) {
+      std::unique_ptr<ThreadPool> own;
+      ThreadPool* pool = options.pool;
+      if(pool == nullptr) {
+         own  = std::make_unique<ThreadPool>(options.n_threads);
+         pool = own.get();
+      }
+      Walk walk(*pool, options);
+      walk.visit(&top, root, "");
+      pool->wait();
+   }
+
+   DirDigest tree;
+   finish(top, "", options.modes, tree);
+   tree.root = top.entry.digest;
+   return tree;
+}
+
+// -------------------------------------------------------------------- manifest
+
+bool write_dir_manifest(const std::string& path,
+                        const DirDigest& tree) noexcept
+{
+   std::vector<ManifestRecord> records(tree.entries.size());
+   std::string strings;
+   for(size_t i = 0; i < records.size(); ++i) {
+      const auto& e = tree.entries[i];
+      auto& r       = records[i];
+      memset(&r, 0, sizeof(r));
+      r.digest         = e.digest;
+      r.size           = e.size;
+      r.mtime_ns       = e.mtime_ns;
+      r.ctime_ns       = e.ctime_ns;
+      r.ino            = e.ino;
+      r.strings_offset = strings.size();
+      r.path_length    = uint32_t(e.path.size());
+      r.target_length  = uint32_t(e.target.size());
+      r.mode           = e.mode;
+      r.error          = e.error;
+      strings += e.path;
+      strings += e.target;
+   }
+
+   ManifestHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, k_magic, sizeof(k_magic));
+   header.record_size  = sizeof(ManifestRecord);
+   header.count        = records.size();
+   header.strings_size = strings.size();
+   header.n_errors     = tree.n_errors;
+   header.root         = tree.root;
+
+   const auto tmp_path = path + ".tmp";
+   std::FILE* fp       = std::fopen(tmp_path.c_str(), "wb");
+   if(fp == nullptr) return false;
+   const size_t n = records.size();
+   bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1
+             && std::fwrite(records.data(), sizeof(ManifestRecord), n, fp) == n
+             && std::fwrite(strings.data(), 1, strings.size(), fp)
+                    == strings.size();
+   ok = (std::fclose(fp) == 0) && ok;
+   ok = ok && std::rename(tmp_path.c_str(), path.c_str()) == 0;
+   if(!ok) std::remove(tmp_path.c_str());
+   return ok;
+}
+
+std::optional<DirDigest> read_dir_manifest(const std::string& path) noexcept
+{
+   std::FILE* fp = std::fopen(path.c_str(), "rb");
+   if(fp == nullptr) return std::nullopt;
+
+   ManifestHeader header;
+   std::vector<ManifestRecord> records;
+   std::string strings;
+   bool ok = std::fread(&header, sizeof(header), 1, fp) == 1
+             && memcmp(header.magic, k_magic, sizeof(k_magic)) == 0
+             && header.record_size == sizeof(ManifestRecord)
+             && header.count < (1u << 30) && header.strings_size < (1ull << 36);
+   if(ok) {
+      records.resize(header.count);
+      strings.resize(header.strings_size);
+      const size_t n = records.size();
+      ok = std::fread(records.data(), sizeof(ManifestRecord), n, fp) == n
+           && std::fread(&strings[0], 1, strings.size(), fp) == strings.size();
+   }
+   std::fclose(fp);
+   if(!ok) return std::nullopt;
+
+   DirDigest tree;
+   tree.root     = header.root;
+   tree.n_errors = header.n_errors;
+   tree.entries.resize(records.size());
+   for(size_t i = 0; i < records.size(); ++i) {
+      const auto& r = records[i];
+      auto& e       = tree.entries[i];
+      if(r.strings_offset + r.path_length + r.target_length > strings.size())
+         return std::nullopt;
+      e.path     = strings.substr(r.strings_offset, r.path_length);
+      e.target   = strings.substr(r.strings_offset + r.path_length,
+                                r.target_length);
+      e.type     = type_of(mode_t(r.mode));
+      e.mode     = r.mode;
+      e.size     = r.size;
+      e.mtime_ns = r.mtime_ns;
+      e.ctime_ns = r.ctime_ns;
+      e.ino      = r.ino;
+      e.digest   = r.digest;
+      e.error    = r.error;
+   }
+   return tree;
+}
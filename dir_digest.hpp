@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A single Sha256 digest for a whole directory tree
+//
+// Directories are listed, and files hashed, in parallel on a ThreadPool.
+// The digest depends only on the tree's contents, never on thread count or
+// traversal order:
+//
+//    digest(dir)  = Sha256(record(child) for each child, sorted by name)
+//    record(e)    = type  u8    'f', 'd', 'l' or 'o' (anything else)
+//                   perms u32   mode & 07777, or 0 without `modes`
+//                   name  u32 length, bytes
+//                   then for 'f': u64 size, Sha256 of the content
+//                            'd': digest(e)
+//                            'l': u32 length, bytes of the link target
+//                            'o': u32 mode & S_IFMT
+//
+// with integers big-endian. The root digest is digest(root); the root
+// directory's own name and mode are not part of it. Symbolic links are
+// recorded, never followed. Timestamps, owners and sizes of directories are
+// not part of the digest either, but timestamps and inode numbers are kept
+// in the entries so that a later scan can skip unchanged files.
+//
+// usage: auto tree = dir_digest("/srv/app");
+//        if(tree.n_errors == 0) std::cout << tree.root_hex();
+//        write_dir_manifest("/srv/app.manifest", tree);
+class ThreadPool;
+struct DirDigest;
+
+struct DirDigestOptions
+{
+   unsigned n_threads = 0;    // 0 means one per hardware thread
+   bool modes         = true; // include permission bits in the digest
+
+   // An earlier scan of the same root: files whose size, mtime, inode and
+   // ctime are unchanged take their digest from it instead of being read.
+   // The inode and ctime catch a file renamed over, or rewritten in place
+   // with its mtime restored (cp -p, rsync -t, tar x).
+   const DirDigest* previous = nullptr;
+
+   // Called (from a pool thread) with each directory's path, as opened,
+   // just before it is listed
+   std::function<void(const std::string& path)> on_directory;
+
+   // Runs the scan on this pool, which must be otherwise idle, instead of
+   // starting `n_threads` threads
+   ThreadPool* pool = nullptr;
+
+   // Map large files rather than read them: faster, but a file truncated
+   // while it is hashed raises SIGBUS, so only for trees nothing else writes
+   bool mmap = false;
+};
+
+enum class DirEntryType : uint8_t {
+   file      = 'f',
+   directory = 'd',
+   symlink   = 'l',
+   other     = 'o'
+};
+
+struct DirDigestEntry
+{
+   std::string path; // relative to the root, '/'-separated; "" is the root
+   DirEntryType type = DirEntryType::other;
+   uint32_t mode     = 0; // st_mode
+   uint64_t size     = 0; // of files
+   int64_t mtime_ns  = 0;
+   int64_t ctime_ns  = 0;
+   uint64_t ino      = 0;
+   Sha256Digest digest{}; // file content, or directory digest
+   std::string target;    // of symbolic links
+   int error = 0;         // errno, if the entry could not be read
+};
+
+struct DirDigest
+{
+   Sha256Digest root{};
+   // Depth first, each directory before its children, which are sorted by
+   // name, so the order is as deterministic as the digest
+   std::vector<DirDigestEntry> entries;
+   size_t n_errors = 0; // entries with an error; the root is then unreliable
+
+   std::string root_hex() const noexcept;
+};
+
+DirDigest dir_digest(const std::string& root,
+                     const DirDigestOptions& options = {}) noexcept;
+
+// Sets the type, mode, size, times and inode of `entry` from lstat() results
+void set_dir_entry_stat(DirDigestEntry& entry, const struct stat& st) noexcept;
+
+// Appends record(entry), above, to `out`, naming it `name`
+void encode_dir_record(std::string& out,
+                       const std::string& name,
+                       const DirDigestEntry& entry,
+                       bool modes = true) noexcept;
+
+// The binary manifest: every entry, and the root. Host byte order.
+bool write_dir_manifest(const std::string& path,
+                        const DirDigest& tree) noexcept;
+std::optional<DirDigest> read_dir_manifest(const std::string& path) noexcept;
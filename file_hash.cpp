@@ -0,0 +1,135 @@
+
+#include "file_hash.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The sink may throw: the window is unmapped, and the file closed, regardless
+namespace
+{
+struct Window
+{
+   void* base;
+   size_t length;
+   ~Window() noexcept { munmap(base, length); }
+};
+
+struct OpenFile
+{
+   int fd;
+   ~OpenFile() noexcept { ::close(fd); }
+};
+} // namespace
+
+// ---------------------------------------------------------------------- read
+
+static bool stream_read(int fd,
+                        const FileChunkSink& sink,
+                        const FileHashOptions& options)
+{
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // fails on pipes; harmless
+
+   std::vector<char> buffer(std::max<size_t>(options.read_size, 4096));
+   off_t done = lseek(fd, 0, SEEK_CUR);
+   while(true) {
+      const ssize_t n = read_retry(fd, buffer.data(), buffer.size());
+      if(n < 0) return false;
+      if(n == 0) return true;
+      sink(buffer.data(), size_t(n));
+      if(options.drop_cache && done >= 0) {
+         posix_fadvise(fd, done, n, POSIX_FADV_DONTNEED);
+         done += n;
+      }
+   }
+}
+
+// ---------------------------------------------------------------------- mmap
+
+static bool stream_mmap(int fd,
+                        off_t begin,
+                        off_t end,
+                        const FileChunkSink& sink,
+                        const FileHashOptions& options)
+{
+   const off_t page   = off_t(sysconf(_SC_PAGESIZE));
+   const off_t window = std::max<off_t>(
+       page, off_t(options.window) / page * page); // whole pages
+
+   for(off_t pos = begin; pos < end;) {
+      const off_t map_at = pos / page * page;
+      const off_t length = std::min(window, end - map_at);
+
+      // Start reading the next window while this one is hashed
+      if(map_at + length < end)
+         posix_fadvise(fd,
+                       map_at + length,
+                       std::min(window, end - map_at - length),
+                       POSIX_FADV_WILLNEED);
+
+      void* base
+          = mmap(nullptr, size_t(length), PROT_READ, MAP_SHARED, fd, map_at);
+      if(base == MAP_FAILED) return false;
+      {
+         const Window mapped{base, size_t(length)};
+         madvise(base, size_t(length), MADV_SEQUENTIAL);
+         madvise(base, size_t(length), MADV_WILLNEED);
+
+         const auto bytes = static_cast<const char*>(base);
+         sink(bytes + (pos - map_at), size_t(map_at + length - pos));
+      }
+
+      if(options.drop_cache)
+         posix_fadvise(fd, map_at, length, POSIX_FADV_DONTNEED);
+      pos = map_at + length;
+   }
+   return lseek(fd, end, SEEK_SET) == end;
+}
+
+// ------------------------------------------------------------------- stream_fd
+
+bool stream_fd(int fd,
+               const FileChunkSink& sink,
+               const FileHashOptions& options)
+{
+   struct stat st;
+   if(fstat(fd, &st) != 0) return false;
+
+   const off_t pos = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+   if(pos >= 0 && st.st_size - pos >= off_t(options.mmap_threshold)
+      && options.window > 0)
+      return stream_mmap(fd, pos, st.st_size, sink, options);
+
+   return stream_read(fd, sink, options);
+}
+
+bool stream_file(const std::string& path,
+                 const FileChunkSink& sink,
+                 const FileHashOptions& options)
+{
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+   const OpenFile file{fd};
+   return stream_fd(fd, sink, options);
+}
+
+// -----------------------------------------------------------------------------
+
+std::optional<std::string> md5_file(const std::string& path) noexcept
+{
+   MD5 hasher;
+   if(!hash_file(path, hasher)) return std::nullopt;
+   return hasher.hexdigest();
+}
+
+std::optional<std::string> sha256_file(const std::string& path) noexcept
+{
+   Sha256 hasher;
+   if(!hash_file(path, hasher)) return std::nullopt;
+   return hasher.hexdigest();
+}
@@ -0,0 +1,75 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+
+// Hashing of whole files
+//
+// Regular files of at least `mmap_threshold` bytes are memory mapped, one
+// window at a time, and the mapped pages are handed directly to the hasher,
+// whose block transform reads them in place. There is no intermediate buffer
+// and no copy. Each window is advised MADV_SEQUENTIAL, and the kernel is
+// asked (POSIX_FADV_WILLNEED) to start reading the next window while the
+// current one is hashed.
+//
+// Small files, pipes, and anything else that cannot be mapped are read with
+// pread()/read() into a buffer.
+//
+// Note: as with any mmap() reader, a file truncated by another process while
+// it is being hashed raises SIGBUS.
+//
+// usage: Sha256 sha;
+//        if(hash_file("big.iso", sha)) std::cout << sha.hexdigest();
+//      or
+//        auto hex = sha256_file("big.iso"); // std::nullopt on error
+struct FileHashOptions
+{
+   size_t mmap_threshold = 1 << 20;  // smaller files are read
+   size_t window         = 64 << 20; // bytes mapped at a time
+   size_t read_size      = 1 << 20;  // buffer size when reading
+   bool drop_cache       = false;    // POSIX_FADV_DONTNEED hashed ranges
+};
+
+using FileChunkSink = std::function<void(const void* data, size_t length)>;
+
+// Feeds the contents of `fd`, from its current position to the end, to `sink`
+// in order. Returns false on I/O error. An exception thrown by `sink` is
+// passed on to the caller, with nothing left mapped or open.
+bool stream_fd(int fd,
+               const FileChunkSink& sink,
+               const FileHashOptions& options = {});
+
+bool stream_file(const std::string& path,
+                 const FileChunkSink& sink,
+                 const FileHashOptions& options = {});
+
+// `hasher` is any type with `append(const void*, size_t)`, and is not
+// finished, so that hashing can continue across several files.
+template<typename Hasher>
+bool hash_fd(int fd, Hasher& hasher, const FileHashOptions& options = {})
+{
+   return stream_fd(
+       fd,
+       [&](const void* data, size_t length) { hasher.append(data, length); },
+       options);
+}
+
+template<typename Hasher>
+bool hash_file(const std::string& path,
+               Hasher& hasher,
+               const FileHashOptions& options = {})
+{
+   return stream_file(
+       path,
+       [&](const void* data, size_t length) { hasher.append(data, length); },
+       options);
+}
+
+std::optional<std::string> md5_file(const std::string& path) noexcept;
+std::optional<std::string> sha256_file(const std::string& path) noexcept;
@@ -0,0 +1,94 @@
+
+#include "hash_batch.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static constexpr size_t cache_line = 64;
+
+template<typename Hasher>
+static void hash_group(const std::string_view* messages,
+                       size_t count,
+                       uint8_t* digests) noexcept
+{
+   for(size_t i = 0; i < count; ++i) {
+      Hasher hasher;
+      hasher.append(messages[i].data(), messages[i].size());
+      hasher.finish().get_digest(digests);
+      digests += hasher.digest_size();
+   }
+}
+
+static void hash_group(HashAlgorithm algorithm,
+                       const std::string_view* messages,
+                       size_t count,
+                       uint8_t* digests) noexcept
+{
+   if(algorithm == HashAlgorithm::md5)
+      hash_group<MD5>(messages, count, digests);
+   else
+      hash_group<Sha256>(messages, count, digests);
+}
+
+size_t digest_size(HashAlgorithm algorithm) noexcept
+{
+   return algorithm == HashAlgorithm::md5 ? 16 : 32;
+}
+
+void hash_batch(HashAlgorithm algorithm,
+                const std::string_view* messages,
+                size_t count,
+                uint8_t* digests,
+                const HashBatchOptions& options) noexcept
+{
+   const size_t size     = digest_size(algorithm);
+   const size_t per_line = cache_line / size; // digests
+
+   // [begin, end) of each group
+   std::vector<std::pair<size_t, size_t>> groups;
+   size_t begin = 0, bytes = 0;
+   for(size_t i = 0; i < count; ++i) {
+      bytes += messages[i].size();
+      if((bytes >= options.group_bytes && (i + 1) % per_line == 0)
+         || i + 1 == count) {
+         groups.emplace_back(begin, i + 1);
+         begin = i + 1;
+         bytes = 0;
+      }
+   }
+   if(groups.size() <= 1) {
+      hash_group(algorithm, messages, count, digests);
+      return;
+   }
+
+   std::unique_ptr<ThreadPool> own_pool;
+   ThreadPool* pool = options.pool;
+   if(pool == nullptr) {
+      own_pool = std::make_unique<ThreadPool>(options.n_threads);
+      pool     = own_pool.get();
+   }
+
+   std::mutex padlock;
+   std::condition_variable finished;
+   size_t n_unfinished = groups.size() - 1;
+   for(size_t g = 0; g + 1 < groups.size(); ++g) {
+      const auto [first, last] = groups[g];
+      pool->submit([&, first = first, last = last] {
+         hash_group(
+             algorithm, messages + first, last - first, digests + first * size);
+         std::lock_guard<std::mutex> lock(padlock);
+         if(--n_unfinished == 0) finished.notify_one();
+      });
+   }
+
+   const auto [first, last] = groups.back();
+   hash_group(
+       algorithm, messages + first, last - first, digests + first * size);
+
+   std::unique_lock<std::mutex> lock(padlock);
+   finished.wait(lock, [&] { return n_unfinished == 0; });
+}
@@ -0,0 +1,47 @@
+
+#pragma once
+
+#include "hashsum.hpp"
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Hashes many independent messages in parallel
+//
+// Messages are dealt to a work-stealing ThreadPool in groups of consecutive
+// messages of about `group_bytes` in all, so that millions of tiny messages
+// cost thousands of tasks rather than millions, while a large message gets
+// a task (nearly) to itself. A single message is never split: SHA-256 and
+// MD5 are sequential, and splitting would change the digest.
+//
+// Digest i is written at `digests + i * digest_size` (16 bytes for MD5, 32
+// for SHA-256). Groups start at a multiple of a cache line's worth of
+// digests, so that two threads never write to the same cache line of a
+// 64-byte aligned `digests`. The calling thread hashes the last group
+// itself, then waits for the others.
+//
+// Without `pool`, one is made for the call, with `n_threads` threads; pass
+// one to amortize thread creation over many calls. hash_batch() must not be
+// called from a task of `pool`.
+//
+// usage: std::vector<std::string_view> messages = ...;
+//        std::vector<uint8_t> digests(messages.size() * 32);
+//        hash_batch(HashAlgorithm::sha256, messages.data(), messages.size(),
+//                   digests.data());
+struct HashBatchOptions
+{
+   ThreadPool* pool   = nullptr;
+   unsigned n_threads = 0;         // for a pool of our own; 0 means one per
+                                   // hardware thread
+   size_t group_bytes = 256 << 10; // per task, roughly
+};
+
+size_t digest_size(HashAlgorithm algorithm) noexcept;
+
+void hash_batch(HashAlgorithm algorithm,
+                const std::string_view* messages,
+                size_t count,
+                uint8_t* digests,
+                const HashBatchOptions& options = {}) noexcept;
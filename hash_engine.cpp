@@ -0,0 +1,629 @@
+
+#include "hash_engine.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static constexpr size_t huge_page_size = 2 << 20;
+
+// --------------------------------------------------------------------- Buffers
+
+struct Buffers
+{
+   char* base    = nullptr;
+   size_t length = 0;
+   bool huge     = false;
+
+   bool allocate(size_t total, bool try_huge) noexcept
+   {
+      length = (total + huge_page_size - 1) / huge_page_size * huge_page_size;
+      const int prot  = PROT_READ | PROT_WRITE;
+      const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+      void* p         = MAP_FAILED;
+      if(try_huge)
+         p = mmap(nullptr, length, prot, flags | MAP_HUGETLB, -1, 0);
+      huge = p != MAP_FAILED;
+      if(!huge) {
+         p = mmap(nullptr, length, prot, flags, -1, 0);
+         if(p == MAP_FAILED) return false;
+         if(try_huge) madvise(p, length, MADV_HUGEPAGE);
+      }
+      base = static_cast<char*>(p);
+      return true;
+   }
+
+   ~Buffers() noexcept
+   {
+      if(base != nullptr) munmap(base, length);
+   }
+};
+
+// ------------------------------------------------------------------------ Ring
+
+// A minimal io_uring, driven with raw system calls
+struct Ring
+{
+   int fd = -1;
+   io_uring_params params;
+
+   void* sq_ptr    = nullptr;
+   void* cq_ptr    = nullptr;
+   size_t sq_len   = 0;
+   size_t cq_len   = 0;
+   io_uring_sqe* sqes = nullptr;
+   io_uring_cqe* cqes = nullptr;
+
+   unsigned* sq_tail  = nullptr;
+   unsigned* sq_mask  = nullptr;
+   unsigned* sq_array = nullptr;
+   unsigned* cq_head  = nullptr;
+   unsigned* cq_tail  = nullptr;
+   unsigned* cq_mask  = nullptr;
+
+   unsigned tail      = 0; // of the submission queue, once published
+   unsigned n_pending = 0; // queued, but not yet passed to io_uring_enter
+
+   bool setup(unsigned entries) noexcept
+   {
+      memset(&params, 0, sizeof(params));
+      fd = int(syscall(__NR_io_uring_setup, entries, &params));
+      if(fd < 0) return false;
+
+      const auto& sq = params.sq_off;
+      const auto& cq = params.cq_off;
+      sq_len = sq.array + params.sq_entries * sizeof(unsigned);
+      cq_len = cq.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+      if(single) sq_len = cq_len = std::max(sq_len, cq_len);
+
+      const int prot  = PROT_READ | PROT_WRITE;
+      const int flags = MAP_SHARED | MAP_POPULATE;
+      sq_ptr = mmap(nullptr, sq_len, prot, flags, fd, IORING_OFF_SQ_RING);
+      if(sq_ptr == MAP_FAILED) return false;
+      if(single)
+         cq_ptr = sq_ptr;
+      else
+         cq_ptr = mmap(nullptr, cq_len, prot, flags, fd, IORING_OFF_CQ_RING);
+      if(cq_ptr == MAP_FAILED) return false;
+      void* s = mmap(nullptr,
+                     params.sq_entries * sizeof(io_uring_sqe),
+                     prot,
+                     flags,
+                     fd,
+                     IORING_OFF_SQES);
+      if(s == MAP_FAILED) return false;
+      sqes = static_cast<io_uring_sqe*>(s);
+
+      auto sq_base = static_cast<char*>(sq_ptr);
+      auto cq_base = static_cast<char*>(cq_ptr);
+      sq_tail      = reinterpret_cast<unsigned*>(sq_base + sq.tail);
+      sq_mask      = reinterpret_cast<unsigned*>(sq_base + sq.ring_mask);
+      sq_array     = reinterpret_cast<unsigned*>(sq_base + sq.array);
+      cq_head      = reinterpret_cast<unsigned*>(cq_base + cq.head);
+      cq_tail      = reinterpret_cast<unsigned*>(cq_base + cq.tail);
+      cq_mask      = reinterpret_cast<unsigned*>(cq_base + cq.ring_mask);
+      cqes         = reinterpret_cast<io_uring_cqe*>(cq_base + cq.cqes);
+      tail         = *sq_tail;
+      return true;
+   }
+
+   ~Ring() noexcept
+   {
+      if(sqes != nullptr)
+         munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+      if(cq_ptr != nullptr && cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+         munmap(cq_ptr, cq_len);
+      if(sq_ptr != nullptr && sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+      if(fd >= 0) close(fd);
+   }
+
+   bool register_buffers(const iovec* iov, unsigned n) noexcept
+   {
+      const auto op = IORING_REGISTER_BUFFERS;
+      return syscall(__NR_io_uring_register, fd, op, iov, n) == 0;
+   }
+
+   // The caller never has more than `sq_entries` reads outstanding, so there
+   // is always room
+   io_uring_sqe* next_sqe() noexcept
+   {
+      const unsigned idx = tail++ & *sq_mask;
+      sq_array[idx]      = idx;
+      ++n_pending;
+      memset(&sqes[idx], 0, sizeof(io_uring_sqe));
+      return &sqes[idx];
+   }
+
+   // Submits pending entries, and waits for at least `wait_for` completions
+   bool enter(unsigned wait_for) noexcept
+   {
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+      while(true) {
+         const unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0u;
+         const long n         = syscall(
+             __NR_io_uring_enter, fd, n_pending, wait_for, flags, nullptr, 0);
+         if(n >= 0) {
+            n_pending -= std::min(n_pending, unsigned(n));
+            if(n_pending == 0 || wait_for > 0) return true;
+            continue;
+         }
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN || errno == EBUSY) return true; // reap first
+         return false;
+      }
+   }
+
+   template<typename F> void reap(F&& handle) noexcept
+   {
+      unsigned head       = *cq_head;
+      const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      for(; head != tail; ++head) {
+         const auto& cqe = cqes[head & *cq_mask];
+         handle(cqe.user_data, cqe.res);
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+   }
+};
+
+// ---------------------------------------------------------------------- Engine
+
+namespace
+{
+struct File;
+
+struct Chunk
+{
+   File* file      = nullptr;
+   uint64_t seq    = 0; // position within the file, in chunks
+   uint64_t offset = 0;
+   size_t length   = 0;
+   size_t done     = 0; // bytes read so far
+   int error       = 0;
+   bool busy       = false; // being read
+   char* data      = nullptr;
+   iovec iov; // for IORING_OP_READV
+};
+
+struct File
+{
+   size_t index      = 0;
+   int fd            = -1;
+   uint64_t size     = 0;
+   uint64_t n_chunks = 0;
+   uint64_t next_seq = 0; // next chunk to read; I/O thread only
+
+   std::atomic<unsigned> outstanding{0}; // chunks being read or hashed
+
+   // Guarded by the engine's mutex
+   std::vector<Chunk*> ready; // read, in any order
+   uint64_t hash_seq = 0;     // next chunk to hash
+   bool queued       = false; // with a worker, or in the work queue
+
+   // Owned by whichever worker has the file queued
+   Sha256 sha;
+   int error = 0;
+};
+
+// Reads (and hashes) on the calling thread, hands chunks to workers
+class Engine
+{
+ public:
+   Engine(const std::vector<std::string>& paths,
+          const HashFilesCallback& callback,
+          const HashEngineOptions& options,
+          Ring& ring,
+          char* buffers,
+          bool fixed_buffers) noexcept;
+
+   void run(unsigned n_workers) noexcept;
+
+   uint64_t n_bytes() const noexcept { return n_bytes_.load(); }
+   size_t n_errors() const noexcept { return n_errors_.load(); }
+
+ private:
+   File* next_readable_file() noexcept;
+   void issue_reads() noexcept;
+   void issue(Chunk& chunk) noexcept;
+   void wait_for_completions() noexcept;
+   void on_completion(Chunk& chunk, int res) noexcept;
+   void deliver(Chunk& chunk) noexcept;
+   void work() noexcept;
+   void finish(File* file, int error) noexcept;
+
+   const std::vector<std::string>& paths_;
+   const HashFilesCallback& callback_;
+   Ring& ring_;
+   const bool fixed_;
+   const size_t buffer_size_;
+   const unsigned per_file_limit_;
+   const size_t max_readable_;
+
+   // I/O thread only
+   std::vector<Chunk> chunks_; // one per buffer
+   std::vector<File*> readable_;
+   std::vector<Chunk*> completed_; // by synchronous reads
+   size_t next_path_  = 0;
+   size_t cursor_     = 0;
+   unsigned inflight_ = 0;
+   bool sync_         = false; // io_uring failed; pread() instead
+
+   std::mutex mutex_;
+   std::condition_variable work_cv_;
+   std::condition_variable io_cv_;
+   std::vector<unsigned> free_; // buffer indices
+   std::vector<File*> work_queue_;
+   uint64_t generation_ = 0; // bumped whenever a worker releases a buffer
+   bool stop_           = false;
+
+   std::atomic<uint64_t> n_bytes_{0};
+   std::atomic<size_t> n_errors_{0};
+};
+
+Engine::Engine(const std::vector<std::string>& paths,
+               const HashFilesCallback& callback,
+               const HashEngineOptions& options,
+               Ring& ring,
+               char* buffers,
+               bool fixed_buffers) noexcept
+    : paths_(paths)
+    , callback_(callback)
+    , ring_(ring)
+    , fixed_(fixed_buffers)
+    , buffer_size_(options.buffer_size)
+    , per_file_limit_(std::max(2u, options.queue_depth / 4))
+    , max_readable_(options.queue_depth)
+    , chunks_(options.queue_depth)
+{
+   for(unsigned i = 0; i < options.queue_depth; ++i) {
+      chunks_[i].data = buffers + i * buffer_size_;
+      free_.push_back(options.queue_depth - 1 - i);
+   }
+}
+
+// A file that may have another read issued. Round robin, so that no file
+// holds all the buffers, and opens more files as needed.
+File* Engine::next_readable_file() noexcept
+{
+   for(size_t i = 0; i < readable_.size(); ++i) {
+      cursor_ = (cursor_ + 1) % readable_.size();
+      File* f = readable_[cursor_];
+      if(f->outstanding.load(std::memory_order_relaxed) < per_file_limit_)
+         return f;
+   }
+
+   while(next_path_ < paths_.size() && readable_.size() < max_readable_) {
+      auto f   = new File;
+      f->index = next_path_++;
+      f->fd    = open(paths_[f->index].c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      if(f->fd < 0 || fstat(f->fd, &st) != 0) {
+         finish(f, errno);
+         continue;
+      }
+      f->size     = uint64_t(st.st_size);
+      f->n_chunks = (f->size + buffer_size_ - 1) / buffer_size_;
+      if(f->n_chunks == 0) {
+         finish(f, 0);
+         continue;
+      }
+      posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      readable_.push_back(f);
+      cursor_ = readable_.size() - 1;
+      return f;
+   }
+   return nullptr;
+}
+
+// Issues a read into every free buffer that has a file to read
+void Engine::issue_reads() noexcept
+{
+   File* f;
+   while((f = next_readable_file()) != nullptr) {
+      unsigned index;
+      {
+         std::lock_guard<std::mutex> guard(mutex_);
+         if(free_.empty()) return;
+         index = free_.back();
+         free_.pop_back();
+      }
+
+      Chunk& c = chunks_[index];
+      c.file   = f;
+      c.seq    = f->next_seq++;
+      c.offset = c.seq * buffer_size_;
+      c.length = size_t(std::min<uint64_t>(buffer_size_, f->size - c.offset));
+      c.done   = 0;
+      c.error  = 0;
+      f->outstanding.fetch_add(1, std::memory_order_relaxed);
+      if(f->next_seq == f->n_chunks) // nothing more to read
+         readable_.erase(std::find(readable_.begin(), readable_.end(), f));
+      ++inflight_;
+      issue(c);
+   }
+}
+
+void Engine::issue(Chunk& chunk) noexcept
+{
+   chunk.busy = true;
+   if(sync_) {
+      while(chunk.done < chunk.length && chunk.error == 0) {
+         const ssize_t n = pread_retry(chunk.file->fd,
+                                       chunk.data + chunk.done,
+                                       chunk.length - chunk.done,
+                                       chunk.offset + chunk.done);
+         if(n <= 0) chunk.error = n < 0 ? errno : EIO;
+         if(n > 0) chunk.done += size_t(n);
+      }
+      completed_.push_back(&chunk);
+      return;
+   }
+
+   const auto index = unsigned(&chunk - chunks_.data());
+   auto sqe         = ring_.next_sqe();
+   sqe->fd          = chunk.file->fd;
+   sqe->off         = chunk.offset + chunk.done;
+   sqe->user_data   = index;
+   if(fixed_) {
+      sqe->opcode    = IORING_OP_READ_FIXED;
+      sqe->addr      = uint64_t(uintptr_t(chunk.data + chunk.done));
+      sqe->len       = unsigned(chunk.length - chunk.done);
+      sqe->buf_index = uint16_t(index);
+   } else {
+      chunk.iov.iov_base = chunk.data + chunk.done;
+      chunk.iov.iov_len  = chunk.length - chunk.done;
+      sqe->opcode        = IORING_OP_READV;
+      sqe->addr          = uint64_t(uintptr_t(&chunk.iov));
+      sqe->len           = 1;
+   }
+}
+
+void Engine::wait_for_completions() noexcept
+{
+   if(!sync_ && !ring_.enter(1)) {
+      // Should not happen, but if it does, finish the job synchronously
+      sync_ = true;
+      for(auto& c : chunks_)
+         if(c.busy) issue(c);
+   }
+
+   if(!sync_) {
+      ring_.reap([&](uint64_t user_data, int res) {
+         on_completion(chunks_[user_data], res);
+      });
+      return;
+   }
+
+   auto completed = std::move(completed_);
+   completed_.clear();
+   for(auto c : completed) on_completion(*c, 0);
+}
+
+// `res` is the result of a read of the rest of the chunk
+void Engine::on_completion(Chunk& chunk, int res) noexcept
+{
+   if(!sync_) {
+      if(res == -EINTR || res == -EAGAIN) return issue(chunk);
+      if(res < 0) chunk.error = -res;
+      if(res == 0) chunk.error = EIO; // the file shrank
+      if(res > 0) chunk.done += size_t(res);
+      if(chunk.error == 0 && chunk.done < chunk.length) // short read
+         return issue(chunk);
+   }
+   --inflight_;
+   chunk.busy = false;
+   deliver(chunk);
+}
+
+// Hands a chunk to the workers, queuing its file if this is the chunk that
+// it was waiting for
+void Engine::deliver(Chunk& chunk) noexcept
+{
+   File* f = chunk.file;
+   std::lock_guard<std::mutex> guard(mutex_);
+   f->ready.push_back(&chunk);
+   if(!f->queued && chunk.seq == f->hash_seq) {
+      f->queued = true;
+      work_queue_.push_back(f);
+      work_cv_.notify_one();
+   }
+}
+
+void Engine::work() noexcept
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   while(true) {
+      work_cv_.wait(lock, [&] { return stop_ || !work_queue_.empty(); });
+      if(work_queue_.empty()) return;
+      File* f = work_queue_.back();
+      work_queue_.pop_back();
+
+      // Hash every chunk that is next in line
+      while(true) {
+         const auto it
+             = std::find_if(f->ready.begin(), f->ready.end(), [&](Chunk* c) {
+                  return c->seq == f->hash_seq;
+               });
+         if(it == f->ready.end()) {
+            f->queued = false;
+            break;
+         }
+         Chunk* c = *it;
+         f->ready.erase(it);
+         lock.unlock();
+
+         if(f->error == 0) f->error = c->error;
+         if(f->error == 0) {
+            f->sha.append(c->data, c->length);
+            n_bytes_.fetch_add(c->length, std::memory_order_relaxed);
+         }
+         const bool last = c->seq + 1 == f->n_chunks;
+         if(last) finish(f, f->error);
+
+         lock.lock();
+         free_.push_back(unsigned(c - chunks_.data()));
+         ++generation_;
+         io_cv_.notify_one();
+         if(last) break;
+         f->outstanding.fetch_sub(1, std::memory_order_relaxed);
+         ++f->hash_seq;
+      }
+   }
+}
+
+// Reports and frees a file
+void Engine::finish(File* f, int error) noexcept
+{
+   Sha256Digest digest{};
+   if(error == 0) f->sha.finish().get_digest(digest.data());
+   if(error != 0) n_errors_.fetch_add(1, std::memory_order_relaxed);
+   if(f->fd >= 0) close(f->fd);
+   callback_(f->index, error, digest);
+   delete f;
+}
+
+void Engine::run(unsigned n_workers) noexcept
+{
+   std::vector<std::thread> workers;
+   for(unsigned i = 0; i < n_workers; ++i)
+      workers.emplace_back([this] { work(); });
+
+   while(true) {
+      uint64_t generation;
+      {
+         std::lock_guard<std::mutex> guard(mutex_);
+         generation = generation_;
+      }
+      issue_reads();
+      if(inflight_ > 0) {
+         wait_for_completions();
+         continue;
+      }
+      if(next_path_ == paths_.size() && readable_.empty()) break; // all read
+
+      // Every buffer, or every readable file's share, is with the workers
+      std::unique_lock<std::mutex> lock(mutex_);
+      io_cv_.wait(lock, [&] { return generation_ != generation; });
+   }
+
+   // Workers drain the queue before they stop
+   {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+      work_cv_.notify_all();
+   }
+   for(auto& t : workers) t.join();
+}
+} // namespace
+
+// ---------------------------------------------------------------------- pread
+
+// Fallback: each thread reads and hashes whole files, one at a time
+static void hash_files_pread(const std::vector<std::string>& paths,
+                             const HashFilesCallback& callback,
+                             const HashEngineOptions& options,
+                             char* buffers,
+                             HashEngineStats& stats) noexcept
+{
+   std::atomic<size_t> next{0};
+   std::atomic<size_t> n_errors{0};
+   std::atomic<uint64_t> n_bytes{0};
+
+   auto run = [&](char* buffer) {
+      size_t i;
+      while((i = next.fetch_add(1)) < paths.size()) {
+         Sha256 sha;
+         int error    = 0;
+         const int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+         if(fd < 0) error = errno;
+         if(fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+         while(error == 0) {
+            const ssize_t n = read_retry(fd, buffer, options.buffer_size);
+            if(n < 0) error = errno;
+            if(n <= 0) break;
+            sha.append(buffer, size_t(n));
+            n_bytes.fetch_add(uint64_t(n), std::memory_order_relaxed);
+         }
+         if(fd >= 0) close(fd);
+
+         Sha256Digest digest{};
+         if(error == 0) sha.finish().get_digest(digest.data());
+         if(error != 0) n_errors.fetch_add(1, std::memory_order_relaxed);
+         callback(i, error, digest);
+      }
+   };
+
+   const auto n_threads = std::min<size_t>(options.queue_depth, paths.size());
+   std::vector<std::thread> threads;
+   for(size_t t = 1; t < n_threads; ++t)
+      threads.emplace_back(run, buffers + t * options.buffer_size);
+   run(buffers);
+   for(auto& t : threads) t.join();
+
+   stats.n_bytes  = n_bytes.load();
+   stats.n_errors = n_errors.load();
+}
+
+// ------------------------------------------------------------------ hash_files
+
+HashEngineStats hash_files(const std::vector<std::string>& paths,
+                           const HashFilesCallback& callback,
+                           const HashEngineOptions& options_in) noexcept
+{
+   auto options        = options_in;
+   options.queue_depth = std::max(1u, std::min(options.queue_depth, 4096u));
+   options.buffer_size = std::max<size_t>(options.buffer_size, 4096);
+   options.buffer_size = (options.buffer_size + 4095) / 4096 * 4096;
+   options.n_workers   = options.n_workers > 0
+                           ? options.n_workers
+                           : std::max(1u, std::thread::hardware_concurrency());
+
+   HashEngineStats stats;
+   stats.n_files = paths.size();
+
+   Buffers buffers;
+   const auto total = options.queue_depth * options.buffer_size;
+   if(!buffers.allocate(total, options.huge_pages)) {
+      for(size_t i = 0; i < paths.size(); ++i) callback(i, ENOMEM, {});
+      stats.n_errors = paths.size();
+      return stats;
+   }
+   stats.huge_pages = buffers.huge;
+
+   Ring ring;
+   stats.io_uring = options.use_io_uring && ring.setup(options.queue_depth);
+   if(!stats.io_uring) {
+      hash_files_pread(paths, callback, options, buffers.base, stats);
+      return stats;
+   }
+
+   // Fixed buffers are pinned, and count against RLIMIT_MEMLOCK on older
+   // kernels. Plain readv() is next best.
+   std::vector<iovec> iov(options.queue_depth);
+   for(size_t i = 0; i < iov.size(); ++i) {
+      iov[i].iov_base = buffers.base + i * options.buffer_size;
+      iov[i].iov_len  = options.buffer_size;
+   }
+   const auto n_iov    = unsigned(iov.size());
+   stats.fixed_buffers = ring.register_buffers(iov.data(), n_iov);
+
+   Engine engine(
+       paths, callback, options, ring, buffers.base, stats.fixed_buffers);
+   engine.run(options.n_workers);
+   stats.n_bytes  = engine.n_bytes();
+   stats.n_errors = engine.n_errors();
+   return stats;
+}
@@ -0,0 +1,59 @@
+
+#pragma once
+
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Asynchronous hashing of many files with io_uring
+//
+// The calling thread drives an io_uring submission queue, keeping up to
+// `queue_depth` reads in flight, spread across several files at once. Each
+// read lands in one of `queue_depth` buffers, which are registered with the
+// kernel (IORING_OP_READ_FIXED) and backed by huge pages when possible.
+// Completed buffers are handed to `n_workers` hashing threads; the chunks of
+// any one file are hashed in order, by one worker at a time, while other
+// workers hash other files.
+//
+// When io_uring is not available (old kernel, seccomp), or `use_io_uring`
+// is false, `queue_depth` threads pread() and hash whole files instead.
+//
+// Files are hashed up to the size that fstat() reports when they are
+// opened. A file that shrinks meanwhile is reported as EIO.
+//
+// usage: hash_files(paths,
+//                   [&](size_t i, int error, const Sha256Digest& digest) {
+//                      ... // paths[i]; `digest` is valid if `error` is 0
+//                   });
+struct HashEngineOptions
+{
+   unsigned queue_depth = 32;      // reads in flight, and number of buffers
+   size_t buffer_size   = 1 << 20; // bytes per read
+   unsigned n_workers   = 0;       // hashing threads; 0 means one per core
+   bool use_io_uring    = true;
+   bool huge_pages      = true; // MAP_HUGETLB, else MADV_HUGEPAGE
+};
+
+struct HashEngineStats
+{
+   bool io_uring      = false; // else the pread() fallback was used
+   bool fixed_buffers = false; // buffers registered with the kernel
+   bool huge_pages    = false; // buffers in MAP_HUGETLB pages
+   size_t n_files     = 0;
+   size_t n_errors    = 0;
+   uint64_t n_bytes   = 0; // hashed
+};
+
+// Called once per path, in no particular order, and from several threads
+// at once. `error` is an errno value, or 0 on success.
+using HashFilesCallback = std::function<void(
+    size_t index, int error, const Sha256Digest& digest)>;
+
+// Returns when every file has been reported.
+HashEngineStats hash_files(const std::vector<std::string>& paths,
+                           const HashFilesCallback& callback,
+                           const HashEngineOptions& options = {}) noexcept;
@@ -0,0 +1,112 @@
+
+#include "hash_functions.h"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <new>
+#include <type_traits>
+
+// The contexts hold the C++ hashers themselves, constructed in place. Both
+// are trivially copyable and destructible, which is what lets C callers
+// copy contexts with memcpy() and drop them without a "free" call.
+namespace
+{
+template<typename Hasher, typename Context> constexpr bool fits()
+{
+   return sizeof(Hasher) <= sizeof(Context::opaque)
+          && alignof(Hasher) <= alignof(Context)
+          && std::is_trivially_copyable_v<Hasher>
+          && std::is_trivially_destructible_v<Hasher>;
+}
+static_assert(fits<Sha256, hf_sha256_ctx>(), "hf_sha256_ctx is too small");
+static_assert(fits<MD5, hf_md5_ctx>(), "hf_md5_ctx is too small");
+
+template<typename Hasher, typename Context>
+Hasher& hasher_of(Context* ctx) noexcept
+{
+   return *std::launder(reinterpret_cast<Hasher*>(ctx->opaque));
+}
+
+template<typename Hasher, typename Context>
+void finish(Context* ctx, uint8_t* digest) noexcept
+{
+   auto& hasher = hasher_of<Hasher>(ctx);
+   hasher.finish().get_digest(digest);
+   new(ctx->opaque) Hasher;
+}
+
+template<typename Hasher>
+void hash(const void* data, size_t size, uint8_t* digest) noexcept
+{
+   Hasher hasher;
+   hasher.append(data, size);
+   hasher.finish().get_digest(digest);
+}
+
+template<typename Hasher>
+void batch(const void* const* messages,
+           const size_t* sizes,
+           size_t count,
+           uint8_t* digests) noexcept
+{
+   const size_t digest_size = Hasher().digest_size();
+   for(size_t i = 0; i < count; ++i)
+      hash<Hasher>(messages[i], sizes[i], digests + i * digest_size);
+}
+} // namespace
+
+unsigned hf_abi_version(void) { return HF_ABI_VERSION; }
+
+// --------------------------------------------------------------------- SHA-256
+
+void hf_sha256_init(hf_sha256_ctx* ctx) { new(ctx->opaque) Sha256; }
+
+void hf_sha256_append(hf_sha256_ctx* ctx, const void* data, size_t size)
+{
+   hasher_of<Sha256>(ctx).append(data, size);
+}
+
+void hf_sha256_finish(hf_sha256_ctx* ctx, uint8_t* digest)
+{
+   finish<Sha256>(ctx, digest);
+}
+
+void hf_sha256(const void* data, size_t size, uint8_t* digest)
+{
+   hash<Sha256>(data, size, digest);
+}
+
+void hf_sha256_batch(const void* const* messages,
+                     const size_t* sizes,
+                     size_t count,
+                     uint8_t* digests)
+{
+   batch<Sha256>(messages, sizes, count, digests);
+}
+
+// ------------------------------------------------------------------------- MD5
+
+void hf_md5_init(hf_md5_ctx* ctx) { new(ctx->opaque) MD5; }
+
+void hf_md5_append(hf_md5_ctx* ctx, const void* data, size_t size)
+{
+   hasher_of<MD5>(ctx).append(data, size);
+}
+
+void hf_md5_finish(hf_md5_ctx* ctx, uint8_t* digest)
+{
+   finish<MD5>(ctx, digest);
+}
+
+void hf_md5(const void* data, size_t size, uint8_t* digest)
+{
+   hash<MD5>(data, size, digest);
+}
+
+void hf_md5_batch(const void* const* messages,
+                  const size_t* sizes,
+                  size_t count,
+                  uint8_t* digests)
+{
+   batch<MD5>(messages, sizes, count, digests);
+}
@@ -0,0 +1,89 @@
+
+#ifndef HASH_FUNCTIONS_H
+#define HASH_FUNCTIONS_H
+
+/* The library's stable C ABI, for calling from other languages
+
+   Everything here is plain C: no exceptions cross it, nothing allocates,
+   and nothing keeps a pointer past the call. Build it as a shared library
+   with `make libhash_functions.so`.
+
+   Contexts are opaque, fixed-size structs that the caller allocates where
+   it likes (on the stack, inline in its own structs, in a Go or Rust
+   value). They hold no pointers, so they may be copied with memcpy() to
+   fork a hash part way through. Their size is part of the ABI, and will
+   only change with HF_ABI_VERSION.
+
+   The batch functions hash `count` independent messages in one call, so
+   that hashing thousands of small messages costs one crossing of the FFI
+   boundary rather than thousands. Digest i is written at
+   `digests + i * HF_SHA256_DIGEST_SIZE` (or HF_MD5_DIGEST_SIZE). A
+   message may be NULL if its size is 0.
+
+   usage: uint8_t digests[1000 * HF_SHA256_DIGEST_SIZE];
+          hf_sha256_batch(messages, sizes, 1000, digests);
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define HF_API __attribute__((visibility("default")))
+#else
+#define HF_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HF_ABI_VERSION 1
+
+#define HF_MD5_DIGEST_SIZE 16
+#define HF_SHA256_DIGEST_SIZE 32
+
+typedef struct hf_md5_ctx
+{
+   uint64_t opaque[32];
+} hf_md5_ctx;
+
+typedef struct hf_sha256_ctx
+{
+   uint64_t opaque[32];
+} hf_sha256_ctx;
+
+/* HF_ABI_VERSION of the library loaded, which may differ from the header's */
+HF_API unsigned hf_abi_version(void);
+
+/* ---------------------------------------------------------------- SHA-256 */
+
+HF_API void hf_sha256_init(hf_sha256_ctx* ctx);
+HF_API void
+hf_sha256_append(hf_sha256_ctx* ctx, const void* data, size_t size);
+
+/* Writes the digest, and initializes `ctx` again for a new hash */
+HF_API void hf_sha256_finish(hf_sha256_ctx* ctx, uint8_t* digest);
+
+HF_API void hf_sha256(const void* data, size_t size, uint8_t* digest);
+HF_API void hf_sha256_batch(const void* const* messages,
+                            const size_t* sizes,
+                            size_t count,
+                            uint8_t* digests);
+
+/* -------------------------------------------------------------------- MD5 */
+
+HF_API void hf_md5_init(hf_md5_ctx* ctx);
+HF_API void hf_md5_append(hf_md5_ctx* ctx, const void* data, size_t size);
+HF_API void hf_md5_finish(hf_md5_ctx* ctx, uint8_t* digest);
+
+HF_API void hf_md5(const void* data, size_t size, uint8_t* digest);
+HF_API void hf_md5_batch(const void* const* messages,
+                         const size_t* sizes,
+                         size_t count,
+                         uint8_t* digests);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HASH_FUNCTIONS_H */
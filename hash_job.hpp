@@ -0,0 +1,90 @@
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// A hash of a buffer that can be done a bounded piece at a time
+//
+// A single-threaded event loop can't afford to hash a large buffer in one
+// call: everything else waits until it's done. A HashJob hashes at most
+// `max_bytes` per `step()`, or as much as it can before a deadline, and
+// picks up where it left off next time. The digest is the same as hashing
+// the whole buffer at once.
+//
+// The deadline form checks the clock after every `slice` bytes, so it
+// overruns by at most the time to hash one slice; it always hashes at
+// least one slice, so a job makes progress even when the loop is behind.
+//
+// The buffer is not copied, and must stay alive and unchanged until the
+// job is done.
+//
+// usage: HashJob<Sha256> job(data, size);
+//        on_idle([&] {
+//           if(job.step(clock::now() + 200us)) reply(job.hasher().hexdigest());
+//        });
+template<typename Hasher> class HashJob
+{
+ public:
+   using Clock = std::chrono::steady_clock;
+
+   static constexpr size_t default_slice = 64 << 10;
+
+   HashJob() = default;
+   HashJob(const void* data, size_t size, size_t slice = default_slice)
+       noexcept
+   {
+      reset(data, size, slice);
+   }
+
+   // Starts a new hash of a new buffer
+   void reset(const void* data,
+              size_t size,
+              size_t slice = default_slice) noexcept
+   {
+      hasher_   = Hasher();
+      data_     = static_cast<const uint8_t*>(data);
+      size_     = size;
+      position_ = 0;
+      slice_    = std::max<size_t>(slice, 1);
+      if(size_ == 0) hasher_.finish();
+   }
+
+   // Hashes up to `max_bytes` more. True once the whole buffer is hashed.
+   bool step(size_t max_bytes) noexcept
+   {
+      const size_t n = std::min(max_bytes, size_ - position_);
+      if(n == 0) return done();
+      hasher_.append(data_ + position_, n);
+      position_ += n;
+      if(done()) hasher_.finish();
+      return done();
+   }
+
+   // Hashes slices until `deadline` passes. True once the whole buffer is
+   // hashed.
+   bool step(Clock::time_point deadline) noexcept
+   {
+      do {
+         step(slice_);
+      } while(!done() && Clock::now() < deadline);
+      return done();
+   }
+
+   bool done() const noexcept { return position_ == size_; }
+   size_t position() const noexcept { return position_; } // bytes hashed
+   size_t size() const noexcept { return size_; }
+
+   // Finished once done()
+   Hasher& hasher() noexcept { return hasher_; }
+   const Hasher& hasher() const noexcept { return hasher_; }
+
+ private:
+   Hasher hasher_;
+   const uint8_t* data_ = nullptr;
+   size_t size_         = 0;
+   size_t position_     = 0;
+   size_t slice_        = default_slice;
+};
@@ -0,0 +1,409 @@
+
+#include "hashd.hpp"
+#include "hashsum.hpp"
+#include "io_util.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests answered by one pool task before the connection is polled again
+static constexpr size_t max_batch = 64;
+
+// --------------------------------------------------------------------- helpers
+
+namespace
+{
+std::optional<HashAlgorithm> to_algorithm(uint32_t value) noexcept
+{
+   for(const auto algorithm : {HashAlgorithm::md5, HashAlgorithm::sha256})
+      if(value == uint32_t(algorithm)) return algorithm;
+   return std::nullopt;
+}
+
+struct Session
+{
+   explicit Session(HashAlgorithm algorithm) noexcept
+       : algorithm(algorithm)
+   {}
+
+   void append(const uint8_t* data, size_t size) noexcept
+   {
+      if(algorithm == HashAlgorithm::md5)
+         md5.append(data, size);
+      else
+         sha256.append(data, size);
+   }
+
+   // The digest of everything appended so far; the session can continue
+   void get_digest(hashd::Response& response) const noexcept
+   {
+      if(algorithm == HashAlgorithm::md5) {
+         MD5 copy = md5;
+         copy.finish().get_digest(response.digest);
+         response.digest_size = uint32_t(copy.digest_size());
+      } else {
+         Sha256 copy = sha256;
+         copy.finish().get_digest(response.digest);
+         response.digest_size = uint32_t(copy.digest_size());
+      }
+   }
+
+   HashAlgorithm algorithm;
+   MD5 md5;
+   Sha256 sha256;
+   int error = 0; // the first failed append's, reported by finish
+};
+} // namespace
+
+struct HashdServer::Connection
+{
+   explicit Connection(int fd) noexcept
+       : fd(fd)
+   {}
+   ~Connection() noexcept
+   {
+      if(ring != nullptr) munmap(ring, ring_size);
+      ::close(fd);
+   }
+
+   int fd;
+   uint8_t* ring    = nullptr; // the client's memfd, mapped read-only
+   size_t ring_size = 0;
+   std::unordered_map<uint64_t, Session> sessions;
+   std::atomic<bool> busy{false}; // a pool task owns everything above
+   bool closed = false;           // written by the task, read once !busy
+};
+
+// ---------------------------------------------------------------------- server
+
+HashdServer::HashdServer() noexcept
+    : stop_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{}
+
+HashdServer::~HashdServer() noexcept
+{
+   if(stop_fd_ >= 0) ::close(stop_fd_);
+   if(wake_fd_ >= 0) ::close(wake_fd_);
+}
+
+void HashdServer::stop() noexcept
+{
+   const uint64_t one = 1;
+   if(stop_fd_ >= 0 && write(stop_fd_, &one, sizeof(one)) < 0) return;
+}
+
+HashdStats HashdServer::stats() const noexcept
+{
+   HashdStats s;
+   s.n_connections = n_connections_.load();
+   s.n_requests    = n_requests_.load();
+   s.n_batches     = n_batches_.load();
+   s.n_bytes       = n_bytes_.load();
+   s.n_shared      = n_shared_.load();
+   return s;
+}
+
+bool HashdServer::serve(const std::string& socket_path,
+                        const HashdOptions& options) noexcept
+{
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if(stop_fd_ < 0 || wake_fd_ < 0
+      || socket_path.size() >= sizeof(address.sun_path))
+      return false;
+   memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+   const int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if(listener < 0) return false;
+   unlink_socket(socket_path);
+   if(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+          != 0
+      || listen(listener, 64) != 0) {
+      ::close(listener);
+      return false;
+   }
+
+   options_ = options;
+   pool_    = std::make_unique<ThreadPool>(options.n_threads);
+
+   std::vector<std::unique_ptr<Connection>> connections;
+   for(bool running = true; running;) {
+      std::vector<pollfd> fds = {{stop_fd_, POLLIN, 0},
+                                 {wake_fd_, POLLIN, 0},
+                                 {listener, POLLIN, 0}};
+      std::vector<Connection*> polled; // those no task is serving
+      for(const auto& c : connections)
+         if(!c->busy.load(std::memory_order_acquire)) {
+            fds.push_back({c->fd, POLLIN, 0});
+            polled.push_back(c.get());
+         }
+      if(poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) break;
+
+      uint64_t n;
+      if(fds[0].revents != 0 && read(stop_fd_, &n, sizeof(n)) > 0)
+         running = false;
+      if(fds[1].revents != 0 && read(wake_fd_, &n, sizeof(n)) < 0) n = 0;
+
+      if(fds[2].revents & POLLIN) {
+         const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+         if(fd >= 0) {
+            // A client that stops reading its responses is dropped, rather
+            // than holding a pool thread
+            const timeval timeout = {10, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            connections.push_back(std::make_unique<Connection>(fd));
+            ++n_connections_;
+         }
+      }
+
+      for(size_t i = 3; running && i < fds.size(); ++i) {
+         if(fds[i].revents == 0) continue;
+         Connection* c = polled[i - 3];
+         c->busy.store(true, std::memory_order_relaxed);
+         pool_->submit([this, c] {
+            drain_(*c);
+            c->busy.store(false, std::memory_order_release);
+            const uint64_t one = 1;
+            if(write(wake_fd_, &one, sizeof(one)) < 0) return;
+         });
+      }
+
+      connections.erase(
+          std::remove_if(connections.begin(),
+                         connections.end(),
+                         [](const auto& c) {
+                            return !c->busy.load(std::memory_order_acquire)
+                                   && c->closed;
+                         }),
+          connections.end());
+   }
+
+   pool_->wait();
+   pool_.reset();
+   connections.clear();
+   ::close(listener);
+   unlink_socket(socket_path);
+   return true;
+}
+
+// Answers the requests queued on `c`, then sends all of the responses at once
+void HashdServer::drain_(Connection& c) noexcept
+{
+   thread_local std::vector<uint8_t> buffer(sizeof(hashd::Request)
+                                            + hashd::max_inline);
+   hashd::Response responses[max_batch];
+   size_t n_responses = 0;
+
+   while(n_responses < max_batch) {
+      iovec iov = {buffer.data(), buffer.size()};
+      alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+      msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_control    = control;
+      msg.msg_controllen = sizeof(control);
+
+      const ssize_t got
+          = recvmsg(c.fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+      if(got < 0 && (errno == EAGAIN || errno == EINTR)) break;
+      if(got <= 0) {
+         c.closed = true;
+         break;
+      }
+
+      int passed_fd = -1;
+      for(auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+          cmsg = CMSG_NXTHDR(&msg, cmsg))
+         if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(passed_fd));
+
+      hashd::Request request;
+      memset(&request, 0, sizeof(request));
+      auto& response = responses[n_responses++];
+      if(size_t(got) < sizeof(request) || (msg.msg_flags & MSG_TRUNC)) {
+         if(passed_fd >= 0) ::close(passed_fd);
+         memset(&response, 0, sizeof(response));
+         response.status = EMSGSIZE;
+         continue;
+      }
+      memcpy(&request, buffer.data(), sizeof(request));
+      response = handle_(c,
+                         request,
+                         buffer.data() + sizeof(request),
+                         size_t(got) - sizeof(request),
+                         passed_fd);
+   }
+   if(n_responses == 0) return;
+   n_requests_ += n_responses;
+   ++n_batches_;
+
+   iovec iovs[max_batch];
+   mmsghdr msgs[max_batch];
+   memset(msgs, 0, sizeof(msgs));
+   for(size_t i = 0; i < n_responses; ++i) {
+      iovs[i]                    = {&responses[i], sizeof(responses[i])};
+      msgs[i].msg_hdr.msg_iov    = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+   for(size_t sent = 0; sent < n_responses;) {
+      const int n = sendmmsg(
+          c.fd, msgs + sent, unsigned(n_responses - sent), MSG_NOSIGNAL);
+      if(n <= 0) {
+         c.closed = true;
+         break;
+      }
+      sent += size_t(n);
+   }
+}
+
+hashd::Response HashdServer::handle_(Connection& c,
+                                     const hashd::Request& request,
+                                     const uint8_t* payload,
+                                     size_t payload_size,
+                                     int passed_fd) noexcept
+{
+   hashd::Response response;
+   memset(&response, 0, sizeof(response));
+   response.session = request.session;
+
+   // The bytes to hash: inline, or a range of the memfd
+   const uint8_t* data = payload;
+   size_t size         = payload_size;
+   int range_error     = 0;
+   if(request.op == hashd::Op::append_shared
+      || request.op == hashd::Op::hash_shared) {
+      if(c.ring == nullptr || request.offset > c.ring_size
+         || request.length > c.ring_size - request.offset) {
+         range_error = ERANGE;
+         size        = 0;
+      } else {
+         data = c.ring + request.offset;
+         size = size_t(request.length);
+         n_shared_ += size;
+      }
+   }
+
+   const auto session = c.sessions.find(request.session);
+   const bool found   = session != c.sessions.end();
+   switch(request.op) {
+   case hashd::Op::attach:
+      if(passed_fd < 0) {
+         response.status = EBADF;
+         break;
+      }
+      response.status = attach_(c, passed_fd, request.length);
+      passed_fd       = -1;
+      break;
+
+   case hashd::Op::open: {
+      const auto algorithm = to_algorithm(request.algorithm);
+      if(!algorithm)
+         response.status = EINVAL;
+      else if(c.sessions.size() >= options_.max_sessions)
+         response.status = EMFILE;
+      else if(!c.sessions.emplace(request.session, Session(*algorithm))
+                   .second)
+         response.status = EEXIST;
+      break;
+   }
+
+   case hashd::Op::append:
+   case hashd::Op::append_shared:
+      if(!found) {
+         response.status = ENOENT;
+      } else if(range_error != 0) {
+         response.status = range_error;
+         if(session->second.error == 0) session->second.error = range_error;
+      } else {
+         session->second.append(data, size);
+         n_bytes_ += size;
+      }
+      break;
+
+   case hashd::Op::finish:
+   case hashd::Op::digest:
+      if(!found) {
+         response.status = ENOENT;
+         break;
+      }
+      if(session->second.error != 0)
+         response.status = session->second.error;
+      else
+         session->second.get_digest(response);
+      if(request.op == hashd::Op::finish) c.sessions.erase(session);
+      break;
+
+   case hashd::Op::discard:
+      if(!found)
+         response.status = ENOENT;
+      else
+         c.sessions.erase(session);
+      break;
+
+   case hashd::Op::hash:
+   case hashd::Op::hash_shared: {
+      const auto algorithm = to_algorithm(request.algorithm);
+      if(!algorithm) {
+         response.status = EINVAL;
+      } else if(range_error != 0) {
+         response.status = range_error;
+      } else {
+         Session one_shot(*algorithm);
+         one_shot.append(data, size);
+         one_shot.get_digest(response);
+         n_bytes_ += size;
+      }
+      break;
+   }
+
+   default: response.status = EINVAL;
+   }
+
+   if(passed_fd >= 0) ::close(passed_fd);
+   return response;
+}
+
+// Maps the client's ring, which must be sealed against shrinking: otherwise
+// the client could truncate it while we read it, and we would take SIGBUS
+int HashdServer::attach_(Connection& c, int fd, uint64_t length) noexcept
+{
+   struct stat st;
+   const int seals = fcntl(fd, F_GET_SEALS);
+   int error       = 0;
+   if(seals < 0 || !(seals & F_SEAL_SHRINK))
+      error = EPERM;
+   else if(length == 0 || length > options_.max_ring_size
+           || fstat(fd, &st) != 0 || uint64_t(st.st_size) < length)
+      error = EINVAL;
+
+   void* ring = MAP_FAILED;
+   if(error == 0) {
+      ring = mmap(nullptr, size_t(length), PROT_READ, MAP_SHARED, fd, 0);
+      if(ring == MAP_FAILED) error = errno;
+   }
+   ::close(fd);
+   if(error != 0) return error;
+
+   if(c.ring != nullptr) munmap(c.ring, c.ring_size);
+   c.ring      = static_cast<uint8_t*>(ring);
+   c.ring_size = size_t(length);
+   return 0;
+}
@@ -0,0 +1,87 @@
+
+#pragma once
+
+#include "hashd_protocol.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A local hashing service, so that processes on a host share one thread
+// pool rather than each hashing on its own
+//
+// Clients (see hashd_client.hpp) connect to a Unix socket and pipeline
+// requests; see hashd_protocol.hpp for the wire format. Payloads of more
+// than a few KiB are not sent through the socket, which would copy them
+// twice, but written once into a memfd ring the client shares with the
+// service when it connects.
+//
+// The service thread only polls. When a connection becomes readable, one
+// pool task drains every request queued on it (up to a limit, so that a
+// busy client can't starve the others), hashes them back to back, and
+// sends all the responses with a single sendmmsg(). A connection is only
+// ever served by one task at a time, so its sessions need no lock, while
+// different connections are hashed in parallel.
+//
+// usage: HashdServer server;
+//        server.serve("/run/hashd.sock", options); // until stop()
+struct HashdOptions
+{
+   unsigned n_threads   = 0;         // 0 means one per hardware thread
+   size_t max_ring_size = 256 << 20; // largest memfd a client may attach
+   size_t max_sessions  = 1024;      // open at once, per connection
+};
+
+struct HashdStats
+{
+   uint64_t n_connections = 0; // accepted since serve()
+   uint64_t n_requests    = 0;
+   uint64_t n_batches     = 0; // pool tasks, each answering >= 1 request
+   uint64_t n_bytes       = 0; // hashed, inline or shared
+   uint64_t n_shared      = 0; // of which read from memfds
+};
+
+class HashdServer
+{
+ public:
+   HashdServer() noexcept;
+   HashdServer(const HashdServer&) = delete;
+   HashdServer& operator=(const HashdServer&) = delete;
+   ~HashdServer() noexcept;
+
+   // Serves `socket_path` until `stop()`. A stale socket there is replaced;
+   // anything else is left in place, and is an error. False if the socket
+   // cannot be created.
+   bool serve(const std::string& socket_path,
+              const HashdOptions& options = {}) noexcept;
+
+   // Safe from any thread, and from a signal handler
+   void stop() noexcept;
+
+   HashdStats stats() const noexcept;
+
+ private:
+   struct Connection;
+
+   HashdOptions options_;
+   int stop_fd_ = -1; // eventfd
+   int wake_fd_ = -1; // eventfd: a task finished with a connection
+   std::unique_ptr<ThreadPool> pool_;
+
+   std::atomic<uint64_t> n_connections_{0};
+   std::atomic<uint64_t> n_requests_{0};
+   std::atomic<uint64_t> n_batches_{0};
+   std::atomic<uint64_t> n_bytes_{0};
+   std::atomic<uint64_t> n_shared_{0};
+
+   void drain_(Connection& connection) noexcept;
+   hashd::Response handle_(Connection& connection,
+                           const hashd::Request& request,
+                           const uint8_t* payload,
+                           size_t payload_size,
+                           int passed_fd) noexcept;
+   int attach_(Connection& connection, int fd, uint64_t length) noexcept;
+};
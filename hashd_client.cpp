@@ -0,0 +1,410 @@
+
+#include "hashd_client.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------- helpers
+
+static std::optional<std::vector<uint8_t>>
+digest_of(const std::optional<hashd::Response>& response) noexcept
+{
+   if(!response || response->status != 0
+      || response->digest_size > sizeof(response->digest))
+      return std::nullopt;
+   return std::vector<uint8_t>(response->digest,
+                               response->digest + response->digest_size);
+}
+
+// ---------------------------------------------------------------------- client
+
+HashdClient::~HashdClient() noexcept { close(); }
+
+std::string HashdClient::default_socket_path() noexcept
+{
+   const char* path = getenv("HASHD_SOCKET");
+   return path != nullptr && *path != '\0' ? path : "/run/hashd.sock";
+}
+
+bool HashdClient::connect(const std::string& socket_path,
+                          size_t ring_size) noexcept
+{
+   close();
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if(socket_path.size() >= sizeof(address.sun_path)) return false;
+   memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+   fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if(fd_ < 0) return false;
+   if(::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+      != 0) {
+      close();
+      return false;
+   }
+
+   if(ring_size >= shared_threshold) {
+      ring_size_ = ring_size;
+      attach_();
+   }
+   return is_connected();
+}
+
+void HashdClient::close() noexcept
+{
+   if(fd_ >= 0) ::close(fd_);
+   if(ring_ != nullptr) munmap(ring_, ring_size_);
+   fd_        = -1;
+   ring_      = nullptr;
+   ring_size_ = 0;
+   head_ = tail_ = 0;
+   pending_.clear();
+}
+
+// Creates the ring, and shares it. The seals are what make it safe for the
+// server to map: the ring can never shrink under it.
+bool HashdClient::attach_() noexcept
+{
+   const int memfd
+       = memfd_create("hashd-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+   const int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+   bool ok         = memfd >= 0 && ftruncate(memfd, off_t(ring_size_)) == 0
+             && fcntl(memfd, F_ADD_SEALS, seals) == 0;
+   void* ring = ok ? mmap(nullptr,
+                          ring_size_,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED,
+                          memfd,
+                          0)
+                   : MAP_FAILED;
+
+   if(ring != MAP_FAILED) {
+      const hashd::Request request = {hashd::Op::attach, 0, 0, 0, ring_size_};
+      hashd::Response response;
+      ok = send_(request, nullptr, 0, 0, memfd) && receive_(response)
+           && response.status == 0;
+   }
+   if(memfd >= 0) ::close(memfd);
+
+   if(ok) {
+      ring_ = static_cast<uint8_t*>(ring);
+   } else {
+      if(ring != MAP_FAILED) munmap(ring, ring_size_);
+      ring_size_ = 0;
+   }
+   return ok;
+}
+
+bool HashdClient::send_(const hashd::Request& request,
+                        const void* payload,
+                        size_t payload_size,
+                        uint64_t ring_end,
+                        int pass_fd) noexcept
+{
+   hashd::Response response;
+   while(fd_ >= 0 && pending_.size() >= max_pending)
+      if(!receive_(response)) return false;
+   if(fd_ < 0) return false;
+
+   iovec iov[2] = {{const_cast<hashd::Request*>(&request), sizeof(request)},
+                   {const_cast<void*>(payload), payload_size}};
+   msghdr msg;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov    = iov;
+   msg.msg_iovlen = payload_size > 0 ? 2 : 1;
+
+   alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+   if(pass_fd >= 0) {
+      msg.msg_control    = control;
+      msg.msg_controllen = sizeof(control);
+      cmsghdr* cmsg      = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level   = SOL_SOCKET;
+      cmsg->cmsg_type    = SCM_RIGHTS;
+      cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+   }
+
+   ssize_t sent;
+   do {
+      sent = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+   } while(sent < 0 && errno == EINTR);
+   if(sent != ssize_t(sizeof(request) + payload_size)) {
+      close();
+      return false;
+   }
+   pending_.push_back({ring_end});
+   return true;
+}
+
+// The response to the oldest pending request
+bool HashdClient::receive_(hashd::Response& response) noexcept
+{
+   ssize_t got;
+   do {
+      got = recv(fd_, &response, sizeof(response), 0);
+   } while(got < 0 && errno == EINTR);
+   if(got != ssize_t(sizeof(response)) || pending_.empty()) {
+      close();
+      return false;
+   }
+   if(pending_.front().ring_end != 0) tail_ = pending_.front().ring_end;
+   pending_.pop_front();
+   return true;
+}
+
+// Sends `request`, and waits for its response
+std::optional<hashd::Response> HashdClient::call_(const hashd::Request& request,
+                                                  const void* payload,
+                                                  size_t payload_size,
+                                                  uint64_t ring_end) noexcept
+{
+   if(!send_(request, payload, payload_size, ring_end)) return std::nullopt;
+   hashd::Response response;
+   while(!pending_.empty())
+      if(!receive_(response)) return std::nullopt;
+   return response;
+}
+
+// The offset of `size` contiguous bytes of the ring, free for us to write,
+// waiting for the server to finish with earlier chunks if need be
+std::optional<uint64_t> HashdClient::reserve_(size_t size) noexcept
+{
+   // A chunk that doesn't fit before the end of the ring goes at its start
+   const size_t position = size_t(head_ % ring_size_);
+   if(ring_size_ - position < size) head_ += ring_size_ - position;
+
+   hashd::Response response;
+   while(ring_size_ - (head_ - tail_) < size) {
+      if(pending_.empty())
+         tail_ = head_;
+      else if(!receive_(response))
+         return std::nullopt;
+   }
+   const uint64_t offset = head_ % ring_size_;
+   head_ += size;
+   return offset;
+}
+
+std::optional<uint64_t> HashdClient::open(HashAlgorithm algorithm) noexcept
+{
+   const uint64_t session = next_session_++;
+   const hashd::Request request
+       = {hashd::Op::open, uint32_t(algorithm), session, 0, 0};
+   if(!send_(request, nullptr, 0)) return std::nullopt;
+   return session;
+}
+
+bool HashdClient::append(uint64_t session,
+                         const void* data,
+                         size_t size) noexcept
+{
+   auto p = static_cast<const uint8_t*>(data);
+   while(size > 0) {
+      hashd::Request request = {hashd::Op::append, 0, session, 0, 0};
+      size_t n;
+      if(ring_ == nullptr || size < shared_threshold) {
+         n              = std::min(size, hashd::max_inline);
+         request.length = n;
+         if(!send_(request, p, n)) return false;
+      } else {
+         n                 = std::min(size, ring_size_ / 4);
+         const auto offset = reserve_(n);
+         if(!offset) return false;
+         memcpy(ring_ + *offset, p, n);
+         request.op     = hashd::Op::append_shared;
+         request.offset = *offset;
+         request.length = n;
+         if(!send_(request, nullptr, 0, head_)) return false;
+      }
+      p += n;
+      size -= n;
+   }
+   return is_connected();
+}
+
+std::optional<std::vector<uint8_t>>
+HashdClient::finish(uint64_t session) noexcept
+{
+   return digest_of(call_({hashd::Op::finish, 0, session, 0, 0}));
+}
+
+std::optional<std::vector<uint8_t>>
+HashdClient::digest(uint64_t session) noexcept
+{
+   return digest_of(call_({hashd::Op::digest, 0, session, 0, 0}));
+}
+
+void HashdClient::discard(uint64_t session) noexcept
+{
+   send_({hashd::Op::discard, 0, session, 0, 0}, nullptr, 0);
+}
+
+std::optional<std::vector<uint8_t>> HashdClient::hash(HashAlgorithm algorithm,
+                                                      const void* data,
+                                                      size_t size) noexcept
+{
+   const auto a = uint32_t(algorithm);
+   if((ring_ == nullptr || size < shared_threshold)
+      && size <= hashd::max_inline)
+      return digest_of(call_({hashd::Op::hash, a, 0, 0, size}, data, size));
+
+   if(ring_ != nullptr && size <= ring_size_ / 4) {
+      const auto offset = reserve_(size);
+      if(!offset) return std::nullopt;
+      memcpy(ring_ + *offset, data, size);
+      return digest_of(call_(
+          {hashd::Op::hash_shared, a, 0, *offset, size}, nullptr, 0, head_));
+   }
+
+   const auto session = open(algorithm);
+   if(!session || !append(*session, data, size)) return std::nullopt;
+   return finish(*session);
+}
+
+HashdClient* HashdClient::thread_default() noexcept
+{
+   thread_local HashdClient client;
+   thread_local bool tried = false;
+   if(!tried) {
+      tried = true;
+      client.connect();
+   }
+   return client.is_connected() ? &client : nullptr;
+}
+
+// -------------------------------------------------------------- remote hashers
+
+template<typename Local>
+RemoteHasher<Local>::RemoteHasher(HashdClient* client) noexcept
+    : client_(client)
+{
+   const auto session = client_ == nullptr
+                            ? std::nullopt
+                            : client_->open(HashdAlgorithm<Local>::algorithm);
+   if(session)
+      session_ = *session;
+   else
+      client_ = nullptr;
+}
+
+template<typename Local>
+RemoteHasher<Local>::RemoteHasher(std::string_view text) noexcept
+    : RemoteHasher()
+{
+   append(text);
+}
+
+template<typename Local> RemoteHasher<Local>::~RemoteHasher() noexcept
+{
+   if(client_ != nullptr && !finalized_) client_->discard(session_);
+}
+
+template<typename Local>
+void RemoteHasher<Local>::append(std::string_view text) noexcept
+{
+   append(text.data(), text.size());
+}
+
+template<typename Local>
+void RemoteHasher<Local>::append(const unsigned char* buf,
+                                 size_t length) noexcept
+{
+   append(static_cast<const void*>(buf), length);
+}
+
+template<typename Local>
+void RemoteHasher<Local>::append(const char* buf, size_t length) noexcept
+{
+   append(static_cast<const void*>(buf), length);
+}
+
+template<typename Local>
+void RemoteHasher<Local>::append(const void* buf, size_t length) noexcept
+{
+   current_digest_.reset();
+   if(client_ == nullptr)
+      local_.append(buf, length);
+   else if(ok_ && !client_->append(session_, buf, length))
+      ok_ = false;
+}
+
+template<typename Local>
+RemoteHasher<Local>& RemoteHasher<Local>::finish() noexcept
+{
+   if(finalized_) return *this;
+   finalized_ = true;
+   if(client_ == nullptr) {
+      local_.finish();
+      local_.get_digest(digest_.data());
+      return *this;
+   }
+   std::optional<std::vector<uint8_t>> digest;
+   if(ok_) digest = client_->finish(session_);
+   if(digest && digest->size() == digest_.size())
+      std::copy(digest->begin(), digest->end(), digest_.begin());
+   else
+      ok_ = false;
+   return *this;
+}
+
+template<typename Local>
+std::optional<typename RemoteHasher<Local>::Digest>
+RemoteHasher<Local>::current_() const noexcept
+{
+   if(!ok_) return std::nullopt;
+   if(finalized_) return digest_;
+   if(current_digest_) return current_digest_;
+
+   Digest digest = {};
+   if(client_ == nullptr) {
+      Local copy = local_;
+      copy.finish().get_digest(digest.data());
+   } else {
+      const auto remote = client_->digest(session_);
+      if(!remote || remote->size() != digest.size()) return std::nullopt;
+      std::copy(remote->begin(), remote->end(), digest.begin());
+   }
+   current_digest_ = digest;
+   return digest;
+}
+
+template<typename Local> std::string RemoteHasher<Local>::hexdigest() noexcept
+{
+   finish();
+   return ok_ ? to_hex(digest_) : std::string();
+}
+
+template<typename Local>
+std::string RemoteHasher<Local>::hexdigest() const noexcept
+{
+   const auto digest = current_();
+   return digest ? to_hex(*digest) : std::string();
+}
+
+template<typename Local>
+bool RemoteHasher<Local>::get_digest(uint8_t* hash) const noexcept
+{
+   const auto digest = current_();
+   if(digest) std::copy(digest->begin(), digest->end(), hash);
+   return digest.has_value();
+}
+
+template<typename Local>
+std::optional<typename RemoteHasher<Local>::Digest>
+RemoteHasher<Local>::get_digest() const noexcept
+{
+   return current_();
+}
+
+template class RemoteHasher<Sha256>;
+template class RemoteHasher<MD5>;
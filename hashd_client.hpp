@@ -0,0 +1,189 @@
+
+#pragma once
+
+#include "hashd_protocol.hpp"
+#include "hashsum.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A connection to hashd (see hashd.hpp)
+//
+// Requests are pipelined: `open()` and `append()` return as soon as the
+// request is sent, and their acknowledgements are collected later, so a
+// stream of appends costs one system call each and no round trips. An
+// append that fails on the server fails the session, which `finish()` then
+// reports.
+//
+// Appends of `shared_threshold` bytes or more are copied into a memfd ring
+// shared with the server when connecting, in chunks of a quarter of the
+// ring, rather than sent through the socket. Space is reclaimed as the
+// server acknowledges the chunks.
+//
+// A HashdClient is not thread-safe; `thread_default()` gives each thread
+// its own connection.
+//
+// usage: HashdClient client;
+//        if(client.connect()) digest = client.hash(HashAlgorithm::sha256,
+//                                                  data, size);
+class HashdClient
+{
+ public:
+   static constexpr size_t default_ring_size = 4 << 20;
+   static constexpr size_t shared_threshold  = 8 << 10;
+
+   HashdClient() = default;
+   HashdClient(const HashdClient&) = delete;
+   HashdClient& operator=(const HashdClient&) = delete;
+   ~HashdClient() noexcept;
+
+   // $HASHD_SOCKET, or /run/hashd.sock
+   static std::string default_socket_path() noexcept;
+
+   // False if the service isn't running. A ring_size of 0, or a kernel
+   // without memfd sealing, sends every payload through the socket.
+   bool connect(const std::string& socket_path = default_socket_path(),
+                size_t ring_size = default_ring_size) noexcept;
+   void close() noexcept;
+   bool is_connected() const noexcept { return fd_ >= 0; }
+   bool has_ring() const noexcept { return ring_ != nullptr; }
+
+   // A new session's id, or std::nullopt if not connected
+   std::optional<uint64_t> open(HashAlgorithm algorithm) noexcept;
+
+   // False if the connection was lost
+   bool append(uint64_t session, const void* data, size_t size) noexcept;
+
+   // The digest, ending the session; std::nullopt if an append failed
+   std::optional<std::vector<uint8_t>> finish(uint64_t session) noexcept;
+
+   // The digest of the data appended so far; the session continues
+   std::optional<std::vector<uint8_t>> digest(uint64_t session) noexcept;
+
+   void discard(uint64_t session) noexcept;
+
+   // One shot
+   std::optional<std::vector<uint8_t>>
+   hash(HashAlgorithm algorithm, const void* data, size_t size) noexcept;
+
+   // This thread's connection to default_socket_path(), attempted once per
+   // thread; nullptr if the service wasn't running, or has gone away
+   static HashdClient* thread_default() noexcept;
+
+ private:
+   struct Pending
+   {
+      uint64_t ring_end; // what the ring's tail becomes when answered, or 0
+   };
+
+   // Responses owed by the server, beyond which we wait for one before
+   // sending more, so that neither side can fill the other's socket buffer
+   static constexpr size_t max_pending = 64;
+
+   int fd_                = -1;
+   uint8_t* ring_         = nullptr;
+   size_t ring_size_      = 0;
+   uint64_t head_         = 0; // bytes ever reserved in the ring
+   uint64_t tail_         = 0; // bytes ever released
+   uint64_t next_session_ = 1;
+   std::deque<Pending> pending_;
+
+   bool send_(const hashd::Request& request,
+              const void* payload,
+              size_t payload_size,
+              uint64_t ring_end = 0,
+              int pass_fd       = -1) noexcept;
+   bool receive_(hashd::Response& response) noexcept;
+   std::optional<hashd::Response> call_(const hashd::Request& request,
+                                        const void* payload = nullptr,
+                                        size_t payload_size = 0,
+                                        uint64_t ring_end   = 0) noexcept;
+   std::optional<uint64_t> reserve_(size_t size) noexcept;
+   bool attach_() noexcept;
+};
+
+// -------------------------------------------------------------- remote hashers
+
+template<typename Hasher> struct HashdAlgorithm;
+
+template<> struct HashdAlgorithm<Sha256>
+{
+   static constexpr HashAlgorithm algorithm = HashAlgorithm::sha256;
+   using Digest                             = Sha256Digest;
+};
+
+template<> struct HashdAlgorithm<MD5>
+{
+   static constexpr HashAlgorithm algorithm = HashAlgorithm::md5;
+   using Digest                             = Md5Digest;
+};
+
+// A drop-in for `Local` (Sha256 or MD5) that hashes on hashd
+//
+// Without a connection, the data is hashed locally by `Local`, so callers
+// need not care whether the service is running. If the connection is lost
+// part way through, the data sent so far is lost with it: `ok()` becomes
+// false, `hexdigest()` is empty, and `get_digest()` has no digest to give,
+// so a failure can't pass for a digest.
+//
+// The const `hexdigest()` and `get_digest()` digest the data so far without
+// finishing, which for a remote hasher is a blocking round trip to hashd.
+// The result is kept until the next append.
+//
+// usage: RemoteSha256 hash;
+//        hash.append(data, size);
+//        std::cout << hash.hexdigest();
+template<typename Local> class RemoteHasher
+{
+ public:
+   using Digest = typename HashdAlgorithm<Local>::Digest;
+
+   explicit RemoteHasher(
+       HashdClient* client = HashdClient::thread_default()) noexcept;
+   RemoteHasher(std::string_view text) noexcept;
+   RemoteHasher(const RemoteHasher&) = delete;
+   RemoteHasher& operator=(const RemoteHasher&) = delete;
+   ~RemoteHasher() noexcept;
+
+   void append(std::string_view text) noexcept;
+   void append(const unsigned char* buf, size_t length) noexcept;
+   void append(const char* buf, size_t length) noexcept;
+   void append(const void* buf, size_t length) noexcept;
+
+   std::string hexdigest() noexcept; // empty on failure
+   std::string hexdigest() const noexcept;
+
+   size_t digest_size() const noexcept { return Digest().size(); }
+   [[nodiscard]] bool get_digest(uint8_t* hash) const noexcept;
+   std::optional<Digest> get_digest() const noexcept;
+
+   // Finish called automatically
+   RemoteHasher& finish() noexcept;
+
+   bool remote() const noexcept { return client_ != nullptr; }
+   bool ok() const noexcept { return ok_; }
+
+ private:
+   HashdClient* client_ = nullptr;
+   uint64_t session_    = 0;
+   Local local_;
+   Digest digest_  = {};
+   bool finalized_ = false;
+   bool ok_        = true;
+   mutable std::optional<Digest> current_digest_; // until the next append
+
+   std::optional<Digest> current_() const noexcept;
+};
+
+using RemoteSha256 = RemoteHasher<Sha256>;
+using RemoteMD5    = RemoteHasher<MD5>;
+
+extern template class RemoteHasher<Sha256>;
+extern template class RemoteHasher<MD5>;
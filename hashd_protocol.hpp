@@ -0,0 +1,51 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The wire format between hashd and its clients
+//
+// Messages travel over a SOCK_SEQPACKET Unix socket, so each request and
+// response is one message, in host byte order. Every request gets exactly
+// one response, in order, which lets clients pipeline appends and collect
+// the acknowledgements later.
+//
+// Small payloads follow the request header in the same message. Large
+// ones are written by the client into a memfd it shared once with
+// `attach` (passing the descriptor with SCM_RIGHTS, sealed against
+// shrinking so the server can never fault on it), and are named by offset
+// and length.
+namespace hashd
+{
+enum class Op : uint32_t {
+   attach        = 1, // SCM_RIGHTS memfd of `length` bytes
+   open          = 2, // start a session for `algorithm`
+   append        = 3, // inline payload to `session`
+   append_shared = 4, // [offset, offset + length) of the memfd
+   finish        = 5, // ends `session`, returning its digest
+   discard       = 6, // ends `session` without a digest
+   hash          = 7, // one shot of an inline payload
+   hash_shared   = 8, // one shot of a memfd range
+   digest        = 9  // the digest of `session` so far; it continues
+};
+
+struct Request
+{
+   Op op;
+   uint32_t algorithm; // HashAlgorithm, for open and hash*
+   uint64_t session;
+   uint64_t offset;
+   uint64_t length;
+};
+
+struct Response
+{
+   int32_t status; // 0, or an errno value
+   uint32_t digest_size;
+   uint64_t session;
+   uint8_t digest[32]; // `digest_size` bytes used
+};
+
+constexpr size_t max_inline = 64 << 10; // payload bytes after a Request
+} // namespace hashd
@@ -0,0 +1,219 @@
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+// Hash data as it is written to, or read from, a stream
+//
+// HashingStreamBuf sits in front of a target streambuf. Writes collect in
+// its own buffer; when that fills (or on flush), the bytes are passed on to
+// the target in one piece, and hashed. Writes at least as large as the
+// buffer skip it. Only bytes the target accepted are hashed: on a short
+// write the stream fails, and the rest stays buffered. With no target, the
+// bytes are only hashed.
+//
+// HashingInputBuf reads from a source streambuf, a buffer at a time, and
+// hashes bytes as the reader consumes them: bytes read ahead into the
+// buffer but never consumed are not part of the digest.
+//
+// ohashstream and ihashstream are the matching std::ostream and
+// std::istream. `finish()` flushes, and returns the finished hasher.
+//
+// usage: std::ofstream file("out.bin", std::ios::binary);
+//        ohashstream<Sha256> out(file);
+//        serialize(out, object);
+//        const auto digest = out.finish().hexdigest();
+template<typename Hasher> class HashingStreamBuf : public std::streambuf
+{
+ public:
+   static constexpr size_t default_buffer_size = 64 << 10;
+
+   explicit HashingStreamBuf(std::streambuf* target,
+                             size_t buffer_size = default_buffer_size)
+       : target_(target)
+       , buffer_(std::max<size_t>(buffer_size, 1))
+   {
+      setp(buffer_.data(), buffer_.data() + buffer_.size());
+   }
+   HashingStreamBuf(const HashingStreamBuf&) = delete;
+   HashingStreamBuf& operator=(const HashingStreamBuf&) = delete;
+   ~HashingStreamBuf() override { flush_(); }
+
+   Hasher& finish()
+   {
+      sync();
+      return hasher_.finish();
+   }
+   const Hasher& hasher() const noexcept { return hasher_; }
+
+ protected:
+   int_type overflow(int_type c) override
+   {
+      if(!flush_()) return traits_type::eof();
+      if(!traits_type::eq_int_type(c, traits_type::eof())) {
+         *pptr() = traits_type::to_char_type(c);
+         pbump(1);
+      }
+      return traits_type::not_eof(c);
+   }
+
+   std::streamsize xsputn(const char* s, std::streamsize n) override
+   {
+      if(n < epptr() - pptr()) {
+         memcpy(pptr(), s, size_t(n));
+         pbump(int(n));
+         return n;
+      }
+      if(!flush_()) return 0;
+      if(size_t(n) < buffer_.size()) return xsputn(s, n);
+      return write_(s, n);
+   }
+
+   int sync() override
+   {
+      if(!flush_()) return -1;
+      return target_ == nullptr || target_->pubsync() != -1 ? 0 : -1;
+   }
+
+ private:
+   std::streambuf* target_;
+   std::vector<char> buffer_;
+   Hasher hasher_;
+
+   // Writes to the target, then hashes what it accepted, so that the digest
+   // is always that of the bytes written. Returns the number accepted.
+   std::streamsize write_(const char* s, std::streamsize n)
+   {
+      std::streamsize written = n;
+      if(target_ != nullptr)
+         written = std::max<std::streamsize>(target_->sputn(s, n), 0);
+      hasher_.append(s, size_t(written));
+      return written;
+   }
+
+   // On a short write, the bytes not written stay buffered, for a retry
+   bool flush_()
+   {
+      const auto n       = pptr() - pbase();
+      const auto written = n == 0 ? 0 : write_(pbase(), n);
+      memmove(buffer_.data(), pbase() + written, size_t(n - written));
+      setp(buffer_.data(), buffer_.data() + buffer_.size());
+      pbump(int(n - written));
+      return written == n;
+   }
+};
+
+template<typename Hasher> class HashingInputBuf : public std::streambuf
+{
+ public:
+   static constexpr size_t default_buffer_size = 64 << 10;
+
+   explicit HashingInputBuf(std::streambuf* source,
+                            size_t buffer_size = default_buffer_size)
+       : source_(source)
+       , buffer_(std::max<size_t>(buffer_size, 1))
+   {
+      setg(buffer_.data(), buffer_.data(), buffer_.data());
+   }
+   HashingInputBuf(const HashingInputBuf&) = delete;
+   HashingInputBuf& operator=(const HashingInputBuf&) = delete;
+
+   // The hash of every byte consumed
+   Hasher& finish()
+   {
+      hash_consumed_();
+      return hasher_.finish();
+   }
+
+ protected:
+   int_type underflow() override
+   {
+      hash_consumed_();
+      const auto n = source_->sgetn(buffer_.data(), buffer_.size());
+      if(n <= 0) return traits_type::eof();
+      setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+      hashed_ = buffer_.data();
+      return traits_type::to_int_type(*gptr());
+   }
+
+   std::streamsize xsgetn(char* s, std::streamsize n) override
+   {
+      // Large reads go straight from the source to the caller
+      const auto buffered = std::min(n, egptr() - gptr());
+      if(n - buffered < std::streamsize(buffer_.size()))
+         return std::streambuf::xsgetn(s, n);
+
+      memcpy(s, gptr(), size_t(buffered));
+      gbump(int(buffered));
+      hash_consumed_();
+      const auto got = source_->sgetn(s + buffered, n - buffered);
+      if(got <= 0) return buffered;
+      hasher_.append(s + buffered, size_t(got));
+      return buffered + got;
+   }
+
+ private:
+   std::streambuf* source_;
+   std::vector<char> buffer_;
+   char* hashed_ = buffer_.data(); // bytes of the buffer before this are
+   Hasher hasher_;                 // hashed
+
+   void hash_consumed_()
+   {
+      if(gptr() > hashed_) hasher_.append(hashed_, size_t(gptr() - hashed_));
+      hashed_ = gptr();
+   }
+};
+
+template<typename Hasher> class ohashstream : public std::ostream
+{
+ public:
+   // With no target, the stream only hashes
+   explicit ohashstream(std::streambuf* target = nullptr,
+                        size_t buffer_size
+                        = HashingStreamBuf<Hasher>::default_buffer_size)
+       : std::ostream(nullptr)
+       , buf_(target, buffer_size)
+   {
+      init(&buf_);
+   }
+   explicit ohashstream(std::ostream& target)
+       : ohashstream(target.rdbuf())
+   {}
+
+   Hasher& finish()
+   {
+      flush();
+      return buf_.finish();
+   }
+
+ private:
+   HashingStreamBuf<Hasher> buf_;
+};
+
+template<typename Hasher> class ihashstream : public std::istream
+{
+ public:
+   explicit ihashstream(std::streambuf* source,
+                        size_t buffer_size
+                        = HashingInputBuf<Hasher>::default_buffer_size)
+       : std::istream(nullptr)
+       , buf_(source, buffer_size)
+   {
+      init(&buf_);
+   }
+   explicit ihashstream(std::istream& source)
+       : ihashstream(source.rdbuf())
+   {}
+
+   Hasher& finish() { return buf_.finish(); }
+
+ private:
+   HashingInputBuf<Hasher> buf_;
+};
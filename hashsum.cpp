@@ -0,0 +1,296 @@
+
+#include "hashsum.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ------------------------------------------------------------------ algorithms
+
+namespace
+{
+struct AlgorithmInfo
+{
+   HashAlgorithm algorithm;
+   const char* name;
+   size_t hex_length;
+};
+
+// Add new algorithms here, and to hash_fd_hex
+constexpr AlgorithmInfo algorithms[] = {{HashAlgorithm::md5, "md5", 32},
+                                        {HashAlgorithm::sha256, "sha256", 64}};
+} // namespace
+
+const char* algorithm_name(HashAlgorithm algorithm) noexcept
+{
+   for(const auto& info : algorithms)
+      if(info.algorithm == algorithm) return info.name;
+   return "";
+}
+
+std::optional<HashAlgorithm> parse_algorithm(const std::string& name) noexcept
+{
+   for(const auto& info : algorithms)
+      if(name == info.name) return info.algorithm;
+   return std::nullopt;
+}
+
+std::optional<HashAlgorithm> algorithm_for_hex_length(size_t length) noexcept
+{
+   for(const auto& info : algorithms)
+      if(length == info.hex_length) return info.algorithm;
+   return std::nullopt;
+}
+
+template<typename Hasher>
+static std::optional<std::string>
+hex_of_fd(int fd, const FileHashOptions& options) noexcept
+{
+   Hasher hasher;
+   if(!hash_fd(fd, hasher, options)) return std::nullopt;
+   return hasher.finish().hexdigest();
+}
+
+std::optional<std::string> hash_fd_hex(HashAlgorithm algorithm,
+                                       int fd,
+                                       const FileHashOptions& options) noexcept
+{
+   switch(algorithm) {
+   case HashAlgorithm::md5: return hex_of_fd<MD5>(fd, options);
+   case HashAlgorithm::sha256: return hex_of_fd<Sha256>(fd, options);
+   }
+   return std::nullopt;
+}
+
+// Sets `error` to errno on failure
+static std::string hash_path(const std::string& path,
+                             HashAlgorithm algorithm,
+                             const FileHashOptions& options,
+                             int& error) noexcept
+{
+   error        = 0;
+   const bool s = path == "-";
+   const int fd = s ? STDIN_FILENO : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) {
+      error = errno;
+      return "";
+   }
+   errno    = 0;
+   auto hex = hash_fd_hex(algorithm, fd, options);
+   if(!hex) error = errno != 0 ? errno : EIO;
+   if(!s) close(fd);
+   return hex ? *hex : "";
+}
+
+// --------------------------------------------------------------------- hashsum
+
+namespace
+{
+class TreeWalk
+{
+ public:
+   TreeWalk(ThreadPool& pool, const HashsumOptions& options) noexcept
+       : pool_(pool)
+       , options_(options)
+   {}
+
+   void file(size_t operand, std::string path) noexcept
+   {
+      pool_.submit([this, operand, path = std::move(path)] {
+         HashsumEntry entry;
+         entry.operand   = operand;
+         entry.path      = path;
+         entry.hexdigest = hash_path(
+             path, options_.algorithm, options_.file_options, entry.error);
+         add_(std::move(entry));
+      });
+   }
+
+   void directory(size_t operand, std::string path) noexcept
+   {
+      pool_.submit([this, operand, path = std::move(path)] {
+         list_(operand, path);
+      });
+   }
+
+   void error(size_t operand, std::string path, int error) noexcept
+   {
+      HashsumEntry entry;
+      entry.operand = operand;
+      entry.path    = std::move(path);
+      entry.error   = error;
+      add_(std::move(entry));
+   }
+
+   std::vector<HashsumEntry> take() noexcept { return std::move(entries_); }
+
+ private:
+   ThreadPool& pool_;
+   const HashsumOptions& options_;
+   std::mutex padlock_;
+   std::vector<HashsumEntry> entries_;
+
+   void add_(HashsumEntry entry) noexcept
+   {
+      std::lock_guard<std::mutex> lock(padlock_);
+      entries_.push_back(std::move(entry));
+   }
+
+   void list_(size_t operand, const std::string& path) noexcept
+   {
+      DIR* dir = opendir(path.c_str());
+      if(dir == nullptr) return error(operand, path, errno);
+
+      const std::string prefix = path.back() == '/' ? path : path + '/';
+      while(const dirent* e = readdir(dir)) {
+         if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+         std::string child = prefix + e->d_name;
+
+         // Symbolic links are followed to files, but never to directories
+         unsigned char type = e->d_type;
+         if(type == DT_UNKNOWN || type == DT_LNK) {
+            struct stat st;
+            if(lstat(child.c_str(), &st) != 0) {
+               error(operand, std::move(child), errno);
+               continue;
+            }
+            if(S_ISLNK(st.st_mode)) {
+               if(stat(child.c_str(), &st) != 0) { // dangling
+                  error(operand, std::move(child), errno);
+                  continue;
+               }
+               type = S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            } else
+               type = S_ISDIR(st.st_mode)   ? DT_DIR
+                      : S_ISREG(st.st_mode) ? DT_REG
+                                            : DT_UNKNOWN;
+         }
+
+         if(type == DT_DIR) directory(operand, std::move(child));
+         if(type == DT_REG) file(operand, std::move(child));
+      }
+      closedir(dir);
+   }
+};
+} // namespace
+
+std::vector<HashsumEntry> hashsum(const std::vector<std::string>& paths,
+                                  const HashsumOptions& options) noexcept
+{
+   ThreadPool pool(options.n_threads);
+   TreeWalk walk(pool, options);
+   for(size_t i = 0; i < paths.size(); ++i) {
+      struct stat st;
+      if(paths[i] != "-" && stat(paths[i].c_str(), &st) != 0)
+         walk.error(i, paths[i], errno);
+      else if(paths[i] != "-" && S_ISDIR(st.st_mode))
+         walk.directory(i, paths[i]);
+      else
+         walk.file(i, paths[i]);
+   }
+   pool.wait();
+
+   auto entries = walk.take();
+   std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+      return a.operand != b.operand ? a.operand < b.operand : a.path < b.path;
+   });
+   return entries;
+}
+
+std::string escape_hashsum_path(const std::string& path) noexcept
+{
+   std::string escaped;
+   for(char c : path) {
+      if(c == '\\')
+         escaped += "\\\\";
+      else if(c == '\n')
+         escaped += "\\n";
+      else if(c == '\r')
+         escaped += "\\r";
+      else
+         escaped += c;
+   }
+   return escaped.size() != path.size() ? "\\" + escaped : escaped;
+}
+
+std::string format_hashsum_line(const HashsumEntry& entry) noexcept
+{
+   const auto path = escape_hashsum_path(entry.path);
+   if(path.size() == entry.path.size())
+      return entry.hexdigest + "  " + path + "\n";
+   return "\\" + entry.hexdigest + "  " + path.substr(1) + "\n";
+}
+
+// ------------------------------------------------------------------ check mode
+
+std::optional<ManifestEntry>
+parse_manifest_line(const std::string& line) noexcept
+{
+   size_t pos         = 0;
+   const bool escaped = !line.empty() && line[0] == '\\';
+   if(escaped) ++pos;
+
+   ManifestEntry entry;
+   while(pos < line.size() && isxdigit(static_cast<unsigned char>(line[pos])))
+      entry.hexdigest += char(tolower(static_cast<unsigned char>(line[pos++])));
+   const auto algorithm = algorithm_for_hex_length(entry.hexdigest.size());
+   if(!algorithm) return std::nullopt;
+   entry.algorithm = *algorithm;
+
+   // "  path" or " *path"
+   if(line.size() < pos + 3 || line[pos] != ' ') return std::nullopt;
+   if(line[pos + 1] != ' ' && line[pos + 1] != '*') return std::nullopt;
+   pos += 2;
+
+   auto end = line.size();
+   if(line[end - 1] == '\r') --end; // a manifest written on Windows
+   for(; pos < end; ++pos) {
+      if(!escaped || line[pos] != '\\') {
+         entry.path += line[pos];
+         continue;
+      }
+      if(++pos == end) return std::nullopt;
+      switch(line[pos]) {
+      case '\\': entry.path += '\\'; break;
+      case 'n': entry.path += '\n'; break;
+      case 'r': entry.path += '\r'; break;
+      default: return std::nullopt;
+      }
+   }
+   if(entry.path.empty()) return std::nullopt;
+   return entry;
+}
+
+std::vector<CheckEntry>
+hashsum_check(const std::vector<ManifestEntry>& manifest,
+              const HashsumOptions& options) noexcept
+{
+   std::vector<CheckEntry> results(manifest.size());
+   ThreadPool pool(options.n_threads);
+   for(size_t i = 0; i < manifest.size(); ++i) {
+      pool.submit([&, i] {
+         const auto& expected = manifest[i];
+         auto& result         = results[i];
+         result.path          = expected.path;
+         const auto hex       = hash_path(expected.path,
+                                    expected.algorithm,
+                                    options.file_options,
+                                    result.error);
+         if(result.error != 0)
+            result.status = CheckStatus::unreadable;
+         else if(hex != expected.hexdigest)
+            result.status = CheckStatus::mismatch;
+      });
+   }
+   pool.wait();
+   return results;
+}
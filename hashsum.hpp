@@ -0,0 +1,100 @@
+
+#pragma once
+
+#include "file_hash.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The library half of the `hashsum` tool
+//
+// Files, and every file under directories (recursively, not following
+// symbolic links to directories), are hashed in parallel on a ThreadPool.
+// A directory task lists its entries and submits one task per file and per
+// subdirectory, so a large tree fans out across all workers immediately.
+//
+// Results come back in a deterministic order, whatever the scheduling: by
+// operand, then by path within a directory operand. Lines are formatted as
+// `sha256sum` and `md5sum` print them, so their `-c` can check our output
+// and vice versa.
+//
+// usage: for(const auto& e : hashsum({"src", "README.md"}))
+//           std::cout << format_hashsum_line(e);
+enum class HashAlgorithm { md5, sha256 };
+
+const char* algorithm_name(HashAlgorithm algorithm) noexcept;
+std::optional<HashAlgorithm> parse_algorithm(const std::string& name) noexcept;
+
+// The algorithm producing hex digests of this length, if any
+std::optional<HashAlgorithm> algorithm_for_hex_length(size_t length) noexcept;
+
+// The hex digest of everything from `fd`'s current position to its end
+std::optional<std::string>
+hash_fd_hex(HashAlgorithm algorithm,
+            int fd,
+            const FileHashOptions& options = {}) noexcept;
+
+struct HashsumOptions
+{
+   HashAlgorithm algorithm = HashAlgorithm::sha256;
+   unsigned n_threads      = 0; // 0 means one per hardware thread
+
+   // read(), never mmap(), by default: a file truncated while it is hashed
+   // (a log rotated, say) would raise SIGBUS and kill the whole process
+   FileHashOptions file_options = [] {
+      FileHashOptions file_options;
+      file_options.mmap_threshold = SIZE_MAX;
+      return file_options;
+   }();
+};
+
+struct HashsumEntry
+{
+   size_t operand = 0; // index into the paths given
+   std::string path;
+   std::string hexdigest; // empty on error
+   int error = 0;         // errno
+};
+
+// "-" is standard input
+std::vector<HashsumEntry> hashsum(const std::vector<std::string>& paths,
+                                  const HashsumOptions& options = {}) noexcept;
+
+// "<hex>  <path>\n", where a path containing '\\', '\n' or '\r' is escaped
+// and the line marked with a leading '\\'
+std::string format_hashsum_line(const HashsumEntry& entry) noexcept;
+
+// The path escaped as above, with the leading '\\' if it needed escaping,
+// as `sha256sum -c` prints it
+std::string escape_hashsum_path(const std::string& path) noexcept;
+
+// ------------------------------------------------------------------ check mode
+
+struct ManifestEntry
+{
+   HashAlgorithm algorithm;
+   std::string hexdigest; // lower case
+   std::string path;
+};
+
+// One line of `format_hashsum_line` or `sha256sum` output (either the text
+// "  " or binary " *" separator). std::nullopt if malformed.
+std::optional<ManifestEntry>
+parse_manifest_line(const std::string& line) noexcept;
+
+enum class CheckStatus { ok, mismatch, unreadable };
+
+struct CheckEntry
+{
+   std::string path;
+   CheckStatus status = CheckStatus::ok;
+   int error          = 0; // errno when unreadable
+};
+
+// Re-hashes every entry in parallel. Results are in manifest order.
+std::vector<CheckEntry>
+hashsum_check(const std::vector<ManifestEntry>& manifest,
+              const HashsumOptions& options = {}) noexcept;
@@ -0,0 +1,69 @@
+
+#include "io_util.hpp"
+
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string to_hex(const uint8_t* bytes, size_t length)
+{
+   static constexpr char digits[] = "0123456789abcdef";
+   std::string s(2 * length, '\0');
+   for(size_t i = 0; i < length; ++i) {
+      s[2 * i]     = digits[bytes[i] >> 4];
+      s[2 * i + 1] = digits[bytes[i] & 0x0f];
+   }
+   return s;
+}
+
+bool write_all(int fd, const void* buf, size_t length) noexcept
+{
+   auto ptr = static_cast<const char*>(buf);
+   while(length > 0) {
+      const ssize_t n = ::write(fd, ptr, length);
+      if(n < 0 && errno == EINTR) continue;
+      if(n < 0) return false;
+      ptr += n;
+      length -= size_t(n);
+   }
+   return true;
+}
+
+ssize_t read_retry(int fd, void* buf, size_t length) noexcept
+{
+   ssize_t n;
+   do {
+      n = ::read(fd, buf, length);
+   } while(n < 0 && errno == EINTR);
+   return n;
+}
+
+ssize_t pread_retry(int fd, void* buf, size_t length, uint64_t offset) noexcept
+{
+   ssize_t n;
+   do {
+      n = ::pread(fd, buf, length, off_t(offset));
+   } while(n < 0 && errno == EINTR);
+   return n;
+}
+
+bool pread_all(int fd, void* buf, size_t length, uint64_t offset) noexcept
+{
+   auto ptr = static_cast<char*>(buf);
+   while(length > 0) {
+      const ssize_t n = pread_retry(fd, ptr, length, offset);
+      if(n <= 0) return false;
+      ptr += n;
+      offset += uint64_t(n);
+      length -= size_t(n);
+   }
+   return true;
+}
+
+void unlink_socket(const std::string& path) noexcept
+{
+   struct stat st;
+   if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path.c_str());
+}
@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+#include <time.h>
+
+// Small helpers shared by the hashing backends, the on-disk stores, and the
+// services
+
+// Lower-case hex of `length` bytes
+std::string to_hex(const uint8_t* bytes, size_t length);
+
+// `digest` is any contiguous container of bytes, e.g. Sha256Digest
+template<typename Digest> std::string to_hex(const Digest& digest)
+{
+   return to_hex(digest.data(), digest.size());
+}
+
+// Writes all of `buf`, retrying short writes and EINTR. Returns false on
+// any other error.
+bool write_all(int fd, const void* buf, size_t length) noexcept;
+
+// read(2) and pread(2), retried on EINTR: 0 at end of file, -1 on error
+ssize_t read_retry(int fd, void* buf, size_t length) noexcept;
+ssize_t pread_retry(int fd, void* buf, size_t length, uint64_t offset) noexcept;
+
+// Reads exactly `length` bytes at `offset`. Returns false on error, or if
+// the file ends first.
+bool pread_all(int fd, void* buf, size_t length, uint64_t offset) noexcept;
+
+// Removes `path` if it is a Unix socket, such as one left behind by an
+// earlier server. Anything else there is left alone, so that bind() fails.
+void unlink_socket(const std::string& path) noexcept;
+
+// A stat time, e.g. st_mtim, in nanoseconds since the epoch
+inline int64_t to_ns(const struct timespec& ts) noexcept
+{
+   return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
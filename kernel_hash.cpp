@@ -0,0 +1,346 @@
+
+#include "kernel_hash.hpp"
+#include "io_util.hpp"
+
+#include "file_hash.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/if_alg.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr size_t copy_size = 64 << 10; // when splice() is refused
+
+// ------------------------------------------------------------------ KernelHash
+
+KernelHash::~KernelHash() noexcept { close(); }
+
+bool KernelHash::open(const char* algorithm, size_t digest_size) noexcept
+{
+   close();
+
+   sockaddr_alg sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.salg_family = AF_ALG;
+   strncpy(reinterpret_cast<char*>(sa.salg_type), "hash", sizeof(sa.salg_type));
+   strncpy(reinterpret_cast<char*>(sa.salg_name),
+           algorithm,
+           sizeof(sa.salg_name) - 1);
+
+   tfm_fd_ = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+   if(tfm_fd_ < 0
+      || bind(tfm_fd_, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0) {
+      close();
+      return false;
+   }
+   digest_size_ = digest_size;
+   if(digest_size > digest_.size() || !reset_()) {
+      close();
+      return false;
+   }
+   return true;
+}
+
+void KernelHash::close() noexcept
+{
+   for(int* fd : {&op_fd_, &tfm_fd_, &pipe_[0], &pipe_[1]}) {
+      if(*fd >= 0) ::close(*fd);
+      *fd = -1;
+   }
+   pipe_size_   = 0;
+   digest_size_ = 0;
+   finalized_   = false;
+   ok_          = true;
+}
+
+// Discards any hash in progress, by starting a new operation socket
+bool KernelHash::reset_() noexcept
+{
+   if(op_fd_ >= 0) ::close(op_fd_);
+   op_fd_ = accept4(tfm_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+   return op_fd_ >= 0;
+}
+
+// An append after finish() starts a new hash
+void KernelHash::start_() noexcept
+{
+   if(finalized_) {
+      finalized_ = false;
+      ok_        = true;
+   }
+}
+
+bool KernelHash::send_all_(const void* data, size_t length) noexcept
+{
+   auto ptr = static_cast<const char*>(data);
+   while(length > 0) {
+      const ssize_t n = send(op_fd_, ptr, length, MSG_MORE);
+      if(n < 0 && errno == EINTR) continue;
+      if(n <= 0) return false;
+      ptr += n;
+      length -= size_t(n);
+   }
+   return true;
+}
+
+bool KernelHash::append(std::string_view text) noexcept
+{
+   return append(text.data(), text.size());
+}
+
+bool KernelHash::append(const unsigned char* buf, size_t length) noexcept
+{
+   return append(static_cast<const void*>(buf), length);
+}
+
+bool KernelHash::append(const char* buf, size_t length) noexcept
+{
+   return append(static_cast<const void*>(buf), length);
+}
+
+bool KernelHash::append(const void* data, size_t length) noexcept
+{
+   start_();
+   ok_ = ok_ && op_fd_ >= 0;
+   if(!ok_) return false;
+   if(send_all_(data, length)) return true;
+   reset_();
+   ok_ = false;
+   return false;
+}
+
+// file -> pipe -> socket, without copying through user space. Every send
+// carries SPLICE_F_MORE, so that the kernel does not finish the hash.
+bool KernelHash::send_fd_(int fd, uint64_t offset, uint64_t length) noexcept
+{
+   if(pipe_[0] < 0) {
+      if(pipe2(pipe_, O_CLOEXEC) != 0) return false;
+      const int size = fcntl(pipe_[1], F_SETPIPE_SZ, 1 << 20);
+      pipe_size_     = size > 0 ? size_t(size) : 65536;
+   }
+
+   auto off = loff_t(offset);
+   while(length > 0) {
+      const auto want = size_t(std::min<uint64_t>(length, pipe_size_));
+      const ssize_t n
+          = splice(fd, &off, pipe_[1], nullptr, want, SPLICE_F_MORE);
+      if(n < 0 && errno == EINTR) continue;
+      if(n < 0 && off == loff_t(offset) && (errno == EINVAL || errno == ENOSYS))
+         break; // not spliceable; copy instead
+      if(n < 0) return false;
+      if(n == 0) return true; // end of file
+      length -= uint64_t(n);
+
+      for(auto left = size_t(n); left > 0;) {
+         const ssize_t m
+             = splice(pipe_[0], nullptr, op_fd_, nullptr, left, SPLICE_F_MORE);
+         if(m < 0 && errno == EINTR) continue;
+         if(m <= 0) {
+            // Whatever is left in the pipe would corrupt the next hash
+            ::close(pipe_[0]);
+            ::close(pipe_[1]);
+            pipe_[0] = pipe_[1] = -1;
+            return false;
+         }
+         left -= size_t(m);
+      }
+   }
+   if(length == 0) return true;
+
+   std::vector<char> buffer(copy_size);
+   while(length > 0) {
+      const auto want = size_t(std::min<uint64_t>(length, buffer.size()));
+      const ssize_t n = pread_retry(fd, buffer.data(), want, uint64_t(off));
+      if(n < 0) return false;
+      if(n == 0) return true;
+      if(!send_all_(buffer.data(), size_t(n))) return false;
+      off += n;
+      length -= uint64_t(n);
+   }
+   return true;
+}
+
+bool KernelHash::append_fd(int fd, uint64_t offset, uint64_t length) noexcept
+{
+   start_();
+   ok_ = ok_ && op_fd_ >= 0;
+   if(!ok_) return false;
+   if(send_fd_(fd, offset, length)) return true;
+   reset_();
+   ok_ = false;
+   return false;
+}
+
+bool KernelHash::finish(uint8_t* digest) noexcept
+{
+   // The socket was already reset when an append failed
+   const bool failed = !ok_;
+   finalized_        = false;
+   ok_               = true;
+   if(op_fd_ < 0 || failed) return false;
+
+   // An empty send without MSG_MORE finalizes the hash
+   ssize_t n;
+   do {
+      n = send(op_fd_, nullptr, 0, 0);
+   } while(n < 0 && errno == EINTR);
+   if(n == 0) n = read_retry(op_fd_, digest, digest_size_);
+   const bool ok = n == ssize_t(digest_size_);
+   if(!ok) reset_();
+   return ok;
+}
+
+KernelHash& KernelHash::finish() noexcept
+{
+   if(!finalized_) {
+      ok_        = finish(digest_.data());
+      finalized_ = true;
+   }
+   return *this;
+}
+
+std::string KernelHash::hexdigest() noexcept
+{
+   finish();
+   return static_cast<const KernelHash*>(this)->hexdigest();
+}
+
+std::string KernelHash::hexdigest() const noexcept
+{
+   return finalized_ && ok_ ? to_hex(digest_.data(), digest_size_)
+                            : std::string();
+}
+
+bool KernelHash::get_digest(uint8_t* hash) const noexcept
+{
+   if(!finalized_ || !ok_) return false;
+   memcpy(hash, digest_.data(), digest_size_);
+   return true;
+}
+
+std::vector<uint8_t> KernelHash::get_digest() const noexcept
+{
+   if(!finalized_ || !ok_) return {};
+   return std::vector<uint8_t>(digest_.begin(),
+                               digest_.begin() + ptrdiff_t(digest_size_));
+}
+
+bool kernel_hash_available(const char* algorithm) noexcept
+{
+   KernelHash kh;
+   return kh.open(algorithm, 0);
+}
+
+// --------------------------------------------------------- HashBackendSelector
+
+bool HashBackendSelector::use_kernel(uint64_t file_size) const noexcept
+{
+   size_t i = 0;
+   while(i + 1 < n_classes && file_size > class_sizes[i]) ++i;
+   return measurements_[i].kernel_is_faster;
+}
+
+// MB/s of `hash_once()`, which hashes `size` bytes and returns false on
+// error, run repeatedly for about `seconds`
+template<typename F>
+static double measure(size_t size, double seconds, F&& hash_once) noexcept
+{
+   using clock     = std::chrono::steady_clock;
+   const auto t0   = clock::now();
+   const auto stop = t0 + std::chrono::duration<double>(seconds);
+   uint64_t bytes  = 0;
+   do {
+      if(!hash_once()) return 0.0;
+      bytes += size;
+   } while(clock::now() < stop);
+   const std::chrono::duration<double> elapsed = clock::now() - t0;
+   return double(bytes) / 1e6 / elapsed.count();
+}
+
+template<typename Hasher>
+HashBackendSelector HashBackendSelector::calibrate(double seconds) noexcept
+{
+   using Algorithm = KernelAlgorithm<Hasher>;
+   HashBackendSelector selector;
+
+   KernelHash kh;
+   typename Algorithm::Digest digest;
+   const bool have_kernel = kh.open(Algorithm::name, digest.size());
+
+   // The page cache is what real files are hashed from, hence a memfd
+   const int fd = memfd_create("hash-backend-calibration", MFD_CLOEXEC);
+   std::vector<char> data(class_sizes.back());
+   for(size_t i = 0; i < data.size(); ++i)
+      data[i] = char(i * 2654435761u >> 24);
+
+   for(size_t c = 0; c < n_classes; ++c) {
+      auto& m = selector.measurements_[c];
+      m.size  = class_sizes[c];
+      if(fd < 0 || ftruncate(fd, 0) != 0
+         || pwrite(fd, data.data(), m.size, 0) != ssize_t(m.size))
+         continue;
+
+      m.library_mb_s = measure(m.size, seconds, [&] {
+         Hasher hasher;
+         const bool ok = lseek(fd, 0, SEEK_SET) == 0 && hash_fd(fd, hasher);
+         hasher.finish();
+         return ok;
+      });
+      if(have_kernel)
+         m.kernel_mb_s = measure(m.size, seconds, [&] {
+            return kh.append_fd(fd) && kh.finish(digest.data());
+         });
+      m.kernel_is_faster = m.kernel_mb_s > m.library_mb_s;
+   }
+
+   if(fd >= 0) ::close(fd);
+   return selector;
+}
+
+template HashBackendSelector
+HashBackendSelector::calibrate<MD5>(double) noexcept;
+template HashBackendSelector
+HashBackendSelector::calibrate<Sha256>(double) noexcept;
+
+// -------------------------------------------------------------- hash_file_auto
+
+template<typename Hasher>
+bool hash_file_auto(const std::string& path,
+                    typename KernelAlgorithm<Hasher>::Digest& digest,
+                    const HashBackendSelector& selector) noexcept
+{
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+   struct stat st;
+   bool ok = fstat(fd, &st) == 0;
+
+   bool done = false;
+   if(ok && selector.use_kernel(uint64_t(st.st_size))) {
+      KernelHash kh;
+      done = kh.open(KernelAlgorithm<Hasher>::name, digest.size())
+             && kh.append_fd(fd) && kh.finish(digest.data());
+   }
+   if(ok && !done) {
+      Hasher hasher;
+      ok = hash_fd(fd, hasher);
+      if(ok) hasher.finish().get_digest(digest.data());
+   }
+
+   ::close(fd);
+   return ok;
+}
+
+template bool hash_file_auto<MD5>(const std::string&,
+                                  Md5Digest&,
+                                  const HashBackendSelector&) noexcept;
+template bool hash_file_auto<Sha256>(const std::string&,
+                                     Sha256Digest&,
+                                     const HashBackendSelector&) noexcept;
@@ -0,0 +1,165 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hashing with the Linux kernel crypto API (AF_ALG)
+//
+// On hosts with a hardware hashing driver, the kernel may hash faster than
+// this library, and file data can be spliced from the page cache into the
+// hash socket without being copied to user space.
+//
+// AF_ALG is optional: kernels may be built without it, and sandboxes often
+// block it. Everything here reports failure rather than throwing, and
+// hash_file_auto() falls back to the library's own implementation.
+//
+// KernelHash also has the append() / finish() / hexdigest() / get_digest()
+// interface of Sha256 and MD5, so that it can stand in for them. A failure
+// along the way can't pass for a digest: ok() becomes false, hexdigest() is
+// empty, and get_digest() has no digest to give, until the next hash.
+//
+// usage: KernelHash kh;
+//        Sha256Digest digest;
+//        if(kh.open("sha256", digest.size()) && kh.append_fd(fd)
+//           && kh.finish(digest.data()))
+//           ...
+//      or
+//        if(kh.open("md5", 16)) std::cout << kh.finish().hexdigest();
+class KernelHash
+{
+ public:
+   KernelHash() = default;
+   KernelHash(const KernelHash&) = delete;
+   KernelHash& operator=(const KernelHash&) = delete;
+   ~KernelHash() noexcept;
+
+   // `algorithm` is a kernel crypto API name, such as "sha256" or "md5",
+   // with digests of at most 64 bytes
+   bool open(const char* algorithm, size_t digest_size) noexcept;
+   void close() noexcept;
+   bool is_open() const noexcept { return op_fd_ >= 0; }
+
+   bool append(std::string_view text) noexcept;
+   bool append(const unsigned char* buf, size_t length) noexcept;
+   bool append(const char* buf, size_t length) noexcept;
+   bool append(const void* data, size_t length) noexcept;
+
+   // Hashes `length` bytes of `fd` from `offset`, or up to the end of the
+   // file, with splice() where the kernel supports it. Does not move the
+   // file position.
+   bool append_fd(int fd,
+                  uint64_t offset = 0,
+                  uint64_t length = UINT64_MAX) noexcept;
+
+   // Writes `digest_size` bytes, and readies the socket for a new hash. On
+   // failure, here or in an append since the last finish, the hash is
+   // discarded.
+   bool finish(uint8_t* digest) noexcept;
+
+   // Finishes into a digest kept until the next append
+   KernelHash& finish() noexcept;
+
+   std::string hexdigest() noexcept; // finishes; empty on failure
+   std::string hexdigest() const noexcept;
+
+   size_t digest_size() const noexcept { return digest_size_; }
+   [[nodiscard]] bool get_digest(uint8_t* hash) const noexcept;
+   std::vector<uint8_t> get_digest() const noexcept; // empty on failure
+
+   bool ok() const noexcept { return ok_; }
+
+ private:
+   bool send_all_(const void* data, size_t length) noexcept;
+   bool send_fd_(int fd, uint64_t offset, uint64_t length) noexcept;
+   bool reset_() noexcept;
+   void start_() noexcept;
+
+   int tfm_fd_         = -1; // bound to the algorithm
+   int op_fd_          = -1; // one hash in progress
+   int pipe_[2]        = {-1, -1};
+   size_t pipe_size_   = 0;
+   size_t digest_size_ = 0;
+   std::array<uint8_t, 64> digest_ = {}; // once finished
+   bool finalized_                 = false;
+   bool ok_                        = true; // no failure in this hash
+};
+
+bool kernel_hash_available(const char* algorithm) noexcept;
+
+template<typename Hasher> struct KernelAlgorithm;
+
+template<> struct KernelAlgorithm<Sha256>
+{
+   static constexpr const char* name = "sha256";
+   using Digest                      = Sha256Digest;
+};
+
+template<> struct KernelAlgorithm<MD5>
+{
+   static constexpr const char* name = "md5";
+   using Digest                      = Md5Digest;
+};
+
+// -------------------------------------------------------- HashBackendSelector
+
+// Chooses, per size class, whichever of the library and the kernel hashed
+// files of that size faster on this host
+class HashBackendSelector
+{
+ public:
+   static constexpr size_t n_classes = 4;
+   static constexpr std::array<size_t, n_classes> class_sizes
+       = {4 << 10, 64 << 10, 1 << 20, 16 << 20};
+
+   struct Measurement
+   {
+      size_t size            = 0;
+      double library_mb_s    = 0.0;
+      double kernel_mb_s     = 0.0; // 0 if AF_ALG is unavailable
+      bool kernel_is_faster = false;
+   };
+
+   // Hashes an in-memory file of each class size for about `seconds`,
+   // with each backend
+   template<typename Hasher>
+   static HashBackendSelector calibrate(double seconds = 0.02) noexcept;
+
+   // A default selector never uses the kernel
+   bool use_kernel(uint64_t file_size) const noexcept;
+
+   const std::array<Measurement, n_classes>& measurements() const noexcept
+   {
+      return measurements_;
+   }
+
+ private:
+   std::array<Measurement, n_classes> measurements_;
+};
+
+extern template HashBackendSelector
+HashBackendSelector::calibrate<MD5>(double) noexcept;
+extern template HashBackendSelector
+HashBackendSelector::calibrate<Sha256>(double) noexcept;
+
+// Hashes the file with the kernel if `selector` prefers it for the file's
+// size, and with the library otherwise, or if the kernel fails
+template<typename Hasher>
+bool hash_file_auto(const std::string& path,
+                    typename KernelAlgorithm<Hasher>::Digest& digest,
+                    const HashBackendSelector& selector = {}) noexcept;
+
+extern template bool hash_file_auto<MD5>(const std::string&,
+                                         Md5Digest&,
+                                         const HashBackendSelector&) noexcept;
+extern template bool
+hash_file_auto<Sha256>(const std::string&,
+                       Sha256Digest&,
+                       const HashBackendSelector&) noexcept;
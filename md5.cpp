@@ -44,6 +44,8 @@
 #include <cstdio>
 #include <cstring>
 
+#include <sys/uio.h>
+
 // Constants for MD5Transform routine.
 #define S11 7
 #define S12 12
@@ -385,6 +387,15 @@ void MD5::append(const void* buf, size_t length) noexcept
    append(reinterpret_cast<const unsigned char*>(buf), length);
 }
 
+// Empty segments, whose iov_base may be null, are skipped
+void MD5::append(const struct iovec* segments, size_t count) noexcept
+{
+   for(size_t i = 0; i < count; ++i)
+      if(segments[i].iov_len > 0)
+         update_(static_cast<const unsigned char*>(segments[i].iov_base),
+                 segments[i].iov_len);
+}
+
 // ---------------------------------------------------------------------- finish
 
 MD5& MD5::finish() noexcept
@@ -397,6 +408,27 @@ MD5& MD5::finish() noexcept
    return *this;
 }
 
+// -------------------------------------------------------------------- midstate
+
+MD5::Midstate MD5::midstate() const noexcept
+{
+   assert(!finalized_); // The padding has already been applied
+   Midstate m;
+   memcpy(m.state, state_, sizeof(m.state));
+   m.length = ((uint64_t(count_[1]) << 32) | count_[0]) / 8;
+   memcpy(m.buffer, buffer_, sizeof(m.buffer));
+   return m;
+}
+
+void MD5::restore(const Midstate& m) noexcept
+{
+   memcpy(state_, m.state, sizeof(state_));
+   count_[0] = uint32_t(m.length << 3);
+   count_[1] = uint32_t(m.length >> 29);
+   memcpy(buffer_, m.buffer, sizeof(buffer_));
+   finalized_ = false;
+}
+
 // -----------------------------------------------------------------------------
 
 size_t MD5::digest_size() const noexcept { return 16; }
@@ -408,9 +440,9 @@ void MD5::get_digest(unsigned char hash[16]) const noexcept
    memcpy(hash, digest_, 16);
 }
 
-std::array<unsigned char, 16> MD5::get_digest() const noexcept
+Md5Digest MD5::get_digest() const noexcept
 {
-   std::array<unsigned char, 16> hash;
+   Md5Digest hash;
    get_digest(&hash[0]);
    return hash;
 }
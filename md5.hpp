@@ -44,6 +44,10 @@
 #include <iostream>
 #include <string>
 
+struct iovec;
+
+using Md5Digest = std::array<uint8_t, 16>;
+
 // a small class for calculating MD5 hashes of strings or byte arrays
 // it is not meant to be fast or secure
 //
@@ -64,16 +68,30 @@ class MD5
    void append(const char* buf, size_t length) noexcept;
    void append(const void* buf, size_t length) noexcept;
 
+   // Scatter-gather: the segments in order, as if they were contiguous
+   void append(const struct iovec* segments, size_t count) noexcept;
+
    std::string hexdigest() noexcept;
    std::string hexdigest() const noexcept;
 
    size_t digest_size() const noexcept; // in bytes
    void get_digest(unsigned char hash[16]) const noexcept;
-   std::array<unsigned char, 16> get_digest() const noexcept;
+   Md5Digest get_digest() const noexcept;
 
    // Finish called automatically
    MD5& finish() noexcept;
 
+   // The chaining state of an unfinished hash, for checkpointing a stream
+   // and resuming it later (possibly in another process).
+   struct Midstate
+   {
+      uint32_t state[4];
+      uint64_t length;    // bytes appended so far
+      uint8_t buffer[64]; // the trailing `length % 64` bytes
+   };
+   Midstate midstate() const noexcept;
+   void restore(const Midstate& midstate) noexcept;
+
  private:
    static constexpr int blocksize = 64;
 
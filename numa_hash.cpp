@@ -0,0 +1,263 @@
+
+#include "numa_hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From <numaif.h>, which needs libnuma
+static constexpr int mpol_f_node = 1 << 0;
+static constexpr int mpol_f_addr = 1 << 1;
+
+// ------------------------------------------------------------------ numa_nodes
+
+// "0-3,8,10-11"
+static std::vector<int> parse_cpu_list(const std::string& text) noexcept
+{
+   std::vector<int> cpus;
+   const char* p = text.c_str();
+   while(*p != '\0') {
+      char* end;
+      const long first = strtol(p, &end, 10);
+      if(end == p) break;
+      long last = first;
+      if(*end == '-') last = strtol(end + 1, &end, 10);
+      for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+         cpus.push_back(int(cpu));
+      p = *end == ',' ? end + 1 : end;
+      if(*p == '\n') break;
+   }
+   return cpus;
+}
+
+static std::string read_small_file(const std::string& path) noexcept
+{
+   std::string text;
+   if(std::FILE* fp = std::fopen(path.c_str(), "r")) {
+      char buf[4096];
+      const size_t n = std::fread(buf, 1, sizeof(buf), fp);
+      text.assign(buf, n);
+      std::fclose(fp);
+   }
+   return text;
+}
+
+std::vector<NumaNode> numa_nodes() noexcept
+{
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      for(unsigned i = 0; i < std::thread::hardware_concurrency(); ++i)
+         CPU_SET(i, &allowed);
+
+   std::vector<NumaNode> nodes;
+   const std::string root = "/sys/devices/system/node/";
+   if(DIR* dir = opendir(root.c_str())) {
+      while(const dirent* entry = readdir(dir)) {
+         int id;
+         char tail;
+         if(sscanf(entry->d_name, "node%d%c", &id, &tail) != 1) continue;
+
+         NumaNode node{id, {}};
+         const auto path = root + entry->d_name + "/cpulist";
+         for(int cpu : parse_cpu_list(read_small_file(path)))
+            if(CPU_ISSET(cpu, &allowed)) node.cpus.push_back(cpu);
+         if(!node.cpus.empty()) nodes.push_back(std::move(node));
+      }
+      closedir(dir);
+   }
+
+   if(nodes.empty()) {
+      nodes.push_back(NumaNode{0, {}});
+      for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+         if(CPU_ISSET(cpu, &allowed)) nodes[0].cpus.push_back(cpu);
+   }
+   std::sort(nodes.begin(), nodes.end(), [](const auto& a, const auto& b) {
+      return a.id < b.id;
+   });
+   return nodes;
+}
+
+// ------------------------------------------------------------ numa_page_nodes
+
+std::vector<int>
+numa_page_nodes(const std::vector<const void*>& addresses) noexcept
+{
+   const auto page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+   std::vector<int> nodes(addresses.size(), -1);
+
+   // move_pages() with no target nodes only reports where pages are
+   constexpr size_t batch = 4096;
+   std::vector<void*> pages;
+   for(size_t first = 0; first < addresses.size(); first += batch) {
+      const size_t n = std::min(batch, addresses.size() - first);
+      pages.clear();
+      for(size_t i = 0; i < n; ++i) {
+         const auto a = reinterpret_cast<uintptr_t>(addresses[first + i]);
+         pages.push_back(reinterpret_cast<void*>(a & ~(page_size - 1)));
+      }
+      int* status = &nodes[first];
+      if(syscall(SYS_move_pages, 0, n, pages.data(), nullptr, status, 0) == 0) {
+         for(size_t i = 0; i < n; ++i) status[i] = std::max(status[i], -1);
+         continue;
+      }
+
+      for(size_t i = 0; i < n; ++i) {
+         int node = -1;
+         if(syscall(SYS_get_mempolicy,
+                    &node,
+                    nullptr,
+                    0,
+                    pages[i],
+                    mpol_f_node | mpol_f_addr)
+            != 0)
+            node = -1;
+         status[i] = node;
+      }
+   }
+   return nodes;
+}
+
+// ------------------------------------------------------------- numa_tree_hash
+
+namespace
+{
+class Barrier
+{
+ public:
+   explicit Barrier(size_t n) noexcept
+       : n_(n)
+   {}
+
+   // The last thread to arrive runs `on_release` before the others go on
+   template<typename F> void arrive_and_wait(F&& on_release) noexcept
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if(++arrived_ == n_) {
+         on_release();
+         cv_.notify_all();
+         return;
+      }
+      cv_.wait(lock, [&] { return arrived_ == n_; });
+   }
+
+ private:
+   const size_t n_;
+   size_t arrived_ = 0;
+   std::mutex mutex_;
+   std::condition_variable cv_;
+};
+} // namespace
+
+NumaHashResult numa_tree_hash(const void* data,
+                              size_t length,
+                              const NumaHashOptions& options) noexcept
+{
+   using clock           = std::chrono::steady_clock;
+   const auto bytes      = static_cast<const char*>(data);
+   const size_t leaf     = std::max<size_t>(options.leaf_size, 1);
+   const size_t n_leaves = (length + leaf - 1) / leaf;
+   const auto nodes      = numa_nodes();
+   const size_t n_nodes  = nodes.size();
+
+   // Queue each leaf on the node that holds it; unknown ones round robin
+   std::vector<const void*> addresses(n_leaves);
+   for(size_t i = 0; i < n_leaves; ++i) addresses[i] = bytes + i * leaf;
+   const auto owners = numa_page_nodes(addresses);
+
+   std::vector<std::vector<size_t>> queues(n_nodes);
+   std::vector<size_t> position(n_leaves); // within its queue
+   std::vector<size_t> queue_of(n_leaves);
+   for(size_t i = 0; i < n_leaves; ++i) {
+      size_t q = i % n_nodes;
+      for(size_t k = 0; k < n_nodes; ++k)
+         if(nodes[k].id == owners[i]) q = k;
+      queue_of[i] = q;
+      position[i] = queues[q].size();
+      queues[q].push_back(i);
+   }
+
+   NumaHashResult result;
+   result.nodes.resize(n_nodes);
+   std::vector<std::vector<Sha256Digest>> digests(n_nodes);
+   std::vector<std::atomic<size_t>> next(n_nodes);
+   std::vector<std::atomic<uint64_t>> n_bytes(n_nodes), n_local(n_nodes);
+   std::vector<clock::time_point> finished(n_nodes);
+   std::mutex padlock;
+   clock::time_point start;
+
+   size_t n_threads = 0;
+   for(size_t k = 0; k < n_nodes; ++k) {
+      result.nodes[k].node = nodes[k].id;
+      result.nodes[k].n_threads
+          = options.threads_per_node > 0
+                ? options.threads_per_node
+                : std::max(1u, unsigned(nodes[k].cpus.size()));
+      n_threads += result.nodes[k].n_threads;
+   }
+   Barrier barrier(n_threads);
+
+   auto work = [&](size_t k, unsigned t) {
+      if(options.pin_threads) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         for(int cpu : nodes[k].cpus) CPU_SET(cpu, &set);
+         sched_setaffinity(0, sizeof(set), &set); // this thread only
+      }
+      if(t == 0) digests[k].resize(queues[k].size()); // first touch
+      barrier.arrive_and_wait([&] { start = clock::now(); });
+
+      // Our own node's leaves, then help the others
+      for(size_t j = 0; j < n_nodes; ++j) {
+         const size_t q = (k + j) % n_nodes;
+         size_t i;
+         while((i = next[q].fetch_add(1)) < queues[q].size()) {
+            const size_t index = queues[q][i];
+            const size_t n     = std::min(leaf, length - index * leaf);
+            digests[q][i] = TreeHasher::leaf_digest(bytes + index * leaf, n);
+            n_bytes[k].fetch_add(n, std::memory_order_relaxed);
+            // Not leaves dealt to this node for want of a known owner
+            if(owners[index] == nodes[k].id)
+               n_local[k].fetch_add(n, std::memory_order_relaxed);
+         }
+      }
+
+      const auto now = clock::now();
+      std::lock_guard<std::mutex> guard(padlock);
+      finished[k] = std::max(finished[k], now);
+   };
+
+   std::vector<std::thread> threads;
+   for(size_t k = 0; k < n_nodes; ++k)
+      for(unsigned t = 0; t < result.nodes[k].n_threads; ++t)
+         threads.emplace_back(work, k, t);
+   for(auto& t : threads) t.join();
+
+   for(size_t k = 0; k < n_nodes; ++k) {
+      auto& stats   = result.nodes[k];
+      stats.n_bytes = n_bytes[k].load();
+      stats.n_local = n_local[k].load();
+      if(finished[k] > start)
+         stats.seconds
+             = std::chrono::duration<double>(finished[k] - start).count();
+   }
+
+   TreeHasher tree(leaf);
+   for(size_t i = 0; i < n_leaves; ++i)
+      tree.append_leaf(digests[queue_of[i]][position[i]],
+                       std::min(leaf, length - i * leaf));
+   result.root = tree.finish().digest();
+   return result;
+}
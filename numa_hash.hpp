@@ -0,0 +1,72 @@
+
+#pragma once
+
+#include "tree_hash.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// NUMA-aware parallel tree hashing of memory-resident data
+//
+// The data is split into TreeHasher leaves. The NUMA node holding each
+// leaf's pages is looked up with move_pages() (or get_mempolicy() where
+// that is refused), and the leaf is queued for that node. Each node runs
+// worker threads pinned to its CPUs, which hash their own node's leaves
+// first, reading only local memory, and then help other nodes finish.
+//
+// The data is hashed in place, so the only memory the workers write is
+// their leaf digests; those are allocated by a worker of the node that
+// owns them, so that first-touch places them on that node.
+//
+// The root is the same as TreeHasher(leaf_size) over the same bytes. On a
+// machine without NUMA, this is a plain parallel tree hash.
+//
+// usage: auto result = numa_tree_hash(data, length);
+//        for(const auto& n : result.nodes)
+//           printf("node %d: %.0f MB/s\n", n.node, n.mb_s());
+struct NumaHashOptions
+{
+   size_t leaf_size          = 1 << 20;
+   unsigned threads_per_node = 0;    // 0 means one per usable CPU
+   bool pin_threads          = true; // to the CPUs of their node
+};
+
+struct NumaNodeStats
+{
+   int node             = 0;
+   unsigned n_threads   = 0;
+   uint64_t n_bytes     = 0; // hashed by this node's threads
+   uint64_t n_local     = 0; // ... of which resided on this node
+   double seconds       = 0.0;
+
+   double mb_s() const noexcept
+   {
+      return seconds > 0.0 ? double(n_bytes) / 1e6 / seconds : 0.0;
+   }
+};
+
+struct NumaHashResult
+{
+   Sha256Digest root;
+   std::vector<NumaNodeStats> nodes;
+};
+
+// The NUMA nodes that have CPUs this process may run on, with those CPUs.
+// A single node 0 with every allowed CPU where there is no NUMA
+// information.
+struct NumaNode
+{
+   int id;
+   std::vector<int> cpus;
+};
+std::vector<NumaNode> numa_nodes() noexcept;
+
+// The node of the page at each address, or -1 where unknown (such as a page
+// not yet faulted in)
+std::vector<int>
+numa_page_nodes(const std::vector<const void*>& addresses) noexcept;
+
+NumaHashResult numa_tree_hash(const void* data,
+                              size_t length,
+                              const NumaHashOptions& options = {}) noexcept;
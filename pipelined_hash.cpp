@@ -0,0 +1,219 @@
+
+#include "pipelined_hash.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Offsets, lengths and addresses of O_DIRECT reads are multiples of this,
+// which satisfies the logical block size of every common device
+static constexpr size_t direct_alignment = 4096;
+
+namespace
+{
+struct Slot
+{
+   char* data      = nullptr;
+   size_t length   = 0;
+   uint64_t offset = 0;
+   bool cached     = false; // read through the page cache
+};
+
+class Pipeline
+{
+ public:
+   Pipeline(int fd, bool direct, char* buffers, const PipelineOptions& options)
+       : fd_(fd)
+       , direct_(direct)
+       , buffer_size_(options.buffer_size)
+       , slots_(options.depth)
+   {
+      for(size_t i = 0; i < slots_.size(); ++i)
+         slots_[i].data = buffers + i * buffer_size_;
+   }
+
+   bool run(const FileChunkSink& sink);
+
+ private:
+   void consume(const FileChunkSink& sink);
+   void read_all() noexcept;
+   bool read_slot(Slot& slot, int& error) noexcept;
+   void drop_direct() noexcept;
+
+   const int fd_;
+   bool direct_; // I/O thread only
+   const size_t buffer_size_;
+   std::vector<Slot> slots_;
+
+   std::mutex mutex_;
+   std::condition_variable filled_cv_;
+   std::condition_variable consumed_cv_;
+   uint64_t n_filled_   = 0;
+   uint64_t n_consumed_ = 0;
+   bool done_           = false; // no more slots will be filled
+   bool abandoned_      = false; // the sink threw; stop reading
+   int error_           = 0;
+};
+
+// The sink may throw: the reader is stopped and joined, and the buffers
+// unmapped and the file closed, before the exception leaves
+struct Buffers
+{
+   void* base;
+   size_t length;
+   ~Buffers() noexcept { munmap(base, length); }
+};
+
+struct OpenFile
+{
+   int fd;
+   ~OpenFile() noexcept { ::close(fd); }
+};
+
+// Reads the rest of the file through the page cache
+void Pipeline::drop_direct() noexcept
+{
+   const int flags = fcntl(fd_, F_GETFL);
+   if(flags >= 0) fcntl(fd_, F_SETFL, flags & ~O_DIRECT);
+   direct_ = false;
+}
+
+// Fills `slot` from `slot.offset`, tolerating short reads. Returns false at
+// the end of the file, or on error.
+bool Pipeline::read_slot(Slot& slot, int& error) noexcept
+{
+   slot.length = 0;
+   slot.cached = !direct_;
+   while(slot.length < buffer_size_) {
+      const auto pos = slot.offset + slot.length;
+      if(direct_ && pos % direct_alignment != 0) drop_direct();
+      slot.cached = slot.cached || !direct_;
+
+      const ssize_t n = pread_retry(
+          fd_, slot.data + slot.length, buffer_size_ - slot.length, pos);
+      if(n < 0 && errno == EINVAL && direct_) {
+         drop_direct();
+         continue;
+      }
+      if(n < 0) {
+         error = errno;
+         return false;
+      }
+      if(n == 0) return false;
+      slot.length += size_t(n);
+   }
+   return true;
+}
+
+void Pipeline::read_all() noexcept
+{
+   uint64_t offset = 0;
+   for(uint64_t i = 0;; ++i) {
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         consumed_cv_.wait(lock, [&] {
+            return abandoned_ || n_filled_ - n_consumed_ < slots_.size();
+         });
+         if(abandoned_) return;
+      }
+
+      Slot& slot      = slots_[i % slots_.size()];
+      slot.offset     = offset;
+      int error       = 0;
+      const bool more = read_slot(slot, error);
+      offset += slot.length;
+
+      std::lock_guard<std::mutex> guard(mutex_);
+      ++n_filled_;
+      error_ = error;
+      done_  = !more;
+      filled_cv_.notify_one();
+      if(done_) return;
+   }
+}
+
+bool Pipeline::run(const FileChunkSink& sink)
+{
+   std::thread reader([this] { read_all(); });
+   try {
+      consume(sink);
+   } catch(...) {
+      {
+         std::lock_guard<std::mutex> guard(mutex_);
+         abandoned_ = true;
+         consumed_cv_.notify_one();
+      }
+      reader.join();
+      throw;
+   }
+   reader.join();
+   return error_ == 0;
+}
+
+void Pipeline::consume(const FileChunkSink& sink)
+{
+   for(uint64_t i = 0;; ++i) {
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         filled_cv_.wait(lock, [&] { return n_filled_ > i || done_; });
+         if(n_filled_ == i || error_ != 0) break;
+      }
+
+      const Slot& slot = slots_[i % slots_.size()];
+      if(slot.length > 0) sink(slot.data, slot.length);
+      if(slot.cached)
+         posix_fadvise(
+             fd_, off_t(slot.offset), off_t(slot.length), POSIX_FADV_DONTNEED);
+
+      std::lock_guard<std::mutex> guard(mutex_);
+      ++n_consumed_;
+      consumed_cv_.notify_one();
+   }
+}
+} // namespace
+
+// ------------------------------------------------------- stream_file_pipelined
+
+bool stream_file_pipelined(const std::string& path,
+                           const FileChunkSink& sink,
+                           const PipelineOptions& options_in)
+{
+   auto options        = options_in;
+   options.depth       = std::max(2u, options.depth);
+   options.buffer_size = std::max<size_t>(options.buffer_size, 1);
+   options.buffer_size = (options.buffer_size + direct_alignment - 1)
+                         / direct_alignment * direct_alignment;
+
+   int fd      = -1;
+   bool direct = options.direct;
+   if(direct) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+   if(fd < 0 && (!direct || errno == EINVAL)) {
+      direct = false;
+      fd     = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   }
+   if(fd < 0) return false;
+   const OpenFile file{fd};
+   if(!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   // mmap() memory is page aligned, as O_DIRECT requires
+   const size_t length = options.buffer_size * options.depth;
+   void* buffers       = mmap(nullptr,
+                        length,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0);
+   if(buffers == MAP_FAILED) return false;
+   const Buffers mapped{buffers, length};
+
+   Pipeline pipeline(fd, direct, static_cast<char*>(buffers), options);
+   return pipeline.run(sink);
+}
@@ -0,0 +1,49 @@
+
+#pragma once
+
+#include "file_hash.hpp"
+
+#include <cstddef>
+#include <string>
+
+// Pipelined hashing of a single large file
+//
+// An I/O thread reads the file into a ring of `depth` aligned buffers,
+// while the calling thread hashes the buffers already read, so that read
+// latency and hashing overlap instead of alternating.
+//
+// The file is opened with O_DIRECT, so that hashing a large file does not
+// evict everything else from the page cache. Where O_DIRECT is refused
+// (some filesystems, or an unaligned short read), the rest of the file is
+// read through the page cache, and each range is dropped with
+// POSIX_FADV_DONTNEED once it has been hashed.
+//
+// usage: Sha256 sha;
+//        if(hash_file_pipelined("/backup/disk.img", sha))
+//           std::cout << sha.hexdigest();
+struct PipelineOptions
+{
+   size_t buffer_size = 4 << 20; // bytes per read; rounded up to 4 KiB
+   unsigned depth     = 4;       // buffers in the ring
+   bool direct        = true;    // O_DIRECT, else FADV_DONTNEED after hashing
+};
+
+// Feeds the file to `sink`, in order, on the calling thread. Returns false
+// on I/O error. An exception thrown by `sink` is passed on to the caller,
+// once the reader thread has stopped and nothing is left mapped or open.
+bool stream_file_pipelined(const std::string& path,
+                           const FileChunkSink& sink,
+                           const PipelineOptions& options = {});
+
+// `hasher` is any type with `append(const void*, size_t)`, and is not
+// finished.
+template<typename Hasher>
+bool hash_file_pipelined(const std::string& path,
+                         Hasher& hasher,
+                         const PipelineOptions& options = {})
+{
+   return stream_file_pipelined(
+       path,
+       [&](const void* data, size_t length) { hasher.append(data, length); },
+       options);
+}
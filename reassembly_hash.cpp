@@ -0,0 +1,157 @@
+
+#include "reassembly_hash.hpp"
+
+#include <algorithm>
+
+template<typename Hasher>
+ReassemblyHasher<Hasher>::ReassemblyHasher(uint64_t size,
+                                           size_t window) noexcept
+    : size_(size)
+    , window_(window)
+{
+   if(size_ == 0) {
+      hasher_.finish();
+      finished_ = true;
+   }
+}
+
+template<typename Hasher>
+bool ReassemblyHasher<Hasher>::write(uint64_t offset,
+                                     const void* data,
+                                     size_t size) noexcept
+{
+   if(offset > size_ || size > size_ - offset) return false;
+   auto p = static_cast<const uint8_t*>(data);
+
+   std::unique_lock<std::mutex> lock(padlock_);
+   for(;;) {
+      if(offset + size <= next_) return true; // nothing new
+      if(offset < next_) {
+         p += next_ - offset;
+         size -= size_t(next_ - offset);
+         offset = next_;
+      }
+      if(offset == next_ && !hashing_) {
+         hash_run_(lock, p, size);
+         return true;
+      }
+      if(buffered_ == 0 || buffered_ + size <= window_) break;
+      changed_.wait(lock);
+   }
+
+   // Ahead of a gap, or of a piece being hashed
+   auto& piece = pieces_[offset];
+   if(piece.size() >= size) return true; // a duplicate
+   buffered_ -= piece.size();
+   if(piece.empty()) piece = take_buffer_(size);
+   piece.assign(p, p + size);
+   buffered_ += size;
+   peak_ = std::max(peak_, buffered_);
+   return true;
+}
+
+// Hashes `data`, which starts at next_, then every buffered piece that has
+// become contiguous. The lock is dropped while hashing, so that other
+// producers can buffer their pieces meanwhile.
+template<typename Hasher>
+void ReassemblyHasher<Hasher>::hash_run_(std::unique_lock<std::mutex>& lock,
+                                         const uint8_t* data,
+                                         size_t size) noexcept
+{
+   hashing_ = true;
+   next_ += size;
+   lock.unlock();
+   hasher_.append(data, size);
+   lock.lock();
+
+   for(auto it = pieces_.begin(); it != pieces_.end() && it->first <= next_;
+       it     = pieces_.begin()) {
+      Buffer piece     = std::move(it->second);
+      const auto start = it->first;
+      pieces_.erase(it);
+      buffered_ -= piece.size();
+      changed_.notify_all();
+
+      if(start + piece.size() > next_) {
+         const size_t skip = size_t(next_ - start);
+         next_ += piece.size() - skip;
+         lock.unlock();
+         hasher_.append(piece.data() + skip, piece.size() - skip);
+         lock.lock();
+      }
+      recycle_(std::move(piece));
+   }
+
+   hashing_ = false;
+   if(next_ == size_) {
+      hasher_.finish();
+      finished_ = true;
+   }
+   changed_.notify_all();
+}
+
+// A buffer with room for `size` bytes, recycled if possible
+template<typename Hasher>
+typename ReassemblyHasher<Hasher>::Buffer
+ReassemblyHasher<Hasher>::take_buffer_(size_t size) noexcept
+{
+   for(size_t i = 0; i < spare_.size(); ++i)
+      if(spare_[i].capacity() >= size) {
+         Buffer buffer = std::move(spare_[i]);
+         std::swap(spare_[i], spare_.back());
+         spare_.pop_back();
+         spare_bytes_ -= buffer.capacity();
+         return buffer;
+      }
+   return Buffer();
+}
+
+// Keeps `buffer` for reuse, unless that would take us over the window
+template<typename Hasher>
+void ReassemblyHasher<Hasher>::recycle_(Buffer&& buffer) noexcept
+{
+   if(buffer.capacity() == 0
+      || spare_bytes_ + buffered_ + buffer.capacity() > window_)
+      return;
+   buffer.clear();
+   spare_bytes_ += buffer.capacity();
+   spare_.push_back(std::move(buffer));
+}
+
+template<typename Hasher> Hasher& ReassemblyHasher<Hasher>::wait() noexcept
+{
+   std::unique_lock<std::mutex> lock(padlock_);
+   changed_.wait(lock, [this] { return finished_; });
+   return hasher_;
+}
+
+template<typename Hasher>
+bool ReassemblyHasher<Hasher>::done() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return finished_;
+}
+
+template<typename Hasher>
+uint64_t ReassemblyHasher<Hasher>::hashed() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return next_;
+}
+
+template<typename Hasher>
+size_t ReassemblyHasher<Hasher>::buffered() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return buffered_;
+}
+
+template<typename Hasher>
+size_t ReassemblyHasher<Hasher>::peak_buffered() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return peak_;
+}
+
+template class ReassemblyHasher<Sha256>;
+template class ReassemblyHasher<MD5>;
@@ -0,0 +1,83 @@
+
+#pragma once
+
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Hashes an object whose pieces arrive out of order, from several threads
+//
+// Each `write(offset, data, size)` that continues the bytes hashed so far
+// is hashed straight from the caller's buffer, along with any buffered
+// pieces it makes contiguous. Only pieces that arrive ahead of a gap are
+// copied, into buffers recycled between pieces. So memory use is bounded
+// by `window` rather than by the size of the object, and the digest is
+// ready as soon as the last byte arrives.
+//
+// A piece that doesn't fit in the window waits until enough of the object
+// has been hashed. This can't deadlock as long as each producer writes its
+// own pieces in increasing order of offset, as a ranged parallel download
+// does. A lone piece larger than the window is accepted when nothing else
+// is buffered.
+//
+// Pieces may overlap, or be sent twice (a retried range, say), provided
+// the overlapping bytes are the same.
+//
+// usage: ReassemblyHasher<Sha256> hash(content_length);
+//        // from each connection's thread:
+//        hash.write(range_offset + received, buf, n);
+//        ...
+//        std::cout << hash.wait().hexdigest();
+template<typename Hasher> class ReassemblyHasher
+{
+ public:
+   static constexpr size_t default_window = 16 << 20;
+
+   explicit ReassemblyHasher(uint64_t size,
+                             size_t window = default_window) noexcept;
+   ReassemblyHasher(const ReassemblyHasher&) = delete;
+   ReassemblyHasher& operator=(const ReassemblyHasher&) = delete;
+
+   // False if the piece lies beyond the object's size
+   bool write(uint64_t offset, const void* data, size_t size) noexcept;
+
+   // Waits for the last byte to be hashed; the hasher is then finished
+   Hasher& wait() noexcept;
+
+   bool done() const noexcept;
+   uint64_t hashed() const noexcept; // bytes hashed, or being hashed
+   size_t buffered() const noexcept; // bytes waiting for a gap to fill
+   size_t peak_buffered() const noexcept;
+
+ private:
+   using Buffer = std::vector<uint8_t>;
+
+   mutable std::mutex padlock_;
+   std::condition_variable changed_;
+   Hasher hasher_;
+   const uint64_t size_;
+   const size_t window_;
+   uint64_t next_      = 0; // bytes before this are hashed, or being hashed
+   bool hashing_       = false;
+   bool finished_      = false;
+   size_t buffered_    = 0;
+   size_t peak_        = 0;
+   size_t spare_bytes_ = 0;
+   std::map<uint64_t, Buffer> pieces_; // by offset
+   std::vector<Buffer> spare_;         // for reuse
+
+   void hash_run_(std::unique_lock<std::mutex>& lock,
+                  const uint8_t* data,
+                  size_t size) noexcept;
+   Buffer take_buffer_(size_t size) noexcept;
+   void recycle_(Buffer&& buffer) noexcept;
+};
+
+extern template class ReassemblyHasher<Sha256>;
+extern template class ReassemblyHasher<MD5>;
@@ -18,11 +18,14 @@ http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
 
 #include "sha256.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdlib>
 #include <memory.h>
 
+#include <sys/uio.h>
+
 /****************************** MACROS ******************************/
 #define SHA256_BLOCK_SIZE 32 // SHA256 outputs a 32 byte digest
 
@@ -52,13 +55,13 @@ static const uint32_t k[64]
        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void Sha256::transform_() noexcept
+void Sha256::transform_(const BYTE block[64]) noexcept
 {
    WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
    for(i = 0, j = 0; i < 16; ++i, j += 4)
-      m[i] = WORD((data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8)
-                  | (data[j + 3]));
+      m[i] = WORD((block[j] << 24) | (block[j + 1] << 16) | (block[j + 2] << 8)
+                  | (block[j + 3]));
    for(; i < 64; ++i)
       m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
 
@@ -110,17 +113,30 @@ void Sha256::init_() noexcept
 
 void Sha256::update(const BYTE dat[], size_t len) noexcept
 {
-   WORD i;
+   if(len == 0) return; // `dat` may be null
+   size_t i = 0;
+
+   // Top up a partial block first
+   if(datalen > 0) {
+      const size_t n = std::min<size_t>(64 - datalen, len);
+      memcpy(data + datalen, dat, n);
+      datalen += WORD(n);
+      i = n;
+      if(datalen < 64) return;
+      transform_(data);
+      bitlen += 512;
+      datalen = 0;
+   }
 
-   for(i = 0; i < len; ++i) {
-      this->data[datalen] = dat[i];
-      datalen++;
-      if(datalen == 64) {
-         transform_();
-         bitlen += 512;
-         datalen = 0;
-      }
+   // Whole blocks are transformed straight from the caller's buffer
+   for(; i + 64 <= len; i += 64) {
+      transform_(dat + i);
+      bitlen += 512;
    }
+
+   // Buffer the rest
+   memcpy(data, dat + i, len - i);
+   datalen = WORD(len - i);
 }
 
 void Sha256::final(BYTE hash[]) noexcept
@@ -136,7 +152,7 @@ void Sha256::final(BYTE hash[]) noexcept
    } else {
       data[i++] = 0x80;
       while(i < 64) data[i++] = 0x00;
-      transform_();
+      transform_(data);
       memset(data, 0, 56);
    }
 
@@ -150,7 +166,7 @@ void Sha256::final(BYTE hash[]) noexcept
    data[58] = static_cast<BYTE>(bitlen >> 40);
    data[57] = static_cast<BYTE>(bitlen >> 48);
    data[56] = static_cast<BYTE>(bitlen >> 56);
-   transform_();
+   transform_(data);
 
    // Since this implementation uses little endian byte ordering and SHA uses
    // big endian, reverse all the bytes when copying the final state to the
@@ -200,6 +216,17 @@ void Sha256::append(const void* buf, size_t length) noexcept
    append(reinterpret_cast<const unsigned char*>(buf), length);
 }
 
+// A block that straddles segments is assembled in `data`; whole blocks
+// within a segment are transformed in place, as for a single buffer. Empty
+// segments, whose iov_base may be null, are skipped.
+void Sha256::append(const struct iovec* segments, size_t count) noexcept
+{
+   for(size_t i = 0; i < count; ++i)
+      if(segments[i].iov_len > 0)
+         update(static_cast<const BYTE*>(segments[i].iov_base),
+                segments[i].iov_len);
+}
+
 // ---------------------------------------------------------------------- finish
 
 Sha256& Sha256::finish() noexcept
@@ -212,6 +239,27 @@ Sha256& Sha256::finish() noexcept
    return *this;
 }
 
+// -------------------------------------------------------------------- midstate
+
+Sha256::Midstate Sha256::midstate() const noexcept
+{
+   assert(!finalized_); // The padding has already been applied
+   Midstate m;
+   memcpy(m.state, state, sizeof(m.state));
+   m.length = bitlen / 8 + datalen;
+   memcpy(m.buffer, data, sizeof(m.buffer));
+   return m;
+}
+
+void Sha256::restore(const Midstate& m) noexcept
+{
+   memcpy(state, m.state, sizeof(state));
+   datalen = WORD(m.length % 64);
+   bitlen  = (m.length - datalen) * 8;
+   memcpy(data, m.buffer, sizeof(data));
+   finalized_ = false;
+}
+
 // -----------------------------------------------------------------------------
 
 size_t Sha256::digest_size() const noexcept { return SHA256_BLOCK_SIZE; }
@@ -1,11 +1,17 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <type_traits>
 #include <vector>
 
+struct iovec;
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
 class Sha256
 {
  public:
@@ -17,6 +23,9 @@ class Sha256
    void append(const char* buf, size_t length) noexcept;
    void append(const void* buf, size_t length) noexcept;
 
+   // Scatter-gather: the segments in order, as if they were contiguous
+   void append(const struct iovec* segments, size_t count) noexcept;
+
    std::string hexdigest() noexcept;
    std::string hexdigest() const noexcept;
 
@@ -27,6 +36,17 @@ class Sha256
    // Finish called automatically
    Sha256& finish() noexcept;
 
+   // The chaining state of an unfinished hash, for checkpointing a stream
+   // and resuming it later (possibly in another process).
+   struct Midstate
+   {
+      uint32_t state[8];
+      uint64_t length;    // bytes appended so far
+      uint8_t buffer[64]; // the trailing `length % 64` bytes
+   };
+   Midstate midstate() const noexcept;
+   void restore(const Midstate& midstate) noexcept;
+
  private:
    using BYTE = uint8_t;
    using WORD = uint32_t;
@@ -38,7 +58,7 @@ class Sha256
    BYTE digest_[32];
    bool finalized_ = false;
 
-   void transform_() noexcept;
+   void transform_(const BYTE block[64]) noexcept;
    void init_() noexcept;
    void update(const BYTE dat[], size_t len) noexcept;
    void final(BYTE hash[]) noexcept;
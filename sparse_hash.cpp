@@ -0,0 +1,87 @@
+
+#include "sparse_hash.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr size_t read_size = 1 << 20;
+
+static const char zero_page[64 << 10] = {};
+
+// The sinks may throw: the file is closed regardless
+namespace
+{
+struct OpenFile
+{
+   int fd;
+   ~OpenFile() noexcept { ::close(fd); }
+};
+} // namespace
+
+// Reads [begin, end) to `data`
+static bool read_extent(int fd,
+                        off_t begin,
+                        off_t end,
+                        std::vector<char>& buffer,
+                        const FileChunkSink& data)
+{
+   while(begin < end) {
+      const auto want = size_t(std::min<off_t>(end - begin, off_t(read_size)));
+      const ssize_t n = pread_retry(fd, buffer.data(), want, uint64_t(begin));
+      if(n <= 0) return false; // error, or the file shrank
+      data(buffer.data(), size_t(n));
+      begin += n;
+   }
+   return true;
+}
+
+bool stream_file_sparse(const std::string& path,
+                        const FileChunkSink& data,
+                        const ZeroRunSink& zeros_sink,
+                        uint64_t* bytes_read)
+{
+   const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if(fd < 0) return false;
+   const OpenFile file{fd};
+   struct stat st;
+   if(fstat(fd, &st) != 0) return false;
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   const ZeroRunSink zeros = zeros_sink ? zeros_sink : [&](uint64_t length) {
+      while(length > 0) {
+         const auto n = size_t(std::min<uint64_t>(length, sizeof(zero_page)));
+         data(zero_page, n);
+         length -= n;
+      }
+   };
+
+   std::vector<char> buffer(read_size);
+   const off_t size = st.st_size;
+   uint64_t n_read  = 0;
+   bool ok          = true;
+   for(off_t pos = 0; ok && pos < size;) {
+      // ENXIO: no data past `pos`. EINVAL: no hole reporting.
+      off_t extent = lseek(fd, pos, SEEK_DATA);
+      if(extent < 0 && errno != ENXIO && errno != EINVAL) ok = false;
+      if(extent < 0) extent = errno == ENXIO ? size : pos;
+      extent = std::min(extent, size);
+      if(extent > pos) zeros(uint64_t(extent - pos));
+      pos = extent;
+      if(!ok || pos == size) break;
+
+      off_t hole = lseek(fd, pos, SEEK_HOLE);
+      hole       = hole < 0 ? size : std::min(hole, size);
+      ok         = read_extent(fd, pos, hole, buffer, data);
+      n_read += uint64_t(hole - pos);
+      pos = hole;
+   }
+
+   if(bytes_read != nullptr) *bytes_read = n_read;
+   return ok;
+}
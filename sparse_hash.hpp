@@ -0,0 +1,65 @@
+
+#pragma once
+
+#include "file_hash.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+// Hashing of sparse files without reading their holes
+//
+// lseek(SEEK_DATA/SEEK_HOLE) finds the file's data extents, and only those
+// are read. Each hole is passed to `zeros` as a length, or, if `zeros` is
+// empty, fed to `data` from an in-memory zero page, so that the result is
+// the same as hashing every byte of the file. Filesystems without hole
+// reporting present the whole file as data.
+//
+// With a TreeHasher, which has append_zeros(), holes cost neither I/O nor
+// hashing of their bytes.
+//
+// usage: TreeHasher tree;
+//        if(hash_file_sparse("vm.img", tree)) std::cout << tree.hexdigest();
+using ZeroRunSink = std::function<void(uint64_t length)>;
+
+// Feeds the first st_size bytes of the file, in order. `bytes_read`, if
+// not null, receives the number of bytes read from data extents. Returns
+// false on I/O error, or if the file shrinks while being read. An exception
+// thrown by either sink is passed on to the caller, with the file closed.
+bool stream_file_sparse(const std::string& path,
+                        const FileChunkSink& data,
+                        const ZeroRunSink& zeros = nullptr,
+                        uint64_t* bytes_read     = nullptr);
+
+namespace detail
+{
+template<typename Hasher, typename = void>
+struct has_append_zeros : std::false_type
+{};
+
+template<typename Hasher>
+using append_zeros_t
+    = decltype(std::declval<Hasher&>().append_zeros(uint64_t(0)));
+
+template<typename Hasher>
+struct has_append_zeros<Hasher, std::void_t<append_zeros_t<Hasher>>>
+    : std::true_type
+{};
+} // namespace detail
+
+// `hasher` is any type with `append(const void*, size_t)`, and is not
+// finished. Holes go to `hasher.append_zeros(uint64_t)` where it exists.
+template<typename Hasher>
+bool hash_file_sparse(const std::string& path,
+                      Hasher& hasher,
+                      uint64_t* bytes_read = nullptr)
+{
+   const FileChunkSink data = [&](const void* buf, size_t length) {
+      hasher.append(buf, length);
+   };
+   ZeroRunSink zeros;
+   if constexpr(detail::has_append_zeros<Hasher>::value)
+      zeros = [&](uint64_t length) { hasher.append_zeros(length); };
+   return stream_file_sparse(path, data, zeros, bytes_read);
+}
@@ -0,0 +1,170 @@
+
+#include "streaming_hash.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_FUNCTIONS_X86 1
+#endif
+
+static constexpr size_t line_size = 64;
+
+static const char* line_of(const char* p) noexcept
+{
+   return reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(p)
+                                        & ~uintptr_t(line_size - 1));
+}
+
+// ------------------------------------------------------------------- evicting
+
+#ifdef HASH_FUNCTIONS_X86
+__attribute__((target("clflushopt"))) static void
+flush_lines_opt(const char* begin, const char* end) noexcept
+{
+   for(auto p = line_of(begin); p < end; p += line_size)
+      _mm_clflushopt(const_cast<char*>(p));
+}
+
+static void flush_lines(const char* begin, const char* end) noexcept
+{
+   for(auto p = line_of(begin); p < end; p += line_size)
+      _mm_clflush(p);
+}
+#endif
+
+CacheFlush cache_flush_support() noexcept
+{
+#ifdef HASH_FUNCTIONS_X86
+   static const CacheFlush support = [] {
+      unsigned a, b, c, d;
+      if(__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 23)))
+         return CacheFlush::clflushopt;
+      if(__get_cpuid(1, &a, &b, &c, &d) && (d & (1u << 19)))
+         return CacheFlush::clflush;
+      return CacheFlush::none;
+   }();
+   return support;
+#else
+   return CacheFlush::none;
+#endif
+}
+
+static void
+evict(CacheFlush flush, const char* begin, const char* end) noexcept
+{
+#ifdef HASH_FUNCTIONS_X86
+   if(flush == CacheFlush::clflushopt) flush_lines_opt(begin, end);
+   if(flush == CacheFlush::clflush) flush_lines(begin, end);
+#else
+   (void) flush;
+   (void) begin;
+   (void) end;
+#endif
+}
+
+// --------------------------------------------------------------- stream_buffer
+
+void stream_buffer(const void* data,
+                   size_t length,
+                   const FileChunkSink& sink,
+                   const StreamingOptions& options) noexcept
+{
+   const auto flush = options.evict ? cache_flush_support() : CacheFlush::none;
+   const size_t step     = std::max(options.step, line_size);
+   const size_t distance = options.prefetch_distance;
+
+   auto p          = static_cast<const char*>(data);
+   const auto end  = p + length;
+   auto prefetched = p; // lines before this have been prefetched
+   auto flushed    = p; // ... and before this, evicted
+
+   auto prefetch_to = [&](const char* limit) {
+      for(limit = std::min(limit, end); prefetched < limit;
+          prefetched += line_size)
+         __builtin_prefetch(prefetched, 0, 0); // NTA
+   };
+
+   while(p < end) {
+      const size_t n = std::min<size_t>(step, size_t(end - p));
+      prefetch_to(p + n + std::min<size_t>(distance, size_t(end - p - n)));
+      sink(p, n);
+      p += n;
+
+      // Whole lines only, as the next step still needs a partial one
+      const auto done = p == end ? end : line_of(p);
+      if(done > flushed) {
+         evict(flush, flushed, done);
+         flushed = done;
+      }
+   }
+}
+
+// ----------------------------------------------------------------- copy_buffer
+
+#ifdef HASH_FUNCTIONS_X86
+// Streaming stores, 64 bytes at a time; `dst` is 16-byte aligned
+static void
+copy_non_temporal(char* dst, const char* src, size_t length) noexcept
+{
+   for(; length >= 64; length -= 64, dst += 64, src += 64) {
+      const auto in   = reinterpret_cast<const __m128i*>(src);
+      const auto out  = reinterpret_cast<__m128i*>(dst);
+      const __m128i a = _mm_loadu_si128(in + 0);
+      const __m128i b = _mm_loadu_si128(in + 1);
+      const __m128i c = _mm_loadu_si128(in + 2);
+      const __m128i d = _mm_loadu_si128(in + 3);
+      _mm_stream_si128(out + 0, a);
+      _mm_stream_si128(out + 1, b);
+      _mm_stream_si128(out + 2, c);
+      _mm_stream_si128(out + 3, d);
+   }
+   memcpy(dst, src, length);
+}
+#endif
+
+static void
+copy_block(char* dst,
+           const char* src,
+           size_t length,
+           bool non_temporal) noexcept
+{
+#ifdef HASH_FUNCTIONS_X86
+   if(non_temporal) {
+      const size_t head = std::min(length, size_t(-uintptr_t(dst) & 15));
+      memcpy(dst, src, head);
+      copy_non_temporal(dst + head, src + head, length - head);
+      return;
+   }
+#else
+   (void) non_temporal;
+#endif
+   memcpy(dst, src, length);
+}
+
+void copy_buffer(void* dst,
+                 const void* src,
+                 size_t length,
+                 const FileChunkSink& sink,
+                 const CopyHashOptions& options) noexcept
+{
+   const size_t step = std::max(options.step, line_size);
+   auto out          = static_cast<char*>(dst);
+   auto in           = static_cast<const char*>(src);
+
+   for(size_t done = 0; done < length;) {
+      const size_t n = std::min(step, length - done);
+      copy_block(out + done, in + done, n, options.non_temporal);
+      sink(in + done, n); // still in L1 from the copy
+      done += n;
+   }
+
+#ifdef HASH_FUNCTIONS_X86
+   // Streaming stores are weakly ordered: make them visible before whatever
+   // the caller does next to publish `dst`
+   if(options.non_temporal) _mm_sfence();
+#endif
+}
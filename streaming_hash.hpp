@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include "file_hash.hpp"
+
+#include <cstddef>
+
+// Cache-friendly hashing of large inputs
+//
+// Hashing a large object reads every byte exactly once, yet by default each
+// line is brought into every cache level and evicts somebody's working set.
+// Above `threshold` bytes, this mode:
+//
+//  * prefetches `prefetch_distance` bytes ahead with a non-temporal hint
+//    (PREFETCHNTA on x86), which fills the line into L1 while minimizing
+//    LLC allocation, and
+//  * optionally evicts each line once it has been hashed, with CLFLUSHOPT
+//    (or CLFLUSH on older CPUs), so it does not linger in the LLC.
+//
+// True non-temporal loads (MOVNTDQA) only bypass the cache for
+// write-combining memory, not for ordinary heap or page-cache pages, so the
+// prefetch hint is what's used here.
+//
+// usage: Sha256 sha;
+//        append_streaming(sha, object.data(), object.size());
+struct StreamingOptions
+{
+   size_t threshold         = 4 << 20; // smaller inputs use plain append()
+   size_t prefetch_distance = 1024;    // bytes ahead of the hasher
+   size_t step              = 4096;    // bytes hashed per prefetch/evict
+   bool evict               = true;    // flush lines once hashed
+};
+
+enum class CacheFlush { none, clflush, clflushopt };
+
+// The best line flush instruction this CPU has
+CacheFlush cache_flush_support() noexcept;
+
+// Feeds [data, data + length) to `sink` in `step`-sized pieces, prefetching
+// ahead and evicting behind
+void stream_buffer(const void* data,
+                   size_t length,
+                   const FileChunkSink& sink,
+                   const StreamingOptions& options = {}) noexcept;
+
+template<typename Hasher>
+void append_streaming(Hasher& hasher,
+                      const void* data,
+                      size_t length,
+                      const StreamingOptions& options = {})
+{
+   if(length < options.threshold) return hasher.append(data, length);
+   stream_buffer(
+       data,
+       length,
+       [&](const void* buf, size_t n) { hasher.append(buf, n); },
+       options);
+}
+
+// Copies [src, src + length) to `dst`, and feeds the same bytes to `sink`
+//
+// Copying a buffer and then hashing it reads it from memory twice, once it
+// is larger than the cache. Here each `step`-sized block is copied and then
+// hashed straight away, while it is still in L1, so the source is read from
+// memory once. With `non_temporal`, the copy uses streaming stores (MOVNTDQ
+// on x86), which write `dst` around the cache: worthwhile for large copies
+// into a send or storage buffer that won't be read again soon. `dst` and
+// `src` must not overlap.
+//
+// usage: Sha256 sha;
+//        copy_and_hash(send_buffer, object.data(), object.size(), sha);
+struct CopyHashOptions
+{
+   size_t step       = 4096;  // bytes copied, then hashed, at a time
+   bool non_temporal = false; // bypass the cache when writing dst
+};
+
+void copy_buffer(void* dst,
+                 const void* src,
+                 size_t length,
+                 const FileChunkSink& sink,
+                 const CopyHashOptions& options = {}) noexcept;
+
+template<typename Hasher>
+void copy_and_hash(void* dst,
+                   const void* src,
+                   size_t length,
+                   Hasher& hasher,
+                   const CopyHashOptions& options = {})
+{
+   copy_buffer(
+       dst,
+       src,
+       length,
+       [&](const void* buf, size_t n) { hasher.append(buf, n); },
+       options);
+}
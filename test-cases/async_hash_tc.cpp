@@ -0,0 +1,140 @@
+
+#include "async_hash.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+namespace
+{
+// Starts running when called, and frees itself when done
+struct Detached
+{
+   struct promise_type
+   {
+      Detached get_return_object() noexcept { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() noexcept {}
+      void unhandled_exception() noexcept { std::terminate(); }
+   };
+};
+
+struct Result
+{
+   std::string hexdigest;
+   std::thread::id resumed_on;
+};
+
+Detached hash_one(const std::string& data,
+                  AsyncHashOptions options,
+                  std::promise<Result>& result)
+{
+   auto hash = co_await hash_async<Sha256>(data, options);
+   result.set_value({hash.hexdigest(), std::this_thread::get_id()});
+}
+
+Detached hash_stream(const std::vector<std::string>& chunks,
+                     AsyncHashOptions options,
+                     std::promise<Result>& result)
+{
+   AsyncHasher<MD5> hash(options);
+   for(const auto& chunk : chunks) co_await hash.append(chunk);
+   result.set_value({hash.hasher().hexdigest(), std::this_thread::get_id()});
+}
+} // namespace
+
+CATCH_TEST_CASE("AsyncHash_", "[async_hash]")
+{
+   ThreadPool pool(2);
+   AsyncHashOptions options;
+   options.executor         = &pool;
+   options.inline_threshold = 4096;
+
+   const std::string small(100, 's'), large(1 << 20, 'L');
+   const auto caller = std::this_thread::get_id();
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("async-hash-inline-or-offloaded")
+   {
+      // Below the threshold, the result is there as soon as the call returns
+      std::promise<Result> inline_result;
+      auto inline_future = inline_result.get_future();
+      hash_one(small, options, inline_result);
+      CATCH_REQUIRE(inline_future.wait_for(std::chrono::seconds(0))
+                    == std::future_status::ready);
+      const auto r = inline_future.get();
+      CATCH_REQUIRE(r.hexdigest == Sha256(small).hexdigest());
+      CATCH_REQUIRE(r.resumed_on == caller);
+
+      // Above it, the coroutine carries on on the pool
+      std::promise<Result> pooled_result;
+      auto pooled_future = pooled_result.get_future();
+      hash_one(large, options, pooled_result);
+      const auto p = pooled_future.get();
+      CATCH_REQUIRE(p.hexdigest == Sha256(large).hexdigest());
+      CATCH_REQUIRE(p.resumed_on != caller);
+
+      // The default executor
+      std::promise<Result> default_result;
+      auto default_future = default_result.get_future();
+      hash_one(large, AsyncHashOptions(), default_result);
+      CATCH_REQUIRE(default_future.get().hexdigest
+                    == Sha256(large).hexdigest());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("async-hash-post-back")
+   {
+      // An event loop of our own, run on this thread
+      std::mutex padlock;
+      std::vector<std::function<void()>> posted;
+      // `post` uses its own state after handing over the continuation, which
+      // may by then have resumed the caller and destroyed the awaitable
+      auto n_posted = std::make_shared<std::atomic<int>>(0);
+      options.post  = [&, n_posted](std::function<void()> continuation) {
+         {
+            std::lock_guard<std::mutex> lock(padlock);
+            posted.push_back(std::move(continuation));
+         }
+         ++*n_posted;
+      };
+
+      const std::vector<std::string> chunks = {small, large, small, large};
+      std::promise<Result> result;
+      auto future = result.get_future();
+      hash_stream(chunks, options, result);
+      while(future.wait_for(std::chrono::milliseconds(1))
+            != std::future_status::ready) {
+         std::vector<std::function<void()>> ready;
+         {
+            std::lock_guard<std::mutex> lock(padlock);
+            ready.swap(posted);
+         }
+         for(auto& continuation : ready) continuation();
+      }
+
+      const auto r = future.get();
+      CATCH_REQUIRE(r.hexdigest
+                    == MD5(small + large + small + large).hexdigest());
+      CATCH_REQUIRE(r.resumed_on == caller);
+      while(*n_posted < 2) std::this_thread::yield();
+   }
+}
+
+#endif
@@ -0,0 +1,98 @@
+
+#include "blob_store.hpp"
+#include "temp_dir.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static Sha256Digest sha256_digest(std::string_view data)
+{
+   Sha256Digest digest;
+   Sha256(data).get_digest(digest.data());
+   return digest;
+}
+
+CATCH_TEST_CASE("BlobStore_", "[blob_store]")
+{
+   const TempDir dir("blobs");
+
+   BlobStore store;
+   CATCH_REQUIRE(store.open(dir.path()));
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("blob-store-put-get")
+   {
+      const std::string data = "The rain in Spain falls mainly on the plains.";
+      const auto digest      = store.put(data);
+      CATCH_REQUIRE(digest);
+      CATCH_REQUIRE(*digest == sha256_digest(data));
+
+      struct stat st;
+      CATCH_REQUIRE(stat(store.loose_path(*digest).c_str(), &st) == 0);
+
+      std::string out;
+      CATCH_REQUIRE(store.get(*digest, out));
+      CATCH_REQUIRE(out == data);
+      CATCH_REQUIRE(!store.contains(sha256_digest("missing")));
+
+      // Streamed in pieces, the same content lands on the same name
+      auto writer = store.writer();
+      CATCH_REQUIRE(writer.append(data.substr(0, 10)));
+      CATCH_REQUIRE(writer.append(data.substr(10)));
+      CATCH_REQUIRE(writer.commit() == digest);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("blob-store-pack")
+   {
+      std::vector<std::string> blobs;
+      std::vector<Sha256Digest> digests;
+      for(int i = 0; i < 200; ++i) {
+         blobs.push_back("blob " + std::to_string(i));
+         digests.push_back(*store.put(blobs.back()));
+      }
+      blobs.push_back(std::string(100000, 'x')); // too big to pack
+      digests.push_back(*store.put(blobs.back()));
+      blobs.push_back(""); // empty objects are fine too
+      digests.push_back(*store.put(blobs.back()));
+
+      // Readers keep reading while pack() moves objects underneath them.
+      // (Catch assertions are not thread-safe, so count failures.)
+      int n_failed = 0;
+      std::thread reader([&]() {
+         std::string out;
+         for(int round = 0; round < 20; ++round)
+            for(size_t i = 0; i < blobs.size(); ++i)
+               if(!store.get(digests[i], out) || out != blobs[i]) ++n_failed;
+      });
+      CATCH_REQUIRE(store.pack(1024) == 201);
+      reader.join();
+      CATCH_REQUIRE(n_failed == 0);
+
+      CATCH_REQUIRE(store.n_packs() == 1);
+
+      struct stat st;
+      CATCH_REQUIRE(stat(store.loose_path(digests[0]).c_str(), &st) != 0);
+      CATCH_REQUIRE(stat(store.loose_path(digests[200]).c_str(), &st) == 0);
+
+      // A second store instance finds the pack on open
+      BlobStore other;
+      CATCH_REQUIRE(other.open(dir.path()));
+      std::string out;
+      for(size_t i = 0; i < blobs.size(); ++i) {
+         CATCH_REQUIRE(other.get(digests[i], out));
+         CATCH_REQUIRE(out == blobs[i]);
+      }
+      CATCH_REQUIRE(other.pack(1024) == 0);
+   }
+}
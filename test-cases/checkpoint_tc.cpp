@@ -0,0 +1,76 @@
+
+#include "checkpoint.hpp"
+#include "temp_dir.hpp"
+
+#include <fstream>
+#include <string>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length, char seed)
+{
+   std::string data(length, '\0');
+   for(size_t i = 0; i < length; ++i) data[i] = char(seed + i * 7 + (i >> 9));
+   return data;
+}
+
+template<typename Hasher> static void test_checkpoint()
+{
+   const TempDir dir("checkpoint");
+   const std::string path = dir.path() + "/data";
+
+   CheckpointOptions options;
+   options.interval = 64 * 1024;
+
+   auto hash = [&](uint64_t& n_hashed) {
+      Hasher hasher;
+      CATCH_REQUIRE(hash_file_incremental(path, hasher, options, &n_hashed));
+      return hasher.hexdigest();
+   };
+
+   // First run hashes everything
+   std::string data = make_data(1000000 + 13, 'a');
+   std::ofstream(path, std::ios::binary) << data;
+   uint64_t n_hashed = 0;
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+   CATCH_REQUIRE(n_hashed == data.size());
+
+   // Unchanged: only the tail after the last checkpoint
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+   CATCH_REQUIRE(n_hashed < options.interval);
+
+   // Appended: resume from the last checkpoint
+   const std::string more = make_data(100000 + 5, 'q');
+   std::ofstream(path, std::ios::binary | std::ios::app) << more;
+   data += more;
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+   CATCH_REQUIRE(n_hashed < more.size() + options.interval);
+
+   // Rewritten with different content: spot checks fail, full rehash
+   data = make_data(data.size() + 1000, 'z');
+   std::ofstream(path, std::ios::binary) << data;
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+   CATCH_REQUIRE(n_hashed == data.size());
+
+   // Only the first bytes rewritten, then appended to: full rehash
+   data.replace(0, 100, std::string(100, '!'));
+   data += make_data(5000, 'r');
+   std::ofstream(path, std::ios::binary) << data;
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+   CATCH_REQUIRE(n_hashed == data.size());
+
+   // Truncated: checkpoints past the end are ignored
+   data.resize(200000);
+   std::ofstream(path, std::ios::binary) << data;
+   CATCH_REQUIRE(hash(n_hashed) == Hasher(data).hexdigest());
+}
+
+CATCH_TEST_CASE("Checkpoint_", "[checkpoint]")
+{
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("checkpoint-sha256") { test_checkpoint<Sha256>(); }
+   CATCH_SECTION("checkpoint-md5") { test_checkpoint<MD5>(); }
+}
@@ -0,0 +1,99 @@
+
+#include "digest_cache.hpp"
+#include "temp_dir.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static FileDigests digests_of(const std::string& data)
+{
+   FileDigests digests;
+   MD5(data).get_digest(digests.md5.data());
+   Sha256(data).get_digest(digests.sha256.data());
+   return digests;
+}
+
+static bool operator==(const FileDigests& a, const FileDigests& b)
+{
+   return a.md5 == b.md5 && a.sha256 == b.sha256;
+}
+
+CATCH_TEST_CASE("DigestCache_", "[digest_cache]")
+{
+   const TempDir dir("digest-cache");
+   const std::string cache_path = dir.path() + "/cache";
+   const std::string file_path  = dir.path() + "/file";
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-cache-store-lookup")
+   {
+      DigestCache cache;
+      CATCH_REQUIRE(cache.open(cache_path, 64));
+      CATCH_REQUIRE(cache.n_slots() == 64);
+
+      struct stat st = {};
+      st.st_dev      = 1;
+      st.st_size     = 100;
+
+      // More files than slots: old entries are evicted, never corrupted
+      for(int i = 0; i < 500; ++i) {
+         st.st_ino = ino_t(i);
+         CATCH_REQUIRE(cache.store(st, digests_of(std::to_string(i))));
+         CATCH_REQUIRE(cache.lookup(st) == digests_of(std::to_string(i)));
+      }
+      for(int i = 0; i < 500; ++i) {
+         st.st_ino = ino_t(i);
+         if(auto digests = cache.lookup(st))
+            CATCH_REQUIRE(*digests == digests_of(std::to_string(i)));
+      }
+
+      // Any change to the metadata is a miss
+      st.st_ino = 499;
+      CATCH_REQUIRE(cache.lookup(st));
+      st.st_mtim.tv_nsec = 1;
+      CATCH_REQUIRE(!cache.lookup(st));
+
+      // Persistent, and the existing size wins over the requested one
+      st.st_mtim.tv_nsec = 0;
+      cache.close();
+      CATCH_REQUIRE(cache.open(cache_path, 1024));
+      CATCH_REQUIRE(cache.n_slots() == 64);
+      CATCH_REQUIRE(cache.lookup(st) == digests_of("499"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-cache-hash-file")
+   {
+      const std::string data(3 << 20, 'x');
+      std::ofstream(file_path) << data;
+
+      DigestCache cache;
+      CATCH_REQUIRE(cache.open(cache_path));
+
+      // The file was only just written, so it is not cached yet
+      CATCH_REQUIRE(cache.hash_file(file_path) == digests_of(data));
+      CATCH_REQUIRE(cache.hash_file(file_path) == digests_of(data));
+      CATCH_REQUIRE(cache.hits() == 0);
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+      CATCH_REQUIRE(cache.hash_file(file_path) == digests_of(data));
+      CATCH_REQUIRE(cache.hash_file(file_path) == digests_of(data));
+      CATCH_REQUIRE(cache.hits() == 1);
+
+      // Rewriting the file invalidates the entry
+      std::ofstream(file_path) << "different";
+      CATCH_REQUIRE(cache.hash_file(file_path) == digests_of("different"));
+      CATCH_REQUIRE(cache.hits() == 1);
+
+      CATCH_REQUIRE(!cache.hash_file("/nonexistent/file"));
+   }
+}
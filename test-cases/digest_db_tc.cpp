@@ -0,0 +1,138 @@
+
+#include "digest_db.hpp"
+#include "temp_dir.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+template<typename Hasher, typename Digest> static Digest make_digest(size_t i)
+{
+   Digest digest;
+   Hasher hasher;
+   hasher.append(std::to_string(i));
+   hasher.finish().get_digest(digest.data());
+   return digest;
+}
+
+static std::string read_file(const std::string& path)
+{
+   std::ifstream in(path, std::ios::binary);
+   return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+template<typename Hasher, typename Digest>
+static void test_digest_db(const std::string& dir, unsigned fanout_bits)
+{
+   const std::string path = dir + "/digests.db";
+   const size_t N         = 20000;
+
+   // Even keys go in (twice, to exercise dedup), odd keys stay out
+   DigestDbBuilder<Digest> builder;
+   for(size_t i = 0; i < 2 * N; i += 2) {
+      builder.add(make_digest<Hasher, Digest>(i));
+      builder.add(make_digest<Hasher, Digest>(i));
+   }
+   CATCH_REQUIRE(builder.write(path, fanout_bits));
+
+   DigestDb db;
+   CATCH_REQUIRE(db.open(path));
+   CATCH_REQUIRE(db.size() == N);
+   CATCH_REQUIRE(db.digest_size() == sizeof(Digest));
+   CATCH_REQUIRE(db.fanout_bits() == fanout_bits);
+
+   std::vector<uint8_t> batch;
+   for(size_t i = 0; i < 2 * N; ++i) {
+      const auto digest = make_digest<Hasher, Digest>(i);
+      CATCH_REQUIRE(db.contains(digest) == (i % 2 == 0));
+      batch.insert(end(batch), begin(digest), end(digest));
+   }
+
+   std::vector<char> found(2 * N);
+   db.contains_batch(batch.data(), 2 * N, reinterpret_cast<bool*>(&found[0]));
+   for(size_t i = 0; i < 2 * N; ++i)
+      CATCH_REQUIRE(bool(found[i]) == (i % 2 == 0));
+
+   for(size_t i = 1; i < db.size(); ++i)
+      CATCH_REQUIRE(memcmp(db.record(i - 1), db.record(i), sizeof(Digest)) < 0);
+   db.close();
+
+   // A fanout table out of order is rejected
+   if(fanout_bits != 0) {
+      std::FILE* fp = std::fopen(path.c_str(), "r+b");
+      CATCH_REQUIRE(fp != nullptr);
+      const uint64_t past_the_end = N + 1000;
+      CATCH_REQUIRE(std::fseek(fp, 32 + sizeof(uint64_t), SEEK_SET) == 0);
+      CATCH_REQUIRE(std::fwrite(&past_the_end, sizeof(uint64_t), 1, fp) == 1);
+      CATCH_REQUIRE(std::fclose(fp) == 0);
+      CATCH_REQUIRE(!db.open(path));
+   }
+}
+
+CATCH_TEST_CASE("DigestDb_", "[digest_db]")
+{
+   const TempDir dir("digest-db");
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-db-sha256")
+   {
+      test_digest_db<Sha256, Sha256Digest>(dir.path(), 16);
+      test_digest_db<Sha256, Sha256Digest>(dir.path(), 0);
+   }
+
+   CATCH_SECTION("digest-db-md5")
+   {
+      test_digest_db<MD5, Md5Digest>(dir.path(), 8);
+   }
+
+   CATCH_SECTION("digest-db-spilled")
+   {
+      // Through an external sort, with several runs: the same file
+      const std::string path = dir.path() + "/digests.db";
+      DigestDbBuilder<Sha256Digest> in_memory;
+      DigestDbBuilder<Sha256Digest> spilled(dir.path(),
+                                            2000 * sizeof(Sha256Digest));
+      for(size_t i = 0; i < 30000; ++i) {
+         const auto digest = make_digest<Sha256, Sha256Digest>(i % 9000);
+         in_memory.add(digest);
+         spilled.add(digest);
+      }
+      CATCH_REQUIRE(in_memory.write(path + ".expected", 12));
+      CATCH_REQUIRE(spilled.write(path, 12));
+      CATCH_REQUIRE(spilled.size() == 9000);
+      CATCH_REQUIRE(read_file(path) == read_file(path + ".expected"));
+
+      // Digests out of order are refused, and nothing is written
+      const std::string unsorted = dir.path() + "/unsorted.db";
+      const auto a = make_digest<Sha256, Sha256Digest>(1);
+      const auto b = make_digest<Sha256, Sha256Digest>(2);
+      DigestDbWriter writer;
+      CATCH_REQUIRE(writer.open(unsorted, sizeof(Sha256Digest)));
+      CATCH_REQUIRE(writer.add(std::max(a, b).data()));
+      CATCH_REQUIRE(!writer.add(std::min(a, b).data()));
+      CATCH_REQUIRE(!writer.commit());
+      CATCH_REQUIRE(!DigestDb().open(unsorted));
+   }
+
+   CATCH_SECTION("digest-db-empty-and-invalid")
+   {
+      const std::string path = dir.path() + "/empty.db";
+      CATCH_REQUIRE(DigestDbBuilder<Sha256Digest>{}.write(path));
+
+      DigestDb db;
+      CATCH_REQUIRE(db.open(path));
+      CATCH_REQUIRE(db.size() == 0);
+      CATCH_REQUIRE(!db.contains(Sha256Digest{}));
+
+      CATCH_REQUIRE(!db.open("/nonexistent/digest.db"));
+      CATCH_REQUIRE(!db.is_open());
+   }
+}
@@ -0,0 +1,121 @@
+
+#include "digest_map.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static Sha256Digest make_key(size_t i)
+{
+   Sha256Digest key;
+   Sha256 sha;
+   sha.append(std::to_string(i));
+   sha.finish().get_digest(key.data());
+   return key;
+}
+
+CATCH_TEST_CASE("DigestMap_", "[digest_map]")
+{
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-map-insert-find")
+   {
+      DigestMap<uint64_t> map(16); // small, so that it must grow
+      const size_t N = 5000;
+
+      for(size_t i = 0; i < N; ++i) {
+         auto [value, inserted] = map.insert(make_key(i), i);
+         CATCH_REQUIRE(inserted);
+         CATCH_REQUIRE(value == i);
+      }
+
+      CATCH_REQUIRE(map.size() == N);
+      CATCH_REQUIRE(map.capacity() > N);
+
+      for(size_t i = 0; i < N; ++i) {
+         auto [value, inserted] = map.insert(make_key(i), i + 1);
+         CATCH_REQUIRE(!inserted);
+         CATCH_REQUIRE(value == i); // first insert wins
+         CATCH_REQUIRE(map.find(make_key(i)) == i);
+      }
+
+      CATCH_REQUIRE(!map.contains(make_key(N)));
+      CATCH_REQUIRE(map.size() == N);
+
+      // Sealed tables are migrated by later inserts, so misses don't probe
+      // the whole chain
+      CATCH_REQUIRE(map.n_live_tables() <= 2);
+      for(size_t i = N; i < 2 * N; ++i) map.insert(make_key(i), i);
+      CATCH_REQUIRE(map.n_live_tables() <= 2);
+      CATCH_REQUIRE(map.size() == 2 * N);
+      for(size_t i = 0; i < 2 * N; ++i)
+         CATCH_REQUIRE(map.find(make_key(i)) == i);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-map-concurrent")
+   {
+      DigestMap<uint64_t> map(64);
+      const size_t N         = 20000;
+      const size_t n_threads = 4;
+
+      std::vector<Sha256Digest> keys(N);
+      for(size_t i = 0; i < N; ++i) keys[i] = make_key(i);
+
+      // Every thread inserts every key, so inserts race on the same keys
+      // while tables grow underneath them
+      std::vector<size_t> n_inserted(n_threads, 0);
+      std::vector<std::thread> threads;
+      for(size_t t = 0; t < n_threads; ++t)
+         threads.emplace_back([&, t]() {
+            for(size_t j = 0; j < N; ++j) {
+               const size_t i = (j * (t + 1)) % N; // different orders
+               if(map.insert(keys[i], i).second) ++n_inserted[t];
+            }
+         });
+      for(auto& thread : threads) thread.join();
+
+      size_t total = 0;
+      for(auto n : n_inserted) total += n;
+      CATCH_REQUIRE(total == N);
+      CATCH_REQUIRE(map.size() == N);
+
+      for(size_t i = 0; i < N; ++i) CATCH_REQUIRE(map.find(keys[i]) == i);
+      CATCH_REQUIRE(map.n_live_tables() <= 2);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("digest-map-find-while-migrating")
+   {
+      DigestMap<uint64_t> map(16);
+      const size_t N = 20000;
+      std::vector<Sha256Digest> keys(N);
+      for(size_t i = 0; i < N; ++i) keys[i] = make_key(i);
+
+      // Whatever has been inserted stays visible as tables are sealed,
+      // migrated and drained
+      std::atomic<size_t> n_inserted{0};
+      std::atomic<size_t> n_missing{0};
+      std::thread reader([&] {
+         for(size_t n; (n = n_inserted.load()) < N;)
+            for(size_t i = n > 64 ? n - 64 : 0; i < n; ++i)
+               if(map.find(keys[i]) != i) ++n_missing;
+      });
+      for(size_t i = 0; i < N; ++i) {
+         map.insert(keys[i], i);
+         n_inserted.store(i + 1);
+      }
+      reader.join();
+      CATCH_REQUIRE(n_missing == 0);
+      CATCH_REQUIRE(map.size() == N);
+   }
+}
@@ -0,0 +1,90 @@
+
+#include "digest_sort.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+template<typename Hasher, typename Digest> static Digest make_digest(size_t i)
+{
+   Digest digest;
+   Hasher hasher;
+   hasher.append(std::to_string(i));
+   hasher.finish().get_digest(digest.data());
+   return digest;
+}
+
+CATCH_TEST_CASE("DigestSort_", "[digest_sort]")
+{
+   // Every key i < N/3 appears 3 times, so there's plenty to dedup
+   const size_t N = 300000;
+   auto key_of    = [&](size_t i) { return i % (N / 3); };
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("radix-sort")
+   {
+      std::vector<Md5Digest> digests(N);
+      for(size_t i = 0; i < N; ++i)
+         digests[i] = make_digest<MD5, Md5Digest>(key_of(i));
+
+      auto expected = digests;
+      std::sort(begin(expected), end(expected));
+
+      radix_sort(digests.data(), digests.size(), 4);
+      CATCH_REQUIRE(digests == expected);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("radix-sort-unique-with-payload")
+   {
+      using Record = DigestRecord<Sha256Digest, uint32_t>;
+      std::vector<Record> records(N);
+      for(size_t i = 0; i < N; ++i)
+         records[i] = {make_digest<Sha256, Sha256Digest>(key_of(i)),
+                       uint32_t(key_of(i))};
+
+      std::vector<uint32_t> counts(N);
+      const auto n = radix_sort_unique(records.data(), N, counts.data(), 4);
+      CATCH_REQUIRE(n == N / 3);
+
+      for(size_t i = 0; i < n; ++i) {
+         CATCH_REQUIRE(counts[i] == 3);
+         CATCH_REQUIRE(records[i].digest
+                       == make_digest<Sha256, Sha256Digest>(records[i].payload));
+         if(i > 0) CATCH_REQUIRE(records[i - 1].digest < records[i].digest);
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("external-sort")
+   {
+      // Budget of 20k digests, so that the input spills several runs
+      ExternalDigestSorter<Sha256Digest> sorter("/tmp",
+                                                20000 * sizeof(Sha256Digest));
+      std::map<Sha256Digest, uint64_t> expected;
+      for(size_t i = 0; i < 100000; ++i) {
+         const auto digest = make_digest<Sha256, Sha256Digest>(i % 30000);
+         CATCH_REQUIRE(sorter.add(digest));
+         ++expected[digest];
+      }
+      CATCH_REQUIRE(sorter.n_runs() >= 4);
+
+      std::vector<std::pair<const Sha256Digest, uint64_t>> emitted;
+      CATCH_REQUIRE(sorter.finish([&](const Sha256Digest& d, uint64_t count) {
+         emitted.emplace_back(d, count);
+      }));
+
+      CATCH_REQUIRE(emitted.size() == expected.size());
+      CATCH_REQUIRE(std::equal(begin(emitted), end(emitted), begin(expected)));
+      CATCH_REQUIRE(sorter.n_runs() == 0);
+   }
+}
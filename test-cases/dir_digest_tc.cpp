@@ -0,0 +1,188 @@
+
+#include "dir_digest.hpp"
+#include "temp_dir.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static void write_file(const std::string& path, const std::string& data)
+{
+   std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+static std::string be32(uint32_t x)
+{
+   return {char(x >> 24), char(x >> 16), char(x >> 8), char(x)};
+}
+
+static std::string bytes(const Sha256Digest& digest)
+{
+   return std::string(reinterpret_cast<const char*>(digest.data()), 32);
+}
+
+static Sha256Digest digest_of(const std::string& data)
+{
+   Sha256Digest digest;
+   Sha256(data).get_digest(digest.data());
+   return digest;
+}
+
+CATCH_TEST_CASE("DirDigest_", "[dir_digest]")
+{
+   const TempDir tmp("dir-digest");
+   const std::string root = tmp.path() + "/root";
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("dir-digest-encoding")
+   {
+      // One file "a" holding "x", mode 0640, in one subdirectory "s"
+      mkdir(root.c_str(), 0755);
+      mkdir((root + "/s").c_str(), 0700);
+      write_file(root + "/s/a", "x");
+      chmod((root + "/s/a").c_str(), 0640);
+
+      const auto file = std::string("f") + be32(0640) + be32(1) + "a"
+                        + be32(0) + be32(1) + bytes(digest_of("x"));
+      const auto dir  = std::string("d") + be32(0700) + be32(1) + "s"
+                       + bytes(digest_of(file));
+
+      const auto tree = dir_digest(root);
+      CATCH_REQUIRE(tree.n_errors == 0);
+      CATCH_REQUIRE(tree.root == digest_of(dir));
+      CATCH_REQUIRE(tree.root_hex() == Sha256(dir).hexdigest());
+
+      CATCH_REQUIRE(tree.entries.size() == 3);
+      CATCH_REQUIRE(tree.entries[0].path == "");
+      CATCH_REQUIRE(tree.entries[1].path == "s");
+      CATCH_REQUIRE(tree.entries[1].digest == digest_of(file));
+      CATCH_REQUIRE(tree.entries[2].path == "s/a");
+      CATCH_REQUIRE(tree.entries[2].type == DirEntryType::file);
+      CATCH_REQUIRE(tree.entries[2].size == 1);
+      CATCH_REQUIRE(tree.entries[2].digest == digest_of("x"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("dir-digest-deterministic")
+   {
+      mkdir(root.c_str(), 0755);
+      for(int d = 0; d < 8; ++d) {
+         const auto dir = root + "/dir" + std::to_string(7 - d);
+         mkdir(dir.c_str(), 0755);
+         for(int f = 0; f < 20; ++f)
+            write_file(dir + "/f" + std::to_string(f),
+                       std::string(size_t(d * 1000 + f), char('a' + f)));
+      }
+      symlink("dir1/f3", (root + "/link").c_str());
+      mkfifo((root + "/fifo").c_str(), 0600);
+
+      DirDigestOptions options;
+      options.n_threads = 1;
+      const auto one    = dir_digest(root, options);
+      CATCH_REQUIRE(one.n_errors == 0);
+      CATCH_REQUIRE(one.entries.size() == 1 + 8 * 21 + 2);
+      for(unsigned n_threads : {2u, 4u, 7u}) {
+         options.n_threads = n_threads;
+         const auto many   = dir_digest(root, options);
+         CATCH_REQUIRE(many.root == one.root);
+         CATCH_REQUIRE(many.entries.size() == one.entries.size());
+         for(size_t i = 0; i < one.entries.size(); ++i)
+            CATCH_REQUIRE(many.entries[i].path == one.entries[i].path);
+      }
+
+      // Sensitive to content, names, link targets and (optionally) modes
+      write_file(root + "/dir3/f5", "changed");
+      const auto changed = dir_digest(root);
+      CATCH_REQUIRE(changed.root != one.root);
+
+      rename((root + "/dir3/f5").c_str(), (root + "/dir3/f5b").c_str());
+      const auto renamed = dir_digest(root);
+      CATCH_REQUIRE(renamed.root != changed.root);
+
+      unlink((root + "/link").c_str());
+      symlink("dir1/f4", (root + "/link").c_str());
+      const auto relinked = dir_digest(root);
+      CATCH_REQUIRE(relinked.root != renamed.root);
+      for(const auto& e : relinked.entries)
+         if(e.path == "link") CATCH_REQUIRE(e.target == "dir1/f4");
+
+      options.modes            = false;
+      const auto without_modes = dir_digest(root, options);
+      chmod((root + "/dir2/f1").c_str(), 0600);
+      CATCH_REQUIRE(dir_digest(root).root != relinked.root);
+      CATCH_REQUIRE(dir_digest(root, options).root == without_modes.root);
+
+      // Manifest round trip
+      const auto manifest = root + ".manifest";
+      CATCH_REQUIRE(write_dir_manifest(manifest, relinked));
+      const auto loaded = read_dir_manifest(manifest);
+      CATCH_REQUIRE(loaded);
+      CATCH_REQUIRE(loaded->root == relinked.root);
+      CATCH_REQUIRE(loaded->entries.size() == relinked.entries.size());
+      for(size_t i = 0; i < loaded->entries.size(); ++i) {
+         const auto& a = loaded->entries[i];
+         const auto& b = relinked.entries[i];
+         CATCH_REQUIRE(a.path == b.path);
+         CATCH_REQUIRE(a.type == b.type);
+         CATCH_REQUIRE(a.mode == b.mode);
+         CATCH_REQUIRE(a.size == b.size);
+         CATCH_REQUIRE(a.mtime_ns == b.mtime_ns);
+         CATCH_REQUIRE(a.ctime_ns == b.ctime_ns);
+         CATCH_REQUIRE(a.ino == b.ino);
+         CATCH_REQUIRE(a.digest == b.digest);
+         CATCH_REQUIRE(a.target == b.target);
+      }
+      std::remove(manifest.c_str());
+      CATCH_REQUIRE(!read_dir_manifest(manifest));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("dir-digest-previous")
+   {
+      mkdir(root.c_str(), 0755);
+      write_file(root + "/a", "aaaa");
+      const auto first = dir_digest(root);
+      CATCH_REQUIRE(first.entries[1].path == "a");
+
+      // Unchanged files are not read again: plant a wrong digest to show it
+      auto planted = first;
+      planted.entries[1].digest.fill(0xab);
+      DirDigestOptions options;
+      options.previous = &planted;
+      CATCH_REQUIRE(dir_digest(root, options).entries[1].digest[0] == 0xab);
+
+      // A file renamed over it, with the same size and mtime, is read
+      write_file(root + "/b", "bbbb");
+      struct stat st;
+      CATCH_REQUIRE(lstat((root + "/a").c_str(), &st) == 0);
+      const timespec times[2] = {st.st_atim, st.st_mtim};
+      CATCH_REQUIRE(utimensat(AT_FDCWD, (root + "/b").c_str(), times, 0) == 0);
+      CATCH_REQUIRE(rename((root + "/b").c_str(), (root + "/a").c_str()) == 0);
+      const auto second = dir_digest(root, options);
+      CATCH_REQUIRE(second.entries[1].mtime_ns == first.entries[1].mtime_ns);
+      CATCH_REQUIRE(second.entries[1].digest == digest_of("bbbb"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("dir-digest-errors")
+   {
+      const auto missing = dir_digest(root + "/missing");
+      CATCH_REQUIRE(missing.n_errors == 1);
+      CATCH_REQUIRE(missing.entries[0].error == ENOENT);
+   }
+}
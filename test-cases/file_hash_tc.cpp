@@ -0,0 +1,145 @@
+
+#include "file_hash.hpp"
+#include "temp_dir.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length)
+{
+   std::string data(length, '\0');
+   uint32_t x = 12345;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+   return data;
+}
+
+static void write_file(const std::string& path, const std::string& data)
+{
+   std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+CATCH_TEST_CASE("FileHash_", "[file_hash]")
+{
+   const TempDir dir("file-hash");
+   const std::string path = dir.path() + "/data";
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("file-hash-small")
+   {
+      for(size_t length : {0, 1, 63, 64, 65, 1000, 100000}) {
+         const auto data = make_data(length);
+         write_file(path, data);
+         CATCH_REQUIRE(sha256_file(path) == Sha256(data).hexdigest());
+         CATCH_REQUIRE(md5_file(path) == MD5(data).hexdigest());
+      }
+      CATCH_REQUIRE(!sha256_file(dir.path() + "/missing"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("file-hash-mmap-windows")
+   {
+      // Windows that don't divide the file, nor line up with blocks
+      const auto data = make_data(3 * 65536 + 4099);
+      write_file(path, data);
+
+      for(size_t window : {4096, 65536, 1 << 20}) {
+         FileHashOptions options;
+         options.mmap_threshold = 0;
+         options.window         = window;
+         options.drop_cache     = window == 4096;
+
+         Sha256 sha;
+         MD5 md5;
+         CATCH_REQUIRE(hash_file(path, sha, options));
+         CATCH_REQUIRE(hash_file(path, md5, options));
+         CATCH_REQUIRE(sha.hexdigest() == Sha256(data).hexdigest());
+         CATCH_REQUIRE(md5.hexdigest() == MD5(data).hexdigest());
+      }
+
+      // Hashing several files into one hasher
+      Sha256 sha;
+      CATCH_REQUIRE(hash_file(path, sha));
+      CATCH_REQUIRE(hash_file(path, sha));
+      CATCH_REQUIRE(sha.hexdigest() == Sha256(data + data).hexdigest());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("file-hash-sink-throws")
+   {
+      // An exception from the sink reaches the caller, mapped or read
+      write_file(path, make_data(100000));
+      const FileChunkSink sink = [](const void*, size_t) {
+         throw std::runtime_error("sink");
+      };
+      for(size_t threshold : {0, 1 << 20}) {
+         FileHashOptions options;
+         options.mmap_threshold = threshold;
+         CATCH_REQUIRE_THROWS_AS(stream_file(path, sink, options),
+                                 std::runtime_error);
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("file-hash-fd-position")
+   {
+      // Only the bytes after the current position are hashed, whether
+      // mapped or read, and the fd is left at the end
+      const auto data = make_data(70000);
+      write_file(path, data);
+
+      for(size_t threshold : {0, 1 << 20}) {
+         FileHashOptions options;
+         options.mmap_threshold = threshold;
+         options.window         = 8192;
+
+         const int fd = ::open(path.c_str(), O_RDONLY);
+         CATCH_REQUIRE(fd >= 0);
+         CATCH_REQUIRE(lseek(fd, 5000, SEEK_SET) == 5000);
+         Sha256 sha;
+         CATCH_REQUIRE(hash_fd(fd, sha, options));
+         CATCH_REQUIRE(lseek(fd, 0, SEEK_CUR) == off_t(data.size()));
+         ::close(fd);
+         CATCH_REQUIRE(sha.hexdigest()
+                       == Sha256(data.substr(5000)).hexdigest());
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("file-hash-pipe")
+   {
+      const auto data = make_data(20000);
+      int fds[2];
+      CATCH_REQUIRE(pipe(fds) == 0);
+      CATCH_REQUIRE(write(fds[1], data.data(), data.size())
+                    == ssize_t(data.size()));
+      ::close(fds[1]);
+
+      FileHashOptions options;
+      options.mmap_threshold = 0; // pipes are read regardless
+      options.read_size      = 1000;
+      MD5 md5;
+      CATCH_REQUIRE(hash_fd(fds[0], md5, options));
+      ::close(fds[0]);
+      CATCH_REQUIRE(md5.hexdigest() == MD5(data).hexdigest());
+   }
+}
@@ -0,0 +1,89 @@
+
+#include "hash_batch.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+template<typename Hasher>
+static bool check(const std::vector<std::string_view>& messages,
+                  const std::vector<uint8_t>& digests)
+{
+   for(size_t i = 0; i < messages.size(); ++i) {
+      Hasher hasher;
+      hasher.append(messages[i].data(), messages[i].size());
+      const auto expected = hasher.finish().get_digest();
+      const auto* digest = &digests[i * expected.size()];
+      if(memcmp(digest, expected.data(), expected.size()) != 0) return false;
+   }
+   return true;
+}
+
+CATCH_TEST_CASE("HashBatch_", "[hash_batch]")
+{
+   // Mostly small messages, some empty, and a few large ones
+   std::string storage(4 << 20, '\0');
+   for(size_t i = 0; i < storage.size(); ++i)
+      storage[i] = char(i * 7 + i / 251);
+   std::vector<std::string_view> messages;
+   for(size_t i = 0, pos = 0; i < 5000; ++i) {
+      const size_t size = i % 997 == 0 ? 300000 : i % 13 == 0 ? 0 : i % 200;
+      messages.emplace_back(storage.data() + pos % (storage.size() - size),
+                            size);
+      pos += 4099;
+   }
+
+   CATCH_REQUIRE(digest_size(HashAlgorithm::md5) == 16);
+   CATCH_REQUIRE(digest_size(HashAlgorithm::sha256) == 32);
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-batch-own-pool")
+   {
+      HashBatchOptions options;
+      options.n_threads   = 3;
+      options.group_bytes = 10000;
+      std::vector<uint8_t> sha256(messages.size() * 32);
+      hash_batch(HashAlgorithm::sha256,
+                 messages.data(),
+                 messages.size(),
+                 sha256.data(),
+                 options);
+      CATCH_REQUIRE(check<Sha256>(messages, sha256));
+
+      std::vector<uint8_t> md5(messages.size() * 16);
+      hash_batch(HashAlgorithm::md5,
+                 messages.data(),
+                 messages.size(),
+                 md5.data(),
+                 options);
+      CATCH_REQUIRE(check<MD5>(messages, md5));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-batch-shared-pool")
+   {
+      ThreadPool pool(2);
+      HashBatchOptions options;
+      options.pool = &pool;
+      for(const size_t count : {0, 1, 3, 5000}) {
+         const std::vector<std::string_view> some(messages.begin(),
+                                                  messages.begin() + count);
+         std::vector<uint8_t> digests(count * 32);
+         hash_batch(HashAlgorithm::sha256,
+                    some.data(),
+                    count,
+                    digests.data(),
+                    options);
+         CATCH_REQUIRE(check<Sha256>(some, digests));
+      }
+   }
+}
@@ -0,0 +1,109 @@
+
+#include "hash_engine.hpp"
+#include "temp_dir.hpp"
+
+#include <cerrno>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length, uint32_t seed)
+{
+   std::string data(length, '\0');
+   for(auto& c : data) {
+      seed = seed * 1103515245u + 12345u;
+      c    = char(seed >> 24);
+   }
+   return data;
+}
+
+CATCH_TEST_CASE("HashEngine_", "[hash_engine]")
+{
+   // Sizes around the buffer size used below, and a few large files
+   const TempDir dir("hash-engine");
+   std::vector<std::string> paths;
+   std::vector<Sha256Digest> expected;
+   const size_t sizes[] = {0, 1, 4095, 4096, 4097, 100000, 3 << 20, 12345};
+   for(size_t i = 0; i < 40; ++i) {
+      const auto path = dir.path() + "/" + std::to_string(i);
+      const auto data = make_data(sizes[i % 8] + i / 8, uint32_t(i));
+      std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+      paths.push_back(path);
+      expected.emplace_back();
+      Sha256(data).get_digest(expected.back().data());
+   }
+   paths.push_back(dir.path() + "/does-not-exist");
+
+   auto check = [&](const HashEngineOptions& options) {
+      std::mutex padlock;
+      std::vector<int> n_calls(paths.size());
+      std::vector<int> errors(paths.size());
+      std::vector<Sha256Digest> digests(paths.size());
+      const auto stats = hash_files(
+          paths,
+          [&](size_t i, int error, const Sha256Digest& digest) {
+             std::lock_guard<std::mutex> guard(padlock);
+             ++n_calls[i];
+             errors[i]  = error;
+             digests[i] = digest;
+          },
+          options);
+
+      for(size_t i = 0; i < expected.size(); ++i) {
+         CATCH_REQUIRE(n_calls[i] == 1);
+         CATCH_REQUIRE(errors[i] == 0);
+         CATCH_REQUIRE(digests[i] == expected[i]);
+      }
+      CATCH_REQUIRE(n_calls.back() == 1);
+      CATCH_REQUIRE(errors.back() == ENOENT);
+      CATCH_REQUIRE(stats.n_files == paths.size());
+      CATCH_REQUIRE(stats.n_errors == 1);
+      return stats;
+   };
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-engine-io-uring")
+   {
+      HashEngineOptions options;
+      options.queue_depth = 8;
+      options.buffer_size = 4096;
+      options.n_workers   = 3;
+      const auto stats    = check(options);
+      CATCH_REQUIRE(stats.n_bytes > (3u << 20) * 5);
+
+      options.queue_depth = 64;
+      options.buffer_size = 1 << 20;
+      options.n_workers   = 0;
+      check(options);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-engine-pread")
+   {
+      HashEngineOptions options;
+      options.use_io_uring = false;
+      options.queue_depth  = 4;
+      options.buffer_size  = 4096;
+      options.huge_pages   = false;
+      const auto stats     = check(options);
+      CATCH_REQUIRE(!stats.io_uring);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-engine-empty")
+   {
+      const auto stats = hash_files(
+          {}, [](size_t, int, const Sha256Digest&) { CATCH_REQUIRE(false); });
+      CATCH_REQUIRE(stats.n_files == 0);
+   }
+}
@@ -0,0 +1,109 @@
+
+#include "hash_functions.h"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("HashFunctionsC_", "[hash_functions]")
+{
+   CATCH_REQUIRE(hf_abi_version() == HF_ABI_VERSION);
+
+   std::vector<std::string> messages;
+   for(size_t size = 0; size < 300; size += 7)
+      messages.emplace_back(std::string(size, char('a' + size % 26)));
+   messages.push_back(std::string(100000, 'z'));
+
+   std::vector<const void*> pointers;
+   std::vector<size_t> sizes;
+   for(const auto& m : messages) {
+      pointers.push_back(m.empty() ? nullptr : m.data());
+      sizes.push_back(m.size());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-functions-sha256")
+   {
+      std::vector<uint8_t> digests(messages.size() * HF_SHA256_DIGEST_SIZE);
+      hf_sha256_batch(
+          pointers.data(), sizes.data(), messages.size(), digests.data());
+
+      hf_sha256_ctx ctx;
+      hf_sha256_init(&ctx);
+      for(size_t i = 0; i < messages.size(); ++i) {
+         const auto expected = Sha256(messages[i]).get_digest();
+         CATCH_REQUIRE(memcmp(&digests[i * HF_SHA256_DIGEST_SIZE],
+                              expected.data(),
+                              HF_SHA256_DIGEST_SIZE)
+                       == 0);
+
+         uint8_t digest[HF_SHA256_DIGEST_SIZE];
+         hf_sha256(pointers[i], sizes[i], digest);
+         CATCH_REQUIRE(memcmp(digest, expected.data(), sizeof(digest)) == 0);
+
+         // Streaming, reusing the context after each finish
+         for(size_t pos = 0; pos < sizes[i]; pos += 50)
+            hf_sha256_append(
+                &ctx, &messages[i][pos], std::min<size_t>(50, sizes[i] - pos));
+         hf_sha256_finish(&ctx, digest);
+         CATCH_REQUIRE(memcmp(digest, expected.data(), sizeof(digest)) == 0);
+      }
+
+      // A context copied part way through carries on independently
+      hf_sha256_append(&ctx, "hello ", 6);
+      hf_sha256_ctx fork;
+      memcpy(&fork, &ctx, sizeof(ctx));
+      hf_sha256_append(&ctx, "world", 5);
+      hf_sha256_append(&fork, "there", 5);
+      uint8_t a[HF_SHA256_DIGEST_SIZE], b[HF_SHA256_DIGEST_SIZE];
+      hf_sha256_finish(&ctx, a);
+      hf_sha256_finish(&fork, b);
+      CATCH_REQUIRE(memcmp(a, Sha256("hello world").get_digest().data(), 32)
+                    == 0);
+      CATCH_REQUIRE(memcmp(b, Sha256("hello there").get_digest().data(), 32)
+                    == 0);
+
+      // Empty input may be null, including part way through a block
+      hf_sha256(nullptr, 0, a);
+      CATCH_REQUIRE(memcmp(a, Sha256("").get_digest().data(), 32) == 0);
+      hf_sha256_append(&ctx, "abc", 3);
+      hf_sha256_append(&ctx, nullptr, 0);
+      hf_sha256_finish(&ctx, a);
+      CATCH_REQUIRE(memcmp(a, Sha256("abc").get_digest().data(), 32) == 0);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-functions-md5")
+   {
+      std::vector<uint8_t> digests(messages.size() * HF_MD5_DIGEST_SIZE);
+      hf_md5_batch(
+          pointers.data(), sizes.data(), messages.size(), digests.data());
+
+      hf_md5_ctx ctx;
+      hf_md5_init(&ctx);
+      for(size_t i = 0; i < messages.size(); ++i) {
+         const auto expected = MD5(messages[i]).finish().get_digest();
+         CATCH_REQUIRE(memcmp(&digests[i * HF_MD5_DIGEST_SIZE],
+                              expected.data(),
+                              HF_MD5_DIGEST_SIZE)
+                       == 0);
+
+         uint8_t digest[HF_MD5_DIGEST_SIZE];
+         hf_md5(pointers[i], sizes[i], digest);
+         CATCH_REQUIRE(memcmp(digest, expected.data(), sizeof(digest)) == 0);
+
+         hf_md5_append(&ctx, pointers[i], sizes[i]);
+         hf_md5_finish(&ctx, digest);
+         CATCH_REQUIRE(memcmp(digest, expected.data(), sizeof(digest)) == 0);
+      }
+   }
+}
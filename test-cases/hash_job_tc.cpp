@@ -0,0 +1,68 @@
+
+#include "hash_job.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <string>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("HashJob_", "[hash_job]")
+{
+   std::string data(3000000, '\0');
+   for(size_t i = 0; i < data.size(); ++i) data[i] = char(i * 131 + (i >> 9));
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-job-byte-budget")
+   {
+      for(const size_t budget : {1u, 63u, 64u, 1000u, 1u << 20}) {
+         const auto part = data.substr(0, budget == 1 ? 5000 : data.size());
+         HashJob<Sha256> job(part.data(), part.size());
+         size_t n_steps = 0;
+         for(size_t before = 0; !job.step(budget); before = job.position()) {
+            CATCH_REQUIRE(job.position() - before == budget);
+            ++n_steps;
+         }
+         CATCH_REQUIRE(n_steps == (part.size() - 1) / budget);
+         CATCH_REQUIRE(job.done());
+         CATCH_REQUIRE(job.hasher().hexdigest() == Sha256(part).hexdigest());
+
+         // Steps after the end change nothing
+         CATCH_REQUIRE(job.step(budget));
+         CATCH_REQUIRE(job.hasher().hexdigest() == Sha256(part).hexdigest());
+      }
+
+      HashJob<MD5> empty(nullptr, 0);
+      CATCH_REQUIRE(empty.done());
+      CATCH_REQUIRE(empty.step(100));
+      CATCH_REQUIRE(empty.hasher().hexdigest() == MD5("").hexdigest());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hash-job-deadline")
+   {
+      using Clock = HashJob<MD5>::Clock;
+
+      // A deadline already past still gets one slice done
+      HashJob<MD5> job(data.data(), data.size(), 4096);
+      CATCH_REQUIRE(!job.step(Clock::now() - std::chrono::seconds(1)));
+      CATCH_REQUIRE(job.position() == 4096);
+
+      size_t n_steps = 1;
+      while(!job.step(Clock::now() + std::chrono::microseconds(100)))
+         ++n_steps;
+      CATCH_REQUIRE(n_steps > 1);
+      CATCH_REQUIRE(job.hasher().hexdigest() == MD5(data).hexdigest());
+
+      // Reused for another buffer
+      job.reset(data.data(), 100);
+      CATCH_REQUIRE(job.step(Clock::now() + std::chrono::seconds(10)));
+      CATCH_REQUIRE(job.hasher().hexdigest()
+                    == MD5(data.substr(0, 100)).hexdigest());
+   }
+}
@@ -0,0 +1,215 @@
+
+#include "hashd.hpp"
+#include "hashd_client.hpp"
+#include "temp_dir.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string pattern(size_t size, unsigned seed)
+{
+   std::string data(size, '\0');
+   uint32_t x = seed * 2654435761u + 1;
+   for(auto& c : data) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      c = char(x);
+   }
+   return data;
+}
+
+template<typename Local>
+static std::vector<uint8_t> local_digest(const std::string& data)
+{
+   Local local;
+   local.append(data);
+   const auto digest = local.finish().get_digest();
+   return std::vector<uint8_t>(digest.begin(), digest.end());
+}
+
+static bool connect(HashdClient& client,
+                    const std::string& socket_path,
+                    size_t ring_size = HashdClient::default_ring_size)
+{
+   for(int i = 0; i < 100; ++i) {
+      if(client.connect(socket_path, ring_size)) return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+   }
+   return false;
+}
+
+CATCH_TEST_CASE("Hashd_", "[hashd]")
+{
+   const TempDir dir("hashd");
+   const std::string socket_path = dir.path() + "/hashd.sock";
+   HashdServer server;
+   HashdOptions options;
+   options.n_threads    = 2;
+   options.max_sessions = 16;
+   std::thread service([&] { server.serve(socket_path, options); });
+   bool stopped = false;
+
+   // Inline, shared, and larger than the (small) ring: the ring wraps
+   const size_t sizes[] = {0, 1, 64, 8191, 8192, 100000, 300000};
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashd-client")
+   {
+      HashdClient client;
+      CATCH_REQUIRE(connect(client, socket_path, 64 << 10));
+      CATCH_REQUIRE(client.has_ring());
+
+      for(const auto size : sizes) {
+         const auto data = pattern(size, unsigned(size));
+         CATCH_REQUIRE(client.hash(HashAlgorithm::sha256, data.data(), size)
+                       == local_digest<Sha256>(data));
+         CATCH_REQUIRE(client.hash(HashAlgorithm::md5, data.data(), size)
+                       == local_digest<MD5>(data));
+
+         // In pieces of every kind, pipelined
+         const auto session = client.open(HashAlgorithm::sha256);
+         CATCH_REQUIRE(session);
+         for(size_t pos = 0, n = 1; pos < size; pos += n, n = n * 7 + 3)
+            CATCH_REQUIRE(client.append(
+                *session, data.data() + pos, std::min(n, size - pos)));
+         CATCH_REQUIRE(client.finish(*session) == local_digest<Sha256>(data));
+      }
+
+      // Unknown sessions and algorithms fail, without losing the connection
+      CATCH_REQUIRE(!client.finish(12345));
+      const auto bad = client.open(HashAlgorithm(7));
+      CATCH_REQUIRE(client.append(*bad, "abc", 3));
+      CATCH_REQUIRE(!client.finish(*bad));
+      CATCH_REQUIRE(client.hash(HashAlgorithm::md5, "abc", 3)
+                    == local_digest<MD5>("abc"));
+
+      // Sessions past the cap fail, until one is closed
+      std::vector<uint64_t> sessions;
+      for(size_t i = 0; i < options.max_sessions; ++i)
+         sessions.push_back(*client.open(HashAlgorithm::md5));
+      const auto over = client.open(HashAlgorithm::md5);
+      CATCH_REQUIRE(client.append(*over, "abc", 3));
+      CATCH_REQUIRE(!client.finish(*over));
+      CATCH_REQUIRE(client.finish(sessions.back()) == local_digest<MD5>(""));
+      sessions.pop_back();
+      const auto reopened = client.open(HashAlgorithm::md5);
+      CATCH_REQUIRE(client.append(*reopened, "abc", 3));
+      CATCH_REQUIRE(client.finish(*reopened) == local_digest<MD5>("abc"));
+      for(const auto session : sessions) client.discard(session);
+
+      // Without a ring, everything goes through the socket
+      HashdClient socket_only;
+      CATCH_REQUIRE(socket_only.connect(socket_path, 0));
+      CATCH_REQUIRE(!socket_only.has_ring());
+      const auto data = pattern(200000, 3);
+      CATCH_REQUIRE(socket_only.hash(HashAlgorithm::sha256, data.data(), 200000)
+                    == local_digest<Sha256>(data));
+      CATCH_REQUIRE(server.stats().n_shared > 0);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashd-remote-hasher")
+   {
+      HashdClient client;
+      CATCH_REQUIRE(connect(client, socket_path));
+
+      for(const auto size : sizes) {
+         const auto data = pattern(size, 11);
+         RemoteSha256 remote(&client);
+         RemoteMD5 remote_md5(&client);
+         RemoteSha256 local(nullptr);
+         CATCH_REQUIRE(remote.remote());
+         CATCH_REQUIRE(!local.remote());
+         remote.append(data);
+         remote_md5.append(data.data(), data.size());
+         local.append(data);
+
+         const auto expected = Sha256(data).hexdigest();
+         CATCH_REQUIRE(static_cast<const RemoteSha256&>(remote).hexdigest()
+                       == expected);
+         CATCH_REQUIRE(remote.hexdigest() == expected);
+         CATCH_REQUIRE(remote.ok());
+         const auto digest = remote.get_digest();
+         CATCH_REQUIRE(digest);
+         CATCH_REQUIRE(std::vector<uint8_t>(digest->begin(), digest->end())
+                       == local_digest<Sha256>(data));
+         CATCH_REQUIRE(local.hexdigest() == expected);
+         CATCH_REQUIRE(remote_md5.hexdigest() == MD5(data).hexdigest());
+      }
+
+      // Several clients at once
+      std::vector<std::thread> threads;
+      std::vector<int> failures(4, 0);
+      for(unsigned t = 0; t < failures.size(); ++t)
+         threads.emplace_back([&, t] {
+            HashdClient own;
+            if(!own.connect(socket_path)) {
+               ++failures[t];
+               return;
+            }
+            for(unsigned i = 0; i < 20; ++i) {
+               const auto data = pattern(1000 * i * i, t * 100 + i);
+               RemoteSha256 hash(&own);
+               hash.append(data);
+               if(hash.hexdigest() != Sha256(data).hexdigest()) ++failures[t];
+            }
+         });
+      for(auto& thread : threads) thread.join();
+      for(const auto n : failures) CATCH_REQUIRE(n == 0);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashd-stop")
+   {
+      HashdClient client;
+      CATCH_REQUIRE(connect(client, socket_path));
+      RemoteSha256 interrupted(&client);
+      interrupted.append("before");
+
+      server.stop();
+      service.join();
+      stopped = true;
+      interrupted.append(pattern(100000, 5));
+      interrupted.finish();
+      CATCH_REQUIRE(!interrupted.ok());
+      CATCH_REQUIRE(interrupted.hexdigest().empty());
+      CATCH_REQUIRE(!interrupted.get_digest());
+      uint8_t digest[32];
+      CATCH_REQUIRE(!interrupted.get_digest(digest));
+      CATCH_REQUIRE(!client.is_connected());
+
+      // With no service, hashing carries on locally
+      HashdClient none;
+      CATCH_REQUIRE(!none.connect(socket_path));
+      RemoteMD5 fallback(none.is_connected() ? &none : nullptr);
+      fallback.append("abc");
+      CATCH_REQUIRE(fallback.hexdigest() == MD5("abc").hexdigest());
+
+      // Anything but a socket at the path is left alone
+      const std::string file_path = dir.path() + "/not-a-socket";
+      std::ofstream(file_path) << "kept";
+      HashdServer other;
+      CATCH_REQUIRE(!other.serve(file_path, options));
+      std::string kept;
+      std::getline(std::ifstream(file_path), kept);
+      CATCH_REQUIRE(kept == "kept");
+   }
+
+   if(!stopped) {
+      server.stop();
+      service.join();
+   }
+}
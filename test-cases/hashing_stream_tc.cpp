@@ -0,0 +1,140 @@
+
+#include "hashing_stream.hpp"
+#include "md5.hpp"
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+// A target that takes `room` bytes in all, and then no more
+class FullAfter : public std::streambuf
+{
+ public:
+   explicit FullAfter(size_t bytes)
+       : room(bytes)
+   {}
+   size_t room;
+   std::string data;
+
+ protected:
+   std::streamsize xsputn(const char* s, std::streamsize n) override
+   {
+      const auto taken = std::min(size_t(n), room - data.size());
+      data.append(s, taken);
+      return std::streamsize(taken);
+   }
+   int_type overflow(int_type c) override
+   {
+      const char ch = traits_type::to_char_type(c);
+      return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+   }
+};
+
+CATCH_TEST_CASE("HashingStream_", "[hashing_stream]")
+{
+   std::string data(300000, '\0');
+   for(size_t i = 0; i < data.size(); ++i) data[i] = char(i * 131 + (i >> 9));
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("ohashstream-tee")
+   {
+      for(const size_t buffer_size : {1u, 100u, 4096u, 64u << 10}) {
+         std::ostringstream target;
+         ohashstream<Sha256> out(target.rdbuf(), buffer_size);
+
+         // Single characters, small writes, and writes larger than the buffer
+         size_t pos = 0;
+         for(size_t n = 0; pos < data.size(); n = (n * 7 + 3) % 20000) {
+            const auto len = std::min(n, data.size() - pos);
+            if(len == 0)
+               out.put(data[pos++]);
+            else
+               out.write(data.data() + pos, std::streamsize(len));
+            pos += len;
+         }
+         CATCH_REQUIRE(out.good());
+         CATCH_REQUIRE(out.finish().hexdigest() == Sha256(data).hexdigest());
+         CATCH_REQUIRE(target.str() == data);
+      }
+
+      // Only what the target accepted is hashed; the rest stays buffered
+      for(const size_t buffer_size : {100u, 4096u}) {
+         FullAfter target(1000);
+         ohashstream<Sha256> out(&target, buffer_size);
+         out.write(data.data(), 5000);
+         out.flush();
+         CATCH_REQUIRE(out.bad());
+         CATCH_REQUIRE(target.data == data.substr(0, 1000));
+         const auto expected = Sha256(data.substr(0, 1000)).hexdigest();
+         CATCH_REQUIRE(out.finish().hexdigest() == expected);
+      }
+      {
+         FullAfter target(300);
+         ohashstream<MD5> out(&target, 4096);
+         out.write(data.data(), 500);
+         CATCH_REQUIRE(!out.flush());
+         CATCH_REQUIRE(target.data == data.substr(0, 300));
+         target.room = 1000;
+         out.clear();
+         CATCH_REQUIRE(out.flush());
+         CATCH_REQUIRE(target.data == data.substr(0, 500));
+         const auto expected = MD5(data.substr(0, 500)).hexdigest();
+         CATCH_REQUIRE(out.finish().hexdigest() == expected);
+      }
+
+      // Formatted output, and a stream that only hashes
+      ohashstream<MD5> out;
+      out << "x = " << 42 << '\n';
+      CATCH_REQUIRE(out.finish().hexdigest() == MD5("x = 42\n").hexdigest());
+
+      // Bytes still buffered are written when the stream goes away
+      std::ostringstream target;
+      {
+         ohashstream<MD5> buffered(target);
+         buffered << "pending";
+         CATCH_REQUIRE(target.str().empty());
+      }
+      CATCH_REQUIRE(target.str() == "pending");
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("ihashstream")
+   {
+      for(const size_t buffer_size : {1u, 100u, 4096u, 64u << 10}) {
+         std::istringstream source(data);
+         ihashstream<Sha256> in(source.rdbuf(), buffer_size);
+
+         std::string read(data.size(), '\0');
+         size_t pos = 0;
+         for(size_t n = 0; pos < data.size(); n = (n * 7 + 3) % 20000) {
+            const auto len = std::min(n, data.size() - pos);
+            if(len == 0) {
+               read[pos++] = char(in.get());
+            } else {
+               in.read(&read[pos], std::streamsize(len));
+               CATCH_REQUIRE(size_t(in.gcount()) == len);
+            }
+            pos += len;
+         }
+         CATCH_REQUIRE(read == data);
+         CATCH_REQUIRE(in.get() == std::char_traits<char>::eof());
+         CATCH_REQUIRE(in.finish().hexdigest() == Sha256(data).hexdigest());
+      }
+
+      // Only what the reader consumed is hashed, not what was read ahead
+      std::istringstream source("first line\nsecond line\n");
+      ihashstream<MD5> in(source);
+      std::string line;
+      std::getline(in, line);
+      CATCH_REQUIRE(line == "first line");
+      CATCH_REQUIRE(in.finish().hexdigest() == MD5("first line\n").hexdigest());
+   }
+}
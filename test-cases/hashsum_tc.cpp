@@ -0,0 +1,144 @@
+
+#include "hashsum.hpp"
+#include "temp_dir.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static void write_file(const std::string& path, const std::string& data)
+{
+   std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+CATCH_TEST_CASE("Hashsum_", "[hashsum]")
+{
+   const TempDir tmp("hashsum");
+   const std::string root = tmp.path() + "/root";
+   mkdir(root.c_str(), 0755);
+   mkdir((root + "/d").c_str(), 0755);
+   mkdir((root + "/d/sub").c_str(), 0755);
+
+   // Named so that creation order differs from sorted order
+   const std::vector<std::string> files
+       = {"/d/z", "/d/sub/b", "/d/a", "/d/sub/a", "/d/m"};
+   for(size_t i = 0; i < files.size(); ++i)
+      write_file(root + files[i], std::string(i * 1000, char('a' + i)));
+   write_file(root + "/single", "single");
+   symlink("..", (root + "/d/sub/loop").c_str()); // not followed
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashsum-order")
+   {
+      for(unsigned n_threads : {1u, 3u}) {
+         HashsumOptions options;
+         options.n_threads = n_threads;
+         const auto entries
+             = hashsum({root + "/single", root + "/d", root + "/missing"},
+                       options);
+
+         const std::vector<std::string> expected
+             = {"/single", "/d/a", "/d/m", "/d/sub/a", "/d/sub/b", "/d/z"};
+         CATCH_REQUIRE(entries.size() == expected.size() + 1);
+         for(size_t i = 0; i < expected.size(); ++i) {
+            CATCH_REQUIRE(entries[i].path == root + expected[i]);
+            CATCH_REQUIRE(entries[i].error == 0);
+            CATCH_REQUIRE(entries[i].hexdigest
+                          == sha256_file(root + expected[i]));
+         }
+         CATCH_REQUIRE(entries.back().error == ENOENT);
+         CATCH_REQUIRE(entries.back().operand == 2);
+      }
+
+      HashsumOptions options;
+      options.algorithm  = HashAlgorithm::md5;
+      const auto entries = hashsum({root + "/single"}, options);
+      CATCH_REQUIRE(entries.size() == 1);
+      CATCH_REQUIRE(entries[0].hexdigest == MD5("single").hexdigest());
+
+      // A dangling link is reported, where it falls in the order
+      symlink("nowhere", (root + "/d/sub/dangling").c_str());
+      const auto with_dangling = hashsum({root + "/d"});
+      CATCH_REQUIRE(with_dangling.size() == 6);
+      CATCH_REQUIRE(with_dangling[4].path == root + "/d/sub/dangling");
+      CATCH_REQUIRE(with_dangling[4].error == ENOENT);
+      CATCH_REQUIRE(with_dangling[4].hexdigest.empty());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashsum-lines")
+   {
+      HashsumEntry entry;
+      entry.hexdigest = Sha256("x").hexdigest();
+      entry.path      = "dir/file name";
+      CATCH_REQUIRE(format_hashsum_line(entry)
+                    == entry.hexdigest + "  dir/file name\n");
+
+      entry.path = "a\\b\nc";
+      const auto line = format_hashsum_line(entry);
+      CATCH_REQUIRE(line == "\\" + entry.hexdigest + "  a\\\\b\\nc\n");
+
+      // Round trip
+      const auto parsed = parse_manifest_line(line.substr(0, line.size() - 1));
+      CATCH_REQUIRE(parsed);
+      CATCH_REQUIRE(parsed->algorithm == HashAlgorithm::sha256);
+      CATCH_REQUIRE(parsed->hexdigest == entry.hexdigest);
+      CATCH_REQUIRE(parsed->path == entry.path);
+
+      // Binary mode marker, upper case hex, and md5 by length
+      const auto md5 = parse_manifest_line(
+          "D41D8CD98F00B204E9800998ECF8427E *empty");
+      CATCH_REQUIRE(md5);
+      CATCH_REQUIRE(md5->algorithm == HashAlgorithm::md5);
+      CATCH_REQUIRE(md5->hexdigest == "d41d8cd98f00b204e9800998ecf8427e");
+      CATCH_REQUIRE(md5->path == "empty");
+
+      CATCH_REQUIRE(!parse_manifest_line(""));
+      CATCH_REQUIRE(!parse_manifest_line("abc  file"));
+      CATCH_REQUIRE(!parse_manifest_line(entry.hexdigest + " file"));
+      CATCH_REQUIRE(!parse_manifest_line(entry.hexdigest + "  "));
+      CATCH_REQUIRE(!parse_manifest_line("\\" + entry.hexdigest + "  a\\q"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("hashsum-check")
+   {
+      std::vector<ManifestEntry> manifest;
+      for(const auto& entry : hashsum({root + "/d"})) {
+         auto line = format_hashsum_line(entry);
+         line.pop_back(); // '\n'
+         manifest.push_back(*parse_manifest_line(line));
+      }
+      manifest.push_back(
+          ManifestEntry{HashAlgorithm::md5, MD5("single").hexdigest(),
+                        root + "/single"});
+      manifest.push_back(manifest[0]);
+      manifest.back().path = root + "/missing";
+
+      write_file(root + "/d/m", "changed");
+      const auto results = hashsum_check(manifest);
+      CATCH_REQUIRE(results.size() == manifest.size());
+      for(size_t i = 0; i < results.size(); ++i) {
+         CATCH_REQUIRE(results[i].path == manifest[i].path);
+         const auto expected = results[i].path == root + "/d/m"
+                                   ? CheckStatus::mismatch
+                               : results[i].path == root + "/missing"
+                                   ? CheckStatus::unreadable
+                                   : CheckStatus::ok;
+         CATCH_REQUIRE(results[i].status == expected);
+      }
+      CATCH_REQUIRE(results.back().error == ENOENT);
+   }
+}
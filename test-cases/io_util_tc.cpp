@@ -0,0 +1,86 @@
+
+#include "io_util.hpp"
+
+#include <array>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("IoUtil_", "[io_util]")
+{
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("io-util-to-hex")
+   {
+      const std::array<uint8_t, 4> bytes = {0x00, 0x0f, 0xa5, 0xff};
+      CATCH_REQUIRE(to_hex(bytes) == "000fa5ff");
+      CATCH_REQUIRE(to_hex(bytes.data(), 2) == "000f");
+      CATCH_REQUIRE(to_hex(bytes.data(), 0).empty());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("io-util-write-all")
+   {
+      // More than a pipe holds at once, drained as it is written
+      const std::string data(1 << 20, 'x');
+      int fds[2];
+      CATCH_REQUIRE(pipe(fds) == 0);
+      std::string read_back;
+      bool ok = false;
+      {
+         std::thread writer([&] {
+            ok = write_all(fds[1], data.data(), data.size());
+            ::close(fds[1]);
+         });
+         char buf[4096];
+         ssize_t n;
+         while((n = ::read(fds[0], buf, sizeof(buf))) > 0)
+            read_back.append(buf, size_t(n));
+         writer.join();
+      }
+      ::close(fds[0]);
+      CATCH_REQUIRE(ok);
+      CATCH_REQUIRE(read_back == data);
+
+      CATCH_REQUIRE(!write_all(-1, data.data(), 1));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("io-util-read")
+   {
+      int fds[2];
+      CATCH_REQUIRE(pipe(fds) == 0);
+      CATCH_REQUIRE(write_all(fds[1], "abcdef", 6));
+      ::close(fds[1]);
+      char buf[8] = {};
+      CATCH_REQUIRE(read_retry(fds[0], buf, sizeof(buf)) == 6);
+      CATCH_REQUIRE(std::string(buf) == "abcdef");
+      CATCH_REQUIRE(read_retry(fds[0], buf, sizeof(buf)) == 0);
+      CATCH_REQUIRE(read_retry(-1, buf, sizeof(buf)) == -1);
+      ::close(fds[0]);
+
+      // A whole range, or false if the file ends first
+      FILE* file = std::tmpfile();
+      CATCH_REQUIRE(file != nullptr);
+      const int fd = fileno(file);
+      CATCH_REQUIRE(write_all(fd, "0123456789", 10));
+      CATCH_REQUIRE(pread_retry(fd, buf, 4, 8) == 2);
+      CATCH_REQUIRE(pread_all(fd, buf, 4, 3));
+      CATCH_REQUIRE(std::string(buf, 4) == "3456");
+      CATCH_REQUIRE(!pread_all(fd, buf, 4, 8));
+      std::fclose(file);
+
+      const timespec ts = {12, 345};
+      CATCH_REQUIRE(to_ns(ts) == 12000000345);
+   }
+}
@@ -0,0 +1,144 @@
+
+#include "kernel_hash.hpp"
+#include "temp_dir.hpp"
+
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length)
+{
+   std::string data(length, '\0');
+   uint32_t x = 777;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+   return data;
+}
+
+// Expects AF_ALG to be available
+static void check_kernel_socket(const std::string& path,
+                                const std::string& data)
+{
+   KernelHash kh;
+   Sha256Digest digest, expected;
+   CATCH_REQUIRE(kh.open("sha256", digest.size()));
+
+   // Empty, then reused for a message sent in pieces
+   CATCH_REQUIRE(kh.finish(digest.data()));
+   Sha256("").get_digest(expected.data());
+   CATCH_REQUIRE(digest == expected);
+
+   CATCH_REQUIRE(kh.append(data.data(), 1000));
+   CATCH_REQUIRE(kh.append(data.data() + 1000, data.size() - 1000));
+   CATCH_REQUIRE(kh.finish(digest.data()));
+   Sha256(data).get_digest(expected.data());
+   CATCH_REQUIRE(digest == expected);
+
+   // Spliced from a file, in part and in full
+   const int fd = ::open(path.c_str(), O_RDONLY);
+   CATCH_REQUIRE(fd >= 0);
+   CATCH_REQUIRE(kh.append_fd(fd, 100, 5000));
+   CATCH_REQUIRE(kh.finish(digest.data()));
+   Sha256(std::string_view(data).substr(100, 5000))
+       .get_digest(expected.data());
+   CATCH_REQUIRE(digest == expected);
+
+   CATCH_REQUIRE(kh.append_fd(fd));
+   CATCH_REQUIRE(kh.finish(digest.data()));
+   Sha256(data).get_digest(expected.data());
+   CATCH_REQUIRE(digest == expected);
+   ::close(fd);
+
+   // As a stand-in for Sha256, including after a failed append
+   CATCH_REQUIRE(kh.append(std::string_view("hello ")));
+   CATCH_REQUIRE(kh.append("world", 5));
+   CATCH_REQUIRE(kh.hexdigest() == Sha256("hello world").hexdigest());
+   CATCH_REQUIRE(kh.get_digest() == Sha256("hello world").get_digest());
+   CATCH_REQUIRE(kh.get_digest(digest.data()));
+   CATCH_REQUIRE(!kh.append_fd(-1));
+   CATCH_REQUIRE(!kh.append(data.data(), data.size()));
+   CATCH_REQUIRE(!kh.ok());
+   CATCH_REQUIRE(kh.finish().hexdigest().empty());
+   CATCH_REQUIRE(kh.append(data));
+   CATCH_REQUIRE(kh.finish().ok());
+   CATCH_REQUIRE(kh.hexdigest() == Sha256(data).hexdigest());
+
+   KernelHash md5;
+   Md5Digest md5_digest, md5_expected;
+   CATCH_REQUIRE(md5.open("md5", md5_digest.size()));
+   CATCH_REQUIRE(md5.append(data.data(), data.size()));
+   CATCH_REQUIRE(md5.finish(md5_digest.data()));
+   MD5(data).get_digest(md5_expected.data());
+   CATCH_REQUIRE(md5_digest == md5_expected);
+}
+
+CATCH_TEST_CASE("KernelHash_", "[kernel_hash]")
+{
+   const TempDir dir("kernel-hash");
+   const std::string path = dir.path() + "/data";
+   const auto data        = make_data(300000);
+   std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("kernel-hash-socket")
+   {
+      // AF_ALG may be compiled out, or blocked by a sandbox
+      if(kernel_hash_available("sha256")) check_kernel_socket(path, data);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("kernel-hash-unopened")
+   {
+      // Every call fails, and nothing passes for a digest
+      KernelHash kh;
+      CATCH_REQUIRE(!kh.append("abc"));
+      CATCH_REQUIRE(!kh.ok());
+      CATCH_REQUIRE(kh.hexdigest().empty());
+      CATCH_REQUIRE(kh.get_digest().empty());
+      uint8_t digest[32];
+      CATCH_REQUIRE(!kh.get_digest(digest));
+      CATCH_REQUIRE(!kh.finish(digest));
+      CATCH_REQUIRE(!kh.open("no-such-algorithm", 32));
+      CATCH_REQUIRE(kh.finish().hexdigest().empty());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("kernel-hash-auto")
+   {
+      // Whichever backend is chosen, the digests are the same
+      const auto selector = HashBackendSelector::calibrate<Sha256>(0.001);
+      for(const auto& m : selector.measurements()) {
+         CATCH_REQUIRE(m.library_mb_s > 0.0);
+         CATCH_REQUIRE(m.kernel_is_faster == (m.kernel_mb_s > m.library_mb_s));
+      }
+
+      Sha256Digest digest, expected;
+      Sha256(data).get_digest(expected.data());
+      CATCH_REQUIRE(hash_file_auto<Sha256>(path, digest, selector));
+      CATCH_REQUIRE(digest == expected);
+      CATCH_REQUIRE(hash_file_auto<Sha256>(path, digest));
+      CATCH_REQUIRE(digest == expected);
+
+      Md5Digest md5_digest, md5_expected;
+      MD5(data).get_digest(md5_expected.data());
+      const auto md5_selector = HashBackendSelector::calibrate<MD5>(0.001);
+      CATCH_REQUIRE(hash_file_auto<MD5>(path, md5_digest, md5_selector));
+      CATCH_REQUIRE(md5_digest == md5_expected);
+
+      CATCH_REQUIRE(!hash_file_auto<Sha256>(dir.path() + "/missing", digest));
+      CATCH_REQUIRE(!HashBackendSelector().use_kernel(1 << 20));
+   }
+}
@@ -1,6 +1,10 @@
 
 #include "md5.hpp"
 
+#include <vector>
+
+#include <sys/uio.h>
+
 #define CATCH_CONFIG_PREFIX_ALL
 #include "catch.hpp"
 
@@ -34,4 +38,45 @@ CATCH_TEST_CASE("Md5Sum_", "[md5_sum]")
          CATCH_REQUIRE(m.hexdigest() == digest);
       }
    }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("md5-midstate")
+   {
+      const std::string data(1000, 'x');
+      for(size_t split : {0, 1, 63, 64, 65, 500, 1000}) {
+         MD5 a;
+         a.append(data.substr(0, split));
+         const auto midstate = a.midstate();
+
+         MD5 b;
+         b.restore(midstate);
+         b.append(data.substr(split));
+         CATCH_REQUIRE(b.hexdigest() == md5(data));
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("md5-iovec")
+   {
+      std::string data(3000, '\0');
+      for(size_t i = 0; i < data.size(); ++i) data[i] = char(i * 17 + i / 5);
+
+      for(size_t step : {1, 7, 64, 100}) {
+         std::vector<iovec> segments;
+         for(size_t pos = 0, n = 0; pos < data.size(); pos += n, step += 3) {
+            n = std::min(step, data.size() - pos);
+            segments.push_back({&data[pos], n});
+         }
+         segments.insert(segments.begin() + 1, iovec{nullptr, 0});
+         segments.push_back(iovec{nullptr, 0});
+
+         MD5 hash;
+         hash.append(segments.data(), segments.size());
+         CATCH_REQUIRE(hash.hexdigest() == md5(data));
+      }
+   }
 }
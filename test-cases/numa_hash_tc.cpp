@@ -0,0 +1,74 @@
+
+#include "numa_hash.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("NumaHash_", "[numa_hash]")
+{
+   std::string data(5 * 65536 + 1234, '\0');
+   uint32_t x = 4242;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("numa-topology")
+   {
+      const auto nodes = numa_nodes();
+      CATCH_REQUIRE(!nodes.empty());
+      for(const auto& node : nodes) CATCH_REQUIRE(!node.cpus.empty());
+
+      // Touched memory is on some node, where NUMA is reported at all
+      const auto owners = numa_page_nodes({data.data(), &data[70000]});
+      CATCH_REQUIRE(owners.size() == 2);
+      for(int owner : owners) CATCH_REQUIRE(owner >= -1);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("numa-tree-hash")
+   {
+      for(size_t length :
+          {size_t(0), size_t(100), size_t(65536), data.size()}) {
+         TreeHasher tree(65536);
+         tree.append(data.data(), length);
+
+         for(unsigned threads : {0u, 1u, 3u}) {
+            NumaHashOptions options;
+            options.leaf_size        = 65536;
+            options.threads_per_node = threads;
+            const auto result = numa_tree_hash(data.data(), length, options);
+            CATCH_REQUIRE(result.root == tree.finish().digest());
+
+            // Only leaves whose node is known can count as local
+            std::vector<const void*> leaves;
+            for(size_t pos = 0; pos < length; pos += 65536)
+               leaves.push_back(&data[pos]);
+            const auto owners = numa_page_nodes(leaves);
+            uint64_t known    = 0;
+            for(size_t i = 0; i < leaves.size(); ++i)
+               if(owners[i] >= 0)
+                  known += std::min<size_t>(65536, length - i * 65536);
+
+            uint64_t total = 0, local = 0;
+            for(const auto& node : result.nodes) {
+               CATCH_REQUIRE(node.n_threads > 0);
+               CATCH_REQUIRE(node.n_local <= node.n_bytes);
+               total += node.n_bytes;
+               local += node.n_local;
+            }
+            CATCH_REQUIRE(total == length);
+            CATCH_REQUIRE(local <= known);
+         }
+      }
+   }
+}
@@ -0,0 +1,105 @@
+
+#include "pipelined_hash.hpp"
+#include "temp_dir.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length)
+{
+   std::string data(length, '\0');
+   uint32_t x = 54321;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+   return data;
+}
+
+CATCH_TEST_CASE("PipelinedHash_", "[pipelined_hash]")
+{
+   const TempDir dir("pipelined-hash");
+   const std::string path = dir.path() + "/data";
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("pipelined-hash-sizes")
+   {
+      for(size_t length : {0, 1, 4095, 4096, 8192, 5000, 100000, 1 << 20}) {
+         const auto data = make_data(length);
+         std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+
+         for(bool direct : {true, false}) {
+            for(size_t buffer_size : {4096, 12288, 1 << 20}) {
+               PipelineOptions options;
+               options.direct      = direct;
+               options.buffer_size = buffer_size;
+               options.depth       = 2;
+
+               Sha256 sha;
+               MD5 md5;
+               CATCH_REQUIRE(hash_file_pipelined(path, sha, options));
+               CATCH_REQUIRE(hash_file_pipelined(path, md5, options));
+               CATCH_REQUIRE(sha.hexdigest() == Sha256(data).hexdigest());
+               CATCH_REQUIRE(md5.hexdigest() == MD5(data).hexdigest());
+            }
+         }
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("pipelined-hash-odd-buffer-size")
+   {
+      // Rounded up to a multiple of the O_DIRECT alignment
+      const auto data = make_data(300000);
+      std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+
+      PipelineOptions options;
+      options.buffer_size = 1000;
+      options.depth       = 7;
+      Sha256 sha;
+      CATCH_REQUIRE(hash_file_pipelined(path, sha, options));
+      CATCH_REQUIRE(sha.hexdigest() == Sha256(data).hexdigest());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("pipelined-hash-sink-throws")
+   {
+      // The reader is stopped part way, with slots still to be filled
+      const auto data = make_data(1 << 20);
+      std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+
+      for(bool direct : {true, false}) {
+         PipelineOptions options;
+         options.direct      = direct;
+         options.buffer_size = 4096;
+         options.depth       = 2;
+
+         size_t n_chunks = 0;
+         const FileChunkSink sink = [&](const void*, size_t) {
+            if(++n_chunks == 3) throw std::runtime_error("sink");
+         };
+         CATCH_REQUIRE_THROWS_AS(stream_file_pipelined(path, sink, options),
+                                 std::runtime_error);
+         CATCH_REQUIRE(n_chunks == 3);
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("pipelined-hash-missing")
+   {
+      Sha256 sha;
+      CATCH_REQUIRE(!hash_file_pipelined(dir.path() + "/missing", sha));
+   }
+}
@@ -0,0 +1,81 @@
+
+#include "reassembly_hash.hpp"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("ReassemblyHash_", "[reassembly_hash]")
+{
+   std::string object(8 << 20, '\0');
+   for(size_t i = 0; i < object.size(); ++i)
+      object[i] = char((i * 2654435761u) >> 13);
+   const auto expected = Sha256(object).hexdigest();
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("reassembly-hash-parallel-ranges")
+   {
+      // As a downloader would: 4 connections, each fetching every 4th of
+      // 32 ranges, in pieces of varying size
+      const size_t window = 1 << 20;
+      ReassemblyHasher<Sha256> hash(object.size(), window);
+      const size_t n_ranges = 32, range = object.size() / n_ranges;
+
+      std::vector<std::thread> connections;
+      for(size_t c = 0; c < 4; ++c)
+         connections.emplace_back([&, c] {
+            std::mt19937 rng(static_cast<unsigned>(c));
+            for(size_t r = c; r < n_ranges; r += 4)
+               for(size_t pos = r * range; pos < (r + 1) * range;) {
+                  const size_t n
+                      = std::min(1 + rng() % 40000, (r + 1) * range - pos);
+                  hash.write(pos, object.data() + pos, n);
+                  pos += n;
+               }
+         });
+      for(auto& c : connections) c.join();
+
+      CATCH_REQUIRE(hash.done());
+      CATCH_REQUIRE(hash.wait().hexdigest() == expected);
+      CATCH_REQUIRE(hash.hashed() == object.size());
+      CATCH_REQUIRE(hash.buffered() == 0);
+      CATCH_REQUIRE(hash.peak_buffered() <= window);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("reassembly-hash-overlaps")
+   {
+      // Overlapping and repeated pieces, in random order, from one thread:
+      // the window must hold them all
+      std::vector<std::pair<size_t, size_t>> pieces; // offset, size
+      for(size_t pos = 0; pos < object.size(); pos += 50000)
+         pieces.emplace_back(pos, std::min<size_t>(70000, object.size() - pos));
+      pieces.push_back(pieces[3]);
+      pieces.emplace_back(12345, 100);
+      std::shuffle(pieces.begin(), pieces.end(), std::mt19937(7));
+
+      ReassemblyHasher<Sha256> hash(object.size(), 2 * object.size());
+      for(const auto& [offset, size] : pieces) {
+         CATCH_REQUIRE(!hash.done());
+         CATCH_REQUIRE(hash.write(offset, object.data() + offset, size));
+      }
+      CATCH_REQUIRE(hash.done());
+      CATCH_REQUIRE(hash.wait().hexdigest() == expected);
+
+      // Beyond the end
+      CATCH_REQUIRE(!hash.write(object.size() - 1, "ab", 2));
+
+      ReassemblyHasher<MD5> empty(0);
+      CATCH_REQUIRE(empty.done());
+      CATCH_REQUIRE(empty.wait().hexdigest() == MD5("").hexdigest());
+   }
+}
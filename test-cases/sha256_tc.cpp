@@ -1,6 +1,11 @@
 
 #include "sha256.hpp"
 
+#include <array>
+#include <vector>
+
+#include <sys/uio.h>
+
 #define CATCH_CONFIG_PREFIX_ALL
 #include "catch.hpp"
 
@@ -39,4 +44,47 @@ CATCH_TEST_CASE("Sha256Sum_", "[sha256_sum]")
          CATCH_REQUIRE(m.hexdigest() == digest);
       }
    }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sha256-midstate")
+   {
+      const std::string data(1000, 'x');
+      for(size_t split : {0, 1, 63, 64, 65, 500, 1000}) {
+         Sha256 a;
+         a.append(data.substr(0, split));
+         const auto midstate = a.midstate();
+
+         Sha256 b;
+         b.restore(midstate);
+         b.append(data.substr(split));
+         CATCH_REQUIRE(b.hexdigest() == sha256(data));
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sha256-iovec")
+   {
+      std::string data(5000, '\0');
+      for(size_t i = 0; i < data.size(); ++i) data[i] = char(i * 31 + i / 7);
+
+      // Segments of every size, so that blocks straddle one or more of them
+      for(size_t step : {1, 3, 63, 64, 65, 200, 1000}) {
+         std::vector<iovec> segments;
+         for(size_t pos = 0, n = 0; pos < data.size(); pos += n, step += 5) {
+            n = std::min(step, data.size() - pos);
+            segments.push_back({&data[pos], n});
+         }
+         segments.insert(segments.begin() + 2, iovec{nullptr, 0});
+         segments.push_back(iovec{nullptr, 0});
+
+         Sha256 hash;
+         hash.append("head", 4);
+         hash.append(segments.data(), segments.size());
+         CATCH_REQUIRE(hash.hexdigest() == sha256("head" + data));
+      }
+   }
 }
@@ -0,0 +1,108 @@
+
+#include "sparse_hash.hpp"
+#include "temp_dir.hpp"
+#include "tree_hash.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("SparseHash_", "[sparse_hash]")
+{
+   const TempDir dir("sparse-hash");
+   const std::string path = dir.path() + "/data";
+
+   // 8 MiB with two 64 KiB extents of data; the rest are holes
+   const size_t size = 8 << 20;
+   std::string image(size, '\0');
+   for(size_t i = 0; i < 65536; ++i) {
+      image[(1 << 20) + i] = char(i * 7 + 1);
+      image[(5 << 20) + i] = char(i * 13 + 3);
+   }
+   const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   CATCH_REQUIRE(fd >= 0);
+   CATCH_REQUIRE(pwrite(fd, &image[1 << 20], 65536, 1 << 20) == 65536);
+   CATCH_REQUIRE(pwrite(fd, &image[5 << 20], 65536, 5 << 20) == 65536);
+   CATCH_REQUIRE(ftruncate(fd, off_t(size)) == 0);
+   ::close(fd);
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sparse-hash-stream")
+   {
+      uint64_t bytes_read = 0;
+      Sha256 sha;
+      MD5 md5;
+      CATCH_REQUIRE(hash_file_sparse(path, sha, &bytes_read));
+      CATCH_REQUIRE(hash_file_sparse(path, md5));
+      CATCH_REQUIRE(sha.hexdigest() == Sha256(image).hexdigest());
+      CATCH_REQUIRE(md5.hexdigest() == MD5(image).hexdigest());
+
+      // Holes were not read, where the filesystem reports them
+      CATCH_REQUIRE(bytes_read >= 2 * 65536);
+      CATCH_REQUIRE(bytes_read <= size);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sparse-hash-tree")
+   {
+      TreeHasher tree(1 << 16), expected(1 << 16, false);
+      CATCH_REQUIRE(hash_file_sparse(path, tree));
+      expected.append(image.data(), image.size());
+      CATCH_REQUIRE(tree.hexdigest() == expected.hexdigest());
+      CATCH_REQUIRE(tree.n_zero_leaves() == tree.n_leaves() - 2);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sparse-hash-sink-throws")
+   {
+      // From either sink; with no zero sink, holes go to the data sink
+      const FileChunkSink data = [](const void*, size_t) {
+         throw std::runtime_error("data");
+      };
+      const ZeroRunSink zeros = [](uint64_t) {
+         throw std::runtime_error("zeros");
+      };
+      CATCH_REQUIRE_THROWS_AS(stream_file_sparse(path, data),
+                              std::runtime_error);
+      CATCH_REQUIRE_THROWS_AS(stream_file_sparse(path, data, zeros),
+                              std::runtime_error);
+      CATCH_REQUIRE_THROWS_AS(
+          stream_file_sparse(path, [](const void*, size_t) {}, zeros),
+          std::runtime_error);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("sparse-hash-trailing-hole")
+   {
+      const std::string tail_path = path + ".tail";
+      const int tfd
+          = ::open(tail_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      CATCH_REQUIRE(tfd >= 0);
+      CATCH_REQUIRE(write(tfd, "abc", 3) == 3);
+      CATCH_REQUIRE(ftruncate(tfd, 100000) == 0);
+      ::close(tfd);
+
+      std::string expected(100000, '\0');
+      expected.replace(0, 3, "abc");
+      Sha256 sha;
+      CATCH_REQUIRE(hash_file_sparse(tail_path, sha));
+      CATCH_REQUIRE(sha.hexdigest() == Sha256(expected).hexdigest());
+      std::remove(tail_path.c_str());
+
+      CATCH_REQUIRE(!hash_file_sparse(dir.path() + "/missing", sha));
+   }
+}
@@ -0,0 +1,112 @@
+
+#include "streaming_hash.hpp"
+
+#include <algorithm>
+#include <string>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("StreamingHash_", "[streaming_hash]")
+{
+   std::string data(300000 + 17, '\0');
+   uint32_t x = 31337;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("streaming-hash-digests")
+   {
+      // Unaligned starts, odd steps, with and without eviction
+      for(size_t offset : {0, 1, 63}) {
+         const auto view = std::string_view(data).substr(offset);
+         for(size_t step : {1, 100, 4096, 1 << 20}) {
+            for(bool evict : {false, true}) {
+               StreamingOptions options;
+               options.threshold         = 0;
+               options.step              = step;
+               options.prefetch_distance = step * 3;
+               options.evict             = evict;
+
+               Sha256 sha;
+               MD5 md5;
+               append_streaming(sha, view.data(), view.size(), options);
+               append_streaming(md5, view.data(), view.size(), options);
+               CATCH_REQUIRE(sha.hexdigest() == Sha256(view).hexdigest());
+               CATCH_REQUIRE(md5.hexdigest() == MD5(view).hexdigest());
+            }
+         }
+      }
+
+      // Below the threshold, and empty
+      Sha256 sha;
+      append_streaming(sha, data.data(), 0);
+      append_streaming(sha, data.data(), 1000);
+      const auto expected = Sha256(data.substr(0, 1000)).hexdigest();
+      CATCH_REQUIRE(sha.hexdigest() == expected);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("streaming-hash-pieces")
+   {
+      size_t total = 0, n_calls = 0;
+      StreamingOptions options;
+      options.step = 1000; // rounded up to a line at least
+      stream_buffer(
+          data.data(),
+          data.size(),
+          [&](const void* p, size_t n) {
+             CATCH_REQUIRE(p == data.data() + total);
+             CATCH_REQUIRE(n <= 1000);
+             total += n;
+             ++n_calls;
+          },
+          options);
+      CATCH_REQUIRE(total == data.size());
+      CATCH_REQUIRE(n_calls == (data.size() + 999) / 1000);
+
+      const auto flush = cache_flush_support();
+      CATCH_REQUIRE((flush == CacheFlush::none || flush == CacheFlush::clflush
+                     || flush == CacheFlush::clflushopt));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("copy-and-hash")
+   {
+      // Unaligned sources and destinations, odd steps, both kinds of store
+      std::string dst(data.size() + 64, '\0');
+      for(size_t offset : {0, 1, 63}) {
+         const auto view = std::string_view(data).substr(offset);
+         for(size_t out : {0, 5, 16}) {
+            for(size_t step : {1, 100, 4096, 1 << 20}) {
+               for(bool non_temporal : {false, true}) {
+                  CopyHashOptions options;
+                  options.step         = step;
+                  options.non_temporal = non_temporal;
+
+                  std::fill(dst.begin(), dst.end(), '\0');
+                  Sha256 sha;
+                  copy_and_hash(
+                      &dst[out], view.data(), view.size(), sha, options);
+                  CATCH_REQUIRE(dst.compare(out, view.size(), view) == 0);
+                  CATCH_REQUIRE(dst[out + view.size()] == '\0');
+                  CATCH_REQUIRE(sha.hexdigest() == Sha256(view).hexdigest());
+               }
+            }
+         }
+      }
+
+      MD5 md5;
+      copy_and_hash(&dst[0], data.data(), 0, md5);
+      copy_and_hash(&dst[0], data.data(), 1000, md5);
+      CATCH_REQUIRE(md5.hexdigest() == MD5(data.substr(0, 1000)).hexdigest());
+   }
+}
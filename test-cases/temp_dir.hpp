@@ -0,0 +1,47 @@
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Removes `path` and everything under it, without following symbolic links.
+// True if nothing is left.
+inline bool remove_tree(const std::string& path) noexcept
+{
+   return nftw(
+              path.c_str(),
+              [](const char* p, const struct stat*, int, struct FTW*) {
+                 return ::remove(p);
+              },
+              16,
+              FTW_DEPTH | FTW_PHYS)
+          == 0;
+}
+
+// A fresh directory under /tmp, removed with everything in it when the test
+// case ends, including when a CATCH_REQUIRE fails part way
+//
+// usage: const TempDir dir("checkpoint");
+//        const std::string path = dir.path() + "/data";
+class TempDir
+{
+ public:
+   explicit TempDir(const std::string& name)
+       : path_("/tmp/hash-functions-" + name + "-XXXXXX")
+   {
+      if(mkdtemp(&path_[0]) == nullptr)
+         throw std::runtime_error("mkdtemp failed for " + path_);
+   }
+   TempDir(const TempDir&) = delete;
+   TempDir& operator=(const TempDir&) = delete;
+   ~TempDir() noexcept { remove_tree(path_); }
+
+   const std::string& path() const noexcept { return path_; }
+
+ private:
+   std::string path_;
+};
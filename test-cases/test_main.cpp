@@ -1,6 +1,7 @@
 
 #define CATCH_CONFIG_PREFIX_ALL
 #define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // SIGSTKSZ is not constexpr in newer glibc
 #include "catch.hpp"
 
 int main(int argc, char** argv)
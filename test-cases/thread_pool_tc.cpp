@@ -0,0 +1,78 @@
+
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <functional>
+#include <set>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+CATCH_TEST_CASE("ThreadPool_", "[thread_pool]")
+{
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("thread-pool-tasks")
+   {
+      for(unsigned n_threads : {1u, 2u, 4u}) {
+         ThreadPool pool(n_threads);
+         CATCH_REQUIRE(pool.size() == n_threads);
+
+         std::vector<std::atomic<int>> counts(1000);
+         for(auto& c : counts) c = 0;
+         for(size_t i = 0; i < counts.size(); ++i)
+            pool.submit([&, i] { ++counts[i]; });
+         pool.wait();
+
+         size_t n_once = 0;
+         for(auto& c : counts) n_once += c.load() == 1 ? 1 : 0;
+         CATCH_REQUIRE(n_once == counts.size());
+
+         // The pool can be reused after waiting
+         std::atomic<int> n{0};
+         for(int i = 0; i < 10; ++i) pool.submit([&] { ++n; });
+         pool.wait();
+         CATCH_REQUIRE(n == 10);
+      }
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("thread-pool-nested")
+   {
+      // A binary tree of tasks, each spawning two more from inside the pool
+      ThreadPool pool(4);
+      std::atomic<int> n_leaves{0}, n_outside{0};
+      std::function<void(int)> spawn = [&](int depth) {
+         if(ThreadPool::current_worker() < 0) ++n_outside;
+         if(depth == 0) {
+            ++n_leaves;
+            return;
+         }
+         pool.submit([&, depth] { spawn(depth - 1); });
+         pool.submit([&, depth] { spawn(depth - 1); });
+      };
+      pool.submit([&] { spawn(12); });
+      pool.wait();
+
+      CATCH_REQUIRE(n_leaves == 1 << 12);
+      CATCH_REQUIRE(n_outside == 0);
+      CATCH_REQUIRE(ThreadPool::current_worker() == -1);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("thread-pool-destructor-drains")
+   {
+      std::atomic<int> n{0};
+      {
+         ThreadPool pool(2);
+         for(int i = 0; i < 100; ++i) pool.submit([&] { ++n; });
+      }
+      CATCH_REQUIRE(n == 100);
+   }
+}
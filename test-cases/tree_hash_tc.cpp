@@ -0,0 +1,107 @@
+
+#include "tree_hash.hpp"
+
+#include <string>
+#include <vector>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static std::string make_data(size_t length)
+{
+   std::string data(length, '\0');
+   uint32_t x = 99;
+   for(auto& c : data) {
+      x = x * 1103515245u + 12345u;
+      c = char(x >> 24);
+   }
+   return data;
+}
+
+// RFC 6962, written out recursively
+static Sha256Digest reference_root(std::string_view data, size_t leaf_size)
+{
+   if(data.size() <= leaf_size)
+      return TreeHasher::leaf_digest(data.data(), data.size());
+   size_t k = leaf_size;
+   while(k * 2 < data.size()) k *= 2;
+   return TreeHasher::node_digest(reference_root(data.substr(0, k), leaf_size),
+                                  reference_root(data.substr(k), leaf_size));
+}
+
+CATCH_TEST_CASE("TreeHash_", "[tree_hash]")
+{
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-hash-reference")
+   {
+      const auto data = make_data(64 * 17 + 5);
+      for(size_t n : {size_t(1), size_t(63), size_t(64), size_t(65),
+                      size_t(64 * 3), size_t(64 * 7 + 1), data.size()}) {
+         const auto prefix   = std::string_view(data.data(), n);
+         const auto expected = reference_root(prefix, 64);
+
+         // In one piece, and in awkward pieces
+         TreeHasher a(64), b(64);
+         a.append(data.data(), n);
+         for(size_t i = 0; i < n; i += 13)
+            b.append(&data[i], std::min<size_t>(13, n - i));
+         CATCH_REQUIRE(a.finish().digest() == expected);
+         CATCH_REQUIRE(b.finish().digest() == expected);
+         CATCH_REQUIRE(a.length() == n);
+         CATCH_REQUIRE(a.n_leaves() == (n + 63) / 64);
+      }
+
+      // Empty input
+      Sha256Digest empty;
+      Sha256("").get_digest(empty.data());
+      CATCH_REQUIRE(TreeHasher().finish().digest() == empty);
+      CATCH_REQUIRE(TreeHasher().hexdigest() == sha256(""));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-hash-zeros")
+   {
+      // A memoized zero leaf has the same digest as a hashed one
+      const auto data = make_data(1000);
+      std::string with_zeros = data + std::string(64 * 40 + 30, '\0') + data;
+      const auto expected = reference_root(with_zeros, 64);
+
+      TreeHasher plain(64, false);
+      plain.append(with_zeros.data(), with_zeros.size());
+      CATCH_REQUIRE(plain.finish().digest() == expected);
+      CATCH_REQUIRE(plain.n_zero_leaves() == 0);
+
+      TreeHasher detected(64);
+      detected.append(with_zeros.data(), with_zeros.size());
+      CATCH_REQUIRE(detected.finish().digest() == expected);
+      CATCH_REQUIRE(detected.n_zero_leaves() >= 39);
+
+      TreeHasher appended(64);
+      appended.append(data.data(), data.size());
+      appended.append_zeros(64 * 40 + 30);
+      appended.append(data.data(), data.size());
+      CATCH_REQUIRE(appended.finish().digest() == expected);
+      CATCH_REQUIRE(appended.n_zero_leaves() >= 39);
+      CATCH_REQUIRE(appended.length() == with_zeros.size());
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-hash-append-leaf")
+   {
+      // Leaves hashed elsewhere (e.g. in parallel) combine to the same root
+      const auto data = make_data(64 * 9 + 10);
+      TreeHasher tree(64);
+      for(size_t i = 0; i < data.size(); i += 64) {
+         const size_t n = std::min<size_t>(64, data.size() - i);
+         tree.append_leaf(TreeHasher::leaf_digest(&data[i], n), n);
+      }
+      CATCH_REQUIRE(tree.finish().digest() == reference_root(data, 64));
+      CATCH_REQUIRE(tree.length() == data.size());
+   }
+}
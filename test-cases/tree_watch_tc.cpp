@@ -0,0 +1,230 @@
+
+#include "tree_watch.hpp"
+#include "temp_dir.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CATCH_CONFIG_PREFIX_ALL
+#include "catch.hpp"
+
+static void write_file(const std::string& path, const std::string& data)
+{
+   std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+// The watcher's index matches a fresh scan, entry by entry
+static bool in_sync(TreeWatcher& watcher, const std::string& root)
+{
+   watcher.update(100);
+   const auto scan  = dir_digest(root);
+   const auto index = watcher.snapshot();
+   if(index.root != scan.root || watcher.root_digest() != scan.root
+      || index.entries.size() != scan.entries.size())
+      return false;
+   for(size_t i = 0; i < scan.entries.size(); ++i)
+      if(index.entries[i].path != scan.entries[i].path
+         || index.entries[i].digest != scan.entries[i].digest)
+         return false;
+   return true;
+}
+
+static void test_serve(TreeWatcher& watcher, const std::string& root)
+{
+   const std::string socket_path = root + ".sock";
+   std::thread server([&] { watcher.serve(socket_path); });
+
+   std::optional<std::string> response;
+   for(int i = 0; i < 100 && !response; ++i) {
+      response = tree_watch_query(socket_path, "root");
+      if(!response) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+   }
+   const auto scan = dir_digest(root);
+   CATCH_REQUIRE(response == scan.root_hex());
+
+   write_file(root + "/served", "12345");
+   const auto file = tree_watch_query(socket_path, "get served");
+   CATCH_REQUIRE(file == "f " + Sha256("12345").hexdigest() + " 5");
+   CATCH_REQUIRE(tree_watch_query(socket_path, "get nope")
+                 == "error not found");
+   CATCH_REQUIRE(tree_watch_query(socket_path, "stats")->compare(0, 6, "files ")
+                 == 0);
+   CATCH_REQUIRE(tree_watch_query(socket_path, "bogus")
+                 == "error unknown request");
+
+   watcher.stop();
+   server.join();
+   CATCH_REQUIRE(!tree_watch_query(socket_path, "root"));
+
+   // Only a socket is replaced
+   write_file(socket_path, "not a socket");
+   CATCH_REQUIRE(!watcher.serve(socket_path));
+   std::string kept;
+   std::getline(std::ifstream(socket_path), kept);
+   CATCH_REQUIRE(kept == "not a socket");
+}
+
+CATCH_TEST_CASE("TreeWatch_", "[tree_watch]")
+{
+   const TempDir tmp("tree-watch");
+   const std::string root  = tmp.path() + "/root";
+   const std::string index = root + ".index";
+   mkdir(root.c_str(), 0755);
+   for(int d = 0; d < 4; ++d) {
+      const auto dir = root + "/d" + std::to_string(d);
+      mkdir(dir.c_str(), 0755);
+      mkdir((dir + "/sub").c_str(), 0755);
+      for(int f = 0; f < 10; ++f)
+         write_file(dir + "/sub/f" + std::to_string(f),
+                    std::string(size_t(100 * f + d), 'x'));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-watch-changes")
+   {
+      TreeWatcher watcher;
+      CATCH_REQUIRE(!watcher.open(root + "/missing"));
+      CATCH_REQUIRE(watcher.open(root));
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.stats().n_files == 40);
+      CATCH_REQUIRE(watcher.stats().n_directories == 9);
+
+      // Only the changed file is read again
+      write_file(root + "/d1/sub/f3", "new content");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.stats().n_rehashed == 1);
+      const auto f3 = watcher.lookup("d1/sub/f3");
+      CATCH_REQUIRE(f3);
+      CATCH_REQUIRE(f3->digest == dir_digest(root + "/d1/sub/f3").root);
+
+      // A file renamed over another, keeping its size and mtime
+      write_file(root + "/same", "aaaa");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      write_file(root + "/same.new", "bbbb");
+      struct stat st;
+      CATCH_REQUIRE(lstat((root + "/same").c_str(), &st) == 0);
+      const timespec times[2] = {st.st_atim, st.st_mtim};
+      const auto renamed      = root + "/same.new";
+      CATCH_REQUIRE(utimensat(AT_FDCWD, renamed.c_str(), times, 0) == 0);
+      CATCH_REQUIRE(rename(renamed.c_str(), (root + "/same").c_str()) == 0);
+      CATCH_REQUIRE(in_sync(watcher, root));
+      Sha256Digest expected;
+      Sha256("bbbb").get_digest(expected.data());
+      CATCH_REQUIRE(watcher.lookup("same")->digest == expected);
+
+      write_file(root + "/added", "added");
+      chmod((root + "/d2/sub/f1").c_str(), 0600);
+      symlink("d0", (root + "/link").c_str());
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.lookup("link")->target == "d0");
+
+      // New directories are scanned, and watched
+      mkdir((root + "/new").c_str(), 0755);
+      mkdir((root + "/new/deeper").c_str(), 0755);
+      write_file(root + "/new/deeper/file", "deep");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      write_file(root + "/new/deeper/file2", "deeper");
+      CATCH_REQUIRE(in_sync(watcher, root));
+
+      // Moves within the tree, out of it, and deletions
+      rename((root + "/d0").c_str(), (root + "/d0-moved").c_str());
+      CATCH_REQUIRE(in_sync(watcher, root));
+      write_file(root + "/d0-moved/sub/f0", "still watched");
+      CATCH_REQUIRE(in_sync(watcher, root));
+
+      rename((root + "/d1").c_str(), (root + "-outside").c_str());
+      CATCH_REQUIRE(in_sync(watcher, root));
+      write_file(root + "-outside/sub/f0", "no longer watched");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(remove_tree(root + "-outside"));
+
+      CATCH_REQUIRE(remove_tree(root + "/d2"));
+      CATCH_REQUIRE(in_sync(watcher, root));
+
+      // A file replaced by a directory, and back
+      unlink((root + "/added").c_str());
+      mkdir((root + "/added").c_str(), 0755);
+      CATCH_REQUIRE(in_sync(watcher, root));
+      rmdir((root + "/added").c_str());
+      write_file(root + "/added", "again");
+      CATCH_REQUIRE(in_sync(watcher, root));
+
+      // A directory removed and recreated between updates is a new one:
+      // scanned, and watched
+      CATCH_REQUIRE(remove_tree(root + "/d3"));
+      mkdir((root + "/d3").c_str(), 0755);
+      write_file(root + "/d3/b", "b");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.lookup("d3/b"));
+      write_file(root + "/d3/c", "c");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.lookup("d3/c"));
+
+      CATCH_REQUIRE(watcher.stats().n_directories == 6);
+      CATCH_REQUIRE(!watcher.update(0));
+
+      test_serve(watcher, root);
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-watch-overflow")
+   {
+      TreeWatcher watcher;
+      CATCH_REQUIRE(watcher.open(root));
+
+      // More events than the kernel queues
+      int max_queued = 16384;
+      std::ifstream("/proc/sys/fs/inotify/max_queued_events") >> max_queued;
+      for(int i = 0; i < max_queued + 4096; ++i)
+         write_file(root + "/d" + std::to_string(i % 4) + "/churn",
+                    std::to_string(i));
+      mkdir((root + "/d0/sub/new").c_str(), 0755);
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.stats().n_rescans == 1);
+
+      // Still watched everywhere, the new directory included
+      write_file(root + "/d0/sub/new/f", "after");
+      write_file(root + "/d2/sub/f4", "after");
+      CATCH_REQUIRE(in_sync(watcher, root));
+      CATCH_REQUIRE(watcher.lookup("d0/sub/new/f"));
+   }
+
+   //
+   // -------------------------------------------------------
+   //
+   CATCH_SECTION("tree-watch-index")
+   {
+      TreeWatchOptions options;
+      options.index_path = index;
+      {
+         TreeWatcher watcher;
+         CATCH_REQUIRE(watcher.open(root, options));
+      }
+      const auto saved = read_dir_manifest(index);
+      CATCH_REQUIRE(saved);
+      CATCH_REQUIRE(saved->root == dir_digest(root).root);
+
+      // Files unchanged since the index was written take their digest from
+      // it, without being read: plant a wrong one to show it
+      auto planted = *saved;
+      for(auto& e : planted.entries)
+         if(e.path == "d3/sub/f2") e.digest.fill(0xab);
+      CATCH_REQUIRE(write_dir_manifest(index, planted));
+
+      TreeWatcher watcher;
+      CATCH_REQUIRE(watcher.open(root, options));
+      CATCH_REQUIRE(watcher.lookup("d3/sub/f2")->digest[0] == 0xab);
+      CATCH_REQUIRE(watcher.lookup("d3/sub/f1")->digest
+                    == dir_digest(root + "/d3/sub/f1").root);
+   }
+}
@@ -0,0 +1,104 @@
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+static thread_local const ThreadPool* tls_pool = nullptr;
+static thread_local int tls_worker             = -1;
+
+ThreadPool::ThreadPool(unsigned n_threads) noexcept
+{
+   if(n_threads == 0)
+      n_threads = std::max(1u, std::thread::hardware_concurrency());
+   for(unsigned i = 0; i < n_threads; ++i)
+      queues_.push_back(std::make_unique<Queue>());
+   for(unsigned i = 0; i < n_threads; ++i)
+      threads_.emplace_back([this, i] { run_(i); });
+}
+
+ThreadPool::~ThreadPool() noexcept
+{
+   wait();
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+   }
+   work_cv_.notify_all();
+   for(auto& thread : threads_) thread.join();
+}
+
+int ThreadPool::current_worker() noexcept { return tls_worker; }
+
+// ---------------------------------------------------------------------- submit
+
+void ThreadPool::submit(Task task) noexcept
+{
+   const size_t q = tls_pool == this
+                        ? size_t(tls_worker)
+                        : next_queue_.fetch_add(1) % queues_.size();
+   n_unfinished_.fetch_add(1);
+
+   // Counted first, and under the sleep lock, so that a worker about to
+   // sleep sees it, and the count never drops below the deques' contents
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      n_queued_.fetch_add(1);
+   }
+   {
+      std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+      queues_[q]->tasks.push_back(std::move(task));
+   }
+   work_cv_.notify_one();
+}
+
+void ThreadPool::wait() noexcept
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   idle_cv_.wait(lock, [&] { return n_unfinished_.load() == 0; });
+}
+
+// --------------------------------------------------------------------- workers
+
+// Newest from our own deque, else the oldest from someone else's
+bool ThreadPool::pop_(size_t self, Task& task) noexcept
+{
+   const size_t n = queues_.size();
+   for(size_t k = 0; k < n; ++k) {
+      auto& queue = *queues_[(self + k) % n];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if(queue.tasks.empty()) continue;
+      if(k == 0) {
+         task = std::move(queue.tasks.back());
+         queue.tasks.pop_back();
+      } else {
+         task = std::move(queue.tasks.front());
+         queue.tasks.pop_front();
+      }
+      n_queued_.fetch_sub(1);
+      return true;
+   }
+   return false;
+}
+
+void ThreadPool::run_(size_t self) noexcept
+{
+   tls_pool   = this;
+   tls_worker = int(self);
+
+   Task task;
+   for(;;) {
+      if(!pop_(self, task)) {
+         std::unique_lock<std::mutex> lock(mutex_);
+         work_cv_.wait(lock, [&] { return stop_ || n_queued_.load() > 0; });
+         if(stop_ && n_queued_.load() == 0) return;
+         continue;
+      }
+
+      task();
+      task = nullptr; // release captures before reporting completion
+      if(n_unfinished_.fetch_sub(1) == 1) {
+         std::lock_guard<std::mutex> lock(mutex_);
+         idle_cv_.notify_all();
+      }
+   }
+}
@@ -0,0 +1,68 @@
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing thread pool
+//
+// Each worker has its own deque of tasks. A task submitted from inside a
+// worker goes on that worker's deque, and the worker runs its newest task
+// first (so a task that fans out keeps its children hot in cache), while
+// idle workers steal the oldest tasks from the others. Tasks submitted from
+// outside the pool are dealt round robin.
+//
+// Tasks may submit more tasks; `wait()` returns once every task, including
+// those, has finished. It must not be called from inside a task.
+//
+// usage: ThreadPool pool;
+//        for(const auto& path : paths)
+//           pool.submit([&, path] { hash(path); });
+//        pool.wait();
+class ThreadPool
+{
+ public:
+   using Task = std::function<void()>;
+
+   // 0 threads means one per hardware thread
+   explicit ThreadPool(unsigned n_threads = 0) noexcept;
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+   ~ThreadPool() noexcept; // waits for the remaining tasks
+
+   void submit(Task task) noexcept;
+   void wait() noexcept;
+
+   unsigned size() const noexcept { return unsigned(threads_.size()); }
+
+   // The index of the calling worker in its pool, or -1 outside any pool
+   static int current_worker() noexcept;
+
+ private:
+   struct Queue
+   {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+   };
+
+   std::vector<std::unique_ptr<Queue>> queues_;
+   std::vector<std::thread> threads_;
+   std::atomic<size_t> n_queued_{0};     // in any deque
+   std::atomic<size_t> n_unfinished_{0}; // queued or running
+   std::atomic<unsigned> next_queue_{0}; // for outside submissions
+
+   std::mutex mutex_; // for sleeping and waking only
+   std::condition_variable work_cv_;
+   std::condition_variable idle_cv_;
+   bool stop_ = false;
+
+   bool pop_(size_t self, Task& task) noexcept;
+   void run_(size_t self) noexcept;
+};
@@ -0,0 +1,77 @@
+
+// hashd: a local hashing service
+//
+// usage: hashd [-j threads] [-r max-ring-MiB] [SOCKET]
+//
+// Serves hash requests from HashdClient and RemoteSha256/RemoteMD5 on the
+// Unix socket SOCKET ($HASHD_SOCKET, or /run/hashd.sock by default), until
+// SIGINT or SIGTERM.
+
+#include "hashd.hpp"
+#include "hashd_client.hpp"
+#include "parse_count.hpp"
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+static HashdServer server;
+
+static void usage(FILE* out)
+{
+   std::fputs("usage: hashd [-j threads] [-r max-ring-MiB] [SOCKET]\n", out);
+}
+
+static void on_signal(int) { server.stop(); }
+
+int main(int argc, char** argv)
+{
+   HashdOptions options;
+
+   int opt;
+   while((opt = getopt(argc, argv, "j:r:h")) != -1) {
+      switch(opt) {
+      case 'j': {
+         const auto n_threads = parse_count(optarg, 0, 1024);
+         if(!n_threads) {
+            usage(stderr);
+            return EXIT_FAILURE;
+         }
+         options.n_threads = unsigned(*n_threads);
+         break;
+      }
+      case 'r': {
+         const auto mib = parse_count(optarg, 1, SIZE_MAX >> 20);
+         if(!mib) {
+            usage(stderr);
+            return EXIT_FAILURE;
+         }
+         options.max_ring_size = size_t(*mib) << 20;
+         break;
+      }
+      case 'h': usage(stdout); return EXIT_SUCCESS;
+      default: usage(stderr); return EXIT_FAILURE;
+      }
+   }
+   if(argc - optind > 1) {
+      usage(stderr);
+      return EXIT_FAILURE;
+   }
+   const std::string socket_path = optind < argc
+                                       ? argv[optind]
+                                       : HashdClient::default_socket_path();
+
+   std::signal(SIGINT, on_signal);
+   std::signal(SIGTERM, on_signal);
+   if(!server.serve(socket_path, options)) {
+      std::fprintf(stderr,
+                   "hashd: cannot listen on %s\n",
+                   socket_path.c_str());
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+
+// hashsum: parallel, recursive md5sum/sha256sum
+//
+// usage: hashsum [-a md5|sha256] [-j threads] [FILE|DIR]...
+//        hashsum -c [-q] [-j threads] [MANIFEST]...
+//
+// With no FILE, or when FILE is -, standard input is hashed. Directories
+// are hashed recursively. Output is `sha256sum` compatible, in the order
+// the operands were given, each directory's files sorted by path.
+//
+// With -c, each MANIFEST (standard input if none) lists digests to verify,
+// in the format above. The algorithm of each line follows from its length,
+// unless -a is given.
+
+#include "hashsum.hpp"
+#include "parse_count.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+static void usage(FILE* out)
+{
+   std::fputs("usage: hashsum [-a md5|sha256] [-j threads] [FILE|DIR]...\n"
+              "       hashsum -c [-q] [-j threads] [MANIFEST]...\n",
+              out);
+}
+
+static int compute(const std::vector<std::string>& paths,
+                   const HashsumOptions& options)
+{
+   int status = EXIT_SUCCESS;
+   for(const auto& entry : hashsum(paths, options)) {
+      if(entry.error != 0) {
+         std::fprintf(stderr,
+                      "hashsum: %s: %s\n",
+                      entry.path.c_str(),
+                      strerror(entry.error));
+         status = EXIT_FAILURE;
+         continue;
+      }
+      const auto line = format_hashsum_line(entry);
+      std::fwrite(line.data(), 1, line.size(), stdout);
+   }
+   return status;
+}
+
+static int check(const std::vector<std::string>& manifests,
+                 const HashsumOptions& options,
+                 bool forced_algorithm,
+                 bool quiet)
+{
+   std::vector<ManifestEntry> entries;
+   size_t n_malformed = 0;
+   for(const auto& path : manifests) {
+      std::ifstream file;
+      if(path != "-") {
+         file.open(path);
+         if(!file) {
+            std::fprintf(stderr,
+                         "hashsum: %s: %s\n",
+                         path.c_str(),
+                         strerror(errno));
+            return EXIT_FAILURE;
+         }
+      }
+      std::istream& in = path == "-" ? std::cin : file;
+
+      std::string line;
+      while(std::getline(in, line)) {
+         auto entry = parse_manifest_line(line);
+         if(!entry
+            || (forced_algorithm && entry->algorithm != options.algorithm))
+            ++n_malformed;
+         else
+            entries.push_back(std::move(*entry));
+      }
+   }
+
+   size_t n_mismatched = 0, n_unreadable = 0;
+   for(const auto& result : hashsum_check(entries, options)) {
+      const auto escaped = escape_hashsum_path(result.path);
+      const char* path   = escaped.c_str();
+      switch(result.status) {
+      case CheckStatus::ok:
+         if(!quiet) std::printf("%s: OK\n", path);
+         break;
+      case CheckStatus::mismatch:
+         std::printf("%s: FAILED\n", path);
+         ++n_mismatched;
+         break;
+      case CheckStatus::unreadable:
+         std::fprintf(
+             stderr, "hashsum: %s: %s\n", path, strerror(result.error));
+         std::printf("%s: FAILED open or read\n", path);
+         ++n_unreadable;
+         break;
+      }
+   }
+
+   if(n_malformed > 0)
+      std::fprintf(stderr,
+                   "hashsum: WARNING: %zu line%s improperly formatted\n",
+                   n_malformed,
+                   n_malformed == 1 ? " is" : "s are");
+   if(n_unreadable > 0)
+      std::fprintf(stderr,
+                   "hashsum: WARNING: %zu listed file%s could not be read\n",
+                   n_unreadable,
+                   n_unreadable == 1 ? "" : "s");
+   if(n_mismatched > 0)
+      std::fprintf(stderr,
+                   "hashsum: WARNING: %zu computed checksum%s did NOT match\n",
+                   n_mismatched,
+                   n_mismatched == 1 ? "" : "s");
+   if(entries.empty()) {
+      std::fputs("hashsum: no properly formatted checksum lines found\n",
+                 stderr);
+      return EXIT_FAILURE;
+   }
+   return n_mismatched + n_unreadable > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+   HashsumOptions options;
+   bool check_mode = false, quiet = false, forced_algorithm = false;
+
+   int opt;
+   while((opt = getopt(argc, argv, "a:cj:qh")) != -1) {
+      switch(opt) {
+      case 'a': {
+         const auto algorithm = parse_algorithm(optarg);
+         if(!algorithm) {
+            std::fprintf(stderr, "hashsum: unknown algorithm '%s'\n", optarg);
+            return EXIT_FAILURE;
+         }
+         options.algorithm = *algorithm;
+         forced_algorithm  = true;
+         break;
+      }
+      case 'c': check_mode = true; break;
+      case 'j': {
+         const auto n_threads = parse_count(optarg, 0, 1024);
+         if(!n_threads) {
+            usage(stderr);
+            return EXIT_FAILURE;
+         }
+         options.n_threads = unsigned(*n_threads);
+         break;
+      }
+      case 'q': quiet = true; break;
+      case 'h': usage(stdout); return EXIT_SUCCESS;
+      default: usage(stderr); return EXIT_FAILURE;
+      }
+   }
+
+   std::vector<std::string> operands(argv + optind, argv + argc);
+   if(operands.empty()) operands.push_back("-");
+
+   return check_mode ? check(operands, options, forced_algorithm, quiet)
+                     : compute(operands, options);
+}
@@ -0,0 +1,25 @@
+
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <optional>
+
+// Parses a command-line count: decimal digits only, with nothing after them,
+// and in [min, max]. Returns nullopt otherwise, so that "-j x" or "-j -1" is
+// a usage error rather than silently zero, or four billion threads.
+//
+// usage: const auto n = parse_count(optarg, 0, 1024);
+//        if(!n) { usage(stderr); return EXIT_FAILURE; }
+inline std::optional<unsigned long>
+parse_count(const char* arg, unsigned long min, unsigned long max) noexcept
+{
+   if(!std::isdigit(static_cast<unsigned char>(arg[0]))) return std::nullopt;
+   char* end = nullptr;
+   errno     = 0;
+   const auto value = std::strtoul(arg, &end, 10);
+   if(errno != 0 || *end != '\0' || value < min || value > max)
+      return std::nullopt;
+   return value;
+}
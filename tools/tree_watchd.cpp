@@ -0,0 +1,99 @@
+
+// tree_watchd: keeps a directory tree's digest current, and serves queries
+//
+// usage: tree_watchd [-i index] [-j threads] [-s save-seconds] ROOT SOCKET
+//        tree_watchd -q SOCKET REQUEST...
+//
+// The first form scans ROOT, then follows changes with inotify and answers
+// requests on the Unix socket SOCKET until SIGINT or SIGTERM. With -i, the
+// index is kept in that file across restarts. The second form sends each
+// REQUEST ("root", "get <path>", "stats" or "save") and prints the replies.
+
+#include "parse_count.hpp"
+#include "tree_watch.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+static TreeWatcher watcher;
+
+static void usage(FILE* out)
+{
+   std::fputs(
+       "usage: tree_watchd [-i index] [-j threads] [-s save-seconds] ROOT "
+       "SOCKET\n"
+       "       tree_watchd -q SOCKET REQUEST...\n",
+       out);
+}
+
+static void on_signal(int) { watcher.stop(); }
+
+int main(int argc, char** argv)
+{
+   TreeWatchOptions options;
+   bool query = false;
+
+   int opt;
+   while((opt = getopt(argc, argv, "i:j:s:qh")) != -1) {
+      switch(opt) {
+      case 'i': options.index_path = optarg; break;
+      case 'j': {
+         const auto n_threads = parse_count(optarg, 0, 1024);
+         if(!n_threads) {
+            usage(stderr);
+            return EXIT_FAILURE;
+         }
+         options.n_threads = unsigned(*n_threads);
+         break;
+      }
+      case 's': options.save_interval = atof(optarg); break;
+      case 'q': query = true; break;
+      case 'h': usage(stdout); return EXIT_SUCCESS;
+      default: usage(stderr); return EXIT_FAILURE;
+      }
+   }
+
+   if(query) {
+      if(argc - optind < 2) {
+         usage(stderr);
+         return EXIT_FAILURE;
+      }
+      for(int i = optind + 1; i < argc; ++i) {
+         const auto response = tree_watch_query(argv[optind], argv[i]);
+         if(!response) {
+            std::fprintf(stderr, "tree_watchd: cannot connect\n");
+            return EXIT_FAILURE;
+         }
+         std::printf("%s\n", response->c_str());
+      }
+      return EXIT_SUCCESS;
+   }
+
+   if(argc - optind != 2) {
+      usage(stderr);
+      return EXIT_FAILURE;
+   }
+   const std::string root = argv[optind], socket_path = argv[optind + 1];
+
+   if(!watcher.open(root, options)) {
+      std::fprintf(stderr, "tree_watchd: cannot watch %s\n", root.c_str());
+      return EXIT_FAILURE;
+   }
+   std::printf("%s  %s\n", watcher.snapshot().root_hex().c_str(), root.c_str());
+   std::fflush(stdout);
+
+   std::signal(SIGINT, on_signal);
+   std::signal(SIGTERM, on_signal);
+   if(!watcher.serve(socket_path)) {
+      std::fprintf(stderr,
+                   "tree_watchd: cannot listen on %s\n",
+                   socket_path.c_str());
+      return EXIT_FAILURE;
+   }
+   watcher.close();
+   return EXIT_SUCCESS;
+}
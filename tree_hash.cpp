@@ -0,0 +1,186 @@
+
+#include "tree_hash.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static const uint8_t leaf_prefix = 0x00;
+static const uint8_t node_prefix = 0x01;
+
+static const char zeros[64 << 10] = {};
+
+static bool is_zero(const char* p, size_t length) noexcept
+{
+   return length == 0 || (p[0] == 0 && memcmp(p, p + 1, length - 1) == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+Sha256Digest TreeHasher::leaf_digest(const void* buf, size_t length) noexcept
+{
+   Sha256 sha;
+   sha.append(&leaf_prefix, 1);
+   sha.append(buf, length);
+   Sha256Digest digest;
+   sha.finish().get_digest(digest.data());
+   return digest;
+}
+
+Sha256Digest TreeHasher::node_digest(const Sha256Digest& left,
+                                     const Sha256Digest& right) noexcept
+{
+   Sha256 sha;
+   sha.append(&node_prefix, 1);
+   sha.append(left.data(), left.size());
+   sha.append(right.data(), right.size());
+   Sha256Digest digest;
+   sha.finish().get_digest(digest.data());
+   return digest;
+}
+
+//  --------------------------------------------------------------- Construction
+
+TreeHasher::TreeHasher(size_t leaf_size, bool detect_zero_leaves) noexcept
+    : leaf_size_(std::max<size_t>(leaf_size, 1))
+    , detect_zero_leaves_(detect_zero_leaves)
+{}
+
+const Sha256Digest& TreeHasher::zero_leaf_() noexcept
+{
+   if(!have_zero_leaf_) {
+      Sha256 sha;
+      sha.append(&leaf_prefix, 1);
+      for(size_t done = 0; done < leaf_size_; done += sizeof(zeros))
+         sha.append(zeros, std::min(sizeof(zeros), leaf_size_ - done));
+      sha.finish().get_digest(zero_leaf_digest_.data());
+      have_zero_leaf_ = true;
+   }
+   return zero_leaf_digest_;
+}
+
+// Merges equal subtrees, like carrying in a binary counter
+void TreeHasher::push_leaf_(const Sha256Digest& leaf) noexcept
+{
+   Sha256Digest node = leaf;
+   unsigned height   = 0;
+   while(!stack_.empty() && stack_.back().second == height) {
+      node = node_digest(stack_.back().first, node);
+      stack_.pop_back();
+      ++height;
+   }
+   stack_.emplace_back(node, height);
+   ++n_leaves_;
+}
+
+// ---------------------------------------------------------------------- append
+
+void TreeHasher::append(const void* buf, size_t length) noexcept
+{
+   assert(!finalized_);
+   auto p = static_cast<const char*>(buf);
+   length_ += length;
+
+   while(length > 0) {
+      // Whole leaves straight from the caller's buffer
+      if(leaf_fill_ == 0 && length >= leaf_size_) {
+         if(detect_zero_leaves_ && is_zero(p, leaf_size_)) {
+            push_leaf_(zero_leaf_());
+            ++n_zero_leaves_;
+         } else {
+            push_leaf_(leaf_digest(p, leaf_size_));
+         }
+         p += leaf_size_;
+         length -= leaf_size_;
+         continue;
+      }
+
+      if(leaf_fill_ == 0) {
+         leaf_ = Sha256();
+         leaf_.append(&leaf_prefix, 1);
+      }
+      const size_t n = std::min(length, leaf_size_ - leaf_fill_);
+      leaf_.append(p, n);
+      leaf_fill_ += n;
+      p += n;
+      length -= n;
+      if(leaf_fill_ == leaf_size_) {
+         Sha256Digest leaf;
+         leaf_.finish().get_digest(leaf.data());
+         push_leaf_(leaf);
+         leaf_fill_ = 0;
+      }
+   }
+}
+
+void TreeHasher::append_zeros(uint64_t length) noexcept
+{
+   assert(!finalized_);
+
+   // Up to a leaf boundary
+   while(length > 0 && leaf_fill_ != 0) {
+      const auto n = size_t(std::min<uint64_t>(
+          length, std::min(sizeof(zeros), leaf_size_ - leaf_fill_)));
+      append(zeros, n);
+      length -= n;
+   }
+
+   // Whole leaves: no hashing at all, beyond the tree's nodes
+   for(; length >= leaf_size_; length -= leaf_size_) {
+      push_leaf_(zero_leaf_());
+      ++n_zero_leaves_;
+      length_ += leaf_size_;
+   }
+
+   while(length > 0) {
+      const auto n = size_t(std::min<uint64_t>(length, sizeof(zeros)));
+      append(zeros, n);
+      length -= n;
+   }
+}
+
+void TreeHasher::append_leaf(const Sha256Digest& leaf, size_t length) noexcept
+{
+   assert(!finalized_ && leaf_fill_ == 0 && length <= leaf_size_);
+   push_leaf_(leaf);
+   length_ += length;
+}
+
+// ---------------------------------------------------------------------- finish
+
+TreeHasher& TreeHasher::finish() noexcept
+{
+   if(finalized_) return *this;
+
+   if(leaf_fill_ > 0) {
+      Sha256Digest leaf;
+      leaf_.finish().get_digest(leaf.data());
+      push_leaf_(leaf);
+      leaf_fill_ = 0;
+   }
+
+   if(stack_.empty()) {
+      Sha256().finish().get_digest(root_.data());
+   } else {
+      // Fold from the right: the smallest subtree is the deepest
+      root_ = stack_.back().first;
+      for(size_t i = stack_.size() - 1; i-- > 0;)
+         root_ = node_digest(stack_[i].first, root_);
+   }
+   stack_.clear();
+   finalized_ = true;
+   return *this;
+}
+
+Sha256Digest TreeHasher::digest() const noexcept
+{
+   assert(finalized_); // You must call finish() before getting the digest
+   return root_;
+}
+
+std::string TreeHasher::hexdigest() noexcept
+{
+   finish();
+   return to_hex(root_);
+}
@@ -0,0 +1,79 @@
+
+#pragma once
+
+#include "sha256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Merkle tree hash over Sha256
+//
+// The input is split into leaves of `leaf_size` bytes (the last may be
+// shorter), and hashed as in RFC 6962:
+//
+//    leaf = Sha256(0x00 || chunk)
+//    node = Sha256(0x01 || left || right)
+//
+// where a tree of n > 1 leaves has a left subtree of the largest power of
+// two below n, and a right subtree of the rest. Empty input hashes to
+// Sha256("").
+//
+// Leaves are independent, which allows them to be hashed in parallel and
+// combined with append_leaf(). And since every all-zero leaf has the same
+// digest, it is computed once: append_zeros(), and whole leaves of zeros
+// passed to append(), cost one node hash per leaf instead of hashing the
+// leaf's bytes.
+//
+// usage: TreeHasher tree;
+//        tree.append(data, length);
+//        tree.append_zeros(1 << 30); // a hole in a sparse file
+//        std::cout << tree.hexdigest();
+class TreeHasher
+{
+ public:
+   explicit TreeHasher(size_t leaf_size         = 1 << 20,
+                       bool detect_zero_leaves = true) noexcept;
+
+   void append(const void* buf, size_t length) noexcept;
+   void append_zeros(uint64_t length) noexcept;
+
+   // Appends a leaf whose digest was computed elsewhere. Must be called at
+   // a leaf boundary, and only the last leaf may be short.
+   void append_leaf(const Sha256Digest& leaf, size_t length) noexcept;
+
+   TreeHasher& finish() noexcept;
+   Sha256Digest digest() const noexcept; // finish() first
+   std::string hexdigest() noexcept;
+
+   size_t leaf_size() const noexcept { return leaf_size_; }
+   uint64_t length() const noexcept { return length_; }
+   uint64_t n_leaves() const noexcept { return n_leaves_; }
+   uint64_t n_zero_leaves() const noexcept { return n_zero_leaves_; }
+
+   static Sha256Digest leaf_digest(const void* buf, size_t length) noexcept;
+   static Sha256Digest node_digest(const Sha256Digest& left,
+                                   const Sha256Digest& right) noexcept;
+
+ private:
+   void push_leaf_(const Sha256Digest& leaf) noexcept;
+   const Sha256Digest& zero_leaf_() noexcept;
+
+   size_t leaf_size_;
+   bool detect_zero_leaves_;
+   Sha256 leaf_;          // the partial leaf
+   size_t leaf_fill_ = 0; // bytes in the partial leaf
+   uint64_t length_  = 0;
+   uint64_t n_leaves_      = 0;
+   uint64_t n_zero_leaves_ = 0;
+
+   // Roots of perfect subtrees, with their heights, largest first
+   std::vector<std::pair<Sha256Digest, unsigned>> stack_;
+
+   Sha256Digest zero_leaf_digest_;
+   bool have_zero_leaf_ = false;
+   Sha256Digest root_;
+   bool finalized_ = false;
+};
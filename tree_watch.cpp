@@ -0,0 +1,678 @@
+
+#include "tree_watch.hpp"
+#include "file_hash.hpp"
+#include "io_util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static constexpr uint32_t watch_mask
+    = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+      | IN_MODIFY | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+// --------------------------------------------------------------------- helpers
+
+static std::string parent_of(const std::string& rel) noexcept
+{
+   const auto slash = rel.rfind('/');
+   return slash == std::string::npos ? "" : rel.substr(0, slash);
+}
+
+static std::string name_of(const std::string& rel) noexcept
+{
+   const auto slash = rel.rfind('/');
+   return slash == std::string::npos ? rel : rel.substr(slash + 1);
+}
+
+static std::string join(const std::string& rel, const std::string& name)
+{
+   return rel.empty() ? name : name.empty() ? rel : rel + '/' + name;
+}
+
+static int depth_of(const std::string& rel) noexcept
+{
+   if(rel.empty()) return 0;
+   return 1 + int(std::count(rel.begin(), rel.end(), '/'));
+}
+
+static bool read_link(const std::string& path, std::string& target) noexcept
+{
+   target.assign(256, '\0');
+   for(;;) {
+      const ssize_t n = readlink(path.c_str(), &target[0], target.size());
+      if(n < 0) return false;
+      if(size_t(n) < target.size()) {
+         target.resize(size_t(n));
+         return true;
+      }
+      target.resize(target.size() * 2);
+   }
+}
+
+// -------------------------------------------------------------- open and close
+
+TreeWatcher::TreeWatcher() noexcept = default;
+
+TreeWatcher::~TreeWatcher() noexcept { close(); }
+
+bool TreeWatcher::open(const std::string& root,
+                       const TreeWatchOptions& options) noexcept
+{
+   close();
+   root_ = root;
+   while(root_.size() > 1 && root_.back() == '/') root_.pop_back();
+   options_    = options;
+   inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   stop_fd_    = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if(inotify_fd_ < 0 || stop_fd_ < 0) {
+      close();
+      return false;
+   }
+   pool_ = std::make_unique<ThreadPool>(options.n_threads);
+
+   std::optional<DirDigest> previous;
+   if(!options.index_path.empty())
+      previous = read_dir_manifest(options.index_path);
+
+   const auto scan = scan_("", previous ? &*previous : nullptr);
+   bool ok;
+   {
+      std::lock_guard<std::mutex> lock(padlock_);
+      install_("", scan);
+      ok = root_entry_.type == DirEntryType::directory
+           && root_entry_.error == 0;
+      last_save_ = std::chrono::steady_clock::now();
+      unsaved_   = !previous || previous->root != root_entry_.digest;
+   }
+   if(!ok) close();
+   return ok;
+}
+
+void TreeWatcher::close() noexcept
+{
+   std::lock_guard<std::mutex> serial(update_lock_);
+   std::lock_guard<std::mutex> lock(padlock_);
+   if(inotify_fd_ >= 0 && unsaved_ && !options_.index_path.empty())
+      save_locked_();
+   if(inotify_fd_ >= 0) ::close(inotify_fd_); // drops every watch
+   if(stop_fd_ >= 0) ::close(stop_fd_);
+   inotify_fd_ = stop_fd_ = -1;
+   pool_.reset();
+   root_entry_ = DirDigestEntry{};
+   dirs_.clear();
+   wd_paths_.clear();
+   dirty_.clear();
+   n_files_    = 0;
+   overflowed_ = false;
+   unsaved_    = false;
+   stats_      = TreeWatchStats{};
+}
+
+void TreeWatcher::stop() noexcept
+{
+   const uint64_t one = 1;
+   if(stop_fd_ >= 0 && write(stop_fd_, &one, sizeof(one)) < 0) return;
+}
+
+// ----------------------------------------------------------------------- index
+
+std::string TreeWatcher::full_path_(const std::string& rel) const noexcept
+{
+   if(rel.empty()) return root_;
+   return root_ == "/" ? root_ + rel : root_ + '/' + rel;
+}
+
+DirDigestEntry* TreeWatcher::entry_(const std::string& rel) noexcept
+{
+   if(rel.empty()) return &root_entry_;
+   const auto dir = dirs_.find(parent_of(rel));
+   if(dir == dirs_.end()) return nullptr;
+   const auto ii = dir->second.children.find(name_of(rel));
+   return ii == dir->second.children.end() ? nullptr : &ii->second;
+}
+
+const DirDigestEntry* TreeWatcher::entry_(const std::string& rel) const
+    noexcept
+{
+   return const_cast<TreeWatcher*>(this)->entry_(rel);
+}
+
+void TreeWatcher::put_(const std::string& rel,
+                       const DirDigestEntry& entry) noexcept
+{
+   if(rel.empty()) {
+      root_entry_ = entry;
+      return;
+   }
+   auto& slot = dirs_[parent_of(rel)].children[name_of(rel)];
+   if(slot.type == DirEntryType::file) --n_files_;
+   if(entry.type == DirEntryType::file) ++n_files_;
+   slot      = entry;
+   slot.path = rel;
+   if(entry.type == DirEntryType::directory) dirs_[rel];
+}
+
+// Scans the subtree at `rel`, watching its directories. The index is not
+// read, so padlock_ need not be held.
+TreeWatcher::Scan TreeWatcher::scan_(const std::string& rel,
+                                     const DirDigest* previous) const noexcept
+{
+   std::mutex watch_lock;
+   Scan scan;
+
+   DirDigestOptions options;
+   options.modes        = options_.modes;
+   options.previous     = previous;
+   options.pool         = pool_.get();
+   options.on_directory = [&](const std::string& path) {
+      const int wd = inotify_add_watch(inotify_fd_, path.c_str(), watch_mask);
+      if(wd < 0) return;
+      auto sub = path.substr(root_.size());
+      while(!sub.empty() && sub[0] == '/') sub.erase(0, 1);
+      std::lock_guard<std::mutex> guard(watch_lock);
+      scan.watches.emplace_back(wd, std::move(sub));
+   };
+   scan.tree = dir_digest(full_path_(rel), options);
+   return scan;
+}
+
+// Replaces whatever the index holds at `rel` (the whole index, for the root)
+// with `scan`
+void TreeWatcher::install_(const std::string& rel, const Scan& scan) noexcept
+{
+   // A directory watched already got its existing watch back: it moves to
+   // the new entry, rather than being removed with the old one
+   for(const auto& [wd, path] : scan.watches) {
+      const auto old = wd_paths_.find(wd);
+      if(old == wd_paths_.end()) continue;
+      const auto dir = dirs_.find(old->second);
+      if(dir != dirs_.end() && dir->second.wd == wd) dir->second.wd = -1;
+      wd_paths_.erase(old);
+   }
+   if(rel.empty()) {
+      for(const auto& [wd, path] : wd_paths_)
+         inotify_rm_watch(inotify_fd_, wd);
+      wd_paths_.clear();
+      dirs_.clear();
+      n_files_ = 0;
+   } else {
+      remove_(rel);
+   }
+
+   for(const auto& e : scan.tree.entries) put_(join(rel, e.path), e);
+   for(const auto& [wd, path] : scan.watches) {
+      const auto dir = dirs_.find(path);
+      if(dir == dirs_.end()) continue; // replaced while we scanned
+      dir->second.wd = wd;
+      wd_paths_[wd]  = path;
+   }
+}
+
+void TreeWatcher::remove_(const std::string& rel) noexcept
+{
+   const auto* entry = entry_(rel);
+   if(entry == nullptr || rel.empty()) return;
+
+   if(entry->type == DirEntryType::directory) {
+      // `rel` and everything under it: "rel", then "rel/..." contiguously
+      const auto prefix = rel + '/';
+      auto under        = [&](const std::string& path) {
+         return path == rel || path.compare(0, prefix.size(), prefix) == 0;
+      };
+      auto ii = dirs_.find(rel);
+      while(ii != dirs_.end() && under(ii->first)) {
+         for(const auto& child : ii->second.children)
+            if(child.second.type == DirEntryType::file) --n_files_;
+         if(ii->second.wd >= 0) {
+            inotify_rm_watch(inotify_fd_, ii->second.wd);
+            wd_paths_.erase(ii->second.wd);
+         }
+         ii = dirs_.erase(ii);
+         if(ii != dirs_.end() && ii->first < prefix)
+            ii = dirs_.lower_bound(prefix); // skip "rel-x" and the like
+      }
+   }
+
+   auto& siblings = dirs_[parent_of(rel)].children;
+   const auto ii  = siblings.find(name_of(rel));
+   if(ii->second.type == DirEntryType::file) --n_files_;
+   siblings.erase(ii);
+}
+
+// Recomputes the digests of `touched` directories and all their ancestors,
+// deepest first
+void TreeWatcher::recompute_(std::set<std::string>& touched) noexcept
+{
+   std::set<std::string> all;
+   for(const auto& rel : touched)
+      for(auto p = rel; all.insert(p).second && !p.empty(); p = parent_of(p))
+         ;
+
+   std::vector<std::string> order(all.begin(), all.end());
+   std::stable_sort(
+       order.begin(), order.end(), [](const auto& a, const auto& b) {
+          return depth_of(a) > depth_of(b);
+       });
+
+   std::string record;
+   for(const auto& rel : order) {
+      auto* entry    = entry_(rel);
+      const auto dir = dirs_.find(rel);
+      if(entry == nullptr || dir == dirs_.end()) continue;
+      Sha256 sha;
+      for(const auto& [name, child] : dir->second.children) {
+         record.clear();
+         encode_dir_record(record, name, child, options_.modes);
+         sha.append(record.data(), record.size());
+      }
+      sha.finish().get_digest(entry->digest.data());
+   }
+}
+
+void TreeWatcher::flatten_(const std::string& rel, DirDigest& out) const
+    noexcept
+{
+   const auto* entry = entry_(rel);
+   out.entries.push_back(*entry);
+   out.entries.back().path = rel;
+   if(entry->error != 0) ++out.n_errors;
+
+   const auto dir = dirs_.find(rel);
+   if(entry->type != DirEntryType::directory || dir == dirs_.end()) return;
+   for(const auto& child : dir->second.children)
+      flatten_(join(rel, child.first), out);
+}
+
+// ---------------------------------------------------------------------- update
+
+bool TreeWatcher::read_events_() noexcept
+{
+   alignas(inotify_event) char buf[64 << 10];
+   for(;;) {
+      const ssize_t n = read_retry(inotify_fd_, buf, sizeof(buf));
+      if(n < 0) return errno == EAGAIN;
+      if(n == 0) return true;
+
+      for(const char* p = buf; p < buf + n;) {
+         const auto* event = reinterpret_cast<const inotify_event*>(p);
+         p += sizeof(inotify_event) + event->len;
+         ++stats_.n_events;
+
+         if(event->mask & IN_Q_OVERFLOW) {
+            overflowed_ = true;
+            continue;
+         }
+         const auto ii = wd_paths_.find(event->wd);
+         if(ii == wd_paths_.end()) continue; // already dropped
+         if(event->mask & IN_IGNORED) {
+            const auto dir = dirs_.find(ii->second);
+            if(dir != dirs_.end() && dir->second.wd == event->wd)
+               dir->second.wd = -1;
+            wd_paths_.erase(ii);
+            continue;
+         }
+         if(event->len > 0)
+            dirty_.insert(join(ii->second, event->name));
+         else if(event->mask & IN_ATTRIB)
+            dirty_.insert(ii->second); // the directory's own mode
+      }
+   }
+}
+
+bool TreeWatcher::apply_(std::unique_lock<std::mutex>& lock) noexcept
+{
+   if(overflowed_) {
+      // Events were lost: rescan, reusing the digests of unchanged files.
+      // Queries are answered from the old index meanwhile.
+      DirDigest previous;
+      flatten_("", previous);
+      dirty_.clear();
+      overflowed_ = false;
+      ++stats_.n_rescans;
+      lock.unlock();
+      const auto scan = scan_("", &previous);
+      lock.lock();
+      install_("", scan);
+      return root_entry_.digest != previous.root;
+   }
+   if(dirty_.empty()) return false;
+
+   const auto before = root_entry_.digest;
+   const auto dirty  = std::move(dirty_);
+   dirty_.clear();
+
+   // Removals first, so that a directory moved within the tree is dropped
+   // from its old place (and its watch freed) before being scanned anew
+   std::vector<std::pair<std::string, struct stat>> present;
+   std::set<std::string> touched;
+   for(const auto& rel : dirty) {
+      struct stat st;
+      if(lstat(full_path_(rel).c_str(), &st) == 0) {
+         present.emplace_back(rel, st);
+      } else if(entry_(rel) != nullptr && !rel.empty()) {
+         remove_(rel);
+         touched.insert(parent_of(rel));
+      }
+   }
+
+   // Parents sort before their children, so that nothing under a directory
+   // to be rescanned is looked at on its own
+   std::vector<std::pair<std::string, DirDigestEntry>> rehash;
+   std::set<std::string> rescan;
+   auto in_rescan = [&](const std::string& rel) {
+      for(auto p = parent_of(rel); !p.empty(); p = parent_of(p))
+         if(rescan.count(p) != 0) return true;
+      return false;
+   };
+   for(const auto& [rel, st] : present) {
+      if(rel.empty()) {
+         set_dir_entry_stat(root_entry_, st);
+         continue;
+      }
+      if(dirs_.count(parent_of(rel)) == 0) continue; // not in the tree
+      if(in_rescan(rel)) continue;
+
+      DirDigestEntry entry;
+      set_dir_entry_stat(entry, st);
+      auto* old = entry_(rel);
+      touched.insert(parent_of(rel));
+
+      if(entry.type == DirEntryType::directory) {
+         // The same directory, still watched; otherwise it is a new one (a
+         // directory removed and recreated between updates, say), or one
+         // whose watch was dropped, and its contents are unknown
+         const auto dir = dirs_.find(rel);
+         if(old != nullptr && old->type == DirEntryType::directory
+            && old->error == 0 && old->ino == entry.ino
+            && dir != dirs_.end() && dir->second.wd >= 0) {
+            old->mode     = entry.mode;
+            old->mtime_ns = entry.mtime_ns;
+            old->ctime_ns = entry.ctime_ns;
+         } else {
+            rescan.insert(rel);
+         }
+         continue;
+      }
+
+      if(entry.type == DirEntryType::symlink
+         && !read_link(full_path_(rel), entry.target))
+         entry.error = errno;
+      if(old != nullptr && old->type == DirEntryType::directory)
+         remove_(rel);
+
+      // An event means the content may have changed even if size and mtime
+      // haven't: a file renamed over this one, or rewritten within one tick
+      // of a coarse clock
+      if(entry.type == DirEntryType::file)
+         rehash.emplace_back(rel, std::move(entry));
+      else
+         put_(rel, entry);
+   }
+
+   // Files and new directories are read without padlock_, so that other
+   // threads' queries are answered meanwhile, from the index as it was.
+   // update_lock_ keeps anything else from changing it. read(), never
+   // mmap(): a file truncated while it is hashed (a log rotated, say) would
+   // raise SIGBUS.
+   FileHashOptions file_options;
+   file_options.mmap_threshold = SIZE_MAX;
+   lock.unlock();
+   for(auto& [rel, entry] : rehash) {
+      pool_->submit([&entry = entry, path = full_path_(rel), &file_options] {
+         Sha256 sha;
+         errno = 0;
+         if(hash_file(path, sha, file_options))
+            sha.finish().get_digest(entry.digest.data());
+         else
+            entry.error = errno != 0 ? errno : EIO;
+      });
+   }
+   pool_->wait();
+   std::vector<std::pair<std::string, Scan>> scans;
+   for(const auto& rel : rescan) scans.emplace_back(rel, scan_(rel, nullptr));
+   lock.lock();
+   for(const auto& [rel, scan] : scans) install_(rel, scan);
+   for(const auto& [rel, entry] : rehash) put_(rel, entry);
+   stats_.n_rehashed += rehash.size();
+
+   recompute_(touched);
+   unsaved_ = unsaved_ || !touched.empty();
+   return root_entry_.digest != before;
+}
+
+bool TreeWatcher::update(int timeout_ms) noexcept
+{
+   if(!is_open()) return false;
+   pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+   if(timeout_ms != 0 && poll(fds, 2, timeout_ms) < 0 && errno != EINTR)
+      return false;
+
+   std::lock_guard<std::mutex> serial(update_lock_);
+   std::unique_lock<std::mutex> lock(padlock_);
+   read_events_();
+   const bool changed = apply_(lock);
+   maybe_save_();
+   return changed;
+}
+
+// --------------------------------------------------------------------- queries
+
+Sha256Digest TreeWatcher::root_digest() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return root_entry_.digest;
+}
+
+std::optional<DirDigestEntry>
+TreeWatcher::lookup(const std::string& path) const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   if(const auto* entry = entry_(path == "." ? "" : path)) {
+      auto result = *entry;
+      result.path = path == "." ? "" : path;
+      return result;
+   }
+   return std::nullopt;
+}
+
+TreeWatchStats TreeWatcher::stats() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   auto stats          = stats_;
+   stats.n_files       = n_files_;
+   stats.n_directories = dirs_.size();
+   return stats;
+}
+
+DirDigest TreeWatcher::snapshot() const noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   DirDigest out;
+   if(!is_open()) return out;
+   flatten_("", out);
+   out.root = root_entry_.digest;
+   return out;
+}
+
+bool TreeWatcher::save() noexcept
+{
+   std::lock_guard<std::mutex> lock(padlock_);
+   return is_open() && !options_.index_path.empty() && save_locked_();
+}
+
+bool TreeWatcher::save_locked_() noexcept
+{
+   DirDigest tree;
+   flatten_("", tree);
+   tree.root = root_entry_.digest;
+   if(!write_dir_manifest(options_.index_path, tree)) return false;
+   last_save_ = std::chrono::steady_clock::now();
+   unsaved_   = false;
+   ++stats_.n_saves;
+   return true;
+}
+
+void TreeWatcher::maybe_save_() noexcept
+{
+   const std::chrono::duration<double> since
+       = std::chrono::steady_clock::now() - last_save_;
+   if(unsaved_ && !options_.index_path.empty()
+      && since.count() >= options_.save_interval)
+      save_locked_();
+}
+
+// ---------------------------------------------------------------------- server
+
+std::string TreeWatcher::respond_(const std::string& request) noexcept
+{
+   if(request == "root") return to_hex(root_digest());
+
+   if(request.compare(0, 4, "get ") == 0) {
+      const auto entry = lookup(request.substr(4));
+      if(!entry) return "error not found";
+      switch(entry->type) {
+      case DirEntryType::file:
+         return "f " + to_hex(entry->digest) + " "
+                + std::to_string(entry->size);
+      case DirEntryType::directory: return "d " + to_hex(entry->digest);
+      case DirEntryType::symlink: return "l " + entry->target;
+      case DirEntryType::other: return "o";
+      }
+   }
+
+   if(request == "stats") {
+      const auto s = stats();
+      char buf[256];
+      snprintf(buf,
+               sizeof(buf),
+               "files %zu directories %zu events %" PRIu64
+               " rehashed %" PRIu64 " rescans %" PRIu64 " saves %" PRIu64,
+               s.n_files,
+               s.n_directories,
+               s.n_events,
+               s.n_rehashed,
+               s.n_rescans,
+               s.n_saves);
+      return buf;
+   }
+
+   if(request == "save") return save() ? "ok" : "error cannot save";
+   return "error unknown request";
+}
+
+bool TreeWatcher::serve(const std::string& socket_path) noexcept
+{
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if(!is_open() || socket_path.size() >= sizeof(address.sun_path))
+      return false;
+   memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+   const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(listener < 0) return false;
+   unlink_socket(socket_path);
+   if(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+          != 0
+      || listen(listener, 16) != 0) {
+      ::close(listener);
+      return false;
+   }
+
+   std::vector<std::pair<int, std::string>> clients; // and partial input
+   for(bool running = true; running;) {
+      std::vector<pollfd> fds = {{stop_fd_, POLLIN, 0},
+                                 {inotify_fd_, POLLIN, 0},
+                                 {listener, POLLIN, 0}};
+      for(const auto& client : clients)
+         fds.push_back({client.first, POLLIN, 0});
+
+      // Wake up in time for a pending save
+      int timeout = -1;
+      {
+         std::lock_guard<std::mutex> lock(padlock_);
+         if(unsaved_ && !options_.index_path.empty()) timeout = 1000;
+      }
+      if(poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+      uint64_t n_stops;
+      if(fds[0].revents != 0 && read(stop_fd_, &n_stops, sizeof(n_stops)) > 0)
+         running = false;
+      update(0);
+
+      if(fds[2].revents & POLLIN) {
+         const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+         if(fd >= 0) clients.emplace_back(fd, std::string());
+      }
+
+      for(size_t i = 3; i < fds.size(); ++i) {
+         if(fds[i].revents == 0) continue;
+         auto& [fd, input] = clients[i - 3];
+         char buf[4096];
+         const ssize_t n = read(fd, buf, sizeof(buf));
+         if(n > 0) input.append(buf, size_t(n));
+
+         size_t eol;
+         while((eol = input.find('\n')) != std::string::npos) {
+            const auto response = respond_(input.substr(0, eol)) + '\n';
+            input.erase(0, eol + 1);
+            if(send(fd, response.data(), response.size(), MSG_NOSIGNAL) < 0)
+               break;
+         }
+         if(n <= 0 || input.size() > 4096) {
+            ::close(fd);
+            fd = -1;
+         }
+      }
+      clients.erase(std::remove_if(clients.begin(),
+                                   clients.end(),
+                                   [](const auto& c) { return c.first < 0; }),
+                    clients.end());
+   }
+
+   for(const auto& client : clients) ::close(client.first);
+   ::close(listener);
+   unlink_socket(socket_path);
+   return true;
+}
+
+std::optional<std::string>
+tree_watch_query(const std::string& socket_path,
+                 const std::string& request) noexcept
+{
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if(socket_path.size() >= sizeof(address.sun_path)) return std::nullopt;
+   memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+   const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(fd < 0) return std::nullopt;
+   if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+      != 0) {
+      ::close(fd);
+      return std::nullopt;
+   }
+
+   const auto line = request + '\n';
+   std::string response;
+   if(send(fd, line.data(), line.size(), MSG_NOSIGNAL) == ssize_t(line.size()))
+   {
+      char c;
+      while(read(fd, &c, 1) == 1 && c != '\n') response += c;
+   }
+   ::close(fd);
+   return response;
+}
@@ -0,0 +1,160 @@
+
+#pragma once
+
+#include "dir_digest.hpp"
+#include "thread_pool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keeps the dir_digest() of a tree up to date as it changes
+//
+// `open()` scans the tree once, in parallel, placing an inotify watch on
+// every directory just before it is listed, so nothing changed during the
+// scan is missed. From then on `update()` reads the events, re-stats and
+// rehashes only the paths they name, and recomputes the digests of their
+// ancestor directories. The cost of an update is proportional to what
+// changed (and the fan-out of its ancestor directories), not to the size of
+// the tree. A directory created or moved into the tree is scanned as a
+// whole; an event queue overflow triggers a rescan that reuses the digest
+// of every file whose size, mtime, inode and ctime are unchanged.
+//
+// With `index_path`, the index is written there (as a dir_digest manifest)
+// at most every `save_interval` seconds and on close, and read back on
+// open, so that a restart only rehashes files changed in the meantime.
+//
+// `serve()` answers line-based queries on a Unix socket while applying
+// changes; each request line gets one response line:
+//
+//    root          <hex>
+//    get <path>    f <hex> <size> | d <hex> | l <target> | o | error ...
+//    stats         files <n> directories <n> events <n> rehashed <n> ...
+//    save          ok | error ...
+//
+// inotify is used rather than fanotify, because fanotify's whole-filesystem
+// marks need CAP_SYS_ADMIN. Note that inotify watches are limited per user
+// (fs.inotify.max_user_watches), one per directory.
+//
+// usage: TreeWatcher watcher;
+//        if(!watcher.open("/srv/app", options)) { ...error... }
+//        watcher.serve("/run/tree-watch.sock"); // until stop()
+struct TreeWatchOptions
+{
+   std::string index_path;      // empty for no on-disk index
+   double save_interval = 60.0; // seconds
+   unsigned n_threads   = 0;    // for scanning and rehashing
+   bool modes           = true; // as DirDigestOptions::modes
+};
+
+struct TreeWatchStats
+{
+   size_t n_files       = 0;
+   size_t n_directories = 0;
+   uint64_t n_events    = 0; // inotify events read
+   uint64_t n_rehashed  = 0; // files read since open, excluding the scan
+   uint64_t n_rescans   = 0; // full rescans, after queue overflows
+   uint64_t n_saves     = 0;
+};
+
+class TreeWatcher
+{
+ public:
+   TreeWatcher() noexcept;
+   TreeWatcher(const TreeWatcher&) = delete;
+   TreeWatcher& operator=(const TreeWatcher&) = delete;
+   ~TreeWatcher() noexcept;
+
+   // Scans `root` and starts watching it. False if inotify is unavailable
+   // or `root` is not a readable directory.
+   bool open(const std::string& root,
+             const TreeWatchOptions& options = {}) noexcept;
+   void close() noexcept;
+   bool is_open() const noexcept { return inotify_fd_ >= 0; }
+
+   // Waits up to `timeout_ms` (-1 forever) for events, then applies every
+   // event queued. Returns true if the index changed.
+   bool update(int timeout_ms = 0) noexcept;
+
+   // Serves queries on `socket_path`, and applies changes, until `stop()`.
+   // False if the socket cannot be created; anything at `socket_path` other
+   // than a socket is left in place, and is an error. Queries are answered
+   // between updates, so one that arrives while files are being rehashed
+   // waits for them; lookups from other threads don't, as update() rehashes
+   // and rescans without holding the index lock.
+   bool serve(const std::string& socket_path) noexcept;
+
+   // Safe from any thread, and from a signal handler
+   void stop() noexcept;
+
+   Sha256Digest root_digest() const noexcept;
+   std::optional<DirDigestEntry> lookup(const std::string& path) const
+       noexcept;
+   TreeWatchStats stats() const noexcept;
+
+   // The whole index, as dir_digest() would return it for the tree now
+   DirDigest snapshot() const noexcept;
+   bool save() noexcept;
+
+ private:
+   struct Dir
+   {
+      std::map<std::string, DirDigestEntry> children; // by name
+      int wd = -1;
+   };
+
+   // A subtree as read from disk, and the watches placed on its directories
+   struct Scan
+   {
+      DirDigest tree;
+      std::vector<std::pair<int, std::string>> watches; // wd, path
+   };
+
+   std::string root_;
+   TreeWatchOptions options_;
+   int inotify_fd_ = -1;
+   int stop_fd_    = -1; // eventfd
+
+   std::mutex update_lock_; // serializes update() and close()
+   mutable std::mutex padlock_;
+   DirDigestEntry root_entry_;
+   std::map<std::string, Dir> dirs_; // by path relative to the root
+   std::unordered_map<int, std::string> wd_paths_;
+   size_t n_files_ = 0;
+   std::set<std::string> dirty_; // paths named by unprocessed events
+   bool overflowed_ = false;
+   TreeWatchStats stats_;
+   std::unique_ptr<ThreadPool> pool_;
+   std::chrono::steady_clock::time_point last_save_;
+   bool unsaved_ = false;
+
+   std::string full_path_(const std::string& rel) const noexcept;
+   DirDigestEntry* entry_(const std::string& rel) noexcept;
+   const DirDigestEntry* entry_(const std::string& rel) const noexcept;
+   void put_(const std::string& rel, const DirDigestEntry& entry) noexcept;
+
+   bool read_events_() noexcept;
+   bool apply_(std::unique_lock<std::mutex>& lock) noexcept;
+   Scan scan_(const std::string& rel, const DirDigest* previous) const
+       noexcept;
+   void install_(const std::string& rel, const Scan& scan) noexcept;
+   void remove_(const std::string& rel) noexcept;
+   void recompute_(std::set<std::string>& touched) noexcept;
+   void flatten_(const std::string& rel, DirDigest& out) const noexcept;
+   void maybe_save_() noexcept;
+   bool save_locked_() noexcept;
+   std::string respond_(const std::string& request) noexcept;
+};
+
+// Sends one request line to a TreeWatcher's socket, and returns the
+// response line (without its newline), or std::nullopt if it can't connect
+std::optional<std::string>
+tree_watch_query(const std::string& socket_path,
+                 const std::string& request) noexcept;